@@ -25,8 +25,16 @@ void arch_smp_init(void);
 void *arch_phys_map(u64 paddr, size_t size, u32 flags);
 void arch_phys_unmap(void *vaddr, size_t size);
 bool arch_phys_copy(u64 dst_paddr, u64 src_paddr, size_t size);
+// zero whole pages without pulling them into the cache where the CPU allows it
+void arch_clear_pages(void *dst, size_t pages);
+// copy to or from user memory, returns how many bytes were left when a page faulted
+size_t arch_copy_user(void *dst, const void *src, size_t len);
 bool arch_keeps_phys_map(void);
 
+void *arch_heap_map(size_t pages);
+// gives an arena from arch_heap_map back, false when the arch has to keep it
+bool arch_heap_unmap(void *start, size_t pages);
+
 void arch_dump_stack_trace(void);
 void arch_dump_registers(const arch_int_state_t *state);
 
@@ -37,6 +45,8 @@ void arch_vm_switch(arch_vm_space_t *space);
 void *arch_vm_root(arch_vm_space_t *space);
 
 void arch_tlb_flush(uintptr_t addr);
+// only CPUs with `space` active are interrupted, a NULL space means kernel mappings
+void arch_tlb_flush_range(arch_vm_space_t *space, uintptr_t start, uintptr_t end);
 void arch_code_sync(void);
 
 void arch_cpu_set_local(void *ptr);
@@ -55,8 +65,19 @@ bool arch_resched_cpu(size_t cpu_id);
 
 u64 arch_timer_ticks(void);
 u32 arch_timer_hz(void);
+// nanoseconds on the same clock as arch_timer_ticks(), as fine as the
+// hardware counter allows
+u64 arch_timer_ns(void);
+// one-shot: this cpu takes its next timer interrupt once arch_timer_ns()
+// reaches `deadline_ns`, or not at all for 0. False when the timer is periodic
+bool arch_timer_program(u64 deadline_ns);
 u64 arch_realtime_ns(void);
 
+// a raw cycle counter for timing short stretches of code on one cpu,
+// arch_cycles_khz() of them go by per millisecond
+u64 arch_cycles(void);
+u64 arch_cycles_khz(void);
+
 const char *arch_name(void);
 const char *arch_cpu_name(void);
 
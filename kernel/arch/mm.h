@@ -1,6 +1,8 @@
 #pragma once
 
 // each arch provides <arch_mm.h> defining
-//   arch_alloc_frames_user, arch_free_frames, arch_map_region
+//   arch_alloc_frames_user, arch_alloc_frames_user_aligned, arch_free_frames
+//   arch_map_region, arch_unmap_region, arch_split_page, arch_large_page_size
 //   arch_get_page, arch_page_get_paddr, arch_page_set_paddr
+//   arch_alloc_frames_try, arch_set_swap_page, arch_page_young
 #include_next <arch_mm.h>
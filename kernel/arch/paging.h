@@ -6,6 +6,7 @@
 //   page_t, PT_PRESENT, PT_WRITE, PT_USER, PT_NO_EXECUTE, PT_HUGE
 //   pt_no_cache, PT_WRITE_THROUGH, PT_DIRTY, PT_ACCESSED, PT_GLOBAL
 //   page_4kib, PAGE_2MIB, page_get_paddr(), page_set_paddr()
+//   PT_SWAP, page_swap_entry(), page_is_swap(), page_swap_slot()
 #include_next <arch_paging.h>
 
 bool arch_supports_nx(void);
@@ -28,17 +28,20 @@
 #include <sys/console.h>
 #include <sys/cpu.h>
 #include <sys/disk.h>
+#include <sys/extable.h>
 #include <sys/framebuffer.h>
 #include <sys/logsink.h>
 #include <sys/panic.h>
 #include <sys/symbols.h>
 #include <sys/tty.h>
+#include <sys/trace.h>
 #include <sys/tty_input.h>
 
 #define LOG_BOOT_HISTORY_CAP (128 * 1024)
 #define ROOTFS_SECTOR_SIZE   512
 #define BOOT_STACK_SIZE      (64 * KIB)
 #define DEFAULT_TIMEBASE_HZ  10000000ULL
+#define TIMER_NEVER_DELTA    (~0ULL >> 2)
 #define UART_WINDOW_SIZE     PAGE_4KIB
 #define MMIO_MAX_REGIONS     24
 #define UART_DEFAULT_IRQ     10
@@ -110,11 +113,16 @@ static struct {
     size_t rootfs_size;
 } boot = { .mem_paddr = RISCV_KERNEL_BASE };
 
+// the clock is read off the time csr; the machine timer is armed one shot for
+// whatever the scheduler has due next
 static struct {
     u64 timebase_hz;
     u64 cpu_hz;
+    u64 clock_base;
+    u64 tick_interval;
     char platform_name[PLATFORM_NAME_MAX];
     bool arm_fail_logged;
+    volatile bool started;
 } timer = {
     .timebase_hz = DEFAULT_TIMEBASE_HZ,
     .cpu_hz = DEFAULT_TIMEBASE_HZ,
@@ -152,13 +160,13 @@ static struct {
 
 static struct {
     arch_syscall_handler_t syscall;
-    volatile u64 ticks;
     u32 fault_log;
     u32 ill_log;
     u32 irq_log;
     u64 hartid[MAX_CORES];
     bool late_init[MAX_CORES];
     bool timer_rearm_pending[MAX_CORES];
+    u64 timer_deadline[MAX_CORES];
 } cpu;
 
 uintptr_t kernel_sp = 0;
@@ -789,7 +797,23 @@ static void _early_map_page(page_t *root, u64 vaddr, u64 paddr, u64 flags) {
     *entry |= pte_leaf_flags(flags);
 }
 
-#if __riscv_xlen == 32
+#if __riscv_xlen == 64
+static bool _early_map_megapage(page_t *root, u64 vaddr, u64 paddr, u64 flags) {
+    if ((vaddr | paddr) & (PAGE_2MIB - 1)) {
+        return false;
+    }
+
+    page_t *lvl2 = _early_walk(root, GET_LVL3_INDEX(vaddr));
+    page_t *entry = &lvl2[GET_LVL2_INDEX(vaddr)];
+    if (*entry & PT_PRESENT) {
+        return false;
+    }
+
+    page_set_paddr(entry, paddr);
+    *entry |= pte_leaf_flags(flags);
+    return true;
+}
+#else
 static bool _early_map_superpage(page_t *root, u64 vaddr, u64 paddr, u64 flags) {
     if ((vaddr | paddr) & (PAGE_4MIB - 1)) {
         return false;
@@ -813,7 +837,12 @@ static void _early_map_range(page_t *root, u64 vaddr, u64 paddr, u64 size, u64 f
     for (u64 addr = base; addr < end;) {
         u64 mapped_vaddr = vaddr + (addr - base);
 
-#if __riscv_xlen == 32
+#if __riscv_xlen == 64
+        if (end - addr >= PAGE_2MIB && _early_map_megapage(root, mapped_vaddr, addr, flags)) {
+            addr += PAGE_2MIB;
+            continue;
+        }
+#else
         if (end - addr >= PAGE_4MIB && _early_map_superpage(root, mapped_vaddr, addr, flags)) {
             addr += PAGE_4MIB;
             continue;
@@ -854,6 +883,15 @@ static uintptr_t _register_mmio(u64 paddr, size_t size) {
     uintptr_t vaddr = ALIGN(mmio.next_vaddr, PAGE_4KIB);
     size_t span = (size_t)(end - base);
 
+#if __riscv_xlen == 64
+    // keep large windows (framebuffers) congruent with their paddr so map_region can use megapages
+    if (span >= PAGE_2MIB) {
+        uintptr_t offset = (uintptr_t)(base & (PAGE_2MIB - 1));
+        uintptr_t aligned = ALIGN(vaddr, PAGE_2MIB) + offset;
+        vaddr = aligned - (aligned - vaddr >= PAGE_2MIB ? PAGE_2MIB : 0);
+    }
+#endif
+
     mmio_region_t *r = &mmio.regions[mmio.count++];
     r->paddr = base;
     r->size = span;
@@ -892,13 +930,29 @@ static void _mmio_map_regions(page_t *root) {
     }
 }
 
-static bool _timer_program_next(void) {
-    u64 interval = timer.timebase_hz / TIMER_FREQ;
-    if (!interval) {
-        interval = 1;
+// split so neither product overflows for the lifetime of the machine
+static u64 _time_to_ns(u64 time) {
+    u64 hz = timer.timebase_hz;
+    return (time / hz) * 1000000000ULL + ((time % hz) * 1000000000ULL) / hz;
+}
+
+static u64 _ns_to_time(u64 ns) {
+    u64 hz = timer.timebase_hz;
+    return (ns / 1000000000ULL) * hz + ((ns % 1000000000ULL) * hz) / 1000000000ULL;
+}
+
+// the M-mode shim arms mtimecmp; stimecmp would need menvcfg.STCE, which
+// firmware does not set for us
+static bool _timer_arm(u64 deadline_ns) {
+    u64 delta = TIMER_NEVER_DELTA;
+
+    if (deadline_ns) {
+        u64 target = timer.clock_base + _ns_to_time(deadline_ns);
+        u64 now = riscv_read_time();
+        delta = target > now ? target - now : 1;
     }
 
-    if (riscv_mtimer_arm(interval)) {
+    if (riscv_mtimer_arm(delta)) {
         return true;
     }
 
@@ -910,6 +964,23 @@ static bool _timer_program_next(void) {
     return false;
 }
 
+static void _timer_start(void) {
+    if (timer.started) {
+        return;
+    }
+
+    timer.tick_interval = timer.timebase_hz / TIMER_FREQ;
+    if (!timer.tick_interval) {
+        timer.tick_interval = 1;
+    }
+
+    // count from one tick so a running clock never reads as zero
+    timer.clock_base = riscv_read_time() - timer.tick_interval;
+    __atomic_store_n(&timer.started, true, __ATOMIC_RELEASE);
+}
+
+// arming clears the pending bit, so a timer trap the scheduler did not
+// re-arm from still gets its deadline reloaded on the way out
 static void _defer_timer_rearm(void) {
     cpu.timer_rearm_pending[_current_cpu_id()] = true;
 }
@@ -923,7 +994,7 @@ void riscv_prepare_sret(arch_int_state_t *frame) {
     }
 
     cpu.timer_rearm_pending[cpu_id] = false;
-    (void)_timer_program_next();
+    (void)_timer_arm(cpu.timer_deadline[cpu_id]);
 }
 
 static bool _handle_user_signal(int signum, arch_int_state_t *frame) {
@@ -947,11 +1018,35 @@ static void _handle_page_fault(arch_int_state_t *frame, uintptr_t cause) {
 
     bool write = cause == EXC_STORE_PAGE;
     bool user = arch_signal_is_user(frame);
+    uintptr_t user_top = (uintptr_t)arch_user_stack_top();
 
-    if (write && user && sched_is_running()) {
+    // user copies write straight into cow pages, so supervisor stores below the user top count too
+    if ((user || addr < user_top) && sched_is_running()) {
         sched_thread_t *thread = sched_current();
+        bool user_thread = thread && thread->user_thread;
+
+        // both paths may sleep on another thread's region syscall, which needs
+        // interrupts back on when the faulting code had them
+        unsigned long irq_flags = arch_irq_save();
+        if (frame && (frame->s_regs.sstatus & SSTATUS_SPIE)) {
+            riscv_enable_irqs();
+        }
+
+        bool resolved = user_thread && write && sched_handle_cow_fault(thread, addr, true);
+
+        // the cause does not say whether the leaf was present, the swap path checks
+        resolved = resolved || (user_thread && sched_handle_swap_fault(thread, addr));
+        arch_irq_restore(irq_flags);
+
+        if (resolved) {
+            return;
+        }
+    }
 
-        if (thread && thread->user_thread && sched_handle_cow_fault(thread, addr, true)) {
+    if (!user && frame) {
+        uintptr_t fixup = extable_fixup(frame->s_regs.sepc);
+        if (fixup) {
+            frame->s_regs.sepc = fixup;
             return;
         }
     }
@@ -1327,9 +1422,38 @@ static u32 _init_uart(const boot_info_t *info, uintptr_t uart_phys) {
     return uart_irq;
 }
 
+// harts missing from the cpu-map keep the defaults of cpu_init_core
+static void _init_cpu_topology(void) {
+    fdt_cpu_topology_t map[MAX_CORES];
+    size_t count = 0;
+
+    if (!boot.dtb || !fdt_find_cpu_map(boot.dtb, map, ARRAY_LEN(map), &count)) {
+        return;
+    }
+
+    for (size_t cpu_id = 0; cpu_id < core_count && cpu_id < MAX_CORES; cpu_id++) {
+        if (cpu.hartid[cpu_id] == UINT64_MAX || !cores_local[cpu_id].valid) {
+            continue;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            if (map[i].hartid != cpu.hartid[cpu_id]) {
+                continue;
+            }
+
+            // a cluster is the nearest thing to a shared cache the map names
+            cores_local[cpu_id].package_id = map[i].package;
+            cores_local[cpu_id].core_id = map[i].core;
+            cores_local[cpu_id].llc_id = map[i].cluster;
+            break;
+        }
+    }
+}
+
 static uintptr_t _init_boot_cpu(boot_info_t *info) {
     cpu_init_boot();
     arch_cpu_set_local(&cores_local[0]);
+    _init_cpu_topology();
 
     arch_set_kernel_stack((uintptr_t)&__stack_top);
     riscv_write_sstatus(riscv_read_sstatus() | SSTATUS_SUM);
@@ -1497,7 +1621,8 @@ void arch_late_init(void) {
         return;
     }
 
-    (void)_timer_program_next();
+    _timer_start();
+    (void)arch_timer_program(arch_timer_ns() + 1000000000ULL / TIMER_FREQ);
     riscv_set_sie_bits(SIE_SSIE | SIE_STIE | (plic.ready ? SIE_SEIE : 0));
 
     cpu.late_init[cpu_id] = false;
@@ -1665,14 +1790,35 @@ void arch_dump_registers(const arch_int_state_t *frame) {
 }
 
 void arch_tlb_flush(uintptr_t addr) {
-    (void)addr;
-    sfence_vma();
+    arch_tlb_flush_range(NULL, addr, addr + PAGE_4KIB);
 }
 
 void arch_code_sync(void) {
     asm volatile("fence.i" ::: "memory");
 }
 
+// the base ISA has no non-temporal stores
+void arch_clear_pages(void *dst, size_t pages) {
+    memset(dst, 0, pages * PAGE_4KIB);
+}
+
+size_t arch_copy_user(void *dst, const void *src, size_t len) {
+    // SUM stays set in supervisor mode, so user pages are reachable directly
+    asm volatile("   beqz %2, 3f\n\t"
+                 "1: lbu t0, 0(%1)\n\t"
+                 "2: sb t0, 0(%0)\n\t"
+                 "   addi %0, %0, 1\n\t"
+                 "   addi %1, %1, 1\n\t"
+                 "   addi %2, %2, -1\n\t"
+                 "   bnez %2, 1b\n\t"
+                 "3:\n\t" EXTABLE_ENTRY("1b", "3b") EXTABLE_ENTRY("2b", "3b")
+                 : "+r"(dst), "+r"(src), "+r"(len)
+                 :
+                 : "t0", "memory");
+
+    return len;
+}
+
 void arch_cpu_set_local(void *ptr) {
     cpu_local_ptr = (uintptr_t)ptr;
     riscv_write_tp((uintptr_t)ptr);
@@ -1737,8 +1883,9 @@ void arch_cpu_wait(void) {
     asm volatile("wfi" ::: "memory");
 }
 
+// Zihintpause pause, a fence that older cores run as a plain hint
 void arch_cpu_relax(void) {
-    asm volatile("nop");
+    asm volatile(".word 0x0100000f" ::: "memory");
 }
 
 void arch_resched_self(void) {
@@ -1758,13 +1905,34 @@ bool arch_resched_cpu(size_t cpu_id) {
 }
 
 u64 arch_timer_ticks(void) {
-    return __atomic_load_n(&cpu.ticks, __ATOMIC_ACQUIRE);
+    if (!__atomic_load_n(&timer.started, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    return (riscv_read_time() - timer.clock_base) / timer.tick_interval;
 }
 
 u32 arch_timer_hz(void) {
     return TIMER_FREQ;
 }
 
+u64 arch_timer_ns(void) {
+    if (!__atomic_load_n(&timer.started, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    return _time_to_ns(riscv_read_time() - timer.clock_base);
+}
+
+bool arch_timer_program(u64 deadline_ns) {
+    size_t cpu_id = _current_cpu_id();
+
+    cpu.timer_deadline[cpu_id] = deadline_ns;
+    cpu.timer_rearm_pending[cpu_id] = false;
+
+    return _timer_arm(deadline_ns);
+}
+
 u64 arch_realtime_ns(void) {
     u64 hz = timer.timebase_hz;
     u64 ticks = 0;
@@ -1800,6 +1968,15 @@ u64 arch_cpu_khz(void) {
     return timer.cpu_hz / 1000ULL;
 }
 
+// the cycle CSR is often not readable from S-mode, the time CSR always is
+u64 arch_cycles(void) {
+    return riscv_read_time();
+}
+
+u64 arch_cycles_khz(void) {
+    return timer.timebase_hz / 1000ULL;
+}
+
 void arch_mem_info(size_t *total, size_t *free_mem) {
     if (total) {
         *total = pmm_total_mem();
@@ -1917,6 +2094,8 @@ void trap_handle(arch_int_state_t *frame) {
 #endif
 
     if (interrupt) {
+        trace_event(TRACE_IRQ, cause, 0);
+
         switch (cause) {
         case IRQ_SOFT:
             riscv_clear_sip_bits(SIP_SSIP);
@@ -1925,7 +2104,6 @@ void trap_handle(arch_int_state_t *frame) {
             sched_resched_softirq(frame);
             return;
         case IRQ_TIMER:
-            __atomic_add_fetch(&cpu.ticks, 1, __ATOMIC_RELAXED);
             _defer_timer_rearm();
             _serial_drain_input();
 
@@ -40,6 +40,9 @@ typedef u32 page_t;
 #define PT_ACCESSED (1ULL << 6)
 #define PT_DIRTY    (1ULL << 7)
 
+// RSW bit: a non-valid leaf with it set holds a swap slot in the ppn field
+#define PT_SWAP (1ULL << 8)
+
 #if __riscv_xlen == 64
 #define PT_WRITE_THROUGH (1ULL << 60)
 #define PT_NO_CACHE      (1ULL << 61)
@@ -58,6 +61,18 @@ typedef u32 page_t;
 #define FLAGS_MASK (PT_PRESENT | PT_READ | PT_WRITE | PT_EXECUTE | PT_USER | PT_GLOBAL | PT_ACCESSED | PT_DIRTY)
 #endif
 
+static inline page_t page_swap_entry(u64 slot) {
+    return (page_t)(slot << 10) | (page_t)PT_SWAP;
+}
+
+static inline bool page_is_swap(page_t entry) {
+    return (entry & (PT_PRESENT | PT_SWAP)) == PT_SWAP;
+}
+
+static inline u64 page_swap_slot(page_t entry) {
+    return (u64)(entry >> 10);
+}
+
 static inline page_t page_get_paddr(page_t *page) {
     return ((*page >> 10) << 12);
 }
@@ -60,6 +60,10 @@ static inline void sfence_vma_asid(uintptr_t asid) {
     asm volatile("sfence.vma zero, %0" : : "r"(asid) : "memory");
 }
 
+static inline void sfence_vma_addr(uintptr_t addr) {
+    asm volatile("sfence.vma %0, zero" : : "r"(addr) : "memory");
+}
+
 static inline unsigned long riscv_read_sstatus(void) {
     unsigned long value = 0;
     asm volatile("csrr %0, sstatus" : "=r"(value));
@@ -254,6 +258,12 @@ static inline bool riscv_mtimer_read(u64 *value) {
     return true;
 }
 
+static inline uintptr_t riscv_read_satp(void) {
+    uintptr_t value;
+    asm volatile("csrr %0, satp" : "=r"(value));
+    return value;
+}
+
 static inline void riscv_write_satp(uintptr_t root, u64 mode, uintptr_t asid) {
 #if __riscv_xlen == 64
     u64 value = (mode << 60) | ((u64)asid << 44) | ((u64)root >> 12);
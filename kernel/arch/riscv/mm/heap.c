@@ -1,294 +1,39 @@
 #include "heap.h"
 
-#include <alloc/bitmap.h>
 #include <arch/paging.h>
 #include <base/macros.h>
-#include <inttypes.h>
 #include <log/log.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
-#include <string.h>
-#include <sys/lock.h>
-#include <sys/panic.h>
+#include <sys/slab.h>
 
 #include "physical.h"
 
-#define HEAP_MIN (KERNEL_HEAP_PAGES / 2)
-#define HEAP_MAX (KERNEL_HEAP_PAGES * 16)
-typedef struct {
-    bitmap_allocator_t alloc;
-    size_t pages;
-    bool used;
-} heap_arena_t;
+// RISC-V keeps RAM identity mapped, so heap arenas need no extra mapping
 
-typedef struct {
-    heap_arena_t arenas[KERNEL_HEAP_MAX_ARENAS];
-    size_t arena_count;
-    spinlock_t lock;
-} heap_state_t;
-
-static heap_state_t heap = {
-    .lock = SPINLOCK_INIT,
-};
-
-static size_t _blocks_for_pages(size_t pages) {
-    if (!pages) {
-        return 0;
-    }
-
-    if (pages > SIZE_MAX / PAGE_4KIB) {
-        return 0;
-    }
-
-    size_t chunk_size = pages * PAGE_4KIB;
-    size_t block_count = chunk_size / KERNEL_HEAP_BLOCK_SIZE;
-    size_t bitmap_bytes = DIV_ROUND_UP(block_count, 8);
-    size_t bitmap_blocks = DIV_ROUND_UP(bitmap_bytes, KERNEL_HEAP_BLOCK_SIZE);
-
-    if (bitmap_blocks >= block_count) {
-        return 0;
-    }
-
-    return block_count - bitmap_blocks;
-}
-
-static size_t _pages_for_blocks(size_t blocks) {
-    if (!blocks) {
-        return 0;
-    }
-
-    if (blocks > SIZE_MAX / KERNEL_HEAP_BLOCK_SIZE) {
-        return 0;
-    }
-
-    size_t pages = DIV_ROUND_UP(blocks * KERNEL_HEAP_BLOCK_SIZE, PAGE_4KIB);
-    if (!pages) {
-        pages = 1;
-    }
-
-    while (_blocks_for_pages(pages) < blocks) {
-        if (pages == SIZE_MAX) {
-            return 0;
-        }
-        pages++;
+void *arch_heap_map(size_t pages) {
+    if (!pages || pages > SIZE_MAX / PAGE_4KIB) {
+        return NULL;
     }
 
-    return pages;
+    // the heap lock is held, so a failure must not recurse into reclaim
+    return alloc_frames_try(pages);
 }
 
-static bool _add_arena(size_t pages) {
-    if (!pages || heap.arena_count >= KERNEL_HEAP_MAX_ARENAS) {
-        return false;
-    }
-
-    if (pages > SIZE_MAX / PAGE_4KIB) {
-        return false;
-    }
-
-    size_t free_pages = pmm_free_mem() / PAGE_4KIB;
-    if (pages > free_pages) {
-        return false;
-    }
-
-    size_t chunk_size = pages * PAGE_4KIB;
-    void *start = alloc_frames(pages);
-    if (!start) {
-        return false;
-    }
-
-    heap_arena_t *arena = &heap.arenas[heap.arena_count];
-    if (!bitmap_alloc_init(&arena->alloc, start, chunk_size, KERNEL_HEAP_BLOCK_SIZE)) {
-        free_frames(start, pages);
-        return false;
-    }
-
-    arena->pages = pages;
-    arena->used = true;
-    heap.arena_count++;
+bool arch_heap_unmap(void *start, size_t pages) {
+    free_frames(start, pages);
     return true;
 }
 
-static bool _grow(size_t min_blocks) {
-    if (!min_blocks || heap.arena_count >= KERNEL_HEAP_MAX_ARENAS) {
-        return false;
-    }
-
-    size_t min_pages = _pages_for_blocks(min_blocks);
-    if (!min_pages) {
-        return false;
-    }
-
-    size_t grow_pages = KERNEL_HEAP_PAGES;
-    if (heap.arena_count) {
-        grow_pages = heap.arenas[heap.arena_count - 1].pages;
-    }
-
-    if (grow_pages < min_pages) {
-        grow_pages = min_pages;
-    }
-
-    size_t free_pages = pmm_free_mem() / PAGE_4KIB;
-    if (grow_pages > free_pages) {
-        grow_pages = free_pages;
-    }
-
-    if (grow_pages < min_pages) {
-        return false;
-    }
-
-    return _add_arena(grow_pages);
-}
-
-static heap_arena_t *_find_arena_by_ptr(const void *ptr) {
-    uintptr_t addr = (uintptr_t)ptr;
-
-    for (size_t i = 0; i < heap.arena_count; i++) {
-        heap_arena_t *arena = &heap.arenas[i];
-        if (!arena->used) {
-            continue;
-        }
-
-        uintptr_t start = (uintptr_t)arena->alloc.chunk_start;
-        uintptr_t end = start + arena->alloc.chunk_size;
-        if (end <= start) {
-            continue;
-        }
-
-        if (addr >= start && addr < end) {
-            return arena;
-        }
-    }
-
-    return NULL;
-}
-
 void heap_init(void) {
-    unsigned long irq_flags = spin_lock_irqsave(&heap.lock);
-
-    size_t free_pages = pmm_free_mem() / PAGE_4KIB;
-    size_t min_heap = min(free_pages, (size_t)HEAP_MIN);
-    size_t heap_pages = clamp(free_pages / 3, min_heap, (size_t)HEAP_MAX);
-
-    if (!_add_arena(heap_pages)) {
-        spin_unlock_irqrestore(&heap.lock, irq_flags);
-        panic("failed to initialize RISC-V kernel heap");
-    }
-
-    spin_unlock_irqrestore(&heap.lock, irq_flags);
-}
-
-static void *_kmalloc(size_t size) {
-    if (!size) {
-        return NULL;
-    }
-
-    unsigned long irq_flags = spin_lock_irqsave(&heap.lock);
-
-    size_t header_blocks = DIV_ROUND_UP(sizeof(kheap_header_t), KERNEL_HEAP_BLOCK_SIZE);
-    size_t blocks = DIV_ROUND_UP(size, KERNEL_HEAP_BLOCK_SIZE);
-    if (blocks > SIZE_MAX - header_blocks) {
-        spin_unlock_irqrestore(&heap.lock, irq_flags);
-        panic("kmalloc block count overflow (%zu bytes)", size);
-    }
-
-    size_t total_blocks = blocks + header_blocks;
-
-    void *space = NULL;
-    for (size_t i = 0; i < heap.arena_count; i++) {
-        heap_arena_t *arena = &heap.arenas[i];
-        if (!arena->used) {
-            continue;
-        }
-
-        space = bitmap_alloc_reserve(&arena->alloc, total_blocks);
-        if (space) {
-            break;
-        }
-    }
-
-    if (!space) {
-        if (!_grow(total_blocks)) {
-            spin_unlock_irqrestore(&heap.lock, irq_flags);
-            panic("kmalloc out of memory (%zu bytes)", size);
-        }
-
-        heap_arena_t *arena = &heap.arenas[heap.arena_count - 1];
-        space = bitmap_alloc_reserve(&arena->alloc, total_blocks);
-    }
-
-    if (!space) {
-        spin_unlock_irqrestore(&heap.lock, irq_flags);
-        panic("kmalloc failed after grow (%zu bytes)", size);
-    }
-
-    kheap_header_t *header = space;
-    header->magic = KERNEL_HEAP_MAGIC;
-    header->size = blocks;
-
-    void *memory = (u8 *)space + sizeof(*header);
-    spin_unlock_irqrestore(&heap.lock, irq_flags);
-    return memory;
-}
-
-static void _kfree(void *ptr) {
-    if (!ptr) {
-        return;
-    }
-
-    unsigned long irq_flags = spin_lock_irqsave(&heap.lock);
-
-    kheap_header_t *header = (kheap_header_t *)((u8 *)ptr - sizeof(*header));
-    heap_arena_t *arena = _find_arena_by_ptr(header);
-    if (!arena) {
-        spin_unlock_irqrestore(&heap.lock, irq_flags);
-        panic("kfree pointer is outside the RISC-V heap");
-    }
-
-    if (header->magic != KERNEL_HEAP_MAGIC) {
-        spin_unlock_irqrestore(&heap.lock, irq_flags);
-        panic("invalid RISC-V heap header");
-    }
-
-    size_t header_blocks = DIV_ROUND_UP(sizeof(kheap_header_t), KERNEL_HEAP_BLOCK_SIZE);
-    if (header->size > SIZE_MAX - header_blocks) {
-        spin_unlock_irqrestore(&heap.lock, irq_flags);
-        panic("RISC-V heap block count overflow");
-    }
-
-    size_t blocks = header->size + header_blocks;
-    if (blocks > SIZE_MAX / KERNEL_HEAP_BLOCK_SIZE) {
-        spin_unlock_irqrestore(&heap.lock, irq_flags);
-        panic("RISC-V heap block count overflow");
-    }
-
-    uintptr_t arena_start = (uintptr_t)arena->alloc.chunk_start;
-    uintptr_t arena_end = arena_start + arena->alloc.chunk_size;
-    uintptr_t free_end = (uintptr_t)header + blocks * KERNEL_HEAP_BLOCK_SIZE;
-    if (arena_end <= arena_start) {
-        spin_unlock_irqrestore(&heap.lock, irq_flags);
-        panic("RISC-V heap arena range is invalid");
-    }
-
-    if (free_end < (uintptr_t)header || free_end > arena_end) {
-        spin_unlock_irqrestore(&heap.lock, irq_flags);
-        panic("RISC-V heap block range is invalid");
-    }
-
-    header->magic = 0;
-    if (!bitmap_alloc_free(&arena->alloc, header, blocks)) {
-        spin_unlock_irqrestore(&heap.lock, irq_flags);
-        panic("RISC-V heap bitmap metadata rejected pointer");
-    }
-
-    spin_unlock_irqrestore(&heap.lock, irq_flags);
+    kmem_init();
 }
 
 void arch_init_alloc(void) {
     libc_alloc_ops_t ops = {
-        .malloc_fn = _kmalloc,
-        .free_fn = _kfree,
+        .malloc_fn = kmalloc,
+        .free_fn = kfree,
     };
-
     __libc_init_alloc(&ops);
 }
@@ -10,6 +10,7 @@
 #include <string.h>
 #include <sys/lock.h>
 #include <sys/panic.h>
+#include <sys/reclaim.h>
 
 typedef struct {
     bitmap_allocator_t frames;
@@ -166,12 +167,14 @@ size_t pmm_free_mem(void) {
     return free_mem;
 }
 
-static void *pmm_alloc_frames(size_t count, bool high) {
+static void *pmm_alloc_frames(size_t count, bool high, size_t align) {
     assert(count);
 
     unsigned long irq_flags = spin_lock_irqsave(&pmm.lock);
     void *frames = NULL;
-    if (high) {
+    if (align > PAGE_4KIB) {
+        frames = bitmap_alloc_aligned(&pmm.frames, count, align);
+    } else if (high) {
         frames = bitmap_alloc_high(&pmm.frames, count);
     } else {
         frames = bitmap_alloc_reserve(&pmm.frames, count);
@@ -181,12 +184,26 @@ static void *pmm_alloc_frames(size_t count, bool high) {
         _pmm_ref_set_range(frames, count, 1);
     }
 
+    size_t free_blocks = pmm.frames.free_blocks;
     spin_unlock_irqrestore(&pmm.lock, irq_flags);
+
+    reclaim_note_free(free_blocks);
+    return frames;
+}
+
+// on failure reclaim caches and retry for as long as that frees anything
+static void *pmm_alloc_reclaim(size_t count, bool high, size_t align) {
+    void *frames = pmm_alloc_frames(count, high, align);
+
+    while (!frames && reclaim_direct(count)) {
+        frames = pmm_alloc_frames(count, high, align);
+    }
+
     return frames;
 }
 
 void *alloc_frames(size_t count) {
-    void *frames = pmm_alloc_frames(count, false);
+    void *frames = pmm_alloc_reclaim(count, false, PAGE_4KIB);
     if (!frames) {
         panic("RISC-V PMM exhausted");
     }
@@ -194,8 +211,13 @@ void *alloc_frames(size_t count) {
     return frames;
 }
 
+// never reclaims or panics, for callers that hold a lock reclaim may need
+void *alloc_frames_try(size_t count) {
+    return pmm_alloc_frames(count, false, PAGE_4KIB);
+}
+
 void *alloc_frames_high(size_t count) {
-    void *frames = pmm_alloc_frames(count, true);
+    void *frames = pmm_alloc_reclaim(count, true, PAGE_4KIB);
     if (!frames) {
         panic("RISC-V PMM exhausted");
     }
@@ -204,7 +226,13 @@ void *alloc_frames_high(size_t count) {
 }
 
 void *alloc_frames_user(size_t count) {
-    return pmm_alloc_frames(count, true);
+    return pmm_alloc_reclaim(count, true, PAGE_4KIB);
+}
+
+// contiguous frames whose base is aligned to `align` bytes, used to back
+// megapages. Callers fall back to small pages, so this never reclaims
+void *alloc_frames_user_aligned(size_t count, size_t align) {
+    return pmm_alloc_frames(count, true, align);
 }
 
 void free_frames(void *ptr, size_t count) {
@@ -11,7 +11,33 @@ static bool _leaf_pte(page_t entry) {
     return (entry & (PT_READ | PT_WRITE | PT_EXECUTE)) != 0;
 }
 
-static page_t *_walk_table_once(page_t *table, size_t index) {
+#define PT_ENTRIES (PAGE_4KIB / sizeof(page_t))
+
+// replace a leaf superpage with a table of `child_size` leaves that map the same range
+static page_t *_split_leaf(page_t *table, size_t index, size_t child_size) {
+    page_t leaf = table[index];
+    u64 base = ALIGN_DOWN((u64)page_get_paddr(&leaf), (u64)child_size * PT_ENTRIES);
+    page_t leaf_flags = leaf & FLAGS_MASK;
+
+    page_t *next = alloc_frames(1);
+
+    for (size_t i = 0; i < PT_ENTRIES; i++) {
+        page_set_paddr(&next[i], base + i * child_size);
+        next[i] |= leaf_flags;
+    }
+
+    table[index] = 0;
+    page_set_paddr(&table[index], (u64)(uintptr_t)next);
+    table[index] |= PT_PRESENT;
+
+    return next;
+}
+
+static page_t *_walk_table_once(page_t *table, size_t index, size_t child_size) {
+    if ((table[index] & PT_PRESENT) && _leaf_pte(table[index])) {
+        return _split_leaf(table, index, child_size);
+    }
+
     if (table[index] & PT_PRESENT) {
         return (page_t *)(uintptr_t)page_get_paddr(&table[index]);
     }
@@ -31,11 +57,11 @@ void map_page(page_t *root, u64 vaddr, u64 paddr, u64 flags) {
     }
 
 #if __riscv_xlen == 64
-    page_t *lvl2 = _walk_table_once(root, GET_LVL3_INDEX(vaddr));
-    page_t *lvl1 = _walk_table_once(lvl2, GET_LVL2_INDEX(vaddr));
+    page_t *lvl2 = _walk_table_once(root, GET_LVL3_INDEX(vaddr), PAGE_2MIB);
+    page_t *lvl1 = _walk_table_once(lvl2, GET_LVL2_INDEX(vaddr), PAGE_4KIB);
     page_t *entry = &lvl1[GET_LVL1_INDEX(vaddr)];
 #else
-    page_t *lvl1 = _walk_table_once(root, GET_LVL2_INDEX(vaddr));
+    page_t *lvl1 = _walk_table_once(root, GET_LVL2_INDEX(vaddr), PAGE_4KIB);
     page_t *entry = &lvl1[GET_LVL1_INDEX(vaddr)];
 #endif
 
@@ -46,9 +72,93 @@ void map_page(page_t *root, u64 vaddr, u64 paddr, u64 flags) {
     sfence_vma();
 }
 
+bool split_page(page_t *root, u64 vaddr) {
+    page_t *entry = NULL;
+    size_t size = get_page(root, vaddr, &entry);
+
+    if (!entry) {
+        return false;
+    }
+
+#if __riscv_xlen == 64
+    if (size == (1ULL << 30)) {
+        _split_leaf(root, GET_LVL3_INDEX(vaddr), PAGE_2MIB);
+        size = get_page(root, vaddr, &entry);
+    }
+
+    if (size == PAGE_2MIB) {
+        page_t *lvl2 = entry - GET_LVL2_INDEX(vaddr);
+        _split_leaf(lvl2, GET_LVL2_INDEX(vaddr), PAGE_4KIB);
+        size = get_page(root, vaddr, &entry);
+    }
+#else
+    if (size == PAGE_4MIB) {
+        _split_leaf(root, GET_LVL2_INDEX(vaddr), PAGE_4KIB);
+        size = get_page(root, vaddr, &entry);
+    }
+#endif
+
+    sfence_vma();
+    return size == PAGE_4KIB;
+}
+
+// the 4KiB leaf for vaddr when it holds a swap entry
+static page_t *_swap_leaf(page_t *root, u64 vaddr) {
+    if (!root) {
+        return NULL;
+    }
+
+#if __riscv_xlen == 64
+    page_t lvl2e = root[GET_LVL3_INDEX(vaddr)];
+    if (!(lvl2e & PT_PRESENT) || _leaf_pte(lvl2e)) {
+        return NULL;
+    }
+
+    page_t *lvl2 = (page_t *)(uintptr_t)page_get_paddr(&lvl2e);
+    page_t lvl1e = lvl2[GET_LVL2_INDEX(vaddr)];
+#else
+    page_t lvl1e = root[GET_LVL2_INDEX(vaddr)];
+#endif
+
+    if (!(lvl1e & PT_PRESENT) || _leaf_pte(lvl1e)) {
+        return NULL;
+    }
+
+    page_t *lvl1 = (page_t *)(uintptr_t)page_get_paddr(&lvl1e);
+    page_t *entry = &lvl1[GET_LVL1_INDEX(vaddr)];
+
+    return page_is_swap(*entry) ? entry : NULL;
+}
+
+void set_swap_page(page_t *root, u64 vaddr, u64 slot) {
+    if (!root) {
+        return;
+    }
+
+#if __riscv_xlen == 64
+    page_t *lvl2 = _walk_table_once(root, GET_LVL3_INDEX(vaddr), PAGE_2MIB);
+    page_t *lvl1 = _walk_table_once(lvl2, GET_LVL2_INDEX(vaddr), PAGE_4KIB);
+#else
+    page_t *lvl1 = _walk_table_once(root, GET_LVL2_INDEX(vaddr), PAGE_4KIB);
+#endif
+
+    lvl1[GET_LVL1_INDEX(vaddr)] = page_swap_entry(slot);
+    sfence_vma();
+}
+
 void unmap_page(page_t *root, u64 vaddr) {
     page_t *entry = NULL;
-    (void)get_page(root, vaddr, &entry);
+
+    // a 4KiB unmap inside a superpage only drops that one page
+    if (get_page(root, vaddr, &entry) > PAGE_4KIB) {
+        split_page(root, vaddr);
+        (void)get_page(root, vaddr, &entry);
+    }
+
+    // a swapped out leaf is not valid but still holds its slot
+    if (!entry) {
+        entry = _swap_leaf(root, vaddr);
+    }
 
     if (!entry) {
         return;
@@ -58,9 +168,81 @@ void unmap_page(page_t *root, u64 vaddr) {
     sfence_vma();
 }
 
+void unmap_region(page_t *root, size_t pages, u64 vaddr) {
+    size_t i = 0;
+
+    while (i < pages) {
+        u64 page_vaddr = vaddr + i * PAGE_4KIB;
+
+#if __riscv_xlen == 64
+        page_t *entry = NULL;
+        size_t size = get_page(root, page_vaddr, &entry);
+        bool whole = size == PAGE_2MIB && !(page_vaddr & (PAGE_2MIB - 1)) && pages - i >= PAGE_2MIB / PAGE_4KIB;
+
+        if (entry && whole) {
+            *entry = 0;
+            sfence_vma();
+            i += PAGE_2MIB / PAGE_4KIB;
+            continue;
+        }
+#endif
+
+        unmap_page(root, page_vaddr);
+        i++;
+    }
+}
+
+#if __riscv_xlen == 64
+// a megapage may only replace an empty slot; live page tables are never dropped here
+static bool _megapage_slot_free(page_t *root, u64 vaddr) {
+    page_t lvl2e = root[GET_LVL3_INDEX(vaddr)];
+
+    if (!(lvl2e & PT_PRESENT)) {
+        return true;
+    }
+
+    if (_leaf_pte(lvl2e)) {
+        return false;
+    }
+
+    page_t *lvl2 = (page_t *)(uintptr_t)page_get_paddr(&lvl2e);
+    page_t lvl1e = lvl2[GET_LVL2_INDEX(vaddr)];
+
+    return !(lvl1e & PT_PRESENT) || _leaf_pte(lvl1e);
+}
+
+static void _map_megapage(page_t *root, u64 vaddr, u64 paddr, u64 flags) {
+    page_t *lvl2 = _walk_table_once(root, GET_LVL3_INDEX(vaddr), PAGE_2MIB);
+    page_t *entry = &lvl2[GET_LVL2_INDEX(vaddr)];
+
+    *entry = 0;
+    page_set_paddr(entry, paddr);
+    *entry |= pte_leaf_flags(flags);
+
+    sfence_vma();
+}
+#endif
+
 void map_region(page_t *root, size_t pages, u64 vaddr, u64 paddr, u64 flags) {
-    for (size_t i = 0; i < pages; i++) {
-        map_page(root, vaddr + i * PAGE_4KIB, paddr + i * PAGE_4KIB, flags);
+    size_t i = 0;
+
+    while (i < pages) {
+        u64 page_vaddr = vaddr + i * PAGE_4KIB;
+        u64 page_paddr = paddr + i * PAGE_4KIB;
+
+#if __riscv_xlen == 64
+        bool aligned = !((page_vaddr | page_paddr) & (PAGE_2MIB - 1));
+        bool fits = pages - i >= PAGE_2MIB / PAGE_4KIB;
+
+        if (aligned && fits && _megapage_slot_free(root, page_vaddr)) {
+            _map_megapage(root, page_vaddr, page_paddr, flags);
+            i += PAGE_2MIB / PAGE_4KIB;
+            continue;
+        }
+#endif
+
+        map_page(root, page_vaddr, page_paddr, flags);
+        i++;
     }
 }
 
@@ -114,7 +296,7 @@ size_t get_page(page_t *root, u64 vaddr, page_t **entry) {
         if (entry) {
             *entry = &root[GET_LVL2_INDEX(vaddr)];
         }
-        return 1ULL << 22;
+        return PAGE_4MIB;
     }
 
     page_t *lvl1 = (page_t *)(uintptr_t)page_get_paddr(&lvl1e);
@@ -2,6 +2,7 @@
 
 #include <arch/paging.h>
 #include <base/types.h>
+#include <stdbool.h>
 
 static inline page_t pte_leaf_flags(u64 flags) {
     return PT_PRESENT | PT_ACCESSED | PT_DIRTY | PT_READ | (flags & PT_WRITE) | (flags & PT_USER) |
@@ -10,6 +11,11 @@ static inline page_t pte_leaf_flags(u64 flags) {
 
 void map_page(page_t *root, u64 vaddr, u64 paddr, u64 flags);
 void unmap_page(page_t *root, u64 vaddr);
+void unmap_region(page_t *root, size_t pages, u64 vaddr);
+bool split_page(page_t *root, u64 vaddr);
+
+// replace the 4KiB leaf for vaddr with a swap entry, building missing tables
+void set_swap_page(page_t *root, u64 vaddr, u64 slot);
 
 void map_region(page_t *root, size_t pages, u64 vaddr, u64 paddr, u64 flags);
 size_t get_page(page_t *root, u64 vaddr, page_t **entry);
@@ -21,7 +21,7 @@ bool arch_setup_signal_stack(sched_thread_t *thread, arch_int_state_t *state, si
     uintptr_t aligned = ALIGN_DOWN(sp, 16);
 
     state->s_regs.sp = aligned;
-    state->g_regs.ra = (uintptr_t)thread->signal_trampoline;
+    state->g_regs.ra = (uintptr_t)sched_group(thread)->signal_trampoline;
     state->g_regs.a0 = (uintptr_t)signum;
     state->s_regs.sepc = (uintptr_t)handler;
     return true;
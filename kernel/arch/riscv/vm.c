@@ -10,21 +10,40 @@
 #include <sys/cpu.h>
 #include <sys/lock.h>
 
+// past this many pages one sfence for the whole ASID beats per-page fences
+#define TLB_FLUSH_ALL_PAGES 32
+
+#if __riscv_xlen == 64
+#define SATP_ASID_SHIFT 44
+#else
+#define SATP_ASID_SHIFT 22
+#endif
+
+#define ASID_MASK ((u64)RISCV_ASID_COUNT - 1)
+
+// the context keeps the allocator generation above the ASID bits,
+// a stale generation means the ASID may already belong to someone else
 struct arch_vm_space {
     page_t *root;
-    u16 asid;
+    u64 context;
 };
 
 typedef struct {
     struct arch_vm_space kernel;
-    page_t *current_root[MAX_CORES];
-    u16 current_asid[MAX_CORES];
+    arch_vm_space_t *current[MAX_CORES];
+    bool flush_pending[MAX_CORES];
     bitmap_word_t asids[DIV_ROUND_UP(RISCV_ASID_COUNT, BITMAP_WORD_SIZE)];
+    size_t asid_count;
+    u64 generation;
     spinlock_t asid_lock;
     bool use_asids;
+    bool asids_probed;
 } vm_state_t;
 
-static vm_state_t vm = { .asid_lock = SPINLOCK_INIT };
+static vm_state_t vm = {
+    .generation = RISCV_ASID_COUNT,
+    .asid_lock = SPINLOCK_INIT,
+};
 
 static size_t _current_cpu_id(void) {
     cpu_core_t *core = cpu_current();
@@ -35,41 +54,75 @@ static bool _leaf_pte(page_t entry) {
     return (entry & (PT_READ | PT_WRITE | PT_EXECUTE)) != 0;
 }
 
-static u16 _asid_alloc(void) {
+static u16 _space_asid(const arch_vm_space_t *space) {
+    return (u16)(space->context & ASID_MASK);
+}
+
+// the ASID field is WARL, so writing all ones reveals how many bits the hart keeps
+static void _asid_probe(page_t *root) {
+    vm.asids_probed = true;
+
     if (!vm.use_asids) {
-        return 0;
+        return;
     }
 
-    size_t index = 0;
-    unsigned long flags = spin_lock_irqsave(&vm.asid_lock);
-    bool found = bitmap_find_first_clear(vm.asids, RISCV_ASID_COUNT, &index);
+    riscv_write_satp((uintptr_t)root, RISCV_PAGING_MODE, (uintptr_t)ASID_MASK);
+    u64 asid = ((u64)riscv_read_satp() >> SATP_ASID_SHIFT) & ASID_MASK;
 
-    if (found) {
-        bitmap_set(vm.asids, index);
-    }
+    vm.asid_count = (size_t)asid + 1;
+    vm.use_asids = vm.asid_count > 1;
+}
 
-    spin_unlock_irqrestore(&vm.asid_lock, flags);
+// called with the asid lock held once every ASID of the generation is handed out
+static void _asid_rollover(void) {
+    vm.generation += RISCV_ASID_COUNT;
+    memset(vm.asids, 0, sizeof(vm.asids));
+    bitmap_set(vm.asids, 0);
+
+    // loaded spaces keep their ASID, everything else gets a new one on its next switch
+    for (size_t cpu = 0; cpu < MAX_CORES; cpu++) {
+        arch_vm_space_t *space = vm.current[cpu];
+
+        if (space && space != &vm.kernel && _space_asid(space)) {
+            bitmap_set(vm.asids, _space_asid(space));
+            space->context = vm.generation | _space_asid(space);
+        }
 
-    // ASID 0 remains a safe flush-on-switch fallback while the pool is busy.
-    return found ? (u16)index : 0;
+        vm.flush_pending[cpu] = true;
+    }
 }
 
-static void _asid_free(u16 asid) {
-    if (!asid) {
+static void _asid_assign(arch_vm_space_t *space) {
+    if ((space->context & ~ASID_MASK) == vm.generation) {
         return;
     }
 
-    sfence_vma_asid(asid);
+    size_t index = 0;
 
-    unsigned long flags = spin_lock_irqsave(&vm.asid_lock);
-    bitmap_clear(vm.asids, asid);
-    spin_unlock_irqrestore(&vm.asid_lock, flags);
+    if (!bitmap_find_first_clear(vm.asids, vm.asid_count, &index)) {
+        _asid_rollover();
+
+        // the space may have been loaded somewhere and kept its ASID
+        if ((space->context & ~ASID_MASK) == vm.generation) {
+            return;
+        }
+
+        // ASID 0 remains a safe flush-on-switch fallback if every ASID is loaded
+        if (!bitmap_find_first_clear(vm.asids, vm.asid_count, &index)) {
+            space->context = vm.generation;
+            return;
+        }
+    }
+
+    bitmap_set(vm.asids, index);
+    space->context = vm.generation | index;
 }
 
 void vm_init_kernel(page_t *root, bool use_asids) {
     vm.kernel.root = root;
-    vm.kernel.asid = 0;
+    vm.kernel.context = 0;
     vm.use_asids = use_asids;
+    vm.asid_count = RISCV_ASID_COUNT;
     bitmap_set(vm.asids, 0);
 }
 
@@ -91,7 +144,8 @@ arch_vm_space_t *arch_vm_create_user(void) {
 
     memset(space->root, 0, PAGE_4KIB);
 
-    space->asid = _asid_alloc();
+    // the ASID is handed out lazily on the first switch
+    space->context = 0;
 
 #if __riscv_xlen == 64
     memcpy(
@@ -169,14 +223,17 @@ void arch_vm_destroy(arch_vm_space_t *space) {
     _free_tables_32(space->root);
 #endif
 
+    // ASIDs are only recycled by a rollover, which flushes every hart
+    unsigned long flags = spin_lock_irqsave(&vm.asid_lock);
+
     for (size_t cpu = 0; cpu < MAX_CORES; cpu++) {
-        if (vm.current_root[cpu] == space->root && vm.current_asid[cpu] == space->asid) {
-            vm.current_root[cpu] = NULL;
-            vm.current_asid[cpu] = 0;
+        if (vm.current[cpu] == space) {
+            vm.current[cpu] = NULL;
         }
     }
 
-    _asid_free(space->asid);
+    spin_unlock_irqrestore(&vm.asid_lock, flags);
+
     free_frames(space->root, 1);
     free(space);
 }
@@ -186,19 +243,59 @@ void arch_vm_switch(arch_vm_space_t *space) {
         return;
     }
 
+    unsigned long flags = spin_lock_irqsave(&vm.asid_lock);
     size_t cpu_id = _current_cpu_id();
-    if (vm.current_root[cpu_id] == space->root && vm.current_asid[cpu_id] == space->asid) {
+
+    if (!vm.asids_probed) {
+        _asid_probe(space->root);
+    }
+
+    if (vm.use_asids && space != &vm.kernel) {
+        _asid_assign(space);
+    }
+
+    bool first_switch = !vm.current[cpu_id];
+    bool flush = first_switch || vm.flush_pending[cpu_id] || !_space_asid(space);
+
+    if (vm.current[cpu_id] == space && !flush) {
+        spin_unlock_irqrestore(&vm.asid_lock, flags);
         return;
     }
 
-    bool first_switch = !vm.current_root[cpu_id];
-    vm.current_root[cpu_id] = space->root;
-    vm.current_asid[cpu_id] = space->asid;
-    riscv_write_satp((uintptr_t)space->root, RISCV_PAGING_MODE, space->asid);
+    vm.current[cpu_id] = space;
+    vm.flush_pending[cpu_id] = false;
+    riscv_write_satp((uintptr_t)space->root, RISCV_PAGING_MODE, _space_asid(space));
 
-    if (first_switch || !space->asid) {
+    // entries tagged with a recycled ASID must not survive into its new owner
+    if (flush) {
         sfence_vma();
     }
+
+    spin_unlock_irqrestore(&vm.asid_lock, flags);
+}
+
+// there is a single hart, so every invalidation stays local
+void arch_tlb_flush_range(arch_vm_space_t *space, uintptr_t start, uintptr_t end) {
+    start = ALIGN_DOWN(start, PAGE_4KIB);
+    end = ALIGN(end, PAGE_4KIB);
+
+    if (start >= end) {
+        return;
+    }
+
+    if ((end - start) / PAGE_4KIB > TLB_FLUSH_ALL_PAGES) {
+        if (space && space != &vm.kernel && _space_asid(space)) {
+            sfence_vma_asid(_space_asid(space));
+        } else {
+            sfence_vma();
+        }
+
+        return;
+    }
+
+    for (uintptr_t addr = start; addr < end; addr += PAGE_4KIB) {
+        sfence_vma_addr(addr);
+    }
 }
 
 void *arch_vm_root(arch_vm_space_t *space) {
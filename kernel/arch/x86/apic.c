@@ -56,6 +56,7 @@
 #define MADT_ISO_LEVEL_TRIGGER 3U
 
 #define APIC_TIMER_INITIAL_MAX 0xffffffffU
+#define APIC_TIMER_MAX_NS      (1ULL << 34)
 
 #if defined(__i386__)
 #define APIC_MMIO_STRIDE_32 0x00010000U
@@ -113,8 +114,8 @@ typedef struct {
     bool enabled;
 
     bool timer_ready;
-    u32 timer_rate_hz;
-    u32 timer_initial_count;
+    bool timer_tsc_deadline;
+    u32 timer_counts_per_ms;
 
     u64 lapic_paddr;
     volatile u32 *lapic_mmio;
@@ -546,11 +547,7 @@ static void _parse_madt(void) {
     apic.madt_parsed = true;
 }
 
-static u32 _calibrate_timer(u32 hz) {
-    if (!hz) {
-        return 0;
-    }
-
+static u32 _calibrate_timer(void) {
     if (!tsc_khz()) {
         return 0;
     }
@@ -564,23 +561,14 @@ static u32 _calibrate_timer(u32 hz) {
     tsc_spin(APIC_TIMER_CAL_MS);
 
     u32 end = _read(LAPIC_TIMER_CCOUNT_REG);
+    _write(LAPIC_TIMER_ICOUNT_REG, 0);
+
     u32 elapsed = begin - end;
     if (!elapsed) {
         return 0;
     }
 
-    u64 counts_per_ms = elapsed / APIC_TIMER_CAL_MS;
-    if (!counts_per_ms) {
-        return 0;
-    }
-
-    u64 initial = (counts_per_ms * 1000) / hz;
-
-    if (!initial || initial > 0xffffffffULL) {
-        return 0;
-    }
-
-    return (u32)initial;
+    return elapsed / APIC_TIMER_CAL_MS;
 }
 
 bool apic_init(void) {
@@ -658,35 +646,50 @@ bool apic_init(void) {
     return true;
 }
 
-bool apic_timer_init(u32 hz) {
+bool apic_timer_init(void) {
     if (!apic.enabled) {
         return false;
     }
 
     if (!apic.timer_ready) {
-        u32 initial = _calibrate_timer(hz);
-        if (!initial) {
+        u32 counts_per_ms = _calibrate_timer();
+        if (!counts_per_ms) {
             return false;
         }
 
-        apic.timer_initial_count = initial;
-        apic.timer_rate_hz = hz;
+        cpuid_regs_t regs = { 0 };
+        cpuid(1, &regs);
+
+        apic.timer_counts_per_ms = counts_per_ms;
+        apic.timer_tsc_deadline = (regs.ecx & CPUID_FEAT_ECX_TSC_DEADLINE) != 0;
         apic.timer_ready = true;
     }
 
     return apic_timer_init_local();
 }
 
+// one-shot, nothing fires until a count or a TSC deadline is loaded
 bool apic_timer_init_local(void) {
-    if (!apic.enabled || !apic.timer_ready || !apic.timer_initial_count) {
+    if (!apic.enabled || !apic.timer_ready) {
         return false;
     }
 
-    u32 lvt = IRQ_INT(IRQ_SYSTEM_TIMER) | LAPIC_TIMER_PERIODIC | LAPIC_LVT_MASK;
+    u32 lvt = IRQ_INT(IRQ_SYSTEM_TIMER) | LAPIC_LVT_MASK;
+
+    if (apic.timer_tsc_deadline) {
+        lvt |= LAPIC_TIMER_TSC_DEADLINE;
+    }
 
     _write(LAPIC_TIMER_DIVIDE_REG, APIC_TIMER_DIVIDE_16);
     _write(LAPIC_LVT_TIMER_REG, lvt);
-    _write(LAPIC_TIMER_ICOUNT_REG, apic.timer_initial_count);
+
+    // the mode switch must land before the first deadline msr write, any cpu
+    // with TSC deadline mode has mfence
+    if (apic.timer_tsc_deadline) {
+        asm volatile("mfence" ::: "memory");
+    }
+
+    apic_timer_stop();
 
     return true;
 }
@@ -713,12 +716,58 @@ void apic_timer_disable(void) {
     _write(LAPIC_LVT_TIMER_REG, lvt);
 }
 
+// rounds up so the interrupt never lands before the deadline it was asked for,
+// a delay past the counter's range just fires early and gets re-armed
+void apic_timer_oneshot(u64 ns) {
+    if (!apic.timer_ready) {
+        return;
+    }
+
+    if (ns > APIC_TIMER_MAX_NS) {
+        ns = APIC_TIMER_MAX_NS;
+    }
+
+    u64 count = (ns * apic.timer_counts_per_ms + 999999) / 1000000;
+
+    if (!count) {
+        count = 1;
+    }
+
+    if (count > APIC_TIMER_INITIAL_MAX) {
+        count = APIC_TIMER_INITIAL_MAX;
+    }
+
+    _write(LAPIC_TIMER_ICOUNT_REG, (u32)count);
+}
+
+// a deadline already passed fires at once
+void apic_timer_deadline(u64 tsc) {
+    if (!apic.timer_ready || !apic.timer_tsc_deadline) {
+        return;
+    }
+
+    write_msr(APIC_TSC_DEADLINE_MSR, tsc ? tsc : 1);
+}
+
+void apic_timer_stop(void) {
+    if (!apic.timer_ready) {
+        return;
+    }
+
+    if (apic.timer_tsc_deadline) {
+        write_msr(APIC_TSC_DEADLINE_MSR, 0);
+        return;
+    }
+
+    _write(LAPIC_TIMER_ICOUNT_REG, 0);
+}
+
 bool apic_timer_active(void) {
     return apic.timer_ready;
 }
 
-u32 apic_timer_hz(void) {
-    return apic.timer_rate_hz;
+bool apic_timer_tsc_deadline(void) {
+    return apic.timer_tsc_deadline;
 }
 
 bool ioapic_available(void) {
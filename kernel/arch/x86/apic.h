@@ -7,14 +7,21 @@
 
 #define APIC_MSR_ADDR_MASK (~0xfffULL)
 
-#define LAPIC_LVT_MASK       (1U << 16)
-#define LAPIC_TIMER_PERIODIC (1U << 17)
+#define APIC_TSC_DEADLINE_MSR 0x6e0
+
+#define LAPIC_LVT_MASK           (1U << 16)
+#define LAPIC_TIMER_PERIODIC     (1U << 17)
+#define LAPIC_TIMER_TSC_DEADLINE (2U << 17)
 
 enum cpuid_feature_edx_flags {
     CPUID_FEAT_EDX_MSR = 1U << 5,
     CPUID_FEAT_EDX_APIC = 1U << 9,
 };
 
+enum cpuid_feature_ecx_flags {
+    CPUID_FEAT_ECX_TSC_DEADLINE = 1U << 24,
+};
+
 enum apic_base_msr_flags {
     APIC_MSR_IS_BSP = 1U << 8,
     APIC_MSR_X2APIC_ENABLE = 1U << 10,
@@ -66,12 +73,15 @@ enum lapic_registers {
 };
 
 bool apic_init(void);
-bool apic_timer_init(u32 hz);
+bool apic_timer_init(void);
 bool apic_timer_init_local(void);
 void apic_timer_enable(void);
 void apic_timer_disable(void);
+void apic_timer_oneshot(u64 ns);
+void apic_timer_deadline(u64 tsc);
+void apic_timer_stop(void);
 bool apic_timer_active(void);
-u32 apic_timer_hz(void);
+bool apic_timer_tsc_deadline(void);
 
 bool ioapic_available(void);
 void ioapic_mask_all(void);
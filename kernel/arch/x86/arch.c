@@ -16,6 +16,7 @@
 #include <sys/console.h>
 #include <sys/cpu.h>
 #include <sys/disk.h>
+#include <sys/extable.h>
 #include <sys/framebuffer.h>
 #include <sys/keyboard.h>
 #include <sys/lock.h>
@@ -39,6 +40,7 @@
 #include <x86/serial.h>
 #include <x86/smp.h>
 #include <x86/tsc.h>
+#include <x86/vm.h>
 
 #define LOG_BOOT_HISTORY_CAP (256 * 1024)
 #define ROOTFS_SECTOR_SIZE   512
@@ -655,6 +657,46 @@ static bool _is_user_fault_addr(u64 addr, bool user) {
     return user || (user_top && addr < (u64)user_top);
 }
 
+// kernel faults on user memory resume at the copy routine's fixup
+static bool _fixup_kernel_fault(int_state_t *state) {
+#if defined(__x86_64__)
+    uintptr_t fixup = extable_fixup((uintptr_t)state->s_regs.rip);
+    if (fixup) {
+        state->s_regs.rip = fixup;
+    }
+#else
+    uintptr_t fixup = extable_fixup((uintptr_t)state->s_regs.eip);
+    if (fixup) {
+        state->s_regs.eip = fixup;
+    }
+#endif
+
+    return fixup != 0;
+}
+
+static bool _fault_irqs_were_on(const int_state_t *state) {
+#if defined(__x86_64__)
+    return state && (state->s_regs.rflags & (1ULL << 9));
+#else
+    return state && (state->s_regs.eflags & (1U << 9));
+#endif
+}
+
+static bool _resolve_user_fault(u64 addr, bool present, bool write, bool user) {
+    sched_thread_t *thread = sched_current();
+
+    if (!thread || !thread->user_thread || !_is_user_fault_addr(addr, user)) {
+        return false;
+    }
+
+    if (present && write) {
+        return sched_handle_cow_fault(thread, (uintptr_t)addr, true);
+    }
+
+    // a not present user page may just be swapped out
+    return !present && sched_handle_swap_fault(thread, (uintptr_t)addr);
+}
+
 static void _page_fault_handler(int_state_t *state) {
     u64 addr = read_cr2();
     u64 code = state ? (u64)state->error_code : 0;
@@ -664,21 +706,22 @@ static void _page_fault_handler(int_state_t *state) {
     bool write = code & PF_ERR_WRITE;
     bool user = code & PF_ERR_USER;
 
-    if (present && write) {
-        sched_thread_t *thread = sched_current();
+    // cow and swap faults may sleep on another thread's region syscall, which
+    // needs interrupts back on when the faulting code had them
+    unsigned long irq_flags = arch_irq_save();
+    if (_fault_irqs_were_on(state)) {
+        enable_interrupts();
+    }
 
-        bool is_user_addr = _is_user_fault_addr(addr, user);
-        bool user_thread = thread && thread->user_thread;
-        bool can_cow = user_thread && is_user_addr;
+    bool resolved = _resolve_user_fault(addr, present, write, user);
+    arch_irq_restore(irq_flags);
 
-        bool cow_handled = false;
-        if (can_cow) {
-            cow_handled = sched_handle_cow_fault(thread, (uintptr_t)addr, true);
-        }
+    if (resolved) {
+        return;
+    }
 
-        if (cow_handled) {
-            return;
-        }
+    if (!user && state && _fixup_kernel_fault(state)) {
+        return;
     }
 
     if (_handle_user_signal(SIGSEGV, state)) {
@@ -1155,6 +1198,7 @@ const kernel_args_t *arch_init(void *boot_info) {
     _fpu_hw_enable();
 
     pat_init();
+    vm_init_cpu();
 #if defined(__x86_64__)
     size_t fb_pitch = info->video.bytes_per_line;
     if (!fb_pitch && info->video.bytes_per_pixel && info->video.width <= SIZE_MAX / info->video.bytes_per_pixel) {
@@ -1197,6 +1241,7 @@ const kernel_args_t *arch_init(void *boot_info) {
     acpi_init(info->acpi_root_ptr);
     tsc_init();
     irq_init();
+    smp_topology_init();
     log_set_clock(arch_timer_ticks, arch_timer_hz());
 
     pci_init();
@@ -1257,16 +1302,44 @@ bool arch_keeps_phys_map(void) {
 }
 
 void arch_tlb_flush(uintptr_t addr) {
+    arch_tlb_flush_range(NULL, addr, addr + PAGE_4KIB);
+}
+
+void arch_code_sync(void) {
+    asm volatile("" ::: "memory");
+}
+
+void arch_clear_pages(void *dst, size_t pages) {
 #if defined(__x86_64__)
-    tlb_flush((u64)addr);
+    u64 *cursor = dst;
+    u64 *end = cursor + pages * (PAGE_4KIB / sizeof(u64));
+
+    // movnti bypasses the cache, the pages are rarely read before they're handed out
+    for (; cursor < end; cursor += 4) {
+        asm volatile("movnti %1, 0(%0)\n\t"
+                     "movnti %1, 8(%0)\n\t"
+                     "movnti %1, 16(%0)\n\t"
+                     "movnti %1, 24(%0)"
+                     :
+                     : "r"(cursor), "r"(0UL)
+                     : "memory");
+    }
+
+    asm volatile("sfence" ::: "memory");
 #else
-    tlb_flush((u32)addr);
+    memset(dst, 0, pages * PAGE_4KIB);
 #endif
-    smp_tlb_shootdown(addr);
 }
 
-void arch_code_sync(void) {
-    asm volatile("" ::: "memory");
+size_t arch_copy_user(void *dst, const void *src, size_t len) {
+    // rep movsb is the fast string path on ERMS parts, a fault leaves the remainder in the count
+    asm volatile("1: rep movsb\n\t"
+                 "2:\n\t" EXTABLE_ENTRY("1b", "2b")
+                 : "+D"(dst), "+S"(src), "+c"(len)
+                 :
+                 : "memory");
+
+    return len;
 }
 
 void arch_cpu_set_local(void *ptr) {
@@ -1444,6 +1517,14 @@ u32 arch_timer_hz(void) {
     return irq_timer_hz();
 }
 
+u64 arch_timer_ns(void) {
+    return irq_ns();
+}
+
+bool arch_timer_program(u64 deadline_ns) {
+    return irq_timer_program(deadline_ns);
+}
+
 static void _wallclock_set_base(u64 seconds, u64 ticks) {
     __atomic_store_n(&wallclock_base_seconds, seconds, __ATOMIC_RELEASE);
     __atomic_store_n(&wallclock_base_ticks, ticks, __ATOMIC_RELEASE);
@@ -1576,6 +1657,14 @@ u64 arch_cpu_khz(void) {
     return tsc_khz();
 }
 
+u64 arch_cycles(void) {
+    return read_tsc();
+}
+
+u64 arch_cycles_khz(void) {
+    return tsc_khz();
+}
+
 void arch_mem_info(size_t *total, size_t *free) {
     if (total) {
         *total = pmm_total_mem();
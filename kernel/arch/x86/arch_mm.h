@@ -12,6 +12,15 @@ static inline void *arch_alloc_frames_user(size_t count) {
     return alloc_frames_user(count);
 }
 
+static inline void *arch_alloc_frames_user_aligned(size_t count, size_t align) {
+    return alloc_frames_user_aligned(count, align);
+}
+
+// never reclaims, for callers that may already be running from reclaim
+static inline void *arch_alloc_frames_try(size_t count) {
+    return alloc_frames_try(count);
+}
+
 static inline void arch_free_frames(void *ptr, size_t count) {
     free_frames(ptr, count);
 }
@@ -20,6 +29,24 @@ static inline void arch_map_region(void *root, size_t pages, u64 vaddr, u64 padd
     map_region(root, pages, vaddr, paddr, flags);
 }
 
+static inline void arch_unmap_region(void *root, size_t pages, u64 vaddr) {
+    unmap_region(root, pages, vaddr);
+}
+
+// break a large leaf covering vaddr into 4KiB entries
+static inline bool arch_split_page(void *root, u64 vaddr) {
+    return split_page(root, vaddr);
+}
+
+// leaf size map_region promotes aligned runs to, 0 when only 4KiB pages are used
+static inline size_t arch_large_page_size(void) {
+#if defined(__x86_64__)
+    return PAGE_2MIB;
+#else
+    return 0;
+#endif
+}
+
 static inline size_t arch_get_page(void *root, u64 vaddr, page_t **entry) {
     return get_page(root, vaddr, entry);
 }
@@ -31,3 +58,20 @@ static inline u64 arch_page_get_paddr(page_t *entry) {
 static inline void arch_page_set_paddr(page_t *entry, u64 paddr) {
     page_set_paddr(entry, paddr);
 }
+
+// park a swap slot in the 4KiB leaf for vaddr, large leaves around it are split
+static inline void arch_set_swap_page(void *root, u64 vaddr, u64 slot, u64 flags) {
+    set_swap_page(root, vaddr, slot, flags);
+}
+
+// true when the page was touched since the last call, clears the hardware accessed bit
+static inline bool arch_page_young(page_t *entry) {
+    if (!entry || !(*entry & PT_ACCESSED)) {
+        return false;
+    }
+
+    // the walker sets bits behind our back, so this must be a locked op; the
+    // accessed bit lives in the low word, which i386 can update natively
+    __atomic_fetch_and((volatile u32 *)entry, ~(u32)PT_ACCESSED, __ATOMIC_RELAXED);
+    return true;
+}
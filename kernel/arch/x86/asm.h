@@ -176,10 +176,16 @@ static inline void write_cr3(u32 value) {
 }
 #endif
 
+static inline void tlb_flush_all(void) {
+    write_cr3(read_cr3());
+}
+
 #define CR4_PSE        (1 << 4)
 #define CR4_PAE        (1 << 5)
+#define CR4_PGE        (1 << 7)
 #define CR4_OSFXSR     (1 << 9)
 #define CR4_OSXMMEXCPT (1 << 10)
+#define CR4_PCIDE      (1 << 17)
 
 #if defined(__x86_64__)
 static inline u64 read_cr4(void) {
@@ -205,6 +211,29 @@ static inline void write_cr4(u32 value) {
 }
 #endif
 
+// toggling PGE drops every entry, global ones and all PCIDs included
+static inline void tlb_flush_global(void) {
+    u64 cr4 = read_cr4();
+    write_cr4(cr4 ^ CR4_PGE);
+    write_cr4(cr4);
+}
+
+#if defined(__x86_64__)
+#define INVPCID_ADDR       0
+#define INVPCID_CONTEXT    1
+#define INVPCID_ALL_GLOBAL 2
+#define INVPCID_ALL        3
+
+static inline void invpcid(u64 type, u64 pcid, u64 addr) {
+    struct {
+        u64 pcid;
+        u64 addr;
+    } desc = { pcid, addr };
+
+    asm volatile("invpcid %0, %1" : : "m"(desc), "r"(type) : "memory");
+}
+#endif
+
 #define CPUID_EXTENDED_INFO 0x80000001
 #define CPUID_EI_LM         (1 << 29)
 #define CPUID_EI_1G_PAGES   (1 << 26)
@@ -214,12 +243,12 @@ typedef struct {
     u32 eax, ebx, ecx, edx;
 } cpuid_regs_t;
 
+static inline void cpuid_count(u32 leaf, u32 subleaf, cpuid_regs_t *r) {
+    asm volatile("cpuid" : "=a"(r->eax), "=b"(r->ebx), "=c"(r->ecx), "=d"(r->edx) : "a"(leaf), "c"(subleaf));
+}
+
 static inline void cpuid(u32 leaf, cpuid_regs_t *r) {
-    asm volatile( // ecx holds the subleaf number
-        "cpuid"
-        : "=a"(r->eax), "=b"(r->ebx), "=c"(r->ecx), "=d"(r->edx)
-        : "a"(leaf), "c"(0)
-    );
+    cpuid_count(leaf, 0, r);
 }
 
 #define EFER_MSR 0xC0000080
@@ -146,8 +146,9 @@ void init_paging_32(void) {
     u32 cr4 = read_cr4();
     write_cr4(cr4 | CR4_PAE | CR4_PSE);
 
+    // write protect makes supervisor writes to cow user pages fault like user ones
     u32 cr0 = read_cr0();
-    write_cr0(cr0 | CR0_PG);
+    write_cr0(cr0 | CR0_PG | CR0_WP);
 }
 
 static page_t elf_flags(u32 elf_flags) {
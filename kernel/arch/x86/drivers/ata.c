@@ -223,13 +223,9 @@ static bool ata_wait_irq_event(ata_device_t *dev, u32 *seq) {
         return true;
     }
 
-    u64 start = arch_timer_ticks();
-    u64 timeout = ms_to_ticks(ATA_IRQ_TIMEOUT_MS);
-    u64 max_wait = ms_to_ticks(ATA_IRQ_MAX_WAIT_MS);
-
-    if (!timeout) {
-        timeout = 1;
-    }
+    u64 start = arch_timer_ns();
+    u64 timeout = ms_to_ns(ATA_IRQ_TIMEOUT_MS);
+    u64 max_wait = ms_to_ns(ATA_IRQ_MAX_WAIT_MS);
 
     if (!max_wait) {
         max_wait = timeout;
@@ -244,7 +240,7 @@ static bool ata_wait_irq_event(ata_device_t *dev, u32 *seq) {
             return !ata_take_irq_error(ch);
         }
 
-        u64 elapsed = arch_timer_ticks() - start;
+        u64 elapsed = arch_timer_ns() - start;
         if (elapsed >= timeout) {
             u8 status = inb(ch->io_base + ATA_REG_STATUS);
             if (status & (ATA_SR_ERR | ATA_SR_DF)) {
@@ -289,10 +285,11 @@ static bool ata_wait_irq_event(ata_device_t *dev, u32 *seq) {
                 continue;
             }
 
-            u64 now_ticks = arch_timer_ticks();
+            // past the irq timeout the status is polled once a millisecond
+            u64 now_ns = arch_timer_ns();
             u64 deadline = start + timeout;
-            if ((now_ticks - start) >= timeout) {
-                deadline = now_ticks + 1;
+            if ((now_ns - start) >= timeout) {
+                deadline = now_ns + ms_to_ns(1);
             }
 
             sched_wait_result_t wait_result = ata_wait_irq_queue(ch, wait_seq, deadline);
@@ -5,6 +5,7 @@
 #include <log/log.h>
 #include <sched/scheduler.h>
 #include <stddef.h>
+#include <sys/trace.h>
 #include <x86/asm.h>
 #include <x86/gdt.h>
 #include <x86/irq.h>
@@ -144,6 +145,11 @@ void isr_handler(int_state_t *state) {
     }
 
     if (state->int_num < ISR_COUNT && idt.handlers[state->int_num]) {
+        // past the exceptions only the syscall vector is a trap gate
+        if (state->int_num >= EXCEPTION_COUNT && idt.entries[state->int_num].attributes != IDT_TRP) {
+            trace_event(TRACE_IRQ, state->int_num, 0);
+        }
+
         idt.handlers[state->int_num](state);
         return;
     }
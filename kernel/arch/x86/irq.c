@@ -11,10 +11,18 @@
 #include <x86/pit.h>
 #include <x86/serial.h>
 #include <x86/smp.h>
+#include <x86/tsc.h>
 
+#define NS_PER_TICK (1000000000ULL / TIMER_FREQ)
+
+// with the APIC timer, the clock is read off the TSC and the timer is armed
+// for whatever is due next; the PIT fallback stays periodic and counts ticks
 typedef struct {
     volatile u64 ticks ALIGNED(8);
     volatile u64 core_ticks[MAX_CORES] ALIGNED(8);
+    volatile u64 clock_ns ALIGNED(8);
+    u64 tsc_base;
+    u64 tsc_khz;
     bool apic_timer;
     bool ioapic;
 } irq_state_t;
@@ -44,28 +52,45 @@ static inline void _align_tick_floor(size_t cpu_id) {
     }
 }
 
-static inline void _publish_tick(size_t cpu_id) {
-    if (cpu_id >= MAX_CORES) {
-        cpu_id = 0;
-    }
+static inline u64 _raise_floor(volatile u64 *floor, u64 value) {
+    u64 observed = __atomic_load_n(floor, __ATOMIC_RELAXED);
 
-    u64 core_ticks = __atomic_add_fetch(&irq_state.core_ticks[cpu_id], 1, __ATOMIC_RELAXED);
-    u64 observed = __atomic_load_n(&irq_state.ticks, __ATOMIC_RELAXED);
-
-    while (core_ticks > observed) {
+    while (value > observed) {
         bool published = __atomic_compare_exchange_n(
-            &irq_state.ticks,
+            floor,
             &observed,
-            core_ticks,
+            value,
             false,
             __ATOMIC_RELEASE,
             __ATOMIC_RELAXED
         );
 
         if (published) {
-            break;
+            return value;
         }
     }
+
+    return observed;
+}
+
+static inline void _publish_tick(size_t cpu_id) {
+    if (cpu_id >= MAX_CORES) {
+        cpu_id = 0;
+    }
+
+    u64 core_ticks = __atomic_add_fetch(&irq_state.core_ticks[cpu_id], 1, __ATOMIC_RELAXED);
+    _raise_floor(&irq_state.ticks, core_ticks);
+}
+
+// split so neither product overflows for the lifetime of the machine
+static inline u64 _cycles_to_ns(u64 cycles) {
+    u64 khz = irq_state.tsc_khz;
+    return (cycles / khz) * 1000000ULL + ((cycles % khz) * 1000000ULL) / khz;
+}
+
+static inline u64 _ns_to_cycles(u64 ns) {
+    u64 khz = irq_state.tsc_khz;
+    return (ns / 1000000ULL) * khz + ((ns % 1000000ULL) * khz) / 1000000ULL;
 }
 
 static void _route_irqs(bool to_apic) {
@@ -103,7 +128,10 @@ static void _timer_handler(int_state_t *state) {
     cpu_core_t *core = cpu_current();
     size_t cpu_id = (core && core->id < MAX_CORES) ? core->id : 0;
 
-    _publish_tick(cpu_id);
+    if (!irq_state.apic_timer) {
+        _publish_tick(cpu_id);
+    }
+
     if (cpu_id == 0) {
         arch_wallclock_maintain();
     }
@@ -133,18 +161,20 @@ static void _resched_handler(int_state_t *state) {
 }
 
 static void _init_timer_source(bool apic_ok) {
-    const u32 timer_hz = TIMER_FREQ;
-
     irq_state.apic_timer = false;
 
-    if (apic_ok && apic_timer_init(timer_hz)) {
+    if (apic_ok && apic_timer_init()) {
+        irq_state.tsc_khz = tsc_khz();
         irq_state.apic_timer = true;
-        log_info("APIC timer %u Hz", (unsigned int)apic_timer_hz());
 
+        // count from one tick so a running clock never reads as zero
+        irq_state.tsc_base = read_tsc() - _ns_to_cycles(NS_PER_TICK);
+
+        log_info("APIC %s timer", apic_timer_tsc_deadline() ? "TSC deadline" : "one-shot");
         return;
     }
 
-    pit_set_frequency(timer_hz);
+    pit_set_frequency(TIMER_FREQ);
     log_info("PIT timer %u Hz", (unsigned int)pit_get_frequency());
 }
 
@@ -171,6 +201,7 @@ bool irq_init(void) {
 
     irq_register(IRQ_SYSTEM_TIMER, _timer_handler);
     timer_enable();
+    irq_timer_program(irq_ns() + NS_PER_TICK);
 
     irq_register(IRQ_COM1, _com1_handler);
     serial_set_rx_interrupt(SERIAL_COM1, true);
@@ -188,6 +219,7 @@ void irq_init_ap(void) {
     }
 
     apic_timer_enable();
+    irq_timer_program(irq_ns() + NS_PER_TICK);
 }
 
 void irq_register(size_t irq, int_handler_t handler) {
@@ -249,17 +281,56 @@ bool irq_using_ioapic(void) {
     return irq_state.ioapic;
 }
 
+// the TSCs of different cores may disagree slightly, the shared floor keeps
+// the clock from ever running backwards when a thread migrates
+u64 irq_ns(void) {
+    if (!irq_state.apic_timer) {
+        u64 hz = pit_get_frequency();
+        u64 ticks = __atomic_load_n(&irq_state.ticks, __ATOMIC_ACQUIRE);
+
+        return hz ? (ticks / hz) * 1000000000ULL + ((ticks % hz) * 1000000000ULL) / hz : 0;
+    }
+
+    return _raise_floor(&irq_state.clock_ns, _cycles_to_ns(read_tsc() - irq_state.tsc_base));
+}
+
 u64 irq_ticks(void) {
-    return __atomic_load_n(&irq_state.ticks, __ATOMIC_ACQUIRE);
+    if (!irq_state.apic_timer) {
+        return __atomic_load_n(&irq_state.ticks, __ATOMIC_ACQUIRE);
+    }
+
+    return irq_ns() / NS_PER_TICK;
 }
 
 u32 irq_timer_hz(void) {
     if (irq_state.apic_timer) {
-        return apic_timer_hz();
+        return TIMER_FREQ;
     }
     return pit_get_frequency();
 }
 
+bool irq_timer_program(u64 deadline_ns) {
+    if (!irq_state.apic_timer) {
+        return false;
+    }
+
+    if (!deadline_ns) {
+        apic_timer_stop();
+        return true;
+    }
+
+    u64 target = irq_state.tsc_base + _ns_to_cycles(deadline_ns);
+
+    if (apic_timer_tsc_deadline()) {
+        apic_timer_deadline(target);
+        return true;
+    }
+
+    u64 now = read_tsc();
+    apic_timer_oneshot(target > now ? _cycles_to_ns(target - now) : 0);
+    return true;
+}
+
 void timer_enable(void) {
     if (irq_state.apic_timer) {
         apic_timer_enable();
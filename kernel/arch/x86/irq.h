@@ -30,7 +30,11 @@ void irq_ack(size_t irq);
 bool irq_using_ioapic(void);
 
 u64 irq_ticks(void);
+u64 irq_ns(void);
 u32 irq_timer_hz(void);
+// arms this cpu's timer for `deadline_ns` on the irq_ns() clock, 0 stops it;
+// false when the timer is periodic
+bool irq_timer_program(u64 deadline_ns);
 
 void arch_wallclock_maintain(void);
 
@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/lock.h>
+#include <sys/tlb.h>
 #include <x86/boot.h>
 
 #if defined(__i386__)
@@ -173,6 +174,9 @@ void arch_kernel_stack_free(sched_thread_t *thread) {
     void *root = arch_vm_root(arch_vm_kernel());
 
     if (root) {
+        tlb_batch_t batch;
+        tlb_batch_init(&batch, arch_vm_kernel());
+
         for (size_t i = 0; i < pages; i++) {
             uintptr_t vaddr = base + i * PAGE_4KIB;
             page_t *entry = NULL;
@@ -183,9 +187,11 @@ void arch_kernel_stack_free(sched_thread_t *thread) {
 
             u64 paddr = arch_page_get_paddr(entry);
             unmap_page(root, vaddr);
-            arch_tlb_flush(vaddr);
-            arch_free_frames((void *)(uintptr_t)paddr, 1);
+            tlb_batch_add(&batch, vaddr, vaddr + PAGE_4KIB);
+            tlb_batch_free(&batch, (uintptr_t)paddr, 1);
         }
+
+        tlb_batch_finish(&batch);
     }
 
     unsigned long flags = spin_lock_irqsave(&kstack.lock);
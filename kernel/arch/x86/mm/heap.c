@@ -1,19 +1,15 @@
 #include "heap.h"
 
-#include <alloc/bitmap.h>
 #include <arch/arch.h>
 #include <arch/mm.h>
 #include <arch/paging.h>
 #include <base/macros.h>
 #include <base/types.h>
-#include <inttypes.h>
 #include <log/log.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
-#include <string.h>
-#include <sys/lock.h>
-#include <sys/panic.h>
+#include <sys/slab.h>
 
 #if defined(__x86_64__)
 #include "x86/paging64.h"
@@ -24,367 +20,81 @@
 
 #include "physical.h"
 
-#define HEAP_MIN (KERNEL_HEAP_PAGES / 2)
-#define HEAP_MAX (KERNEL_HEAP_PAGES * 16)
+// the slab allocator in sys/slab.c owns the heap; this file only provides the
+// page-backed arenas it carves up
 
-// the bitmap keeps early heap growth simple; a fuller VM allocator can
-// replace it once x86 has larger dynamic mappings
-
-typedef struct {
-    bitmap_allocator_t alloc;
-    size_t pages;
-    bool used;
-} heap_arena_t;
-
-typedef struct {
-    heap_arena_t arenas[KERNEL_HEAP_MAX_ARENAS];
-    size_t arena_count;
-    spinlock_t lock;
 #if defined(__i386__)
-    uintptr_t vaddr_next;
-    uintptr_t vaddr_limit;
-#endif
-} heap_state_t;
-
-static heap_state_t heap = {
-    .lock = SPINLOCK_INIT,
-};
-
-#if defined(__x86_64__)
-static uintptr_t _linear_offset(void) {
-    return LINEAR_MAP_OFFSET_64;
-}
+static uintptr_t heap_vaddr_next = 0;
+static uintptr_t heap_vaddr_limit = 0;
 #endif
 
-static size_t _blocks_for_pages(size_t pages) {
-    if (!pages) {
-        return 0;
-    }
-
-    if (pages > SIZE_MAX / PAGE_4KIB) {
-        return 0;
-    }
-
-    size_t chunk_size = pages * PAGE_4KIB;
-    size_t block_count = chunk_size / KERNEL_HEAP_BLOCK_SIZE;
-    size_t bitmap_bytes = DIV_ROUND_UP(block_count, 8);
-    size_t bitmap_blocks = DIV_ROUND_UP(bitmap_bytes, KERNEL_HEAP_BLOCK_SIZE);
-
-    if (bitmap_blocks >= block_count) {
-        return 0;
-    }
-
-    return block_count - bitmap_blocks;
-}
-
-static size_t _pages_for_blocks(size_t blocks) {
-    if (!blocks) {
-        return 0;
-    }
-
-    if (blocks > SIZE_MAX / KERNEL_HEAP_BLOCK_SIZE) {
-        return 0;
-    }
-
-    size_t pages = DIV_ROUND_UP(blocks * KERNEL_HEAP_BLOCK_SIZE, PAGE_4KIB);
-    if (!pages) {
-        pages = 1;
-    }
-
-    while (_blocks_for_pages(pages) < blocks) {
-        if (pages == SIZE_MAX) {
-            return 0;
-        }
-
-        pages++;
-    }
-
-    return pages;
-}
-
-// arenas stay mapped for the life of the kernel; free only returns bitmap blocks
-static bool _add_arena(size_t pages) {
-    if (!pages || heap.arena_count >= KERNEL_HEAP_MAX_ARENAS) {
-        return false;
-    }
-
-    if (pages > SIZE_MAX / PAGE_4KIB) {
-        return false;
-    }
-
-    size_t free_pages = pmm_free_mem() / PAGE_4KIB;
-    if (pages > free_pages) {
-        return false;
+// called with the kmem heap lock held
+void *arch_heap_map(size_t pages) {
+    if (!pages || pages > SIZE_MAX / PAGE_4KIB) {
+        return NULL;
     }
 
-    size_t chunk_size = pages * PAGE_4KIB;
-
-    void *paddr = alloc_frames(pages);
+    // the heap lock is held, so a failure must not recurse into reclaim
+    void *paddr = alloc_frames_try(pages);
     if (!paddr) {
-        return false;
+        return NULL;
     }
 
 #if defined(__i386__)
     void *root = arch_vm_root(arch_vm_kernel());
     if (!root) {
         free_frames(paddr, pages);
-        return false;
+        return NULL;
     }
 
-    if (!heap.vaddr_limit) {
+    if (!heap_vaddr_limit) {
         extern char __kernel_end;
-        heap.vaddr_next = ALIGN((uintptr_t)&__kernel_end, PAGE_4KIB);
-        heap.vaddr_limit = KSTACK_REGION_BASE_32;
+        heap_vaddr_next = ALIGN((uintptr_t)&__kernel_end, PAGE_4KIB);
+        heap_vaddr_limit = KSTACK_REGION_BASE_32;
     }
 
     size_t size = pages * PAGE_4KIB;
-    uintptr_t vaddr = heap.vaddr_next;
+    uintptr_t vaddr = heap_vaddr_next;
 
     // i386 has no full direct map, so heap arenas consume a reserved VA window
-    if (!heap.vaddr_limit || vaddr + size < vaddr || vaddr + size > heap.vaddr_limit) {
+    if (vaddr + size < vaddr || vaddr + size > heap_vaddr_limit) {
         free_frames(paddr, pages);
-        return false;
+        return NULL;
     }
 
     arch_map_region(root, pages, vaddr, (uintptr_t)paddr, PT_WRITE);
-    heap.vaddr_next = vaddr + size;
+    heap_vaddr_next = vaddr + size;
 
-    void *start = (void *)vaddr;
+    return (void *)vaddr;
 #else
-    void *start = (void *)((uintptr_t)paddr + _linear_offset());
+    return (void *)((uintptr_t)paddr + LINEAR_MAP_OFFSET_64);
 #endif
-
-    heap_arena_t *arena = &heap.arenas[heap.arena_count];
-
-    bool alloc_inited = bitmap_alloc_init(&arena->alloc, start, chunk_size, KERNEL_HEAP_BLOCK_SIZE);
-
-    if (!alloc_inited) {
-        free_frames(paddr, pages);
-        return false;
-    }
-
-    arena->pages = pages;
-    arena->used = true;
-    heap.arena_count++;
-
-    return true;
 }
 
-static bool _grow(size_t min_blocks) {
-    if (!min_blocks || heap.arena_count >= KERNEL_HEAP_MAX_ARENAS) {
-        return false;
-    }
-
-    size_t min_pages = _pages_for_blocks(min_blocks);
-    if (!min_pages) {
-        return false;
-    }
-
-    size_t grow_pages = KERNEL_HEAP_PAGES;
-
-    if (heap.arena_count) {
-        grow_pages = heap.arenas[heap.arena_count - 1].pages;
-    }
-
-    if (grow_pages < min_pages) {
-        grow_pages = min_pages;
-    }
-
-    size_t free_pages = pmm_free_mem() / PAGE_4KIB;
-
-    if (grow_pages > free_pages) {
-        grow_pages = free_pages;
-    }
-
-    if (grow_pages < min_pages) {
-        return false;
-    }
-
-    if (!_add_arena(grow_pages)) {
-        return false;
-    }
-
+// called with the kmem heap lock held
+bool arch_heap_unmap(void *start, size_t pages) {
+#if defined(__i386__)
+    // the arena VA window only ever grows, so i386 keeps its arenas
+    (void)start;
+    (void)pages;
+    return false;
+#else
+    free_frames((void *)((uintptr_t)start - LINEAR_MAP_OFFSET_64), pages);
     return true;
-}
-
-static heap_arena_t *_find_arena_by_ptr(const void *ptr) {
-    uintptr_t addr = (uintptr_t)ptr;
-
-    for (size_t i = 0; i < heap.arena_count; i++) {
-        heap_arena_t *arena = &heap.arenas[i];
-
-        if (!arena->used) {
-            continue;
-        }
-
-        uintptr_t start = (uintptr_t)arena->alloc.chunk_start;
-        uintptr_t end = start + arena->alloc.chunk_size;
-
-        if (end <= start) {
-            continue;
-        }
-
-        if (addr >= start && addr < end) {
-            return arena;
-        }
-    }
-
-    return NULL;
+#endif
 }
 
 void heap_init() {
     log_debug("kernel heap init");
-    unsigned long irq_flags = spin_lock_irqsave(&heap.lock);
-    size_t free_pages = pmm_free_mem() / PAGE_4KIB;
-
-    // aim to take ~33% of the memory for the kernel heap
-    size_t min_heap = min(free_pages, (size_t)HEAP_MIN);
-    size_t max_heap = HEAP_MAX;
-
-    size_t heap_pages = clamp(free_pages / 3, min_heap, max_heap);
-
-    if (!_add_arena(heap_pages)) {
-        spin_unlock_irqrestore(&heap.lock, irq_flags);
-        panic("Failed to initialize kernel heap");
-    }
-
-    spin_unlock_irqrestore(&heap.lock, irq_flags);
-}
-
-static void *_kmalloc(size_t size) {
-    if (!size) {
-#ifdef KMALLOC_DEBUG
-        log_warn("kmalloc requested zero bytes");
-#endif
-        return NULL;
-    }
-
-    unsigned long irq_flags = spin_lock_irqsave(&heap.lock);
-    size_t header_blocks = DIV_ROUND_UP(sizeof(kheap_header), KERNEL_HEAP_BLOCK_SIZE);
-
-    size_t blocks = DIV_ROUND_UP(size, KERNEL_HEAP_BLOCK_SIZE);
-    if (blocks > SIZE_MAX - header_blocks) {
-        spin_unlock_irqrestore(&heap.lock, irq_flags);
-        panic("kmalloc block count overflow (requested=%zu bytes)", size);
-    }
-
-    size_t total_blocks = blocks + header_blocks;
-
-    void *space = NULL;
-
-    for (size_t i = 0; i < heap.arena_count; i++) {
-        heap_arena_t *arena = &heap.arenas[i];
-
-        if (!arena->used) {
-            continue;
-        }
-
-        space = bitmap_alloc_reserve(&arena->alloc, total_blocks);
-        if (space) {
-            break;
-        }
-    }
-
-    if (!space) {
-        if (!_grow(total_blocks)) {
-            panic("kmalloc out of heap memory (requested=%zu bytes)", size);
-        }
-
-        heap_arena_t *arena = &heap.arenas[heap.arena_count - 1];
-        space = bitmap_alloc_reserve(&arena->alloc, total_blocks);
-    }
-
-    if (!space) {
-        panic("kmalloc out of heap memory after _grow (requested=%zu bytes)", size);
-    }
-
-    // write the header
-    kheap_header *header = space;
-
-    header->magic = KERNEL_HEAP_MAGIC;
-    header->size = blocks;
-
-    void *memory = (u8 *)space + sizeof(kheap_header);
-
-#ifdef KMALLOC_DEBUG
-    log_debug("kmalloc alloc bytes=%zd ptr=%#" PRIx64, size, (u64)(uintptr_t)memory);
-#endif
-
-    spin_unlock_irqrestore(&heap.lock, irq_flags);
-    return memory;
-}
-
-static void _kfree(void *ptr) {
-    if (!ptr) {
-#ifdef KMALLOC_DEBUG
-        log_warn("kmalloc free NULL pointer");
-#endif
-        return;
-    }
-
-    unsigned long irq_flags = spin_lock_irqsave(&heap.lock);
-    kheap_header *header = (kheap_header *)((u8 *)ptr - sizeof(kheap_header));
-
-    heap_arena_t *arena = _find_arena_by_ptr(header);
-    if (!arena) {
-        spin_unlock_irqrestore(&heap.lock, irq_flags);
-        panic("kfree pointer does not belong to any heap arena");
-    }
-
-    if (header->magic != KERNEL_HEAP_MAGIC) {
-        spin_unlock_irqrestore(&heap.lock, irq_flags);
-        panic("kfree invalid heap header");
-    }
-
-    size_t header_blocks = DIV_ROUND_UP(sizeof(kheap_header), KERNEL_HEAP_BLOCK_SIZE);
-
-    size_t user_blocks = header->size;
-    if (user_blocks > SIZE_MAX - header_blocks) {
-        spin_unlock_irqrestore(&heap.lock, irq_flags);
-        panic("kfree heap block count overflow");
-    }
-
-    size_t blocks = user_blocks + header_blocks;
-    if (blocks > SIZE_MAX / KERNEL_HEAP_BLOCK_SIZE) {
-        spin_unlock_irqrestore(&heap.lock, irq_flags);
-        panic("kfree heap block count overflow");
-    }
-
-    uintptr_t arena_start = (uintptr_t)arena->alloc.chunk_start;
-    uintptr_t arena_end = arena_start + arena->alloc.chunk_size;
-    uintptr_t free_end = (uintptr_t)header + blocks * KERNEL_HEAP_BLOCK_SIZE;
-
-    if (arena_end <= arena_start) {
-        spin_unlock_irqrestore(&heap.lock, irq_flags);
-        panic("kfree heap arena range is invalid");
-    }
-
-    if (free_end < (uintptr_t)header || free_end > arena_end) {
-        spin_unlock_irqrestore(&heap.lock, irq_flags);
-        panic("kfree heap block range is invalid");
-    }
-
-    header->magic = 0;
-
-    if (!bitmap_alloc_free(&arena->alloc, header, blocks)) {
-        spin_unlock_irqrestore(&heap.lock, irq_flags);
-        panic("kfree bitmap metadata rejected pointer");
-    }
-
-#ifdef KMALLOC_DEBUG
-    size_t size = user_blocks * KERNEL_HEAP_BLOCK_SIZE;
-    log_debug("kmalloc free bytes=%zd ptr=%#" PRIx64, size, (u64)(uintptr_t)ptr);
-#endif
-
-    spin_unlock_irqrestore(&heap.lock, irq_flags);
+    kmem_init();
 }
 
 void arch_init_alloc() {
     log_debug("kernel malloc init");
 
     libc_alloc_ops_t ops = {
-        .malloc_fn = _kmalloc,
-        .free_fn = _kfree,
+        .malloc_fn = kmalloc,
+        .free_fn = kfree,
     };
     __libc_init_alloc(&ops);
 }
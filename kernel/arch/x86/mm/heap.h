@@ -1,15 +1,6 @@
 #pragma once
 
-#include <base/attributes.h>
 #include <base/types.h>
-#include <sys/config.h>
-
-#define KERNEL_HEAP_MAGIC 0xA110ca7e
-
-typedef struct PACKED {
-    u32 magic; // 4 bytes = 8 hex digits
-    u32 size; // size in blocks
-} kheap_header;
 
 
 void heap_init(void);
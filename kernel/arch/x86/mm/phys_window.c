@@ -129,28 +129,27 @@ static page_t *_get_root(void) {
     return (page_t *)(uintptr_t)(cr3 & ADDR_MASK);
 }
 
-static void _map_window_page(u64 vaddr, u64 paddr, u64 flags) {
-    map_page(_get_root(), PAGE_4KIB, vaddr, paddr, flags);
-}
+// the window base is 2MiB aligned, so aligned spans (framebuffers) get large leaves
+static void _map_window_range(u64 paddr, size_t pages, u64 flags) {
+    page_t *root = _get_root();
 
-static void _clear_window_page(u64 vaddr) {
-    unmap_page(_get_root(), vaddr);
-}
+    map_region(root, pages, PHYS_WINDOW_BASE_64, paddr, flags);
 
-static void _clear_window_range(size_t pages) {
     for (size_t i = 0; i < pages; i++) {
-        _clear_window_page(PHYS_WINDOW_BASE_64 + i * PAGE_4KIB);
+        tlb_flush(PHYS_WINDOW_BASE_64 + i * PAGE_4KIB);
     }
 }
 
+static void _clear_window_range(size_t pages) {
+    unmap_region(_get_root(), pages, PHYS_WINDOW_BASE_64);
+}
+
 static void _restore_window(window_map_t prev) {
     window.pages_mapped = prev.pages;
     window.paddr_base = prev.paddr_base;
     window.flags = prev.flags;
 
-    for (size_t i = 0; i < prev.pages; i++) {
-        _map_window_page(PHYS_WINDOW_BASE_64 + i * PAGE_4KIB, prev.paddr_base + i * PAGE_4KIB, prev.flags);
-    }
+    _map_window_range(prev.paddr_base, prev.pages, prev.flags);
 }
 
 void *arch_phys_map(u64 paddr, size_t size, u32 flags) {
@@ -202,9 +201,7 @@ void *arch_phys_map(u64 paddr, size_t size, u32 flags) {
 
     window.flags = pt_flags;
 
-    for (size_t i = 0; i < pages; i++) {
-        _map_window_page(PHYS_WINDOW_BASE_64 + i * PAGE_4KIB, start + i * PAGE_4KIB, pt_flags);
-    }
+    _map_window_range(start, pages, pt_flags);
 
     return (void *)(uintptr_t)(PHYS_WINDOW_BASE_64 + (paddr - start));
 }
@@ -10,8 +10,10 @@ size_t pmm_total_mem(void);
 size_t pmm_free_mem(void);
 
 void *alloc_frames(size_t count);
+void *alloc_frames_try(size_t count);
 void *alloc_frames_high(size_t count);
 void *alloc_frames_user(size_t count);
+void *alloc_frames_user_aligned(size_t count, size_t align);
 void free_frames(void *ptr, size_t size);
 
 void pmm_ref_init(void);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <base/types.h>
+#include <stdbool.h>
 #include <stddef.h>
 
 #if defined(__x86_64__)
@@ -11,6 +12,11 @@
 
 void map_page(page_t *lvl4_paddr, size_t size, u64 vaddr, u64 paddr, u64 flags);
 void unmap_page(page_t *lvl4_paddr, u64 vaddr);
+void unmap_region(page_t *lvl4_paddr, size_t pages, u64 vaddr);
+bool split_page(page_t *lvl4_paddr, u64 vaddr);
+
+// replace the 4KiB leaf for vaddr with a swap entry, building missing tables with `flags`
+void set_swap_page(page_t *lvl4_paddr, u64 vaddr, u64 slot, u64 flags);
 
 void map_region(page_t *lvl4_paddr, size_t pages, u64 vaddr, u64 paddr, u64 flags);
 void identity_map(page_t *lvl4_paddr, u64 from, u64 to, u64 map_offset, u64 flags, bool remap);
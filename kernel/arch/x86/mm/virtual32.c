@@ -105,14 +105,85 @@ void map_page(page_t *pdpt, size_t size, u64 vaddr, u64 paddr, u64 flags) {
     tlb_flush(vaddr32);
 }
 
+bool split_page(page_t *pdpt, u64 vaddr) {
+    page_t *entry = NULL;
+    size_t size = get_page(pdpt, vaddr, &entry);
+
+    if (!entry) {
+        return false;
+    }
+
+    if (size == PAGE_2MIB) {
+        u32 vaddr32 = (u32)vaddr;
+        page_t *pd = entry - GET_LVL2_INDEX(vaddr32);
+
+        _split_huge_pd(pd, GET_LVL2_INDEX(vaddr32), 0);
+        tlb_flush(vaddr32);
+    }
+
+    return true;
+}
+
+// the 4KiB leaf for vaddr when it holds a swap entry
+static page_t *_swap_leaf(page_t *pdpt, u64 vaddr) {
+    u32 vaddr32 = (u32)vaddr;
+
+    if (!pdpt || !(pdpt[GET_LVL3_INDEX(vaddr32)] & PT_PRESENT)) {
+        return NULL;
+    }
+
+    page_t *pd = (page_t *)(uintptr_t)page_get_paddr(&pdpt[GET_LVL3_INDEX(vaddr32)]);
+    page_t pde = pd[GET_LVL2_INDEX(vaddr32)];
+
+    if (!(pde & PT_PRESENT) || (pde & PT_HUGE)) {
+        return NULL;
+    }
+
+    page_t *pt = (page_t *)(uintptr_t)page_get_paddr(&pde);
+    page_t *entry = &pt[GET_LVL1_INDEX(vaddr32)];
+
+    return page_is_swap(*entry) ? entry : NULL;
+}
+
+void set_swap_page(page_t *pdpt, u64 vaddr, u64 slot, u64 flags) {
+    if (!pdpt) {
+        return;
+    }
+
+    u32 vaddr32 = (u32)vaddr;
+
+    page_t *pd = _walk_pdpt(pdpt, GET_LVL3_INDEX(vaddr32), flags);
+    page_t *pt = _walk_pd(pd, GET_LVL2_INDEX(vaddr32), flags);
+
+    pt[GET_LVL1_INDEX(vaddr32)] = page_swap_entry(slot);
+    tlb_flush(vaddr32);
+}
+
 void unmap_page(page_t *pdpt, u64 vaddr) {
     page_t *page = NULL;
 
-    get_page(pdpt, vaddr, &page);
+    // a 4KiB unmap inside a large PDE only drops that one page
+    if (get_page(pdpt, vaddr, &page) == PAGE_2MIB) {
+        split_page(pdpt, vaddr);
+        get_page(pdpt, vaddr, &page);
+    }
 
     if (page) {
         *page = 0;
         tlb_flush((u32)vaddr);
+        return;
+    }
+
+    // a swapped out leaf is not present but still holds its slot
+    page = _swap_leaf(pdpt, vaddr);
+    if (page) {
+        *page = 0;
+    }
+}
+
+void unmap_region(page_t *pdpt, size_t pages, u64 vaddr) {
+    for (size_t i = 0; i < pages; i++) {
+        unmap_page(pdpt, vaddr + i * PAGE_4KIB);
     }
 }
 
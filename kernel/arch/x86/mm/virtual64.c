@@ -11,10 +11,52 @@
 #include "x86/asm.h"
 #include "x86/boot.h"
 
+// large leaves keep their PAT selector in bit 12 since bit 7 doubles as PT_HUGE
+static u64 _huge_flags(u64 flags) {
+    u64 pat = (flags & PT_PAT_4K) ? PT_PAT_HUGE : 0;
+    return (flags & ~PT_PAT_4K) | PT_HUGE | pat;
+}
+
+// replace a large leaf with a table of `child_size` leaves that map the same range
+static page_t *_split_huge(page_t *table, size_t index, size_t child_size) {
+    page_t huge = table[index];
+    u64 base = ALIGN_DOWN(huge & ADDR_MASK & ~PT_PAT_HUGE, child_size * 512);
+    u64 child_flags = huge & FLAGS_MASK;
+
+    if (child_size == PAGE_4KIB) {
+        child_flags &= ~PT_HUGE;
+
+        if (huge & PT_PAT_HUGE) {
+            child_flags |= PT_PAT_4K;
+        }
+    } else {
+        child_flags |= huge & PT_PAT_HUGE;
+    }
+
+    page_t *next_table = alloc_frames(1);
+    page_t *next = (page_t *)((uintptr_t)next_table + LINEAR_MAP_OFFSET_64);
+
+    for (size_t i = 0; i < 512; i++) {
+        page_set_paddr(&next[i], base + i * child_size);
+        next[i] |= child_flags;
+    }
+
+    page_t parent = 0;
+    page_set_paddr(&parent, (u64)(uintptr_t)next_table);
+    parent |= PT_PRESENT | PT_WRITE | (huge & PT_USER);
+
+    table[index] = parent;
+    return next;
+}
+
 // locate the requested index in the child table, allocate if it doesn't exist
-static page_t *_walk_table_once(page_t *table, size_t index, u64 flags) {
+static page_t *_walk_table_once(page_t *table, size_t index, u64 flags, size_t child_size) {
     page_t *next_table;
 
+    if ((table[index] & PT_PRESENT) && (table[index] & PT_HUGE)) {
+        _split_huge(table, index, child_size);
+    }
+
     if (table[index] & PT_PRESENT) {
         next_table = (page_t *)(uintptr_t)page_get_paddr(&table[index]);
     } else {
@@ -25,7 +67,7 @@ static page_t *_walk_table_once(page_t *table, size_t index, u64 flags) {
         table[index] |= PT_PRESENT;
     }
 
-    table[index] |= flags & FLAGS_MASK;
+    table[index] |= flags & FLAGS_MASK & ~PT_HUGE;
     table[index] |= PT_WRITE;
     table[index] &= ~PT_NO_EXECUTE;
 
@@ -37,7 +79,7 @@ void map_page(page_t *lvl4_paddr, size_t size, u64 vaddr, u64 paddr, u64 flags)
     page_t *lvl4 = (page_t *)((uintptr_t)lvl4_paddr + LINEAR_MAP_OFFSET_64);
 
     size_t lvl3_index = GET_LVL3_INDEX(vaddr);
-    page_t *lvl3 = _walk_table_once(lvl4, lvl4_index, flags);
+    page_t *lvl3 = _walk_table_once(lvl4, lvl4_index, flags, PAGE_1GIB);
 
     page_t *entry;
 
@@ -45,50 +87,194 @@ void map_page(page_t *lvl4_paddr, size_t size, u64 vaddr, u64 paddr, u64 flags)
         entry = &lvl3[lvl3_index];
 
         paddr = ALIGN_DOWN(paddr, PAGE_1GIB);
-        flags |= PT_HUGE;
+        flags = _huge_flags(flags);
         goto finalize;
     }
 
     size_t lvl2_index = GET_LVL2_INDEX(vaddr);
-    page_t *lvl2 = _walk_table_once(lvl3, lvl3_index, flags);
+    page_t *lvl2 = _walk_table_once(lvl3, lvl3_index, flags, PAGE_2MIB);
 
     if (size == PAGE_2MIB) {
         entry = &lvl2[lvl2_index];
 
         paddr = ALIGN_DOWN(paddr, PAGE_2MIB);
-        flags |= PT_HUGE;
+        flags = _huge_flags(flags);
         goto finalize;
     }
 
     size_t lvl1_index = GET_LVL1_INDEX(vaddr);
-    page_t *lvl1 = _walk_table_once(lvl2, lvl2_index, flags);
+    page_t *lvl1 = _walk_table_once(lvl2, lvl2_index, flags, PAGE_4KIB);
 
     entry = &lvl1[lvl1_index];
 
 finalize:
     page_set_paddr(entry, paddr);
 
+    // the higher half is shared by every root, so its leaves can outlive PCID switches
+    if (vaddr >> 63) {
+        flags |= PT_GLOBAL;
+    }
+
     flags |= PT_PRESENT; // present is required for every mapped leaf
-    *entry |= flags & FLAGS_MASK;
+    *entry |= (flags & FLAGS_MASK) | (flags & PT_PAT_HUGE);
+}
+
+bool split_page(page_t *lvl4_paddr, u64 vaddr) {
+    page_t *entry = NULL;
+    size_t size = get_page(lvl4_paddr, vaddr, &entry);
+
+    if (!entry) {
+        return false;
+    }
+
+    if (size == PAGE_1GIB) {
+        page_t *lvl3 = entry - GET_LVL3_INDEX(vaddr);
+        _split_huge(lvl3, GET_LVL3_INDEX(vaddr), PAGE_2MIB);
+        size = get_page(lvl4_paddr, vaddr, &entry);
+    }
+
+    if (size == PAGE_2MIB) {
+        page_t *lvl2 = entry - GET_LVL2_INDEX(vaddr);
+        _split_huge(lvl2, GET_LVL2_INDEX(vaddr), PAGE_4KIB);
+        size = get_page(lvl4_paddr, vaddr, &entry);
+    }
+
+    // the old large TLB entry still translates correctly but must not linger
+    tlb_flush(vaddr);
+
+    return size == PAGE_4KIB;
+}
+
+// the 4KiB leaf for vaddr when it holds a swap entry
+static page_t *_swap_leaf(page_t *lvl4_paddr, u64 vaddr) {
+    if (!lvl4_paddr) {
+        return NULL;
+    }
+
+    page_t *lvl4 = (page_t *)((uintptr_t)lvl4_paddr + LINEAR_MAP_OFFSET_64);
+    page_t lvl4e = lvl4[GET_LVL4_INDEX(vaddr)];
+    if (!(lvl4e & PT_PRESENT) || (lvl4e & PT_HUGE)) {
+        return NULL;
+    }
+
+    page_t *lvl3 = page_get_vaddr(&lvl4e);
+    page_t lvl3e = lvl3[GET_LVL3_INDEX(vaddr)];
+    if (!(lvl3e & PT_PRESENT) || (lvl3e & PT_HUGE)) {
+        return NULL;
+    }
+
+    page_t *lvl2 = page_get_vaddr(&lvl3e);
+    page_t lvl2e = lvl2[GET_LVL2_INDEX(vaddr)];
+    if (!(lvl2e & PT_PRESENT) || (lvl2e & PT_HUGE)) {
+        return NULL;
+    }
+
+    page_t *lvl1 = page_get_vaddr(&lvl2e);
+    page_t *entry = &lvl1[GET_LVL1_INDEX(vaddr)];
+
+    return page_is_swap(*entry) ? entry : NULL;
+}
+
+void set_swap_page(page_t *lvl4_paddr, u64 vaddr, u64 slot, u64 flags) {
+    page_t *lvl4 = (page_t *)((uintptr_t)lvl4_paddr + LINEAR_MAP_OFFSET_64);
+
+    page_t *lvl3 = _walk_table_once(lvl4, GET_LVL4_INDEX(vaddr), flags, PAGE_1GIB);
+    page_t *lvl2 = _walk_table_once(lvl3, GET_LVL3_INDEX(vaddr), flags, PAGE_2MIB);
+    page_t *lvl1 = _walk_table_once(lvl2, GET_LVL2_INDEX(vaddr), flags, PAGE_4KIB);
+
+    lvl1[GET_LVL1_INDEX(vaddr)] = page_swap_entry(slot);
+    tlb_flush(vaddr);
 }
 
 void unmap_page(page_t *lvl4_paddr, u64 vaddr) {
     page_t *page = NULL;
 
-    get_page(lvl4_paddr, vaddr, &page);
+    // a 4KiB unmap inside a large leaf only drops that one page
+    size_t size = get_page(lvl4_paddr, vaddr, &page);
+    if (page && size != PAGE_4KIB) {
+        split_page(lvl4_paddr, vaddr);
+        get_page(lvl4_paddr, vaddr, &page);
+    }
 
     if (page) {
         *page = 0;
         tlb_flush(vaddr);
+        return;
+    }
+
+    // a swapped out leaf is not present but still holds its slot
+    page = _swap_leaf(lvl4_paddr, vaddr);
+    if (page) {
+        *page = 0;
+    }
+}
+
+void unmap_region(page_t *lvl4_paddr, size_t pages, u64 vaddr) {
+    size_t i = 0;
+
+    while (i < pages) {
+        u64 page_vaddr = vaddr + i * PAGE_4KIB;
+        page_t *entry = NULL;
+        size_t size = get_page(lvl4_paddr, page_vaddr, &entry);
+
+        bool whole = size == PAGE_2MIB && !(page_vaddr & (PAGE_2MIB - 1)) && pages - i >= PAGE_2MIB / PAGE_4KIB;
+
+        if (entry && whole) {
+            *entry = 0;
+            tlb_flush(page_vaddr);
+            i += PAGE_2MIB / PAGE_4KIB;
+            continue;
+        }
+
+        unmap_page(lvl4_paddr, page_vaddr);
+        i++;
     }
 }
 
+// a 2MiB leaf may only replace an empty slot; live page tables are never dropped here
+static bool _huge_slot_free(page_t *lvl4_paddr, u64 vaddr) {
+    page_t *lvl4 = (page_t *)((uintptr_t)lvl4_paddr + LINEAR_MAP_OFFSET_64);
+    page_t lvl4e = lvl4[GET_LVL4_INDEX(vaddr)];
+
+    if (!(lvl4e & PT_PRESENT)) {
+        return true;
+    }
+
+    page_t *lvl3 = page_get_vaddr(&lvl4e);
+    page_t lvl3e = lvl3[GET_LVL3_INDEX(vaddr)];
+
+    if (!(lvl3e & PT_PRESENT)) {
+        return true;
+    }
+
+    if (lvl3e & PT_HUGE) {
+        return false;
+    }
+
+    page_t *lvl2 = page_get_vaddr(&lvl3e);
+    page_t lvl2e = lvl2[GET_LVL2_INDEX(vaddr)];
+
+    return !(lvl2e & PT_PRESENT) || (lvl2e & PT_HUGE);
+}
+
 void map_region(page_t *lvl4_paddr, size_t pages, u64 vaddr, u64 paddr, u64 flags) {
-    for (size_t i = 0; i < pages; i++) {
+    size_t i = 0;
+
+    while (i < pages) {
         u64 page_vaddr = vaddr + i * PAGE_4KIB;
         u64 page_paddr = paddr + i * PAGE_4KIB;
 
+        bool aligned = !((page_vaddr | page_paddr) & (PAGE_2MIB - 1));
+        bool fits = pages - i >= PAGE_2MIB / PAGE_4KIB;
+
+        if (aligned && fits && _huge_slot_free(lvl4_paddr, page_vaddr)) {
+            map_page(lvl4_paddr, PAGE_2MIB, page_vaddr, page_paddr, flags);
+            i += PAGE_2MIB / PAGE_4KIB;
+            continue;
+        }
+
         map_page(lvl4_paddr, PAGE_4KIB, page_vaddr, page_paddr, flags);
+        i++;
     }
 }
 
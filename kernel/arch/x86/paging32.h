@@ -41,6 +41,21 @@ typedef u64 page_t;
 #define PT_PAT_HUGE      (1ULL << 12)
 #define PT_NO_EXECUTE    (1ULL << 63)
 
+// software bit: a non-present leaf with it set holds a swap slot in the address field
+#define PT_SWAP (1 << 9)
+
+static inline page_t page_swap_entry(u64 slot) {
+    return ((page_t)slot << 12 & ADDR_MASK) | PT_SWAP;
+}
+
+static inline bool page_is_swap(page_t entry) {
+    return (entry & (PT_PRESENT | PT_SWAP)) == PT_SWAP;
+}
+
+static inline u64 page_swap_slot(page_t entry) {
+    return (entry & ADDR_MASK) >> 12;
+}
+
 static inline page_t page_get_paddr(page_t *page) {
     return *page & ADDR_MASK;
 }
@@ -55,7 +55,7 @@ bool arch_setup_signal_stack(sched_thread_t *thread, arch_int_state_t *state, si
     rsp -= 128;
     rsp -= sizeof(u64);
 
-    u64 trampoline = (u64)thread->signal_trampoline;
+    u64 trampoline = (u64)sched_group(thread)->signal_trampoline;
 
     if (!_write_user(thread, (uintptr_t)rsp, &trampoline, sizeof(trampoline))) {
         return false;
@@ -70,7 +70,7 @@ bool arch_setup_signal_stack(sched_thread_t *thread, arch_int_state_t *state, si
         return false;
 
     esp -= 2 * sizeof(u32);
-    u32 trampoline = (u32)thread->signal_trampoline;
+    u32 trampoline = (u32)sched_group(thread)->signal_trampoline;
     u32 sig = (u32)signum;
 
     if (!_write_user(thread, (uintptr_t)esp, &trampoline, sizeof(trampoline)))
@@ -17,6 +17,7 @@
 #include <x86/idt.h>
 #include <x86/irq.h>
 #include <x86/tsc.h>
+#include <x86/vm.h>
 
 #define AP_STACK_SIZE        (16 * 1024)
 #define AP_START_TIMEOUT_MS  250
@@ -34,7 +35,8 @@ typedef struct {
     volatile u8 ap_ready[MAX_CORES];
 
     spinlock_t tlb_lock;
-    volatile uintptr_t tlb_addr;
+    volatile uintptr_t tlb_start;
+    volatile uintptr_t tlb_end;
     volatile u64 tlb_targets ALIGNED(8);
     volatile u64 tlb_seq ALIGNED(8);
     volatile u64 tlb_seen[TLB_MAX_TARGETS] ALIGNED(8);
@@ -149,6 +151,7 @@ NORETURN static void _smp_ap_entry(void *arg) {
     cpu_set_current(core);
     _fpu_enable_local();
     pat_init();
+    vm_init_cpu();
 
     gdt_init();
     tss_init(_read_stack_ptr());
@@ -208,8 +211,9 @@ static void _patch_trampoline(void *trampoline_base, const cpu_core_t *core) {
     size_t off_stack = _trampoline_offset(&smp_trampoline64_stack);
 
     _write32(trampoline_base, off_cr0, (u32)read_cr0());
-    _write32(trampoline_base, off_cr4, (u32)read_cr4());
-    _write32(trampoline_base, off_cr3, (u32)read_cr3());
+    // PCIDE needs long mode, the AP turns it on itself in vm_init_cpu
+    _write32(trampoline_base, off_cr4, (u32)(read_cr4() & ~(u64)CR4_PCIDE));
+    _write32(trampoline_base, off_cr3, (u32)(read_cr3() & ~0xfffULL));
     _write32(trampoline_base, off_efer, (u32)read_msr(EFER_MSR));
     _write64(trampoline_base, off_entry, (u64)(uintptr_t)_smp_ap_entry);
     _write64(trampoline_base, off_arg, (u64)core->id);
@@ -287,13 +291,10 @@ static void service_tlb_local(void) {
         return;
     }
 
-    uintptr_t addr = __atomic_load_n(&smp.tlb_addr, __ATOMIC_ACQUIRE);
+    uintptr_t start = __atomic_load_n(&smp.tlb_start, __ATOMIC_ACQUIRE);
+    uintptr_t end = __atomic_load_n(&smp.tlb_end, __ATOMIC_ACQUIRE);
 
-#if defined(__x86_64__)
-    tlb_flush((u64)addr);
-#else
-    tlb_flush((u32)addr);
-#endif
+    vm_tlb_flush_local(start, end);
 
     // Never let a delayed request overwrite a newer acknowledgement.
     while (seen < seq) {
@@ -326,6 +327,124 @@ void smp_set_boot_info(const boot_info_t *info) {
     smp.boot_info = info;
 }
 
+// bits of the apic id needed to number `count` things
+static u32 _id_bits(u32 count) {
+    u32 bits = 0;
+
+    while (bits < 32 && (1ULL << bits) < count) {
+        bits++;
+    }
+
+    return bits;
+}
+
+// leaves 0x1f and 0xb list the levels bottom up, each with how far the apic
+// id shifts to leave it; the last one left is the package
+static bool _topology_leaf(u32 leaf, u32 *smt_shift, u32 *pkg_shift) {
+    cpuid_regs_t regs = { 0 };
+    bool found = false;
+
+    for (u32 sub = 0; sub < 8; sub++) {
+        cpuid_count(leaf, sub, &regs);
+
+        u32 type = (regs.ecx >> 8) & 0xffU;
+        if (!type || (!sub && !regs.ebx)) {
+            break;
+        }
+
+        u32 shift = regs.eax & 0x1fU;
+        if (type == 1) {
+            *smt_shift = shift;
+        }
+
+        *pkg_shift = shift;
+        found = true;
+    }
+
+    return found;
+}
+
+// cache leaves say how many logical cpus share each cache, the last level
+// one decides the cache domain
+static bool _llc_leaf(u32 leaf, u32 *llc_shift) {
+    cpuid_regs_t regs = { 0 };
+    u32 best_level = 0;
+
+    for (u32 sub = 0; sub < 16; sub++) {
+        cpuid_count(leaf, sub, &regs);
+
+        if (!(regs.eax & 0x1fU)) {
+            break;
+        }
+
+        u32 level = (regs.eax >> 5) & 0x7U;
+        if (level >= best_level) {
+            best_level = level;
+            *llc_shift = _id_bits(((regs.eax >> 14) & 0xfffU) + 1);
+        }
+    }
+
+    return best_level != 0;
+}
+
+// the apic id packs package, core and smt thread; the bsp's layout stands in
+// for every cpu since mixed packages are not supported anyway
+void smp_topology_init(void) {
+    cpuid_regs_t regs = { 0 };
+    cpuid(0, &regs);
+    u32 max_leaf = regs.eax;
+
+    cpuid(0x80000000, &regs);
+    u32 max_ext = regs.eax;
+
+    u32 smt_shift = 0;
+    u32 pkg_shift = 0;
+    bool found = (max_leaf >= 0x1f && _topology_leaf(0x1f, &smt_shift, &pkg_shift)) ||
+                 (max_leaf >= 0xb && _topology_leaf(0xb, &smt_shift, &pkg_shift));
+
+    if (!found) {
+        cpuid(1, &regs);
+
+        u32 logical = (regs.edx & (1U << 28)) ? (regs.ebx >> 16) & 0xffU : 1;
+        u32 cores = 1;
+
+        if (max_leaf >= 4) {
+            cpuid_count(4, 0, &regs);
+            cores = (regs.eax & 0x1fU) ? (regs.eax >> 26) + 1 : 1;
+        }
+
+        u32 core_bits = _id_bits(cores);
+
+        pkg_shift = _id_bits(logical);
+        smt_shift = core_bits < pkg_shift ? pkg_shift - core_bits : 0;
+    }
+
+    u32 llc_shift = pkg_shift;
+    if (!(max_leaf >= 4 && _llc_leaf(4, &llc_shift)) && max_ext >= 0x8000001d) {
+        _llc_leaf(0x8000001d, &llc_shift);
+    }
+
+    for (size_t i = 0; i < core_count && i < MAX_CORES; i++) {
+        cpu_core_t *core = &cores_local[i];
+        u64 apic_id = core->lapic_id;
+
+        if (!core->valid) {
+            continue;
+        }
+
+        core->package_id = (u32)(apic_id >> pkg_shift);
+        core->core_id = (u32)(apic_id >> smt_shift);
+        core->llc_id = (u32)(apic_id >> llc_shift);
+    }
+
+    log_debug(
+        "cpu topology: smt bits %u, llc bits %u, package bits %u",
+        (unsigned int)smt_shift,
+        (unsigned int)llc_shift,
+        (unsigned int)pkg_shift
+    );
+}
+
 size_t smp_online_count(void) {
     return __atomic_load_n(&core_online_count, __ATOMIC_ACQUIRE);
 }
@@ -433,13 +552,13 @@ bool smp_send_resched(size_t core_id) {
     return lapic_send_fixed(target->lapic_id, SMP_IPI_RESCHED_VECTOR);
 }
 
-static u64 tlb_targets(cpu_core_t *self) {
+static u64 tlb_targets(cpu_core_t *self, u64 mask) {
     u64 targets = 0;
 
     for (size_t i = 0; i < core_count && i < TLB_MAX_TARGETS; i++) {
         cpu_core_t *core = &cores_local[i];
 
-        if (!core->valid || !core->online || i == self->id) {
+        if (!core->valid || !core->online || i == self->id || !(mask & (1ULL << i))) {
             continue;
         }
 
@@ -535,8 +654,9 @@ static void lock_tlb(void) {
     }
 }
 
-void smp_tlb_shootdown(uintptr_t addr) {
-    if (!sched_is_running()) {
+// invalidate [start, end) on the CPUs in `mask` with a single IPI round
+void smp_tlb_shootdown(uintptr_t start, uintptr_t end, u64 mask) {
+    if (!sched_is_running() || start >= end || !mask) {
         return;
     }
 
@@ -553,7 +673,7 @@ void smp_tlb_shootdown(uintptr_t addr) {
     lock_tlb();
     unsigned long irq_flags = arch_irq_save();
 
-    u64 targets = tlb_targets(self);
+    u64 targets = tlb_targets(self, mask);
     if (!targets) {
         spin_unlock(&smp.tlb_lock);
         arch_irq_restore(irq_flags);
@@ -561,7 +681,8 @@ void smp_tlb_shootdown(uintptr_t addr) {
         return;
     }
 
-    __atomic_store_n(&smp.tlb_addr, addr, __ATOMIC_RELEASE);
+    __atomic_store_n(&smp.tlb_start, start, __ATOMIC_RELEASE);
+    __atomic_store_n(&smp.tlb_end, end, __ATOMIC_RELEASE);
     __atomic_store_n(&smp.tlb_targets, targets, __ATOMIC_RELEASE);
     u64 seq = __atomic_load_n(&smp.tlb_seq, __ATOMIC_RELAXED) + 1;
     if (!seq) {
@@ -576,7 +697,8 @@ void smp_tlb_shootdown(uintptr_t addr) {
     wait_tlb_seen(self, targets, seq);
 
     __atomic_store_n(&smp.tlb_targets, 0, __ATOMIC_RELEASE);
-    __atomic_store_n(&smp.tlb_addr, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&smp.tlb_start, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&smp.tlb_end, 0, __ATOMIC_RELEASE);
 
     spin_unlock(&smp.tlb_lock);
     arch_irq_restore(irq_flags);
@@ -9,6 +9,7 @@
 
 void smp_set_boot_info(const boot_info_t *info);
 void smp_init(void);
-void smp_tlb_shootdown(uintptr_t addr);
+void smp_topology_init(void);
+void smp_tlb_shootdown(uintptr_t start, uintptr_t end, u64 mask);
 bool smp_send_resched(size_t core_id);
 size_t smp_online_count(void);
@@ -2,10 +2,13 @@
 #include <base/macros.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/cpu.h>
 #include <x86/asm.h>
 #include <x86/boot.h>
 #include <x86/mm/physical.h>
 #include <x86/mm/virtual.h>
+#include <x86/smp.h>
+#include <x86/vm.h>
 
 #if defined(__x86_64__)
 #include <x86/paging64.h>
@@ -13,11 +16,51 @@
 #include <x86/paging32.h>
 #endif
 
+// past this many pages one full flush is cheaper than an invlpg per page
+#define TLB_FLUSH_ALL_PAGES 32
+
+#define CPUID_FEAT_ECX_PCID     (1U << 17)
+#define CPUID_EXT_FEATURES      0x00000007
+#define CPUID_EXT_EBX_INVPCID   (1U << 10)
+
+// PCID 0 belongs to the kernel root, user spaces rotate through the next few per CPU
+#define PCID_SLOTS  6
+#define CR3_NOFLUSH (1ULL << 63)
+
 struct arch_vm_space {
     page_t *root;
+    volatile u64 active_cpus; // CPUs that currently have this root loaded
+    u64 ctx_id;               // never reused, unlike the struct address
+    volatile u64 tlb_gen;     // bumped by every flush of this space
 };
 
+typedef struct {
+    u64 ctx_id;
+    u64 tlb_gen; // generation of the space the cached entries are current with
+} pcid_slot_t;
+
+typedef struct {
+    arch_vm_space_t *current;
+    size_t current_slot;
+    size_t next_slot;
+    pcid_slot_t slots[PCID_SLOTS];
+} vm_cpu_t;
+
+typedef struct {
+    bool probed;
+    bool pcid;
+    bool invpcid;
+    volatile u64 next_ctx_id;
+    vm_cpu_t cpus[MAX_CORES];
+} vm_state_t;
+
 static struct arch_vm_space kernel_space = { 0 };
+static vm_state_t vm = { .next_ctx_id = 1 };
+
+static size_t _cpu_id(void) {
+    cpu_core_t *core = cpu_current();
+    return (core && core->id < MAX_CORES) ? core->id : 0;
+}
 
 #if defined(__x86_64__)
 static void *_phys_map(page_t *paddr) {
@@ -131,6 +174,10 @@ arch_vm_space_t *arch_vm_create_user(void) {
         return NULL;
     }
 
+    space->active_cpus = 0;
+    space->ctx_id = __atomic_fetch_add(&vm.next_ctx_id, 1, __ATOMIC_RELAXED);
+    space->tlb_gen = 0;
+
     page_t *kernel_root = arch_vm_kernel()->root;
 
 #if defined(__x86_64__)
@@ -233,20 +280,190 @@ void arch_vm_destroy(arch_vm_space_t *space) {
     _free_tables_32(space->root);
 #endif
 
+    // stale PCID slots are harmless, the ctx_id they hold never comes back
+    for (size_t cpu = 0; cpu < MAX_CORES; cpu++) {
+        if (vm.cpus[cpu].current == space) {
+            vm.cpus[cpu].current = NULL;
+        }
+    }
+
     free_frames(space->root, 1);
     free(space);
 }
 
+#if defined(__x86_64__)
+static bool _kernel_addr(uintptr_t addr) {
+    return (addr >> 63) != 0;
+}
+
+// picks the PCID for `space` on this CPU, the entries it still holds are
+// kept only if no flush of the space happened since they were loaded
+static u64 _switch_cr3(vm_cpu_t *cpu, arch_vm_space_t *space, bool reload) {
+    u64 cr3 = (u64)(uintptr_t)space->root;
+
+    if (!vm.pcid || space == &kernel_space) {
+        cpu->current_slot = 0;
+        return cr3;
+    }
+
+    u64 gen = __atomic_load_n(&space->tlb_gen, __ATOMIC_SEQ_CST);
+    size_t slot = PCID_SLOTS;
+
+    for (size_t i = 0; i < PCID_SLOTS; i++) {
+        if (cpu->slots[i].ctx_id == space->ctx_id) {
+            slot = i;
+            break;
+        }
+    }
+
+    bool keep = slot < PCID_SLOTS && cpu->slots[slot].tlb_gen == gen && !reload;
+
+    if (slot == PCID_SLOTS) {
+        slot = cpu->next_slot;
+        cpu->next_slot = (slot + 1) % PCID_SLOTS;
+        cpu->slots[slot].ctx_id = space->ctx_id;
+    }
+
+    cpu->slots[slot].tlb_gen = gen;
+    cpu->current_slot = slot + 1;
+    cr3 |= slot + 1;
+
+    return keep ? (cr3 | CR3_NOFLUSH) : cr3;
+}
+#endif
+
+void vm_init_cpu(void) {
+#if defined(__x86_64__)
+    // the boot CPU decides, the rest follow so every CPU tags the same way
+    if (!vm.probed) {
+        cpuid_regs_t regs = { 0 };
+        cpuid(0, &regs);
+        u32 max_leaf = regs.eax;
+
+        vm.probed = true;
+        cpuid(1, &regs);
+        vm.pcid = (regs.ecx & CPUID_FEAT_ECX_PCID) != 0;
+
+        if (vm.pcid && max_leaf >= CPUID_EXT_FEATURES) {
+            cpuid(CPUID_EXT_FEATURES, &regs);
+            vm.invpcid = (regs.ebx & CPUID_EXT_EBX_INVPCID) != 0;
+        }
+    }
+
+    // kernel leaves are global so they survive switches between PCIDs
+    u64 cr4 = read_cr4() | CR4_PGE;
+
+    if (vm.pcid) {
+        // PCIDE can only be set while CR3 selects PCID 0
+        write_cr3(read_cr3() & ~0xfffULL);
+        cr4 |= CR4_PCIDE;
+    }
+
+    write_cr4(cr4);
+#endif
+}
+
+// invalidate [start, end) on this CPU only
+void vm_tlb_flush_local(uintptr_t start, uintptr_t end) {
+    if (end <= start) {
+        return;
+    }
+
+    // invlpg also drops global entries, so kernel pages need nothing extra
+    if ((end - start) / PAGE_4KIB <= TLB_FLUSH_ALL_PAGES) {
+        for (uintptr_t addr = start; addr < end; addr += PAGE_4KIB) {
+            tlb_flush(addr);
+        }
+
+        return;
+    }
+
+#if defined(__x86_64__)
+    if (_kernel_addr(start)) {
+        if (vm.invpcid) {
+            invpcid(INVPCID_ALL_GLOBAL, 0, 0);
+        } else {
+            tlb_flush_global();
+        }
+
+        return;
+    }
+
+    if (vm.invpcid) {
+        invpcid(INVPCID_CONTEXT, read_cr3() & 0xfff, 0);
+        return;
+    }
+#endif
+
+    tlb_flush_all();
+}
+
 void arch_vm_switch(arch_vm_space_t *space) {
     if (!space || !space->root) {
         return;
     }
 
+    unsigned long flags = arch_irq_save();
+    size_t cpu_id = _cpu_id();
+    vm_cpu_t *cpu = &vm.cpus[cpu_id];
+    u64 bit = 1ULL << cpu_id;
+    arch_vm_space_t *prev = cpu->current;
+
+    // publish before reading tlb_gen so a concurrent flush either sees us or bumps it first
+    __atomic_fetch_or(&space->active_cpus, bit, __ATOMIC_SEQ_CST);
+
 #if defined(__x86_64__)
-    write_cr3((u64)(uintptr_t)space->root);
+    write_cr3(_switch_cr3(cpu, space, prev == space));
 #else
     write_cr3((u32)(uintptr_t)space->root);
 #endif
+
+    // the old space's entries either went with the CR3 write or stay tagged
+    // with its PCID, where its tlb_gen decides if they may be reused
+    if (prev && prev != space) {
+        __atomic_fetch_and(&prev->active_cpus, ~bit, __ATOMIC_SEQ_CST);
+    }
+
+    cpu->current = space;
+    arch_irq_restore(flags);
+}
+
+void arch_tlb_flush_range(arch_vm_space_t *space, uintptr_t start, uintptr_t end) {
+    start = ALIGN_DOWN(start, PAGE_4KIB);
+    end = ALIGN(end, PAGE_4KIB);
+
+    if (start >= end) {
+        return;
+    }
+
+    bool user = space && space != &kernel_space;
+    u64 targets = (u64)-1;
+    u64 gen = 0;
+
+    // kernel mappings are shared by every root, user ones only matter where loaded;
+    // CPUs that switched away catch up through tlb_gen when they come back
+    if (user) {
+        gen = __atomic_add_fetch(&space->tlb_gen, 1, __ATOMIC_SEQ_CST);
+        targets = __atomic_load_n(&space->active_cpus, __ATOMIC_SEQ_CST);
+    }
+
+    unsigned long flags = arch_irq_save();
+    u64 self = 1ULL << _cpu_id();
+
+    if (targets & self) {
+        vm_tlb_flush_local(start, end);
+
+        // the slot stays reusable if this was the only flush it missed
+        vm_cpu_t *cpu = &vm.cpus[_cpu_id()];
+        pcid_slot_t *slot = cpu->current_slot ? &cpu->slots[cpu->current_slot - 1] : NULL;
+
+        if (user && slot && cpu->current == space && slot->tlb_gen + 1 == gen) {
+            slot->tlb_gen = gen;
+        }
+    }
+
+    smp_tlb_shootdown(start, end, targets & ~self);
+    arch_irq_restore(flags);
 }
 
 void *arch_vm_root(arch_vm_space_t *space) {
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <base/types.h>
+
+void vm_init_cpu(void);
+void vm_tlb_flush_local(uintptr_t start, uintptr_t end);
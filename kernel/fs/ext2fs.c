@@ -1,6 +1,7 @@
 #include "ext2fs.h"
 
 #include <arch/arch.h>
+#include <arch/paging.h>
 #include <base/macros.h>
 #include <data/bitmap.h>
 #include <errno.h>
@@ -13,9 +14,13 @@
 #include <string.h>
 #include <sys/disk.h>
 #include <sys/lock.h>
+#include <sys/reclaim.h>
 #include <sys/vfs.h>
 
-#define EXT2_BLOCK_CACHE_SIZE 64
+// the block cache always keeps this many blocks and only grows past them
+// while reclaim says memory is plentiful
+#define EXT2_BLOCK_CACHE_MIN     64
+#define EXT2_BLOCK_CACHE_BUCKETS 256
 
 #define EXT2_ATIME_NOATIME  0
 #define EXT2_ATIME_RELATIME 1
@@ -27,11 +32,11 @@
 
 #define RELATIME_WINDOW_SECS (24U * 60U * 60U)
 
-typedef struct {
-    bool valid;
+typedef struct ext2_cache_entry {
     u32 block;
-    u64 stamp;
     u8 *data;
+    list_node_t lru;
+    struct ext2_cache_entry *hash_next;
 } ext2_cache_entry_t;
 
 typedef struct ext2_node_info ext2_node_info_t;
@@ -48,10 +53,12 @@ typedef struct {
     size_t gdt_offset;
     size_t gdt_size;
 
-    // small write through block cache for inode tables, bitmaps, and directories
-    ext2_cache_entry_t cache[EXT2_BLOCK_CACHE_SIZE];
-    u8 *cache_data;
-    u64 cache_clock;
+    // write through block cache for inode tables, bitmaps, and directories.
+    // Every block is clean, so the shrinker can drop any of them
+    spinlock_t cache_lock;
+    ext2_cache_entry_t *cache_hash[EXT2_BLOCK_CACHE_BUCKETS];
+    reclaim_lru_t cache_lru;
+    reclaim_shrinker_t cache_shrinker;
     ext2_node_info_t *inodes;
 } ext2_private_t;
 
@@ -94,7 +101,7 @@ static bool _ext2_read(disk_partition_t *part, void *dest, size_t offset, size_t
         return false;
     }
 
-    ssize_t read = part->disk->interface->read(part->disk, dest, part->offset + offset, bytes);
+    ssize_t read = disk_read(part->disk, dest, part->offset + offset, bytes);
     if (read != (ssize_t)bytes) {
         log_warn(
             "ext2 read failed disk=%s offset=%lu bytes=%lu ret=%ld part_offset=%lu part_size=%lu",
@@ -119,7 +126,7 @@ static bool _ext2_write(disk_partition_t *part, const void *src, size_t offset,
         return false;
     }
 
-    ssize_t written = part->disk->interface->write(part->disk, (void *)src, part->offset + offset, bytes);
+    ssize_t written = disk_write(part->disk, (void *)src, part->offset + offset, bytes);
     if (written != (ssize_t)bytes) {
         log_warn(
             "ext2 write failed disk=%s offset=%lu bytes=%lu ret=%ld part_offset=%lu part_size=%lu",
@@ -135,67 +142,178 @@ static bool _ext2_write(disk_partition_t *part, const void *src, size_t offset,
     return written == (ssize_t)bytes;
 }
 
+static size_t _cache_bucket(u32 block) {
+    return (block * 2654435761U) % EXT2_BLOCK_CACHE_BUCKETS;
+}
+
+// caller holds priv->cache_lock
 static ext2_cache_entry_t *_cache_find(ext2_private_t *priv, u32 block) {
-    if (!priv || !priv->cache_data) {
-        return NULL;
+    ext2_cache_entry_t *entry = priv->cache_hash[_cache_bucket(block)];
+
+    while (entry && entry->block != block) {
+        entry = entry->hash_next;
     }
 
-    for (size_t i = 0; i < EXT2_BLOCK_CACHE_SIZE; i++) {
-        ext2_cache_entry_t *entry = &priv->cache[i];
+    return entry;
+}
 
-        if (entry->valid && entry->block == block) {
-            return entry;
-        }
+// caller holds priv->cache_lock
+static void _cache_unhash(ext2_private_t *priv, ext2_cache_entry_t *entry) {
+    ext2_cache_entry_t **link = &priv->cache_hash[_cache_bucket(entry->block)];
+
+    while (*link && *link != entry) {
+        link = &(*link)->hash_next;
     }
 
-    return NULL;
+    if (*link) {
+        *link = entry->hash_next;
+    }
+
+    entry->hash_next = NULL;
+}
+
+// caller holds priv->cache_lock
+static void _cache_hash(ext2_private_t *priv, ext2_cache_entry_t *entry) {
+    ext2_cache_entry_t **head = &priv->cache_hash[_cache_bucket(entry->block)];
+
+    entry->hash_next = *head;
+    *head = entry;
 }
 
-static ext2_cache_entry_t *_cache_slot(ext2_private_t *priv) {
-    if (!priv || !priv->cache_data) {
+// caller holds priv->cache_lock
+static ext2_cache_entry_t *_cache_evict(ext2_private_t *priv) {
+    list_node_t *node = reclaim_lru_evict(&priv->cache_lru);
+    if (!node) {
         return NULL;
     }
 
-    ext2_cache_entry_t *victim = NULL;
+    ext2_cache_entry_t *entry = node->data;
+    _cache_unhash(priv, entry);
 
-    // first free slot wins; otherwise evict the least recently used block
-    for (size_t i = 0; i < EXT2_BLOCK_CACHE_SIZE; i++) {
-        ext2_cache_entry_t *entry = &priv->cache[i];
+    return entry;
+}
 
-        if (!entry->data) {
-            continue;
-        }
+static void _cache_entry_free(ext2_cache_entry_t *entry) {
+    free(entry->data);
+    free(entry);
+}
 
-        if (!entry->valid) {
-            return entry;
-        }
+static ext2_cache_entry_t *_cache_entry_new(ext2_private_t *priv) {
+    ext2_cache_entry_t *entry = calloc(1, sizeof(ext2_cache_entry_t));
+    if (!entry) {
+        return NULL;
+    }
 
-        if (!victim || entry->stamp < victim->stamp) {
-            victim = entry;
-        }
+    entry->data = malloc(priv->block_size);
+    if (!entry->data) {
+        free(entry);
+        return NULL;
     }
 
-    return victim;
+    entry->lru.data = entry;
+    return entry;
 }
 
 static void _cache_store(ext2_private_t *priv, u32 block, const void *data) {
-    if (!priv || !priv->cache_data || !data) {
+    if (!priv || !data) {
         return;
     }
 
+    spin_lock(&priv->cache_lock);
+
     ext2_cache_entry_t *entry = _cache_find(priv, block);
+    if (entry) {
+        memcpy(entry->data, data, priv->block_size);
+        reclaim_lru_touch(&priv->cache_lru, &entry->lru);
+        spin_unlock(&priv->cache_lock);
+        return;
+    }
+
+    bool grow = reclaim_lru_count(&priv->cache_lru) < EXT2_BLOCK_CACHE_MIN || reclaim_can_grow();
+    if (!grow) {
+        entry = _cache_evict(priv);
+    }
+
+    spin_unlock(&priv->cache_lock);
+
+    // allocate without the lock, the allocation may run our own shrinker
     if (!entry) {
-        entry = _cache_slot(priv);
+        entry = _cache_entry_new(priv);
     }
 
-    if (!entry || !entry->data) {
+    if (!entry) {
         return;
     }
 
     memcpy(entry->data, data, priv->block_size);
-    entry->valid = true;
     entry->block = block;
-    entry->stamp = ++priv->cache_clock;
+
+    spin_lock(&priv->cache_lock);
+
+    // callers hold priv->lock, so nobody else can have cached the block meanwhile
+    _cache_hash(priv, entry);
+    reclaim_lru_add(&priv->cache_lru, &entry->lru);
+
+    spin_unlock(&priv->cache_lock);
+}
+
+static bool _cache_read(ext2_private_t *priv, u32 block, void *dest) {
+    spin_lock(&priv->cache_lock);
+
+    ext2_cache_entry_t *entry = _cache_find(priv, block);
+    if (entry) {
+        memcpy(dest, entry->data, priv->block_size);
+        reclaim_lru_touch(&priv->cache_lru, &entry->lru);
+    }
+
+    spin_unlock(&priv->cache_lock);
+    return entry != NULL;
+}
+
+static size_t _cache_pages(ext2_private_t *priv, size_t blocks) {
+    return DIV_ROUND_UP(blocks * priv->block_size, PAGE_4KIB);
+}
+
+static size_t _cache_shrink_count(void *ctx) {
+    ext2_private_t *priv = ctx;
+    return _cache_pages(priv, reclaim_lru_count(&priv->cache_lru));
+}
+
+static size_t _cache_shrink_scan(void *ctx, size_t pages) {
+    ext2_private_t *priv = ctx;
+
+    // reclaim may run under this lock already, in which case the cache stays
+    if (!spin_try_lock(&priv->cache_lock)) {
+        return 0;
+    }
+
+    size_t dropped = 0;
+
+    while (_cache_pages(priv, dropped) < pages) {
+        ext2_cache_entry_t *entry = _cache_evict(priv);
+        if (!entry) {
+            break;
+        }
+
+        _cache_entry_free(entry);
+        dropped++;
+    }
+
+    spin_unlock(&priv->cache_lock);
+    return _cache_pages(priv, dropped);
+}
+
+static void _cache_destroy(ext2_private_t *priv) {
+    reclaim_unregister(&priv->cache_shrinker);
+
+    spin_lock(&priv->cache_lock);
+
+    ext2_cache_entry_t *entry = NULL;
+    while ((entry = _cache_evict(priv))) {
+        _cache_entry_free(entry);
+    }
+
+    spin_unlock(&priv->cache_lock);
 }
 
 static bool _read_block(ext2_private_t *priv, disk_partition_t *part, u32 block, void *dest) {
@@ -209,10 +327,7 @@ static bool _read_block(ext2_private_t *priv, disk_partition_t *part, u32 block,
         return true;
     }
 
-    ext2_cache_entry_t *cached = _cache_find(priv, block);
-    if (cached && cached->data) {
-        memcpy(dest, cached->data, priv->block_size);
-        cached->stamp = ++priv->cache_clock;
+    if (_cache_read(priv, block, dest)) {
         return true;
     }
 
@@ -3064,8 +3179,8 @@ static void _free_private(ext2_private_t *priv) {
         info = next;
     }
 
+    _cache_destroy(priv);
     mutex_destroy(&priv->lock);
-    free(priv->cache_data);
     free(priv->groups);
     free(priv);
 }
@@ -3228,6 +3343,7 @@ static fs_instance_t *_probe(disk_partition_t *part) {
     }
 
     mutex_init(&priv->lock);
+    priv->cache_lock = (spinlock_t)SPINLOCK_INIT;
 
     if (!_ext2_read(part, &priv->superblock, 1024, sizeof(ext2_superblock_t))) {
         _free_private(priv);
@@ -3283,17 +3399,13 @@ static fs_instance_t *_probe(disk_partition_t *part) {
         return NULL;
     }
 
-    size_t cache_bytes = (size_t)EXT2_BLOCK_CACHE_SIZE * priv->block_size;
-    if (priv->block_size && cache_bytes / priv->block_size == EXT2_BLOCK_CACHE_SIZE) {
-        priv->cache_data = malloc(cache_bytes);
-    }
-
-    if (priv->cache_data) {
-        memset(priv->cache_data, 0, cache_bytes);
-        for (size_t i = 0; i < EXT2_BLOCK_CACHE_SIZE; i++) {
-            priv->cache[i].data = priv->cache_data + i * priv->block_size;
-        }
-    }
+    priv->cache_shrinker = (reclaim_shrinker_t){
+        .name = "ext2-blocks",
+        .count = _cache_shrink_count,
+        .scan = _cache_shrink_scan,
+        .ctx = priv,
+    };
+    reclaim_register(&priv->cache_shrinker);
 
     if (priv->group_count) {
         ext2_group_descriptor_t *gd = &priv->groups[0];
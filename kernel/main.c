@@ -14,10 +14,14 @@
 #include <sys/procfs.h>
 #include <sys/psf.h>
 #include <sys/pty.h>
+#include <sys/reclaim.h>
 #include <sys/symbols.h>
 #include <sys/syscall.h>
 #include <sys/tty.h>
 #include <sys/vfs.h>
+#include <sys/workqueue.h>
+#include <sys/zram.h>
+#include <sys/zpool.h>
 
 #include "sys/ws.h"
 
@@ -26,6 +30,9 @@ NORETURN void kernel_main(void *boot_info) {
     bool has_framebuffer = framebuffer_get_info() != NULL;
 
     scheduler_init();
+    zpool_init();
+    workqueue_init();
+    reclaim_init();
     syscall_init();
     vfs_init();
     ext2fs_init();
@@ -38,6 +45,9 @@ NORETURN void kernel_main(void *boot_info) {
         panic("failed to mount rootfs");
     }
 
+    zram_init();
+    sched_swap_init();
+
     log_info("tty init");
     tty_init();
     pty_init();
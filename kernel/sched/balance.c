@@ -1,12 +1,82 @@
 #include "internal.h"
 
-u64 sched_target_slice_ns(size_t cpu_id) {
-    size_t runnable = sched_cpu_load(cpu_id);
-    if (!runnable) {
-        runnable = 1;
+// one nice step is worth about 10% of the cpu against a neighbour, so every
+// weight is 1.25 times the next one; the middle entry is nice 0
+static const u32 nice_weights[PRIO_MAX - PRIO_MIN] = {
+    88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+    9548, 7620, 6100, 4904, 3906, 3121, 2501, 1991, 1586, 1277,
+    1024, 820, 655, 526, 423, 335, 272, 215, 172, 137,
+    110, 87, 70, 56, 45, 36, 29, 23, 18, 15,
+};
+
+_Static_assert(SCHED_NICE_0_WEIGHT == 1024U, "the nice weight table is scaled to a nice 0 weight of 1024");
+
+u32 sched_nice_weight(int nice) {
+    nice = max(nice, PRIO_MIN);
+    nice = min(nice, PRIO_MAX - 1);
+
+    return nice_weights[nice - PRIO_MIN];
+}
+
+u64 sched_cpu_weight(size_t cpu_id) {
+    if (cpu_id >= MAX_CORES) {
+        return 0;
+    }
+
+    sched_rq_t *rq = &sched_state.cpus.runqueues[cpu_id];
+    u64 weight = __atomic_load_n(&rq->load_weight, __ATOMIC_RELAXED);
+
+    sched_thread_t *current = __atomic_load_n(&sched_state.cpus.cpu[cpu_id].current, __ATOMIC_ACQUIRE);
+    sched_thread_t *idle = __atomic_load_n(&sched_state.cpus.cpu[cpu_id].idle_thread, __ATOMIC_ACQUIRE);
+
+    if (current && current != idle) {
+        weight += current->weight;
     }
 
-    u64 slice = SCHED_LATENCY_NS / (u64)runnable;
+    return weight;
+}
+
+bool sched_rt_throttled(size_t cpu_id) {
+    if (cpu_id >= MAX_CORES) {
+        return false;
+    }
+
+    sched_cpu_t *cpu = &sched_state.cpus.cpu[cpu_id];
+    bool same_period = arch_timer_ns() - cpu->rt_period_start < SCHED_RT_PERIOD_NS;
+
+    return same_period && cpu->rt_used_ns >= SCHED_RT_RUNTIME_NS;
+}
+
+// until the local real time budget runs out, or until it refills once it has
+static u64 rt_budget_left(size_t cpu_id) {
+    sched_cpu_t *cpu = &sched_state.cpus.cpu[cpu_id];
+    u64 now = arch_timer_ns();
+    u64 period_end = cpu->rt_period_start + SCHED_RT_PERIOD_NS;
+
+    if (now >= period_end) {
+        return SCHED_RT_RUNTIME_NS;
+    }
+
+    if (cpu->rt_used_ns < SCHED_RT_RUNTIME_NS) {
+        return min(SCHED_RT_RUNTIME_NS - cpu->rt_used_ns, period_end - now);
+    }
+
+    return period_end - now;
+}
+
+// each fair thread gets its weight's share of the latency period; a real time
+// one runs until its round robin turn or the budget ends, so the timer is
+// there to catch either
+u64 sched_target_slice_ns(size_t cpu_id, const sched_thread_t *thread) {
+    if (thread && sched_rank(thread) && cpu_id == sched_cpu_id()) {
+        u64 slice = sched_local_slice_ns() + rt_budget_left(cpu_id);
+        return thread->policy == SCHED_RR ? min(slice, SCHED_RR_SLICE_NS) : slice;
+    }
+
+    u64 weight = thread && thread->weight ? thread->weight : SCHED_NICE_0_WEIGHT;
+    u64 total = max(sched_cpu_weight(cpu_id), weight);
+
+    u64 slice = SCHED_LATENCY_NS * weight / total;
 
     if (slice < SCHED_MIN_GRANULARITY_NS) {
         slice = SCHED_MIN_GRANULARITY_NS;
@@ -25,6 +95,18 @@ bool sched_has_better(sched_thread_t *current, size_t cpu_id) {
         return false;
     }
 
+    u32 best_rank = sched_rank(best);
+    u32 current_rank = sched_rank(current);
+
+    // a throttled cpu runs fair work ahead of real time until the period ends
+    if (best_rank != current_rank) {
+        return sched_rt_throttled(cpu_id) ? !best_rank : best_rank > current_rank;
+    }
+
+    if (best_rank) {
+        return false;
+    }
+
     if (best->vruntime_ns < current->vruntime_ns) {
         return true;
     }
@@ -36,6 +118,10 @@ bool sched_has_better(sched_thread_t *current, size_t cpu_id) {
     return false;
 }
 
+// extra load a cpu must carry over a peer before work is pushed to it, by
+// the innermost domain the two share
+static const size_t domain_slack[SCHED_DOMAIN_COUNT] = { 0, 0, 1, 2 };
+
 static size_t sched_push_load(size_t source_cpu, size_t target_cpu, size_t max_moves) {
     if (!max_moves || source_cpu >= MAX_CORES || target_cpu >= MAX_CORES) {
         return 0;
@@ -47,16 +133,10 @@ static size_t sched_push_load(size_t source_cpu, size_t target_cpu, size_t max_m
 
     size_t moved = 0;
     for (size_t i = 0; i < max_moves; i++) {
-        sched_thread_t *thread = rq_take_worst(source_cpu, target_cpu);
-
-        if (!thread) {
+        if (!rq_move_worst(source_cpu, target_cpu, false)) {
             break;
         }
 
-        thread->last_cpu = target_cpu;
-        thread->affinity_core = target_cpu;
-
-        rq_enqueue_cpu(thread, target_cpu);
         moved++;
 
         __atomic_fetch_add(&sched_state.metrics.migrations, 1, __ATOMIC_RELAXED);
@@ -87,25 +167,11 @@ void sched_rebalance_once(size_t cpu_id) {
     __atomic_fetch_add(&sched_state.metrics.balance_runs, 1, __ATOMIC_RELAXED);
 
     for (size_t moved = 0; moved < SCHED_PUSH_BATCH; moved++) {
-        sched_thread_t *stranded = rq_take_unfit(cpu_id, cpu_id);
-        if (!stranded) {
+        size_t target_cpu = MAX_CORES;
+        if (!rq_move_unfit(cpu_id, &target_cpu)) {
             break;
         }
 
-        size_t target_cpu = pick_cpu(stranded, cpu_id);
-        if (target_cpu >= MAX_CORES || target_cpu == cpu_id) {
-            rq_enqueue_cpu(stranded, cpu_id);
-            break;
-        }
-
-        if (!sched_cpu_allowed(stranded, target_cpu)) {
-            rq_enqueue_cpu(stranded, cpu_id);
-            break;
-        }
-
-        stranded->last_cpu = target_cpu;
-        stranded->affinity_core = target_cpu;
-        rq_enqueue_cpu(stranded, target_cpu);
         __atomic_fetch_add(&sched_state.metrics.migrations, 1, __ATOMIC_RELAXED);
 
         if (wake_cpu(target_cpu)) {
@@ -113,41 +179,46 @@ void sched_rebalance_once(size_t cpu_id) {
         }
     }
 
-    size_t idlest = MAX_CORES;
-    size_t idlest_load = (size_t)-1;
+    if (cpu_id >= MAX_CORES) {
+        return;
+    }
+
     size_t local_load = sched_cpu_load(cpu_id);
+    u64 online = sched_online_cpu_mask() & ~(1ULL << cpu_id);
+
+    // imbalance is settled in the nearest domain that has it, and each level
+    // out needs a wider gap before warm caches are given up for it
+    for (size_t level = 0; level < SCHED_DOMAIN_COUNT; level++) {
+        u64 span = sched_domain_span(cpu_id, level) & online;
+        size_t idlest = MAX_CORES;
+        size_t idlest_load = (size_t)-1;
+
+        for (; span; span &= span - 1) {
+            size_t cpu = (size_t)__builtin_ctzll(span);
+            size_t load = sched_cpu_load(cpu);
+
+            if (load < idlest_load) {
+                idlest = cpu;
+                idlest_load = load;
+            }
+        }
 
-    for (size_t cpu = 0; cpu < ncpu; cpu++) {
-        if (!cores_local[cpu].valid || !cores_local[cpu].online) {
+        if (idlest >= MAX_CORES || local_load <= idlest_load + 1 + domain_slack[level]) {
             continue;
         }
 
-        size_t load = sched_cpu_load(cpu);
+        size_t overload = local_load - idlest_load;
+        size_t max_moves = overload / 2;
 
-        if (load < idlest_load) {
-            idlest = cpu;
-            idlest_load = load;
+        if (!max_moves) {
+            max_moves = 1;
         }
-    }
 
-    if (idlest >= MAX_CORES || cpu_id >= MAX_CORES || cpu_id == idlest) {
-        return;
-    }
+        if (max_moves > SCHED_PUSH_BATCH) {
+            max_moves = SCHED_PUSH_BATCH;
+        }
 
-    if (local_load <= (idlest_load + 1)) {
+        sched_push_load(cpu_id, idlest, max_moves);
         return;
     }
-
-    size_t overload = local_load - idlest_load;
-    size_t max_moves = overload / 2;
-
-    if (!max_moves) {
-        max_moves = 1;
-    }
-
-    if (max_moves > SCHED_PUSH_BATCH) {
-        max_moves = SCHED_PUSH_BATCH;
-    }
-
-    sched_push_load(cpu_id, idlest, max_moves);
 }
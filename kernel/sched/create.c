@@ -1,11 +1,18 @@
 #include "internal.h"
 
+#include <sys/tlb.h>
+#include <sys/zpool.h>
+
 void idle_entry(UNUSED void *arg) {
     for (;;) {
         if (sched_cpu_id() == 0) {
             sched_reap();
         }
 
+        // zero frames ahead of time until something else wants the CPU
+        while (!sched_need_resched() && zpool_refill()) {
+        }
+
         arch_cpu_wait();
     }
 }
@@ -92,6 +99,27 @@ bool wake_cpu(size_t cpu_id) {
     return true;
 }
 
+// unlike wake_cpu this interrupts a busy cpu as well, a real time thread that
+// outranks what runs there can't wait for the slice to end
+void sched_preempt_cpu(size_t cpu_id) {
+    if (cpu_id >= MAX_CORES) {
+        return;
+    }
+
+    if (cpu_id != sched_cpu_id()) {
+        sched_set_resched_cpu(cpu_id, true);
+        arch_resched_cpu(cpu_id);
+        return;
+    }
+
+    sched_cpu_t *local = sched_local();
+    sched_set_resched(true);
+
+    if (!__atomic_exchange_n(&local->resched_irq, true, __ATOMIC_ACQ_REL)) {
+        arch_resched_self();
+    }
+}
+
 static size_t wake_cpu_count(void) {
     size_t ncpu = core_count;
 
@@ -133,24 +161,40 @@ static size_t first_cpu_in_mask(u64 mask, size_t ncpu) {
     return 0;
 }
 
+// the base cpu itself when idle, then within its cache a whole idle core
+// before the sibling of a busy one, and only then farther out, nearest first
+static size_t idle_cpu_cost(size_t base_cpu, size_t cpu) {
+    size_t cost = sched_core_idle(cpu) ? 0 : 1;
+
+    if (sched_domain_span(base_cpu, SCHED_DOMAIN_CACHE) & (1ULL << cpu)) {
+        return cost;
+    }
+
+    return sched_cpu_distance(base_cpu, cpu) * 2 + cost;
+}
+
 static size_t pick_idle_cpu(u64 idle_mask, size_t base_cpu, size_t ncpu) {
+    if (base_cpu < ncpu && (idle_mask & (1ULL << base_cpu))) {
+        return base_cpu;
+    }
+
     size_t best_cpu = MAX_CORES;
-    size_t best_distance = (size_t)-1;
+    size_t best_cost = (size_t)-1;
 
     for (size_t cpu = 0; cpu < ncpu; cpu++) {
         if (!(idle_mask & (1ULL << cpu))) {
             continue;
         }
 
-        size_t distance = sched_cpu_distance(base_cpu, cpu, ncpu);
+        size_t cost = idle_cpu_cost(base_cpu, cpu);
         bool no_best = best_cpu >= MAX_CORES;
-        bool closer = distance < best_distance;
-        bool tie_break = distance == best_distance && cpu < best_cpu;
-        bool better = no_best || closer || tie_break;
+        bool cheaper = cost < best_cost;
+        bool tie_break = cost == best_cost && cpu < best_cpu;
+        bool better = no_best || cheaper || tie_break;
 
         if (better) {
             best_cpu = cpu;
-            best_distance = distance;
+            best_cost = cost;
         }
     }
 
@@ -183,11 +227,87 @@ static bool wake_can_prefer(const sched_thread_t *thread, size_t ncpu, u64 allow
     return allowed & (1ULL << thread->last_cpu);
 }
 
-static size_t pick_target_cpu(const sched_thread_t *thread) {
+static u32 running_rank(size_t cpu_id) {
+    sched_thread_t *running = __atomic_load_n(&sched_state.cpus.cpu[cpu_id].current, __ATOMIC_ACQUIRE);
+    return running ? sched_rank(running) : 0;
+}
+
+// a real time thread goes where it displaces the least: an idle or fair cpu
+// before one already running real time work, the lighter one of those first
+static size_t pick_rt_cpu(const sched_thread_t *thread, u64 allowed, size_t ncpu) {
+    size_t best_cpu = MAX_CORES;
+    u32 best_rank = UINT32_MAX;
+    size_t best_load = (size_t)-1;
+
+    for (size_t cpu = 0; cpu < ncpu; cpu++) {
+        if (!(allowed & (1ULL << cpu))) {
+            continue;
+        }
+
+        u32 rank = running_rank(cpu);
+        size_t load = sched_cpu_load(cpu);
+
+        bool better = rank < best_rank || (rank == best_rank && load < best_load);
+        if (!better && rank == best_rank && load == best_load) {
+            better = cpu == thread->last_cpu;
+        }
+
+        if (better) {
+            best_cpu = cpu;
+            best_rank = rank;
+            best_load = load;
+        }
+    }
+
+    return best_cpu;
+}
+
+// a wakee that ran moments ago goes back to its warm cpu when that is idle.
+// Otherwise it follows its waker, whose cache likely holds what it was woken
+// for: an idle cpu sharing that cache, or the waker's own when it is lighter
+// than the one the wakee left. A hot wakee is not pulled out of its cache
+static size_t wake_affine(const sched_thread_t *thread, size_t waker_cpu, size_t prev_cpu, u64 idle_mask, size_t ncpu) {
+    bool hot = sched_thread_hot(thread, arch_timer_ns());
+
+    if (hot && prev_cpu < ncpu && (idle_mask & (1ULL << prev_cpu))) {
+        __atomic_fetch_add(&sched_state.metrics.wake_prev, 1, __ATOMIC_RELAXED);
+        return prev_cpu;
+    }
+
+    u64 near = sched_domain_span(waker_cpu, SCHED_DOMAIN_CACHE);
+
+    if (hot && prev_cpu < ncpu && !(near & (1ULL << prev_cpu))) {
+        return MAX_CORES;
+    }
+
+    size_t target = MAX_CORES;
+
+    if (near & idle_mask) {
+        target = pick_idle_cpu(near & idle_mask, waker_cpu, ncpu);
+    } else if (prev_cpu >= ncpu || sched_cpu_load(waker_cpu) < sched_cpu_load(prev_cpu)) {
+        target = waker_cpu;
+    }
+
+    if (target < MAX_CORES) {
+        __atomic_fetch_add(&sched_state.metrics.wake_affine, 1, __ATOMIC_RELAXED);
+    }
+
+    return target;
+}
+
+static size_t pick_target_cpu(const sched_thread_t *thread, size_t waker_cpu) {
     size_t ncpu = wake_cpu_count();
     u64 online = sched_online_cpu_mask();
     u64 allowed = wake_mask(thread, online);
 
+    if (sched_rank(thread)) {
+        size_t rt_cpu = pick_rt_cpu(thread, allowed, ncpu);
+
+        if (rt_cpu < MAX_CORES) {
+            return rt_cpu;
+        }
+    }
+
     size_t min_load = (size_t)-1;
     bool found = false;
     u64 idle_mask = 0;
@@ -222,6 +342,14 @@ static size_t pick_target_cpu(const sched_thread_t *thread) {
         preferred_cpu = thread->last_cpu;
     }
 
+    if (waker_cpu < ncpu && (allowed & (1ULL << waker_cpu))) {
+        size_t affine_cpu = wake_affine(thread, waker_cpu, preferred_cpu, idle_mask, ncpu);
+
+        if (affine_cpu < MAX_CORES) {
+            return affine_cpu;
+        }
+    }
+
     if (idle_mask) {
         size_t base_cpu = preferred_cpu;
 
@@ -246,7 +374,8 @@ static size_t pick_target_cpu(const sched_thread_t *thread) {
     return min_mask ? pick_min_cpu(min_mask, ncpu) : 0;
 }
 
-void enqueue_ipi(sched_thread_t *thread, bool allow_remote_ipi) {
+// `waker_cpu` is where the thread was woken from, MAX_CORES when it was not
+static void enqueue_placed(sched_thread_t *thread, bool allow_remote_ipi, size_t waker_cpu) {
     if (!thread || thread == sched_local_idle()) {
         return;
     }
@@ -263,19 +392,22 @@ void enqueue_ipi(sched_thread_t *thread, bool allow_remote_ipi) {
         return;
     }
 
-    size_t target_cpu = pick_target_cpu(thread);
+    size_t target_cpu = pick_target_cpu(thread, waker_cpu);
     size_t prev_cpu = thread->last_cpu;
 
-    if (thread->on_rq && prev_cpu != target_cpu) {
-        rq_remove_thread(thread);
-    }
-
     rq_enqueue_cpu(thread, target_cpu);
 
     if (prev_cpu != target_cpu) {
         __atomic_fetch_add(&sched_state.metrics.migrations, 1, __ATOMIC_RELAXED);
     }
 
+    bool may_interrupt = allow_remote_ipi || target_cpu == sched_cpu_id();
+
+    if (may_interrupt && sched_rank(thread) > running_rank(target_cpu)) {
+        sched_preempt_cpu(target_cpu);
+        return;
+    }
+
     size_t self_cpu = sched_cpu_id();
 
     if (target_cpu != self_cpu) {
@@ -289,6 +421,14 @@ void enqueue_ipi(sched_thread_t *thread, bool allow_remote_ipi) {
     }
 }
 
+void enqueue_ipi(sched_thread_t *thread, bool allow_remote_ipi) {
+    enqueue_placed(thread, allow_remote_ipi, MAX_CORES);
+}
+
+void enqueue_wakeup(sched_thread_t *thread) {
+    enqueue_placed(thread, true, sched_cpu_id());
+}
+
 void enqueue_thread(sched_thread_t *thread) {
     enqueue_ipi(thread, true);
 }
@@ -309,7 +449,7 @@ sched_thread_t *create_thread(
     bool user_thread,
     sched_pid_class_t pid_class
 ) {
-    sched_thread_t *thread = calloc(1, sizeof(*thread));
+    sched_thread_t *thread = kmem_cache_zalloc(&sched_thread_cache);
     if (!thread) {
         log_warn("failed to allocate scheduler thread object");
         return NULL;
@@ -324,11 +464,15 @@ sched_thread_t *create_thread(
     thread->last_cpu = sched_cpu_id();
     thread->allowed_cpu_mask = sched_online_cpu_mask();
     thread->affinity_user_set = false;
+    thread->nice = 0;
+    thread->weight = SCHED_NICE_0_WEIGHT;
     thread->vruntime_ns = 0;
     thread->exec_start_ns = 0;
     thread->sum_exec_ns = 0;
+    thread->last_ran_ns = 0;
     thread->refcount = 1;
     thread->lifecycle_flags = 0;
+    thread->group_threads = 1;
     thread->user_thread = user_thread;
     thread->pid = sched_next_pid(pid_class);
     thread->ppid = 0;
@@ -343,6 +487,8 @@ sched_thread_t *create_thread(
             thread->sid = parent->sid;
             thread->allowed_cpu_mask = parent->allowed_cpu_mask;
             thread->affinity_user_set = parent->affinity_user_set;
+            thread->nice = parent->nice;
+            thread->weight = parent->weight;
             thread->vruntime_ns = parent->vruntime_ns;
         } else {
             thread->pgid = thread->pid;
@@ -363,19 +509,20 @@ sched_thread_t *create_thread(
     if (parent && parent->group_count) {
         memcpy(thread->groups, parent->groups, sizeof(thread->groups));
     }
-    thread->umask = parent ? parent->umask : 0022;
+    thread->umask = parent ? sched_group(parent)->umask : 0022;
     thread->stack_size = SCHED_STACK_SIZE;
     thread->tty_index = parent ? parent->tty_index : -1;
     thread->sleep_queued = false;
-    thread->sleep_index = 0;
-    thread->wait_deadline_tick = 0;
+    thread->sleep_cpu = 0;
+    thread->sleep_node.data = thread;
+    thread->wait_deadline_ns = 0;
     thread->wait_flags = 0;
     thread->wait_result = (u8)SCHED_WAIT_ABORTED;
     thread->wait_cookie = 0;
 
     if (!arch_kernel_stack_alloc(thread)) {
         log_warn("failed to allocate scheduler thread stack");
-        free(thread);
+        kmem_cache_free(&sched_thread_cache, thread);
         return NULL;
     }
 
@@ -391,7 +538,7 @@ sched_thread_t *create_thread(
         if (!thread->vm_space) {
             log_warn("failed to allocate user VM space");
             arch_kernel_stack_free(thread);
-            free(thread);
+            kmem_cache_free(&sched_thread_cache, thread);
             return NULL;
         }
     } else {
@@ -399,8 +546,14 @@ sched_thread_t *create_thread(
     }
 
     spinlock_init(&thread->vm_lock);
+    spinlock_init(&thread->fd_lock);
 
     sched_waitq_init(&thread->wait_queue);
+
+    if (user_thread) {
+        sched_waitq_init(&thread->vm_wait);
+    }
+
     sched_signal_init(thread);
 
     arch_fpu_init(thread->fpu_state);
@@ -413,9 +566,7 @@ sched_thread_t *create_thread(
     }
 
     if (enqueue) {
-        unsigned long flags = sched_lock_save();
         enqueue_thread(thread);
-        sched_lock_restore(flags);
     }
 
     return thread;
@@ -452,23 +603,46 @@ sched_thread_t *sched_spawn_kernel(const char *name, thread_entry_t entry, void
     return create_thread(name, entry, arg, true, false, SCHED_PID_KERNEL);
 }
 
+// pinned before the first enqueue so it never runs anywhere else
+sched_thread_t *sched_spawn_kernel_on(const char *name, thread_entry_t entry, void *arg, size_t cpu_id) {
+    if (cpu_id >= MAX_CORES) {
+        return NULL;
+    }
+
+    sched_thread_t *thread = create_thread(name, entry, arg, false, false, SCHED_PID_KERNEL);
+    if (!thread) {
+        return NULL;
+    }
+
+    thread->allowed_cpu_mask = 1ULL << cpu_id;
+    thread->affinity_user_set = true;
+    thread->affinity_core = cpu_id;
+    thread->last_cpu = cpu_id;
+
+    enqueue_thread(thread);
+
+    return thread;
+}
+
 sched_thread_t *sched_create_user_thread(const char *name) {
     return create_thread(name, NULL, NULL, false, true, SCHED_PID_USER);
 }
 
 static void copy_fork_state(sched_thread_t *child, sched_thread_t *parent) {
-    child->ppid = parent->pid;
+    sched_thread_t *group = sched_group(parent);
+
+    child->ppid = group->pid;
     child->pgid = parent->pgid;
     child->sid = parent->sid;
-    child->umask = parent->umask;
+    child->umask = group->umask;
     child->user_stack_base = parent->user_stack_base;
     child->user_stack_size = parent->user_stack_size;
 
-    memcpy(child->cwd, parent->cwd, sizeof(parent->cwd));
-    memcpy(child->signal_handlers, parent->signal_handlers, sizeof(child->signal_handlers));
+    memcpy(child->cwd, group->cwd, sizeof(group->cwd));
+    memcpy(child->signal_handlers, group->signal_handlers, sizeof(child->signal_handlers));
 
     child->signal_mask = parent->signal_mask;
-    child->signal_trampoline = parent->signal_trampoline;
+    child->signal_trampoline = group->signal_trampoline;
     child->signal_pending = 0;
     __atomic_store_n(&child->signal_saved_valid, 0, __ATOMIC_RELEASE);
     __atomic_store_n(&child->current_signal, 0, __ATOMIC_RELEASE);
@@ -494,13 +668,9 @@ static bool region_bytes(const sched_user_region_t *region, size_t *size_out) {
     return true;
 }
 
-static void unmap_child_region(void *root, uintptr_t vaddr, size_t pages) {
-    for (size_t i = 0; i < pages; i++) {
-        uintptr_t page = vaddr + i * PAGE_4KIB;
-
-        unmap_page((page_t *)root, page);
-        arch_tlb_flush(page);
-    }
+static void unmap_child_region(sched_thread_t *child, void *root, uintptr_t vaddr, size_t pages) {
+    arch_unmap_region(root, pages, vaddr);
+    arch_tlb_flush_range(child->vm_space, vaddr, vaddr + pages * PAGE_4KIB);
 }
 
 static int fork_copy_region(sched_thread_t *child, const sched_user_region_t *region, void *root) {
@@ -509,7 +679,7 @@ static int fork_copy_region(sched_thread_t *child, const sched_user_region_t *re
         return -ENOMEM;
     }
 
-    uintptr_t new_paddr = (uintptr_t)arch_alloc_frames_user(region->pages);
+    uintptr_t new_paddr = sched_alloc_user_frames(region->vaddr, region->pages);
     if (!new_paddr) {
         return -ENOMEM;
     }
@@ -517,7 +687,7 @@ static int fork_copy_region(sched_thread_t *child, const sched_user_region_t *re
     arch_map_region(root, region->pages, region->vaddr, new_paddr, region->flags);
 
     if (!sched_add_user_region(child, region->vaddr, new_paddr, region->pages, region->flags)) {
-        unmap_child_region(root, region->vaddr, region->pages);
+        unmap_child_region(child, root, region->vaddr, region->pages);
         arch_free_frames((void *)new_paddr, region->pages);
         return -ENOMEM;
     }
@@ -537,7 +707,7 @@ static int fork_cow_region(
     sched_thread_t *child,
     sched_user_region_t *region,
     void *root,
-    bool *flush_parent_tlb
+    tlb_batch_t *parent_batch
 ) {
     u64 flags = region->flags;
     bool writable = (flags & PT_WRITE) != 0;
@@ -558,13 +728,24 @@ static int fork_cow_region(
     pmm_ref_hold((void *)(uintptr_t)region->paddr, region->pages);
 
     if (writable && sched_mark_cow(parent, region)) {
-        *flush_parent_tlb = true;
+        tlb_batch_add(parent_batch, region->vaddr, region->vaddr + region->pages * PAGE_4KIB);
+    }
+
+    return 0;
+}
+
+// both sides point at the same slots, whoever faults first reads them back
+static int fork_swap_region(sched_thread_t *child, const sched_user_region_t *region, void *root) {
+    if (!sched_add_user_region(child, region->vaddr, region->paddr, region->pages, region->flags)) {
+        return -ENOMEM;
     }
 
+    sched_swap_get(region->paddr, region->pages);
+    sched_swap_map(root, region);
     return 0;
 }
 
-static int fork_user_space(sched_thread_t *parent, sched_thread_t *child, bool *flush_parent_tlb) {
+static int fork_user_space(sched_thread_t *parent, sched_thread_t *child, tlb_batch_t *parent_batch) {
     void *root = arch_vm_root(child->vm_space);
     if (!root) {
         return -ENOMEM;
@@ -572,8 +753,17 @@ static int fork_user_space(sched_thread_t *parent, sched_thread_t *child, bool *
 
     bool cow_enabled = pmm_ref_ready();
 
-    for (sched_user_region_t *region = parent->regions; region; region = region->next) {
-        int status = cow_enabled ? fork_cow_region(parent, child, region, root, flush_parent_tlb)
+    for (sched_user_region_t *region = sched_region_first(parent); region; region = sched_region_next(region)) {
+        if (region->flags & SCHED_REGION_SWAP) {
+            int status = fork_swap_region(child, region, root);
+            if (status < 0) {
+                return status;
+            }
+
+            continue;
+        }
+
+        int status = cow_enabled ? fork_cow_region(parent, child, region, root, parent_batch)
                                  : fork_copy_region(child, region, root);
         if (status < 0) {
             return status;
@@ -584,16 +774,24 @@ static int fork_user_space(sched_thread_t *parent, sched_thread_t *child, bool *
 }
 
 static int fork_clone_vm(sched_thread_t *parent, sched_thread_t *child) {
-    bool flush_parent_tlb = false;
-    unsigned long flags = spin_lock_irqsave(&parent->vm_lock);
+    tlb_batch_t parent_batch;
 
-    int status = fork_user_space(parent, child, &flush_parent_tlb);
+    // the child is already visible to swap while its tree is being filled,
+    // and the parent's other threads must not rewrite theirs meanwhile
+    sched_vm_hold(parent);
+    sched_vm_hold(child);
 
-    if (status == 0 && flush_parent_tlb) {
-        arch_vm_switch(parent->vm_space);
-    }
+    sched_thread_t *group = sched_group(parent);
+    unsigned long flags = spin_lock_irqsave(&group->vm_lock);
+
+    // the parent lost write access to every cow region, one shootdown covers them all
+    tlb_batch_init(&parent_batch, parent->vm_space);
+    int status = fork_user_space(parent, child, &parent_batch);
+    tlb_batch_finish(&parent_batch);
 
-    spin_unlock_irqrestore(&parent->vm_lock, flags);
+    spin_unlock_irqrestore(&group->vm_lock, flags);
+    sched_vm_release(child);
+    sched_vm_release(parent);
     return status;
 }
 
@@ -601,9 +799,7 @@ static void fork_make_runnable(sched_thread_t *child, arch_int_state_t *state) {
     child->context = build_fork_stack(child, state);
     child->vruntime_ns = 0;
 
-    unsigned long flags = sched_lock_save();
     enqueue_thread(child);
-    sched_lock_restore(flags);
 }
 
 pid_t sched_fork(arch_int_state_t *state) {
@@ -633,3 +829,184 @@ pid_t sched_fork(arch_int_state_t *state) {
     fork_make_runnable(child, state);
     return child->pid;
 }
+
+static void vfork_wait(sched_thread_t *parent) {
+    // not interruptible: the child is running on our user stack until it lets go
+    while (__atomic_load_n(&parent->vfork_waiting, __ATOMIC_ACQUIRE)) {
+        u32 wait_seq = sched_wait_seq(&parent->wait_queue);
+
+        if (!__atomic_load_n(&parent->vfork_waiting, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+
+        sched_wait_on(&parent->wait_queue, wait_seq, 0, 0);
+    }
+}
+
+pid_t sched_vfork(arch_int_state_t *state) {
+    sched_thread_t *parent = sched_local_current();
+
+    if (!parent || !parent->user_thread || !state) {
+        return _fork_fail("invalid parent or missing trap state", EINVAL);
+    }
+
+    // the other threads would keep running on the lent image, copy it instead
+    if (parent->group_leader || __atomic_load_n(&parent->group_threads, __ATOMIC_ACQUIRE) > 1) {
+        return sched_fork(state);
+    }
+
+    sched_thread_t *child = sched_create_user_thread(parent->name);
+    if (!child) {
+        return _fork_fail("failed to create child thread", ENOMEM);
+    }
+
+    copy_fork_state(child, parent);
+
+    if (!sched_fd_clone_table(child, parent)) {
+        sched_discard_thread(child);
+        return _fork_fail("failed to clone file descriptor table", ENOMEM);
+    }
+
+    // lend the whole image instead of copying it, the parent sleeps until it comes back
+    unsigned long vm_flags = spin_lock_irqsave(&parent->vm_lock);
+    spin_lock(&child->vm_lock);
+
+    arch_vm_destroy(child->vm_space);
+    child->vm_space = parent->vm_space;
+    child->regions = parent->regions;
+    child->vfork_parent = parent;
+    sched_set_user_mem(child, sched_user_mem_kib(parent));
+
+    parent->regions = (rb_tree_t){ 0 };
+    sched_set_user_mem(parent, 0);
+    __atomic_store_n(&parent->vfork_waiting, true, __ATOMIC_RELEASE);
+
+    spin_unlock(&child->vm_lock);
+    spin_unlock_irqrestore(&parent->vm_lock, vm_flags);
+
+    pid_t pid = child->pid;
+
+    fork_make_runnable(child, state);
+    vfork_wait(parent);
+
+    return pid;
+}
+
+void sched_vfork_release(sched_thread_t *child, rb_tree_t *regions, u64 mem_kib) {
+    sched_thread_t *parent = child ? child->vfork_parent : NULL;
+    if (!parent || !regions) {
+        return;
+    }
+
+    unsigned long vm_flags = spin_lock_irqsave(&parent->vm_lock);
+
+    parent->regions = *regions;
+    *regions = (rb_tree_t){ 0 };
+    sched_set_user_mem(parent, mem_kib);
+    child->vfork_parent = NULL;
+
+    __atomic_store_n(&parent->vfork_waiting, false, __ATOMIC_RELEASE);
+    spin_unlock_irqrestore(&parent->vm_lock, vm_flags);
+
+    sched_wake_all(&parent->wait_queue);
+}
+
+// a new thread in the caller's group: it runs on the same address space and
+// everything sched_group() leads to, from `sp` with its own signal state
+pid_t sched_clone(arch_int_state_t *state, const sched_clone_t *args) {
+    sched_thread_t *parent = sched_local_current();
+
+    if (!parent || !parent->user_thread || !state || !args) {
+        return _fork_fail("invalid parent or missing trap state", EINVAL);
+    }
+
+    // a vfork child only borrows its image, it gets no threads of its own
+    if (parent->vfork_parent) {
+        return -EINVAL;
+    }
+
+    sched_thread_t *leader = sched_group(parent);
+    sched_thread_t *child = sched_create_user_thread(parent->name);
+    if (!child) {
+        return _fork_fail("failed to create clone thread", ENOMEM);
+    }
+
+    copy_fork_state(child, parent);
+
+    // a new process starts out fair, but a thread keeps its creator's class
+    child->policy = parent->policy;
+    child->rt_priority = parent->rt_priority;
+
+    child->ppid = 0;
+    child->user_stack_base = args->stack_base;
+    child->user_stack_size = args->stack_size;
+    child->clear_tid = args->clear_tid;
+
+    arch_vm_destroy(child->vm_space);
+    child->vm_space = parent->vm_space;
+
+    thread_get(leader);
+
+    // joined under the scheduler lock so a concurrent group exit either sees
+    // the new thread or is seen by us
+    unsigned long flags = sched_lock_save();
+
+    child->group_leader = leader;
+    leader->group_threads++;
+    bool exiting = leader->group_exiting;
+
+    sched_lock_restore(flags);
+
+    arch_int_state_t entry = *state;
+    arch_set_user_entry(&entry, arch_state_ip(state), args->sp);
+
+    pid_t pid = child->pid;
+
+    thread_get(child);
+    fork_make_runnable(child, &entry);
+
+    if (exiting) {
+        sched_signal_send(child, SIGKILL);
+    }
+
+    thread_put(child);
+    return pid;
+}
+
+sched_thread_t *sched_spawn_user(sched_thread_t *parent) {
+    if (!parent || !parent->user_thread) {
+        return NULL;
+    }
+
+    sched_thread_t *child = sched_create_user_thread(parent->name);
+    if (!child) {
+        return NULL;
+    }
+
+    // everything fork would inherit except the address space, exec builds that
+    copy_fork_state(child, parent);
+
+    if (!sched_fd_clone_table(child, parent)) {
+        sched_discard_thread(child);
+        return NULL;
+    }
+
+    return child;
+}
+
+void sched_spawn_start(sched_thread_t *child, bool suspended) {
+    if (!suspended) {
+        sched_make_runnable(child);
+        return;
+    }
+
+    // parked as an already reported stop, the first SIGCONT enqueues it
+    unsigned long flags = 0;
+    size_t cpu_id = rq_lock_home(child, &flags);
+
+    thread_set_state(child, THREAD_STOPPED);
+    child->stop_signal = SIGSTOP;
+    child->stop_reported = true;
+
+    rq_unlock_cpu(cpu_id, flags);
+}
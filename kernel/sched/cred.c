@@ -24,7 +24,7 @@ pid_t sched_getpid(void) {
         return -EINVAL;
     }
 
-    return thread->pid;
+    return sched_group(thread)->pid;
 }
 
 static bool _has_group(const sched_thread_t *thread, gid_t gid) {
@@ -209,11 +209,22 @@ int sched_set_affinity(pid_t pid, u64 mask) {
     target->allowed_cpu_mask = mask;
     target->affinity_user_set = true;
 
-    if (target->on_rq && target->state == THREAD_READY) {
-        rq_remove(target);
+    // a queued thread moves straight across to a cpu its new mask allows
+    if (target->on_rq) {
         enqueue_thread(target);
     }
 
+    // a sleeper's timer follows it to a cpu it may still wake up on
+    if (target->sleep_queued && !sched_cpu_allowed(target, target->sleep_cpu)) {
+        size_t timer_cpu = target->last_cpu;
+
+        if (!sched_cpu_allowed(target, timer_cpu)) {
+            timer_cpu = (size_t)__builtin_ctzll(mask);
+        }
+
+        sched_wheel_migrate(target, timer_cpu);
+    }
+
     size_t resched_cpu = MAX_CORES;
 
     if (target->state == THREAD_RUNNING && !sched_cpu_allowed(target, target->last_cpu)) {
@@ -278,6 +289,195 @@ int sched_get_affinity(pid_t pid, u64 *mask_out) {
     return 0;
 }
 
+// `which`/`who` pick whole processes, a zero `who` meaning the caller's own
+static bool _prio_matches(const sched_thread_t *thread, const sched_thread_t *self, int which, id_t who) {
+    const sched_thread_t *process = sched_group(thread);
+
+    if (!thread->user_thread || thread->pid <= 0) {
+        return false;
+    }
+
+    switch (which) {
+    case PRIO_PROCESS:
+        return process->pid == (who ? (pid_t)who : sched_group(self)->pid);
+    case PRIO_PGRP:
+        return process->pgid == (who ? (pid_t)who : self->pgid);
+    case PRIO_USER:
+        return process->ruid == (who ? (uid_t)who : self->ruid);
+    default:
+        return false;
+    }
+}
+
+// a queued thread goes back into the same queue at its new weight, under the
+// one lock so the queue's load never counts the old weight in and the new out
+static void _set_thread_nice(sched_thread_t *thread, int nice) {
+    unsigned long flags = 0;
+    size_t cpu_id = rq_lock_home(thread, &flags);
+    bool requeue = rq_remove_locked(thread);
+
+    thread->nice = (i8)nice;
+    thread->weight = sched_nice_weight(nice);
+
+    if (requeue) {
+        rq_enqueue_locked(thread, cpu_id);
+    }
+
+    rq_unlock_cpu(cpu_id, flags);
+}
+
+int sched_set_nice(int which, id_t who, int nice) {
+    sched_thread_t *self = sched_local_current();
+
+    if (!self || which < PRIO_PROCESS || which > PRIO_USER || who < 0) {
+        return -EINVAL;
+    }
+
+    nice = max(nice, PRIO_MIN);
+    nice = min(nice, PRIO_MAX - 1);
+
+    bool root = self->uid == 0;
+    bool changed = false;
+    int status = -ESRCH;
+
+    unsigned long flags = sched_lock_save();
+
+    ll_foreach(node, sched_state.procs.all_list) {
+        sched_thread_t *thread = node->data;
+
+        if (!thread || !_prio_matches(thread, self, which, who)) {
+            continue;
+        }
+
+        if (!root && self->uid != thread->uid) {
+            status = -EPERM;
+            continue;
+        }
+
+        // only root may raise a thread above its current priority
+        if (!root && nice < thread->nice) {
+            status = -EACCES;
+            continue;
+        }
+
+        _set_thread_nice(thread, nice);
+        changed = true;
+    }
+
+    sched_lock_restore(flags);
+
+    return changed ? 0 : status;
+}
+
+// reports the highest priority, the lowest nice, of everything matched
+int sched_get_nice(int which, id_t who, int *nice_out) {
+    sched_thread_t *self = sched_local_current();
+
+    if (!self || !nice_out || which < PRIO_PROCESS || which > PRIO_USER || who < 0) {
+        return -EINVAL;
+    }
+
+    int nice = PRIO_MAX;
+    unsigned long flags = sched_lock_save();
+
+    ll_foreach(node, sched_state.procs.all_list) {
+        sched_thread_t *thread = node->data;
+
+        if (thread && _prio_matches(thread, self, which, who)) {
+            nice = min(nice, (int)thread->nice);
+        }
+    }
+
+    sched_lock_restore(flags);
+
+    if (nice == PRIO_MAX) {
+        return -ESRCH;
+    }
+
+    *nice_out = nice;
+    return 0;
+}
+
+// policies are per thread; only root may hand out a real time class
+int sched_set_policy(pid_t pid, int policy, int priority) {
+    sched_thread_t *self = sched_local_current();
+
+    if (!self || pid < 0) {
+        return -EINVAL;
+    }
+
+    bool realtime = policy == SCHED_FIFO || policy == SCHED_RR;
+
+    if (!realtime && policy != SCHED_OTHER) {
+        return -EINVAL;
+    }
+
+    if (realtime ? priority < SCHED_RT_PRIO_MIN || priority > SCHED_RT_PRIO_MAX : priority != 0) {
+        return -EINVAL;
+    }
+
+    sched_thread_t *target = pid ? sched_find_thread(pid) : self;
+    if (!target) {
+        return -ESRCH;
+    }
+
+    int status = 0;
+
+    if (self->uid != 0 && (realtime || self->uid != target->uid)) {
+        status = -EPERM;
+    } else {
+        unsigned long flags = 0;
+        size_t cpu_id = rq_lock_home(target, &flags);
+        bool requeue = rq_remove_locked(target);
+
+        target->policy = (u8)policy;
+        target->rt_priority = (u8)priority;
+        target->rt_seq = 0;
+
+        if (requeue) {
+            rq_enqueue_locked(target, cpu_id);
+        }
+
+        rq_unlock_cpu(cpu_id, flags);
+
+        // a new rank may have to take the cpu from whatever runs there now
+        if (requeue) {
+            sched_kick_cpu(cpu_id);
+        }
+    }
+
+    if (pid) {
+        thread_put(target);
+    }
+
+    return status;
+}
+
+int sched_get_policy(pid_t pid, int *priority_out) {
+    sched_thread_t *self = sched_local_current();
+
+    if (!self || pid < 0) {
+        return -EINVAL;
+    }
+
+    sched_thread_t *target = pid ? sched_find_thread(pid) : self;
+    if (!target) {
+        return -ESRCH;
+    }
+
+    int policy = target->policy;
+
+    if (priority_out) {
+        *priority_out = target->rt_priority;
+    }
+
+    if (pid) {
+        thread_put(target);
+    }
+
+    return policy;
+}
+
 bool sched_gid_matches_cred(uid_t uid, gid_t gid, gid_t target_gid) {
     if (gid == target_gid) {
         return true;
@@ -301,7 +501,7 @@ int sched_setumask(mode_t mask) {
         return -EINVAL;
     }
 
-    thread->umask = mask & 0777;
+    sched_group(thread)->umask = mask & 0777;
 
     return 0;
 }
@@ -3,11 +3,14 @@
 #include <sys/panic.h>
 #include <sys/procfs.h>
 #include <sys/pty.h>
+#include <sys/slab.h>
 #include <sys/tty.h>
 #include <sys/vfs.h>
 
 #include "scheduler.h"
 
+static kmem_cache_t sched_file_cache = KMEM_CACHE_INIT("sched_file", sizeof(sched_file_t), 16);
+
 static void fd_reset(sched_fd_t *fd) {
     if (!fd) {
         return;
@@ -45,8 +48,8 @@ static void pipe_try_destroy(sched_pipe_t *pipe) {
         sched_waitq_destroy(pipe->write_wait_queue);
     }
 
-    free(pipe->read_wait_queue);
-    free(pipe->write_wait_queue);
+    kmem_cache_free(&sched_waitq_cache, pipe->read_wait_queue);
+    kmem_cache_free(&sched_waitq_cache, pipe->write_wait_queue);
     free(pipe->ring.data);
     free(pipe);
 }
@@ -63,13 +66,13 @@ sched_pipe_t *sched_pipe_create(size_t capacity) {
 
     u8 *buffer = calloc(capacity, sizeof(u8));
 
-    pipe->read_wait_queue = calloc(1, sizeof(sched_wait_queue_t));
-    pipe->write_wait_queue = calloc(1, sizeof(sched_wait_queue_t));
+    pipe->read_wait_queue = kmem_cache_zalloc(&sched_waitq_cache);
+    pipe->write_wait_queue = kmem_cache_zalloc(&sched_waitq_cache);
 
     if (!buffer || !pipe->read_wait_queue || !pipe->write_wait_queue) {
         free(buffer);
-        free(pipe->read_wait_queue);
-        free(pipe->write_wait_queue);
+        kmem_cache_free(&sched_waitq_cache, pipe->read_wait_queue);
+        kmem_cache_free(&sched_waitq_cache, pipe->write_wait_queue);
         free(pipe);
         return NULL;
     }
@@ -233,7 +236,7 @@ static sched_file_t *file_create(const sched_fd_spec_t *spec) {
         return NULL;
     }
 
-    sched_file_t *file = calloc(1, sizeof(*file));
+    sched_file_t *file = kmem_cache_zalloc(&sched_file_cache);
     if (!file) {
         return NULL;
     }
@@ -287,7 +290,7 @@ static void file_put(sched_file_t *file) {
     }
 
     mutex_destroy(&file->offset_lock);
-    free(file);
+    kmem_cache_free(&sched_file_cache, file);
 }
 
 static void fd_retain(const sched_fd_t *fd) {
@@ -305,35 +308,55 @@ static void fd_release_value(sched_fd_t *fd) {
     fd_reset(fd);
 }
 
+// clone threads share their leader's table, fd_lock guards the slots while
+// the files themselves are only ever dropped outside it
+static sched_thread_t *fd_table(sched_thread_t *thread) {
+    return sched_group(thread);
+}
+
+// caller holds the table's fd_lock
+static int fd_free_slot(const sched_thread_t *table, int min_fd) {
+    int slot = min_fd < 0 ? 0 : min_fd;
+
+    while (slot < SCHED_FD_MAX && table->fd_used[slot]) {
+        slot++;
+    }
+
+    return slot < SCHED_FD_MAX ? slot : -EMFILE;
+}
+
 int sched_fd_open(sched_thread_t *thread, const sched_fd_spec_t *spec, int min_fd) {
     if (!thread || !file_spec_valid(spec)) {
         return -EINVAL;
     }
 
-    int start = min_fd < 0 ? 0 : min_fd;
-    if (start >= SCHED_FD_MAX) {
+    if (min_fd >= SCHED_FD_MAX) {
         return -EMFILE;
     }
 
-    int slot = start;
-    while (slot < SCHED_FD_MAX && thread->fd_used[slot]) {
-        slot++;
+    sched_file_t *file = file_create(spec);
+    if (!file) {
+        return -ENOMEM;
     }
 
-    if (slot >= SCHED_FD_MAX) {
-        return -EMFILE;
+    sched_thread_t *table = fd_table(thread);
+    unsigned long flags = spin_lock_irqsave(&table->fd_lock);
+
+    int slot = fd_free_slot(table, min_fd);
+    if (slot >= 0) {
+        table->fd_used[slot] = true;
+        table->fds[slot] = (sched_fd_t){
+            .file = file,
+            .fd_flags = spec->fd_flags,
+        };
     }
 
-    sched_file_t *file = file_create(spec);
-    if (!file) {
-        return -ENOMEM;
+    spin_unlock_irqrestore(&table->fd_lock, flags);
+
+    if (slot < 0) {
+        file_put(file);
     }
 
-    thread->fd_used[slot] = true;
-    thread->fds[slot] = (sched_fd_t){
-        .file = file,
-        .fd_flags = spec->fd_flags,
-    };
     return slot;
 }
 
@@ -342,42 +365,105 @@ int sched_fd_alloc(sched_thread_t *thread, const sched_fd_t *fd, int min_fd) {
         return -EINVAL;
     }
 
-    int start = min_fd < 0 ? 0 : min_fd;
-
-    if (start >= SCHED_FD_MAX) {
+    if (min_fd >= SCHED_FD_MAX) {
         return -EMFILE;
     }
 
-    for (int slot = start; slot < SCHED_FD_MAX; slot++) {
-        if (thread->fd_used[slot]) {
-            continue;
-        }
+    sched_thread_t *table = fd_table(thread);
+    unsigned long flags = spin_lock_irqsave(&table->fd_lock);
+
+    int slot = fd_free_slot(table, min_fd);
+    if (slot >= 0) {
+        table->fd_used[slot] = true;
+        table->fds[slot] = *fd;
+        fd_retain(&table->fds[slot]);
+    }
+
+    spin_unlock_irqrestore(&table->fd_lock, flags);
+
+    return slot;
+}
 
-        thread->fd_used[slot] = true;
-        thread->fds[slot] = *fd;
-        fd_retain(&thread->fds[slot]);
+// copies the entry and pins its file, so a close on another thread cannot
+// free it while the caller still works with it
+bool sched_fd_get(sched_thread_t *thread, int fd, sched_fd_t *out) {
+    if (!thread || !out || fd < 0 || fd >= SCHED_FD_MAX) {
+        return false;
+    }
+
+    sched_thread_t *table = fd_table(thread);
+    unsigned long flags = spin_lock_irqsave(&table->fd_lock);
 
-        return slot;
+    bool found = table->fd_used[fd] && table->fds[fd].file;
+    if (found) {
+        *out = table->fds[fd];
+        fd_retain(out);
     }
 
-    return -EMFILE;
+    spin_unlock_irqrestore(&table->fd_lock, flags);
+
+    return found;
 }
 
-int sched_fd_close(sched_thread_t *thread, int fd) {
-    if (!thread || fd < 0 || fd >= SCHED_FD_MAX || !thread->fd_used[fd]) {
+void sched_fd_put(sched_fd_t *fd) {
+    fd_release_value(fd);
+}
+
+int sched_fd_set_flags(sched_thread_t *thread, int fd, u32 fd_flags) {
+    if (!thread || fd < 0 || fd >= SCHED_FD_MAX) {
         return -EBADF;
     }
 
-    sched_fd_t old = thread->fds[fd];
-    bool was_vfs = old.file && old.file->kind == SCHED_FD_VFS;
-    thread->fd_used[fd] = false;
+    sched_thread_t *table = fd_table(thread);
+    unsigned long flags = spin_lock_irqsave(&table->fd_lock);
+
+    bool found = table->fd_used[fd];
+    if (found) {
+        table->fds[fd].fd_flags = fd_flags;
+    }
+
+    spin_unlock_irqrestore(&table->fd_lock, flags);
+
+    return found ? 0 : -EBADF;
+}
+
+// takes the entry out of its slot, the caller drops the file
+static bool fd_take(sched_thread_t *table, int fd, sched_fd_t *out) {
+    unsigned long flags = spin_lock_irqsave(&table->fd_lock);
+
+    bool used = table->fd_used[fd];
+    if (used) {
+        *out = table->fds[fd];
+        table->fd_used[fd] = false;
+        fd_reset(&table->fds[fd]);
+    }
+
+    spin_unlock_irqrestore(&table->fd_lock, flags);
+
+    return used;
+}
+
+static void fd_drop(sched_fd_t *old) {
+    bool was_vfs = old->file && old->file->kind == SCHED_FD_VFS;
 
-    fd_reset(&thread->fds[fd]);
-    fd_release_value(&old);
+    fd_release_value(old);
 
     if (was_vfs) {
         procfs_sweep_dead();
     }
+}
+
+int sched_fd_close(sched_thread_t *thread, int fd) {
+    if (!thread || fd < 0 || fd >= SCHED_FD_MAX) {
+        return -EBADF;
+    }
+
+    sched_fd_t old = { 0 };
+    if (!fd_take(fd_table(thread), fd, &old)) {
+        return -EBADF;
+    }
+
+    fd_drop(&old);
 
     return 0;
 }
@@ -394,32 +480,47 @@ int sched_fd_install(sched_thread_t *thread, int target_fd, const sched_fd_t *fd
     sched_fd_t copy = *fd;
     fd_retain(&copy);
 
-    if (thread->fd_used[target_fd]) {
-        sched_fd_close(thread, target_fd);
+    sched_thread_t *table = fd_table(thread);
+    unsigned long flags = spin_lock_irqsave(&table->fd_lock);
+
+    sched_fd_t old = { 0 };
+    bool replaced = table->fd_used[target_fd];
+
+    if (replaced) {
+        old = table->fds[target_fd];
     }
 
-    thread->fd_used[target_fd] = true;
-    thread->fds[target_fd] = copy;
+    table->fd_used[target_fd] = true;
+    table->fds[target_fd] = copy;
+
+    spin_unlock_irqrestore(&table->fd_lock, flags);
+
+    if (replaced) {
+        fd_drop(&old);
+    }
 
     return target_fd;
 }
 
 int sched_fd_dup(sched_thread_t *thread, int oldfd, int newfd) {
-    if (!thread || oldfd < 0 || oldfd >= SCHED_FD_MAX || !thread->fd_used[oldfd]) {
+    if (newfd < 0 || newfd >= SCHED_FD_MAX) {
         return -EBADF;
     }
 
-    if (newfd < 0 || newfd >= SCHED_FD_MAX) {
+    sched_fd_t source = { 0 };
+    if (!sched_fd_get(thread, oldfd, &source)) {
         return -EBADF;
     }
 
-    if (oldfd == newfd) {
-        return newfd;
+    int result = newfd;
+
+    if (oldfd != newfd) {
+        source.fd_flags &= ~SCHED_FD_FLAG_CLOEXEC;
+        result = sched_fd_install(thread, newfd, &source);
     }
 
-    sched_fd_t source = thread->fds[oldfd];
-    source.fd_flags &= ~SCHED_FD_FLAG_CLOEXEC;
-    return sched_fd_install(thread, newfd, &source);
+    sched_fd_put(&source);
+    return result;
 }
 
 bool sched_fd_clone_table(sched_thread_t *dst, const sched_thread_t *src) {
@@ -427,16 +528,21 @@ bool sched_fd_clone_table(sched_thread_t *dst, const sched_thread_t *src) {
         return false;
     }
 
+    sched_thread_t *table = fd_table((sched_thread_t *)src);
+    unsigned long flags = spin_lock_irqsave(&table->fd_lock);
+
     for (int fd = 0; fd < SCHED_FD_MAX; fd++) {
-        if (!src->fd_used[fd]) {
+        if (!table->fd_used[fd]) {
             continue;
         }
 
         dst->fd_used[fd] = true;
-        dst->fds[fd] = src->fds[fd];
+        dst->fds[fd] = table->fds[fd];
         fd_retain(&dst->fds[fd]);
     }
 
+    spin_unlock_irqrestore(&table->fd_lock, flags);
+
     return true;
 }
 
@@ -446,11 +552,11 @@ void sched_fd_close_all(sched_thread_t *thread) {
     }
 
     for (int fd = 0; fd < SCHED_FD_MAX; fd++) {
-        if (!thread->fd_used[fd]) {
-            continue;
-        }
+        sched_fd_t old = { 0 };
 
-        sched_fd_close(thread, fd);
+        if (fd_take(fd_table(thread), fd, &old)) {
+            fd_drop(&old);
+        }
     }
 }
 
@@ -459,12 +565,10 @@ void sched_fd_close_cloexec(sched_thread_t *thread) {
         return;
     }
 
-    for (int fd = 0; fd < SCHED_FD_MAX; fd++) {
-        if (!thread->fd_used[fd]) {
-            continue;
-        }
+    sched_thread_t *table = fd_table(thread);
 
-        if (!(thread->fds[fd].fd_flags & SCHED_FD_FLAG_CLOEXEC)) {
+    for (int fd = 0; fd < SCHED_FD_MAX; fd++) {
+        if (!table->fd_used[fd] || !(table->fds[fd].fd_flags & SCHED_FD_FLAG_CLOEXEC)) {
             continue;
         }
 
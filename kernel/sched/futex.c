@@ -0,0 +1,142 @@
+#include "internal.h"
+
+#include <sys/usercopy.h>
+
+// waiters are keyed on their group and user address. Every user page is
+// private to one group, so the pair names the same word a physical address
+// would, and it stays put while cow breaks or swap move the frame underneath
+typedef struct {
+    list_node_t node;
+    const sched_thread_t *group;
+    uintptr_t addr;
+    bool woken;
+} futex_waiter_t;
+
+// a wake marks its waiters under the lock, then wakes the whole queue and
+// the rest go back to sleep
+typedef struct {
+    spinlock_t lock;
+    linked_list_t waiters;
+    sched_wait_queue_t queue;
+} futex_bucket_t;
+
+typedef struct {
+    futex_bucket_t buckets[SCHED_FUTEX_BUCKETS];
+} futex_state_t;
+
+static futex_state_t futex = { 0 };
+
+static futex_bucket_t *_bucket(const sched_thread_t *group, uintptr_t addr) {
+    u64 key = ((u64)(uintptr_t)group ^ ((u64)addr >> 2)) * 0x9e3779b97f4a7c15ULL;
+    return &futex.buckets[(key >> 32) % SCHED_FUTEX_BUCKETS];
+}
+
+static bool _addr_ok(const u32 *uaddr) {
+    return uaddr && !((uintptr_t)uaddr & (sizeof(u32) - 1));
+}
+
+// drops a waiter that gave up, false when a wake claimed it first
+static bool _cancel(futex_bucket_t *bucket, futex_waiter_t *waiter) {
+    unsigned long flags = spin_lock_irqsave(&bucket->lock);
+    bool queued = !waiter->woken;
+
+    if (queued) {
+        list_remove(&bucket->waiters, &waiter->node);
+    }
+
+    spin_unlock_irqrestore(&bucket->lock, flags);
+    return queued;
+}
+
+void sched_futex_init(void) {
+    for (size_t i = 0; i < SCHED_FUTEX_BUCKETS; i++) {
+        spinlock_init(&futex.buckets[i].lock);
+        sched_waitq_init(&futex.buckets[i].queue);
+    }
+}
+
+int sched_futex_wait(sched_thread_t *thread, u32 *uaddr, u32 val, u64 deadline_ns) {
+    if (!thread || !_addr_ok(uaddr)) {
+        return -EINVAL;
+    }
+
+    sched_thread_t *group = sched_group(thread);
+    futex_bucket_t *bucket = _bucket(group, (uintptr_t)uaddr);
+
+    futex_waiter_t waiter = {
+        .group = group,
+        .addr = (uintptr_t)uaddr,
+    };
+
+    waiter.node.data = &waiter;
+
+    // queue before reading the word, so a store and wake landing in between still finds us
+    unsigned long flags = spin_lock_irqsave(&bucket->lock);
+    list_append(&bucket->waiters, &waiter.node);
+    spin_unlock_irqrestore(&bucket->lock, flags);
+
+    u32 current = 0;
+    if (!user_copy_from(thread, &current, uaddr, sizeof(current))) {
+        return _cancel(bucket, &waiter) ? -EFAULT : 0;
+    }
+
+    if (current != val) {
+        return _cancel(bucket, &waiter) ? -EAGAIN : 0;
+    }
+
+    for (;;) {
+        u32 wait_seq = sched_wait_seq(&bucket->queue);
+
+        if (__atomic_load_n(&waiter.woken, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+
+        sched_wait_result_t result = sched_wait_on(&bucket->queue, wait_seq, deadline_ns, SCHED_WAIT_INTERRUPTIBLE);
+
+        if (result == SCHED_WAIT_TIMEOUT) {
+            return _cancel(bucket, &waiter) ? -ETIMEDOUT : 0;
+        }
+
+        if (result == SCHED_WAIT_INTR) {
+            return _cancel(bucket, &waiter) ? -EINTR : 0;
+        }
+
+        if (result == SCHED_WAIT_ABORTED) {
+            sched_yield();
+        }
+    }
+}
+
+int sched_futex_wake(sched_thread_t *thread, u32 *uaddr, u32 count) {
+    if (!thread || !_addr_ok(uaddr)) {
+        return -EINVAL;
+    }
+
+    sched_thread_t *group = sched_group(thread);
+    futex_bucket_t *bucket = _bucket(group, (uintptr_t)uaddr);
+    u32 woken = 0;
+
+    unsigned long flags = spin_lock_irqsave(&bucket->lock);
+    list_node_t *node = bucket->waiters.head;
+
+    while (node && woken < count) {
+        list_node_t *next = node->next;
+        futex_waiter_t *waiter = node->data;
+
+        if (waiter->group == group && waiter->addr == (uintptr_t)uaddr) {
+            list_remove(&bucket->waiters, node);
+            __atomic_store_n(&waiter->woken, true, __ATOMIC_RELEASE);
+            woken++;
+        }
+
+        node = next;
+    }
+
+    spin_unlock_irqrestore(&bucket->lock, flags);
+
+    if (woken) {
+        sched_wake_all(&bucket->queue);
+    }
+
+    return woken > INT_MAX ? INT_MAX : (int)woken;
+}
@@ -0,0 +1,103 @@
+#include "internal.h"
+
+#include <sys/usercopy.h>
+
+// caller holds the scheduler lock
+static void _kill_group(sched_thread_t *leader, sched_thread_t *self) {
+    ll_foreach(node, sched_state.procs.all_list) {
+        sched_thread_t *thread = node->data;
+
+        if (!thread || thread == self || sched_group(thread) != leader) {
+            continue;
+        }
+
+        if (thread_get_state(thread) == THREAD_ZOMBIE) {
+            continue;
+        }
+
+        sched_signal_send(thread, SIGKILL);
+    }
+}
+
+void sched_exit_group(int code, int signum) {
+    sched_thread_t *self = sched_local_current();
+
+    if (self && self->user_thread) {
+        sched_thread_t *leader = sched_group(self);
+        unsigned long flags = sched_lock_save();
+
+        // the first thread out decides the status the parent sees
+        if (!leader->group_exiting) {
+            leader->group_exiting = true;
+            leader->exit_code = code;
+            leader->exit_signal = signum;
+
+            if (leader->group_threads > 1) {
+                _kill_group(leader, self);
+            }
+        }
+
+        sched_lock_restore(flags);
+    }
+
+    sched_exit();
+}
+
+static bool _group_done(sched_thread_t *leader) {
+    if (__atomic_load_n(&leader->group_exiting, __ATOMIC_ACQUIRE)) {
+        return true;
+    }
+
+    return __atomic_load_n(&leader->group_threads, __ATOMIC_ACQUIRE) <= 1;
+}
+
+// a clone thread just leaves. The leader is the process its parent waits
+// for, so it stays until the other threads are gone and only returns when a
+// signal has to be handled first
+int sched_thread_exit(int code) {
+    sched_thread_t *self = sched_local_current();
+
+    if (!self || self->group_leader) {
+        sched_exit();
+    }
+
+    while (!_group_done(self)) {
+        u32 wait_seq = sched_wait_seq(&self->wait_queue);
+
+        if (_group_done(self)) {
+            break;
+        }
+
+        sched_wait_result_t result = sched_wait_on(&self->wait_queue, wait_seq, 0, SCHED_WAIT_INTERRUPTIBLE);
+
+        if (result == SCHED_WAIT_INTR && !_group_done(self)) {
+            return -EINTR;
+        }
+
+        if (result == SCHED_WAIT_ABORTED) {
+            sched_yield();
+        }
+    }
+
+    sched_exit_group(code, 0);
+}
+
+// a clone thread on its way out wakes whoever joins it, then tells the leader
+void sched_group_leave(sched_thread_t *self) {
+    sched_thread_t *leader = self->group_leader;
+    u32 *clear_tid = (u32 *)self->clear_tid;
+
+    if (clear_tid) {
+        u32 zero = 0;
+
+        if (user_copy_to(self, clear_tid, &zero, sizeof(zero))) {
+            sched_futex_wake(self, clear_tid, UINT32_MAX);
+        }
+    }
+
+    unsigned long flags = sched_lock_save();
+    leader->group_threads--;
+    sched_lock_restore(flags);
+
+    sched_wake_all(&leader->wait_queue);
+}
@@ -11,6 +11,7 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <log/log.h>
+#include <sched.h>
 #include <sched/signal.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -20,20 +21,54 @@
 #include <sys/lock.h>
 #include <sys/panic.h>
 #include <sys/procfs.h>
+#include <sys/resource.h>
+#include <sys/slab.h>
+#include <sys/trace.h>
 #include <sys/tty.h>
 #include <sys/wait.h>
 
 #include "mem.h"
 #include "scheduler.h"
 
+// a thread's home queue is the cpu that owns it, or else the one it last
+// queued on; its lock covers the thread's state and placement, the queue
+// itself, the cpu's current and handoff threads, and the cpu's timer wheel
 typedef struct {
     spinlock_t lock;
     sched_thread_t **heap;
     u32 capacity;
     size_t nr_running;
     u64 min_vruntime ALIGNED(8);
+    u64 load_weight ALIGNED(8);
 } sched_rq_t;
 
+// one u64 bitmap per level marks its occupied slots
+#define SCHED_WHEEL_BITS  6
+#define SCHED_WHEEL_SLOTS (1U << SCHED_WHEEL_BITS)
+#define SCHED_WHEEL_MASK  (SCHED_WHEEL_SLOTS - 1U)
+
+// a level 0 slot spans 2^SCHED_WHEEL_SHIFT ns and each level up is 64 times
+// coarser; a timer sits at the lowest level its distance fits in, and moves
+// down as the clock reaches its slot, so only that slot is ever scanned
+typedef struct {
+    linked_list_t slots[SCHED_WHEEL_LEVELS][SCHED_WHEEL_SLOTS];
+    u64 occupied[SCHED_WHEEL_LEVELS];
+    linked_list_t expired;
+    u64 clock;
+    size_t count;
+    volatile u64 next_ns ALIGNED(8);
+} sched_wheel_t;
+
+// scheduling domains from the innermost out; each cpu's span at a level is
+// the cpus it shares that level with, itself included
+typedef enum {
+    SCHED_DOMAIN_SMT = 0,
+    SCHED_DOMAIN_CACHE,
+    SCHED_DOMAIN_PACKAGE,
+    SCHED_DOMAIN_SYSTEM,
+    SCHED_DOMAIN_COUNT,
+} sched_domain_t;
+
 typedef enum {
     SCHED_PID_IDLE = 0,
     SCHED_PID_USER,
@@ -51,7 +86,13 @@ typedef struct {
     bool need_resched;
     bool force_resched;
     bool resched_irq;
-    u64 local_ticks ALIGNED(8);
+    u64 charged_tick ALIGNED(8);
+    u64 charged_ns;
+    u64 rebalance_tick;
+    volatile u64 timer_deadline;
+    u64 rt_period_start;
+    u64 rt_used_ns;
+    sched_latency_t latency;
 } sched_cpu_t;
 
 typedef struct {
@@ -63,6 +104,9 @@ typedef struct {
     volatile u64 runqueue_max;
     volatile u64 balance_runs;
     volatile u64 wait_timeout_count ALIGNED(8);
+    volatile u64 wake_affine;
+    volatile u64 wake_prev;
+    volatile u64 hot_skips;
 } sched_metrics_t;
 
 typedef struct {
@@ -75,14 +119,9 @@ typedef struct {
 typedef struct {
     spinlock_t lock;
     ring_queue_t *ring;
+    work_t *work;
 } sched_exit_events_t;
 
-typedef struct {
-    sched_thread_t *heap[SCHED_SLEEP_CAPACITY];
-    size_t count;
-    volatile u64 wake_tick ALIGNED(8);
-} sched_sleep_t;
-
 typedef struct {
     bool running;
     bool secondary_released;
@@ -95,22 +134,23 @@ typedef struct {
     linked_list_t *all_list;
     linked_list_t *reap_list;
     hashmap_t *pid_index;
-    pid_t next_user_pid;
-    pid_t next_kernel_pid;
+    volatile pid_t next_user_pid;
+    volatile pid_t next_kernel_pid;
 } sched_procs_t;
 
 typedef struct {
     sched_rq_t runqueues[MAX_CORES];
+    sched_wheel_t wheels[MAX_CORES];
     volatile u32 wake_rr_cursor;
+    volatile u64 rt_seq ALIGNED(8);
+    u64 domain_span[MAX_CORES][SCHED_DOMAIN_COUNT];
     sched_cpu_t cpu[MAX_CORES];
 } sched_cpu_set_t;
 
 typedef struct {
     sched_wait_queue_t poll_wait_queue;
-    sched_wait_queue_t exit_event_wait;
     sched_wait_queue_t sleep_wait_queue;
     sched_exit_events_t exit_events;
-    sched_sleep_t sleep;
 } sched_wait_t;
 
 typedef struct {
@@ -123,6 +163,7 @@ typedef struct {
 } sched_state_t;
 
 extern sched_state_t sched_state;
+extern kmem_cache_t sched_thread_cache;
 
 static inline bool thread_ctx_ok(const sched_thread_t *thread) {
     return thread && thread->context != 0;
@@ -234,14 +275,6 @@ static inline bool sched_mark_resched_cpu(size_t cpu_id) {
     return !prior;
 }
 
-static inline void sched_count_local_tick(void) {
-    sched_local()->local_ticks++;
-}
-
-static inline u64 sched_local_ticks(void) {
-    return sched_local()->local_ticks;
-}
-
 static inline void sched_preempt_inc(void) {
     sched_local()->preempt_depth++;
 }
@@ -266,6 +299,11 @@ static inline u64 sched_tick_ns(void) {
     return ns ? ns : 1ULL;
 }
 
+static inline bool sched_thread_hot(const sched_thread_t *thread, u64 now_ns) {
+    u64 ran = thread->last_ran_ns;
+    return ran && now_ns - ran < SCHED_MIGRATION_COST_NS;
+}
+
 static inline u64 sched_online_cpu_mask(void) {
     u64 mask = 0;
 
@@ -369,45 +407,49 @@ static inline bool thread_is_owned(const sched_thread_t *thread) {
     return thread_on_local_cpu(thread) || thread_in_handoff(thread);
 }
 
-void sched_nudge_thread(sched_thread_t *thread);
-void enqueue_ipi(sched_thread_t *thread, bool allow_remote_ipi);
-
-static inline bool sched_repair_thread(sched_thread_t *thread, bool send_ipi) {
-    if (!thread) {
+// a thread marked running that no cpu owns lost the switch that would have run
+// it; caller holds its home queue lock and queues it again when this says so
+static inline bool sched_repair_thread(sched_thread_t *thread) {
+    if (!thread || thread_get_state(thread) != THREAD_RUNNING || thread_is_owned(thread)) {
         return false;
     }
 
-    if (thread_get_state(thread) != THREAD_RUNNING) {
-        return false;
-    }
+    thread_set_state(thread, THREAD_READY);
+    thread_unclaim(thread);
 
-    if (thread_on_local_cpu(thread)) {
-        sched_nudge_thread(thread);
+    return true;
+}
 
-        return true;
-    }
+static inline size_t thread_home_cpu(const sched_thread_t *thread) {
+    int running_cpu = thread_cpu(thread);
+    size_t cpu_id = running_cpu >= 0 ? (size_t)running_cpu : thread->last_cpu;
 
-    if (thread_in_handoff(thread)) {
-        sched_nudge_thread(thread);
-        return true;
-    }
+    return cpu_id < MAX_CORES ? cpu_id : 0;
+}
 
-    thread_unclaim(thread);
-    thread_set_state(thread, THREAD_READY);
-    enqueue_ipi(thread, send_ipi);
+static inline unsigned long rq_lock_cpu(size_t cpu_id) {
+    return spin_lock_irqsave(&sched_state.cpus.runqueues[cpu_id].lock);
+}
 
-    return true;
+static inline void rq_unlock_cpu(size_t cpu_id, unsigned long flags) {
+    spin_unlock_irqrestore(&sched_state.cpus.runqueues[cpu_id].lock, flags);
 }
 
+void sched_nudge_thread(sched_thread_t *thread);
+void enqueue_ipi(sched_thread_t *thread, bool allow_remote_ipi);
+void enqueue_wakeup(sched_thread_t *thread);
+
 unsigned long sched_lock_save(void);
 bool sched_lock_try_save(unsigned long *flags_out);
 void sched_lock_restore(unsigned long flags);
 bool sched_reconcile_lock(void);
 
-bool sleep_heap_insert(sched_thread_t *thread);
-void sleep_heap_remove_at(size_t index);
-void sleep_heap_remove(sched_thread_t *thread);
-sched_thread_t *sleep_heap_top(void);
+void sched_wheel_init(size_t cpu_id, u64 now_ns);
+void sched_wheel_insert(sched_thread_t *thread, size_t cpu_id);
+void sched_wheel_cancel(sched_thread_t *thread);
+void sched_wheel_migrate(sched_thread_t *thread, size_t cpu_id);
+sched_thread_t *sched_wheel_expire(size_t cpu_id, u64 now_ns);
+u64 sched_wheel_next(size_t cpu_id);
 pid_t sched_next_pid(sched_pid_class_t pid_class);
 
 bool ctx_state_valid(const sched_thread_t *thread, const arch_int_state_t *state);
@@ -416,25 +458,43 @@ bool ctx_valid(const sched_thread_t *thread);
 size_t sched_cpu_load(size_t cpu_id);
 size_t sched_rq_depth(size_t cpu_id);
 bool cpu_needs_ipi(size_t cpu_id);
-size_t sched_cpu_distance(size_t from_cpu, size_t to_cpu, size_t cpu_count);
+void sched_topology_init(void);
+u64 sched_domain_span(size_t cpu_id, sched_domain_t level);
+size_t sched_cpu_distance(size_t from_cpu, size_t to_cpu);
+bool sched_core_idle(size_t cpu_id);
 size_t pick_cpu(const sched_thread_t *thread, size_t disallowed_cpu);
-void sched_publish_handoff(sched_thread_t *thread, size_t cpu_id);
+bool sched_publish_handoff(sched_thread_t *thread, size_t cpu_id);
 void sched_flush_handoff(size_t cpu_id);
 void rq_note_depth(size_t depth);
+size_t rq_lock_home(const sched_thread_t *thread, unsigned long *flags_out);
+size_t rq_lock_home_pair(const sched_thread_t *thread, size_t target_cpu, unsigned long *flags_out);
+void rq_unlock_home_pair(size_t home_cpu, size_t target_cpu, unsigned long flags);
+bool rq_enqueue_locked(sched_thread_t *thread, size_t cpu_id);
 void rq_enqueue_cpu(sched_thread_t *thread, size_t cpu_id);
+bool rq_remove_locked(sched_thread_t *thread);
 bool rq_remove_thread(sched_thread_t *thread);
 bool rq_remove_index(sched_rq_t *rq, u32 index);
+sched_thread_t *rq_pop_locked(size_t cpu_id);
 sched_thread_t *rq_peek_best(size_t cpu_id);
-sched_thread_t *rq_pop_best_allowed(size_t cpu_id);
-sched_thread_t *rq_take_unfit(size_t source_cpu, size_t disallowed_cpu);
-sched_thread_t *rq_take_worst(size_t source_cpu, size_t target_cpu);
+sched_thread_t *rq_move_unfit(size_t source_cpu, size_t *target_out);
+sched_thread_t *rq_move_worst(size_t source_cpu, size_t target_cpu, bool allow_hot);
 
-u64 sched_target_slice_ns(size_t cpu_id);
+u32 sched_nice_weight(int nice);
+u64 sched_cpu_weight(size_t cpu_id);
+u64 sched_target_slice_ns(size_t cpu_id, const sched_thread_t *thread);
 bool sched_has_better(sched_thread_t *current, size_t cpu_id);
 void sched_rebalance_once(size_t cpu_id);
 
 bool wake_cpu(size_t cpu_id);
 
+// real time threads rank above every fair one, which all rank 0
+static inline u32 sched_rank(const sched_thread_t *thread) {
+    return thread->policy == SCHED_OTHER ? 0 : thread->rt_priority;
+}
+
+bool sched_rt_throttled(size_t cpu_id);
+void sched_preempt_cpu(size_t cpu_id);
+
 static inline void sched_kick_cpu(size_t cpu_id) {
     if (cpu_id >= MAX_CORES) {
         return;
@@ -452,8 +512,7 @@ static inline void sched_kick_cpu(size_t cpu_id) {
 
 void enqueue_thread(sched_thread_t *thread);
 void rq_remove(sched_thread_t *thread);
-sched_thread_t *dequeue_thread(void);
-sched_thread_t *pick_next_thread(void);
+sched_thread_t *pick_next_thread(size_t cpu_id, unsigned long *flags_out);
 sched_thread_t *pick_init_thread(void);
 
 u64 _pid_index_key(pid_t pid);
@@ -469,6 +528,8 @@ void thread_get(sched_thread_t *thread);
 void thread_put(sched_thread_t *thread);
 void thread_destroy(sched_thread_t *thread);
 void sched_reap(void);
+void sched_reap_init(void);
+void sched_reap_async(void);
 NORETURN void thread_trampoline(void);
 void idle_entry(void *arg);
 void thread_prepare_user(sched_thread_t *thread, uintptr_t entry, uintptr_t user_stack_top);
@@ -481,12 +542,15 @@ sched_thread_t *create_thread(
     sched_pid_class_t pid_class
 );
 
-void wake_sleepers(u64 now);
-void sched_wake_sleepers(u64 now);
+void wake_sleepers(u64 now_ns);
+bool sched_wake_locked(sched_thread_t *thread, sched_wait_result_t result);
 void wq_dequeue(sched_thread_t *thread);
 void wq_remove(sched_thread_t *thread);
 bool wait_running(sched_thread_t *self);
 void exit_event_push(pid_t pid);
+void sched_group_leave(sched_thread_t *self);
 
 void sched_capture_context(arch_int_state_t *state);
 void force_resched(void);
+void sched_timer_program(void);
+void sched_timer_note_wake(size_t cpu_id, u64 wake_ns);
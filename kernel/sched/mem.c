@@ -6,6 +6,8 @@
 #include <base/units.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/zpool.h>
 
 static inline u64 _pages_to_kib(size_t pages) {
     return ((u64)pages * PAGE_4KIB) / KIB;
@@ -46,7 +48,7 @@ void sched_user_mem_add(sched_thread_t *thread, size_t pages) {
         return;
     }
 
-    __atomic_add_fetch(&thread->user_mem_kib, delta_kib, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&sched_group(thread)->user_mem_kib, delta_kib, __ATOMIC_RELAXED);
 }
 
 void sched_user_mem_sub(sched_thread_t *thread, size_t pages) {
@@ -59,11 +61,12 @@ void sched_user_mem_sub(sched_thread_t *thread, size_t pages) {
         return;
     }
 
-    u64 current = __atomic_load_n(&thread->user_mem_kib, __ATOMIC_RELAXED);
+    sched_thread_t *group = sched_group(thread);
+    u64 current = __atomic_load_n(&group->user_mem_kib, __ATOMIC_RELAXED);
     while (current > 0) {
         u64 next = current > delta_kib ? (current - delta_kib) : 0;
         bool updated = __atomic_compare_exchange_n(
-            &thread->user_mem_kib,
+            &group->user_mem_kib,
             &current,
             next,
             false,
@@ -82,7 +85,7 @@ void sched_set_user_mem(sched_thread_t *thread, u64 kib) {
         return;
     }
 
-    __atomic_store_n(&thread->user_mem_kib, kib, __ATOMIC_RELAXED);
+    __atomic_store_n(&sched_group(thread)->user_mem_kib, kib, __ATOMIC_RELAXED);
 }
 
 u64 sched_user_mem_kib(const sched_thread_t *thread) {
@@ -90,7 +93,272 @@ u64 sched_user_mem_kib(const sched_thread_t *thread) {
         return 0;
     }
 
-    return __atomic_load_n(&thread->user_mem_kib, __ATOMIC_RELAXED);
+    return __atomic_load_n(&sched_group(thread)->user_mem_kib, __ATOMIC_RELAXED);
+}
+
+// back large-page aligned ranges with aligned frames so map_region can promote them
+static uintptr_t _alloc_user_frames(uintptr_t vaddr, size_t pages) {
+    size_t large = arch_large_page_size();
+
+    if (large && !(vaddr & (large - 1)) && pages >= large / PAGE_4KIB) {
+        uintptr_t paddr = (uintptr_t)arch_alloc_frames_user_aligned(pages, large);
+        if (paddr) {
+            return paddr;
+        }
+    }
+
+    return (uintptr_t)arch_alloc_frames_user(pages);
+}
+
+uintptr_t sched_alloc_user_frames(uintptr_t vaddr, size_t pages) {
+    uintptr_t paddr = _alloc_user_frames(vaddr, pages);
+    if (paddr) {
+        return paddr;
+    }
+
+    // frames parked in the zero pool are better spent on a real request
+    zpool_drain();
+    return _alloc_user_frames(vaddr, pages);
+}
+
+// small requests come pre-zeroed from the pool the idle threads keep filled
+uintptr_t sched_alloc_user_zeroed(uintptr_t vaddr, size_t pages) {
+    uintptr_t paddr = zpool_alloc(pages);
+    if (paddr) {
+        return paddr;
+    }
+
+    paddr = sched_alloc_user_frames(vaddr, pages);
+    if (!paddr) {
+        return 0;
+    }
+
+    void *dst = arch_phys_map(paddr, pages * PAGE_4KIB, 0);
+    if (!dst) {
+        arch_free_frames((void *)paddr, pages);
+        return 0;
+    }
+
+    memset(dst, 0, pages * PAGE_4KIB);
+    arch_phys_unmap(dst, pages * PAGE_4KIB);
+
+    return paddr;
+}
+
+#define REGION_OF(n) ((n) ? rb_entry((n), sched_user_region_t, node) : NULL)
+
+static uintptr_t _region_end(const sched_user_region_t *region) {
+    return region->vaddr + (uintptr_t)region->pages * PAGE_4KIB;
+}
+
+// subtree_gap is the widest hole between two regions anywhere in the subtree
+static void _region_augment(rb_node_t *node) {
+    sched_user_region_t *region = REGION_OF(node);
+    sched_user_region_t *left = REGION_OF(node->left);
+    sched_user_region_t *right = REGION_OF(node->right);
+
+    uintptr_t end = _region_end(region);
+    uintptr_t gap = 0;
+
+    region->subtree_start = left ? left->subtree_start : region->vaddr;
+    region->subtree_end = right ? right->subtree_end : end;
+
+    if (left) {
+        gap = max(left->subtree_gap, region->vaddr - left->subtree_end);
+    }
+
+    if (right) {
+        gap = max(gap, right->subtree_gap);
+        gap = max(gap, right->subtree_start - end);
+    }
+
+    region->subtree_gap = gap;
+}
+
+void sched_region_insert(sched_thread_t *thread, sched_user_region_t *region) {
+    rb_tree_t *tree = &sched_group(thread)->regions;
+    rb_node_t **link = &tree->root;
+    rb_node_t *parent = NULL;
+
+    while (*link) {
+        parent = *link;
+
+        if (region->vaddr < REGION_OF(parent)->vaddr) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+        }
+    }
+
+    _region_augment(&region->node);
+    rb_insert(tree, &region->node, parent, link, _region_augment);
+}
+
+void sched_region_remove(sched_thread_t *thread, sched_user_region_t *region) {
+    rb_erase(&sched_group(thread)->regions, &region->node, _region_augment);
+}
+
+// call after changing the extent of a region in place, the start must keep its order
+void sched_region_update(sched_user_region_t *region) {
+    rb_propagate(&region->node, _region_augment);
+}
+
+sched_user_region_t *sched_region_first(const sched_thread_t *thread) {
+    return REGION_OF(rb_first(&sched_group(thread)->regions));
+}
+
+sched_user_region_t *sched_region_last(const sched_thread_t *thread) {
+    return REGION_OF(rb_last(&sched_group(thread)->regions));
+}
+
+sched_user_region_t *sched_region_next(const sched_user_region_t *region) {
+    return REGION_OF(rb_next(&region->node));
+}
+
+sched_user_region_t *sched_region_prev(const sched_user_region_t *region) {
+    return REGION_OF(rb_prev(&region->node));
+}
+
+// lowest region that ends above `start` and begins below `end`
+sched_user_region_t *sched_region_first_overlap(const sched_thread_t *thread, uintptr_t start, uintptr_t end) {
+    if (!thread || start >= end) {
+        return NULL;
+    }
+
+    rb_node_t *node = sched_group(thread)->regions.root;
+    sched_user_region_t *match = NULL;
+
+    while (node) {
+        sched_user_region_t *region = REGION_OF(node);
+
+        if (region->subtree_end <= start) {
+            break;
+        }
+
+        if (_region_end(region) > start) {
+            if (region->vaddr < end) {
+                match = region;
+            }
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+
+    return match;
+}
+
+sched_user_region_t *sched_region_find(const sched_thread_t *thread, uintptr_t addr) {
+    if (addr == (uintptr_t)-1) {
+        return NULL;
+    }
+
+    return sched_region_first_overlap(thread, addr, addr + 1);
+}
+
+static bool _gap_fits(uintptr_t start, uintptr_t end, size_t size, size_t align, uintptr_t *out) {
+    uintptr_t base = ALIGN(start, align);
+    if (base < start || base >= end || end - base < size) {
+        return false;
+    }
+
+    *out = base;
+    return true;
+}
+
+// first fit inside [low, high) looking only at the holes between regions of `node`
+static bool _find_gap(
+    rb_node_t *node,
+    uintptr_t low,
+    uintptr_t high,
+    size_t size,
+    size_t align,
+    uintptr_t *out
+) {
+    sched_user_region_t *region = REGION_OF(node);
+    if (!region || region->subtree_gap < size) {
+        return false;
+    }
+
+    if (region->subtree_end <= low || region->subtree_start >= high) {
+        return false;
+    }
+
+    sched_user_region_t *left = REGION_OF(node->left);
+    sched_user_region_t *right = REGION_OF(node->right);
+    uintptr_t end = _region_end(region);
+
+    if (left && _find_gap(node->left, low, high, size, align, out)) {
+        return true;
+    }
+
+    if (left && _gap_fits(max(left->subtree_end, low), min(region->vaddr, high), size, align, out)) {
+        return true;
+    }
+
+    if (right && _gap_fits(max(end, low), min(right->subtree_start, high), size, align, out)) {
+        return true;
+    }
+
+    return right && _find_gap(node->right, low, high, size, align, out);
+}
+
+// lowest `align`ed address in [low, high) with `size` free bytes, holes before
+// the first and after the last region count too
+bool sched_region_find_gap(
+    const sched_thread_t *thread,
+    uintptr_t low,
+    uintptr_t high,
+    size_t size,
+    size_t align,
+    uintptr_t *out
+) {
+    if (!thread || !out || !size || low >= high) {
+        return false;
+    }
+
+    sched_user_region_t *root = REGION_OF(sched_group(thread)->regions.root);
+    if (!root) {
+        return _gap_fits(low, high, size, align, out);
+    }
+
+    if (_gap_fits(low, min(root->subtree_start, high), size, align, out)) {
+        return true;
+    }
+
+    if (_find_gap(&root->node, low, high, size, align, out)) {
+        return true;
+    }
+
+    return _gap_fits(max(root->subtree_end, low), high, size, align, out);
+}
+
+static void _region_free(rb_node_t *node) {
+    while (node) {
+        _region_free(node->right);
+
+        rb_node_t *left = node->left;
+        sched_user_region_t *region = REGION_OF(node);
+
+        if (region->flags & SCHED_REGION_SWAP) {
+            sched_swap_put(region->paddr, region->pages);
+        } else if (region->paddr && region->pages) {
+            arch_free_frames((void *)region->paddr, region->pages);
+        }
+
+        free(region);
+        node = left;
+    }
+}
+
+void sched_region_tree_free(rb_tree_t *tree) {
+    if (!tree) {
+        return;
+    }
+
+    _region_free(tree->root);
+    tree->root = NULL;
+    tree->count = 0;
 }
 
 bool sched_add_user_region(sched_thread_t *thread, uintptr_t vaddr, uintptr_t paddr, size_t pages, u64 flags) {
@@ -107,58 +375,88 @@ bool sched_add_user_region(sched_thread_t *thread, uintptr_t vaddr, uintptr_t pa
     region->paddr = paddr;
     region->pages = pages;
     region->flags = flags;
-    region->next = thread->regions;
-    thread->regions = region;
+    sched_region_insert(thread, region);
     sched_user_mem_add(thread, pages);
 
     return true;
 }
 
-void sched_clear_user_regions(sched_thread_t *thread) {
+// region syscalls rewrite the tree without the vm lock, this keeps swap out
+// of a thread until the matching release. Only one thread of a clone group
+// holds at a time, the others sleep on the group's vm wait queue
+void sched_vm_hold(sched_thread_t *thread) {
     if (!thread) {
         return;
     }
 
-    sched_user_region_t *region = thread->regions;
-    while (region) {
-        sched_user_region_t *next = region->next;
+    sched_thread_t *group = sched_group(thread);
+    sched_thread_t *self = sched_current();
 
-        if (region->paddr && region->pages) {
-            arch_free_frames((void *)region->paddr, region->pages);
+    for (;;) {
+        unsigned long flags = spin_lock_irqsave(&group->vm_lock);
+
+        if (!group->vm_holder || group->vm_holder == self) {
+            group->vm_holder = self;
+            __atomic_add_fetch(&group->vm_busy, 1, __ATOMIC_RELAXED);
+            spin_unlock_irqrestore(&group->vm_lock, flags);
+            return;
         }
 
-        free(region);
-        region = next;
+        if (!sched_vm_wait_unlock(group, flags)) {
+            sched_yield();
+        }
     }
-
-    thread->regions = NULL;
-    sched_set_user_mem(thread, 0);
 }
 
-static sched_user_region_t *find_user_region(sched_thread_t *thread, uintptr_t addr) {
+void sched_vm_release(sched_thread_t *thread) {
     if (!thread) {
-        return NULL;
+        return;
     }
 
-    sched_user_region_t *region = thread->regions;
+    sched_thread_t *group = sched_group(thread);
+    unsigned long flags = spin_lock_irqsave(&group->vm_lock);
+    bool released = false;
 
-    while (region) {
-        uintptr_t start = region->vaddr;
-        uintptr_t end = 0;
+    if (!__atomic_sub_fetch(&group->vm_busy, 1, __ATOMIC_RELEASE)) {
+        group->vm_holder = NULL;
+        released = true;
+    }
 
-        if (!region_span(start, region->pages, &end)) {
-            region = region->next;
-            continue;
-        }
+    spin_unlock_irqrestore(&group->vm_lock, flags);
 
-        if (addr >= start && addr < end) {
-            return region;
-        }
+    if (released) {
+        sched_wake_all(&group->vm_wait);
+    }
+}
+
+// caller holds the group's vm lock; another thread rewriting the tree makes
+// a fault back off and retry once it is done
+bool sched_vm_held_elsewhere(const sched_thread_t *group) {
+    return group->vm_holder && group->vm_holder != sched_current();
+}
+
+// drops the vm lock taken with `vm_flags` and sleeps until the holder releases.
+// The sequence is read under the lock, so a release in between is not missed.
+// Returns false without sleeping where the caller can't block, with interrupts
+// off or a spinlock held, and it retries instead
+bool sched_vm_wait_unlock(sched_thread_t *group, unsigned long vm_flags) {
+    u32 seq = sched_wait_seq(&group->vm_wait);
+    spin_unlock_irqrestore(&group->vm_lock, vm_flags);
 
-        region = region->next;
+    if (!arch_irq_enabled()) {
+        return false;
     }
 
-    return NULL;
+    return sched_wait_on(&group->vm_wait, seq, 0, 0) != SCHED_WAIT_ABORTED;
+}
+
+void sched_clear_user_regions(sched_thread_t *thread) {
+    if (!thread) {
+        return;
+    }
+
+    sched_region_tree_free(&sched_group(thread)->regions);
+    sched_set_user_mem(thread, 0);
 }
 
 bool sched_mark_cow(sched_thread_t *thread, sched_user_region_t *region) {
@@ -180,8 +478,9 @@ bool sched_mark_cow(sched_thread_t *thread, sched_user_region_t *region) {
         uintptr_t vaddr = region->vaddr + i * PAGE_4KIB;
         page_t *entry = NULL;
 
+        // large leaves are write protected whole and split on the first COW fault
         size_t size = arch_get_page(root, vaddr, &entry);
-        if (!entry || size != PAGE_4KIB) {
+        if (!entry || !size) {
             continue;
         }
 
@@ -194,7 +493,13 @@ bool sched_mark_cow(sched_thread_t *thread, sched_user_region_t *region) {
     return updated;
 }
 
-static bool split_page_region(sched_user_region_t *region, size_t page_index, uintptr_t new_page_paddr, u64 new_flags) {
+bool sched_region_split_page(
+    sched_thread_t *thread,
+    sched_user_region_t *region,
+    size_t page_index,
+    uintptr_t new_page_paddr,
+    u64 new_flags
+) {
     if (!region || !region->pages || page_index >= region->pages) {
         return false;
     }
@@ -207,59 +512,20 @@ static bool split_page_region(sched_user_region_t *region, size_t page_index, ui
     size_t after = region->pages - page_index - 1;
     uintptr_t page_vaddr = region->vaddr + page_index * PAGE_4KIB;
     uintptr_t old_page_paddr = region->paddr + page_index * PAGE_4KIB;
-    sched_user_region_t *next = region->next;
-
-    if (!before && !after) {
-        region->vaddr = page_vaddr;
-        region->paddr = new_page_paddr;
-        region->pages = 1;
-        region->flags = new_flags;
-        return true;
-    }
-
-    if (!before) {
-        sched_user_region_t *after_region = NULL;
-        if (after > 0) {
-            after_region = calloc(1, sizeof(*after_region));
-
-            if (!after_region) {
-                return false;
-            }
 
-            after_region->vaddr = page_vaddr + PAGE_4KIB;
-            after_region->paddr = old_page_paddr + PAGE_4KIB;
-            after_region->pages = after;
-            after_region->flags = region->flags;
-            after_region->next = next;
-        }
-
-        region->vaddr = page_vaddr;
-        region->paddr = new_page_paddr;
-        region->pages = 1;
-        region->flags = new_flags;
-        region->next = after_region ? after_region : next;
-        return true;
-    }
+    // allocate every node up front so a failure leaves the tree untouched
+    sched_user_region_t *page_region = NULL;
+    sched_user_region_t *after_region = NULL;
 
-    if (before > 0) {
-        sched_user_region_t *page_region = calloc(1, sizeof(*page_region));
+    if (before) {
+        page_region = calloc(1, sizeof(*page_region));
         if (!page_region) {
             return false;
         }
+    }
 
-        page_region->vaddr = page_vaddr;
-        page_region->paddr = new_page_paddr;
-        page_region->pages = 1;
-        page_region->flags = new_flags;
-
-        if (!after) {
-            region->pages = before;
-            page_region->next = next;
-            region->next = page_region;
-            return true;
-        }
-
-        sched_user_region_t *after_region = calloc(1, sizeof(*after_region));
+    if (after) {
+        after_region = calloc(1, sizeof(*after_region));
         if (!after_region) {
             free(page_region);
             return false;
@@ -269,15 +535,31 @@ static bool split_page_region(sched_user_region_t *region, size_t page_index, ui
         after_region->paddr = old_page_paddr + PAGE_4KIB;
         after_region->pages = after;
         after_region->flags = region->flags;
-        after_region->next = next;
+    }
 
+    if (before) {
+        page_region->vaddr = page_vaddr;
+        page_region->paddr = new_page_paddr;
+        page_region->pages = 1;
+        page_region->flags = new_flags;
         region->pages = before;
-        region->next = page_region;
-        page_region->next = after_region;
-        return true;
+    } else {
+        region->paddr = new_page_paddr;
+        region->pages = 1;
+        region->flags = new_flags;
+    }
+
+    sched_region_update(region);
+
+    if (page_region) {
+        sched_region_insert(thread, page_region);
+    }
+
+    if (after_region) {
+        sched_region_insert(thread, after_region);
     }
 
-    return false;
+    return true;
 }
 
 bool sched_handle_cow_fault(sched_thread_t *thread, uintptr_t addr, bool write) {
@@ -285,37 +567,48 @@ bool sched_handle_cow_fault(sched_thread_t *thread, uintptr_t addr, bool write)
         return false;
     }
 
-    unsigned long vm_flags = spin_lock_irqsave(&thread->vm_lock);
+    sched_thread_t *group = sched_group(thread);
+    unsigned long vm_flags = spin_lock_irqsave(&group->vm_lock);
+
+    // sleep out the other thread's region syscall, the fault is retried after
+    if (sched_vm_held_elsewhere(group)) {
+        sched_vm_wait_unlock(group, vm_flags);
+        return true;
+    }
 
     uintptr_t page_addr = ALIGN_DOWN(addr, PAGE_4KIB);
-    sched_user_region_t *region = find_user_region(thread, page_addr);
+    sched_user_region_t *region = sched_region_find(thread, page_addr);
 
     if (!region) {
-        spin_unlock_irqrestore(&thread->vm_lock, vm_flags);
+        spin_unlock_irqrestore(&group->vm_lock, vm_flags);
         return false;
     }
 
     if (!(region->flags & SCHED_REGION_COW)) {
-        spin_unlock_irqrestore(&thread->vm_lock, vm_flags);
+        spin_unlock_irqrestore(&group->vm_lock, vm_flags);
         return false;
     }
 
     page_t *root = arch_vm_root(thread->vm_space);
     if (!root) {
-        spin_unlock_irqrestore(&thread->vm_lock, vm_flags);
+        spin_unlock_irqrestore(&group->vm_lock, vm_flags);
         return false;
     }
 
     page_t *entry = NULL;
     size_t size = arch_get_page(root, page_addr, &entry);
 
+    if (entry && size > PAGE_4KIB && arch_split_page(root, page_addr)) {
+        size = arch_get_page(root, page_addr, &entry);
+    }
+
     if (!entry || size != PAGE_4KIB) {
-        spin_unlock_irqrestore(&thread->vm_lock, vm_flags);
+        spin_unlock_irqrestore(&group->vm_lock, vm_flags);
         return false;
     }
 
     if (*entry & PT_WRITE) {
-        spin_unlock_irqrestore(&thread->vm_lock, vm_flags);
+        spin_unlock_irqrestore(&group->vm_lock, vm_flags);
         return false;
     }
 
@@ -331,39 +624,39 @@ bool sched_handle_cow_fault(sched_thread_t *thread, uintptr_t addr, bool write)
     if (refs > 1) {
         uintptr_t new_paddr = (uintptr_t)arch_alloc_frames_user(1);
         if (!new_paddr) {
-            spin_unlock_irqrestore(&thread->vm_lock, vm_flags);
+            spin_unlock_irqrestore(&group->vm_lock, vm_flags);
             return false;
         }
 
         if (!arch_phys_copy(new_paddr, old_paddr, PAGE_4KIB)) {
             arch_free_frames((void *)new_paddr, 1);
-            spin_unlock_irqrestore(&thread->vm_lock, vm_flags);
+            spin_unlock_irqrestore(&group->vm_lock, vm_flags);
             return false;
         }
 
-        bool split_ok = split_page_region(region, page_index, new_paddr, new_flags);
+        bool split_ok = sched_region_split_page(thread, region, page_index, new_paddr, new_flags);
 
         if (!split_ok) {
             arch_free_frames((void *)new_paddr, 1);
-            spin_unlock_irqrestore(&thread->vm_lock, vm_flags);
+            spin_unlock_irqrestore(&group->vm_lock, vm_flags);
             return false;
         }
 
         arch_map_region(root, 1, page_addr, new_paddr, new_flags);
         arch_free_frames((void *)(uintptr_t)old_paddr, 1);
     } else {
-        bool split_ok = split_page_region(region, page_index, (uintptr_t)old_paddr, new_flags);
+        bool split_ok = sched_region_split_page(thread, region, page_index, (uintptr_t)old_paddr, new_flags);
 
         if (!split_ok) {
-            spin_unlock_irqrestore(&thread->vm_lock, vm_flags);
+            spin_unlock_irqrestore(&group->vm_lock, vm_flags);
             return false;
         }
 
         arch_map_region(root, 1, page_addr, old_paddr, new_flags);
     }
 
-    arch_tlb_flush(page_addr);
-    spin_unlock_irqrestore(&thread->vm_lock, vm_flags);
+    arch_tlb_flush_range(thread->vm_space, page_addr, page_addr + PAGE_4KIB);
+    spin_unlock_irqrestore(&group->vm_lock, vm_flags);
 
     return true;
 }
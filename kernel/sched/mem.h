@@ -2,4 +2,13 @@
 
 #include "scheduler.h"
 
+bool sched_vm_held_elsewhere(const sched_thread_t *group);
+bool sched_vm_wait_unlock(sched_thread_t *group, unsigned long vm_flags);
 bool sched_mark_cow(sched_thread_t *thread, sched_user_region_t *region);
+bool sched_region_split_page(
+    sched_thread_t *thread,
+    sched_user_region_t *region,
+    size_t page_index,
+    uintptr_t new_page_paddr,
+    u64 new_flags
+);
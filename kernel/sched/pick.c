@@ -1,181 +1,168 @@
 #include "internal.h"
 
-static void make_zombie(sched_thread_t *thread, int code) {
-    // zombies leave the run queues but stay visible until the parent waits
-    thread_unclaim(thread);
-    thread_set_state(thread, THREAD_ZOMBIE);
-    thread->exit_code = code;
-    thread->exit_signal = 0;
-
-    if (sched_state.procs.zombie_list && !thread->in_zombie_list) {
-        thread->zombie_node.data = thread;
-        list_append(sched_state.procs.zombie_list, &thread->zombie_node);
-        thread->in_zombie_list = true;
-    }
-
-    exit_event_push(thread->pid);
-}
-
-static bool ready_to_run(sched_thread_t *thread) {
-    if (!thread->context) {
-        if (thread_get_state(thread) == THREAD_READY && !thread->on_rq) {
-            enqueue_thread(thread);
-        }
-
-        return false;
-    }
-
-    bool invalid_context = thread_ctx_ok(thread) && !ctx_valid(thread);
-    if (invalid_context) {
-        make_zombie(thread, -EFAULT);
-        return false;
-    }
-
-    if (thread_get_state(thread) != THREAD_READY) {
-        bool orphaned_running = thread_get_state(thread) == THREAD_RUNNING && !thread_is_owned(thread);
-
-        if (orphaned_running) {
-            sched_repair_thread(thread, true);
-        }
-
-        return false;
-    }
-
-    if (thread_cpu(thread) < 0) {
-        return true;
-    }
-
-    if (thread_is_owned(thread)) {
-        return false;
-    }
-
-    thread_set_cpu(thread, -1);
-    return true;
-}
-
-static sched_thread_t *pick_local(size_t cpu_id) {
-    sched_thread_t *thread = NULL;
-
-    while ((thread = rq_pop_best_allowed(cpu_id))) {
-        if (ready_to_run(thread)) {
-            return thread;
-        }
-    }
-
-    return NULL;
-}
-
-static sched_thread_t *rescue_stranded(size_t cpu_id) {
+static void rescue_stranded(size_t cpu_id) {
     // affinity changes can strand runnable threads on queues they can no longer run on
-    sched_thread_t *stranded = rq_take_unfit(cpu_id, cpu_id);
-    if (!stranded) {
-        return NULL;
+    size_t target_cpu = MAX_CORES;
+    if (!rq_move_unfit(cpu_id, &target_cpu)) {
+        return;
     }
 
-    size_t target_cpu = pick_cpu(stranded, cpu_id);
-    bool target_ok = target_cpu < MAX_CORES && target_cpu != cpu_id;
-    bool target_online = target_ok && cores_local[target_cpu].online;
-    bool can_move = target_online && sched_cpu_allowed(stranded, target_cpu);
-
-    if (!can_move) {
-        rq_enqueue_cpu(stranded, cpu_id);
-        return rq_pop_best_allowed(cpu_id);
-    }
-
-    stranded->last_cpu = target_cpu;
-    stranded->affinity_core = target_cpu;
-    rq_enqueue_cpu(stranded, target_cpu);
     __atomic_fetch_add(&sched_state.metrics.migrations, 1, __ATOMIC_RELAXED);
 
     if (wake_cpu(target_cpu)) {
         __atomic_fetch_add(&sched_state.metrics.wake_ipi, 1, __ATOMIC_RELAXED);
     }
-
-    return rq_pop_best_allowed(cpu_id);
 }
 
+// domains are searched from the innermost out and the first one with a
+// queue worth raiding wins, so work only leaves a cache when none inside it can
 static size_t busiest_peer(size_t cpu_id, size_t *load_out) {
-    size_t cpu = MAX_CORES;
-    size_t best_load = 0;
+    u64 online = sched_online_cpu_mask();
+    u64 seen = 1ULL << cpu_id;
 
-    for (size_t i = 0; i < core_count && i < MAX_CORES; i++) {
-        if (i == cpu_id || !cores_local[i].valid || !cores_local[i].online) {
-            continue;
+    for (size_t level = 0; level < SCHED_DOMAIN_COUNT; level++) {
+        u64 span = sched_domain_span(cpu_id, level) & online & ~seen;
+        size_t cpu = MAX_CORES;
+        size_t best_load = 0;
+
+        seen |= span;
+
+        for (; span; span &= span - 1) {
+            size_t peer = (size_t)__builtin_ctzll(span);
+            size_t load = sched_cpu_load(peer);
+
+            if (load > best_load) {
+                best_load = load;
+                cpu = peer;
+            }
         }
 
-        size_t load = sched_cpu_load(i);
-        if (load > best_load) {
-            best_load = load;
-            cpu = i;
+        if (best_load >= 2) {
+            *load_out = best_load;
+            return cpu;
         }
     }
 
-    *load_out = best_load;
-    return cpu;
+    *load_out = 0;
+    return MAX_CORES;
 }
 
-static sched_thread_t *steal_idle_work(size_t cpu_id) {
+static void steal_idle_work(size_t cpu_id) {
     size_t load = 0;
     size_t cpu = busiest_peer(cpu_id, &load);
 
     if (cpu >= MAX_CORES || load < 2) {
-        return NULL;
+        return;
     }
 
-    sched_thread_t *first = NULL;
-
-    // keep one stolen thread local and enqueue the rest behind it for fairness
+    // stolen threads go straight onto this queue and the best of them runs;
+    // an idle cpu would rather run a cache hot thread than none, but only one
     for (size_t i = 0; i < SCHED_IDLE_STEAL_BATCH; i++) {
-        sched_thread_t *victim = rq_take_worst(cpu, cpu_id);
+        sched_thread_t *victim = rq_move_worst(cpu, cpu_id, false);
+
+        if (!victim && !i) {
+            victim = rq_move_worst(cpu, cpu_id, true);
+        }
 
         if (!victim) {
             break;
         }
 
-        victim->last_cpu = cpu_id;
-        victim->affinity_core = cpu_id;
         __atomic_fetch_add(&sched_state.metrics.steals, 1, __ATOMIC_RELAXED);
         __atomic_fetch_add(&sched_state.metrics.migrations, 1, __ATOMIC_RELAXED);
+    }
+}
 
-        if (!first) {
-            first = victim;
-            continue;
-        }
-
-        rq_enqueue_cpu(victim, cpu_id);
+// a thread picked from the queue may still be mid-teardown on another cpu;
+// switching to a half built context would jump to garbage
+static bool invalid_context(const sched_thread_t *thread) {
+    if (!thread_ctx_ok(thread)) {
+        return false;
     }
 
-    return first;
+    return !thread->context || !ctx_valid(thread);
 }
 
-sched_thread_t *dequeue_thread(void) {
-    size_t cpu_id = sched_cpu_id();
-    sched_flush_handoff(cpu_id);
-
-    sched_thread_t *thread = pick_local(cpu_id);
-    if (thread) {
-        return thread;
+// the process lock is only tried from here, since picks run from the timer
+// interrupt; a thread left unretired goes back on the queue for the next pick
+static bool retire_bad(sched_thread_t *thread) {
+    unsigned long flags = 0;
+    if (!sched_lock_try_save(&flags)) {
+        return false;
     }
 
-    thread = rescue_stranded(cpu_id);
-    if (thread) {
-        return thread;
+    unsigned long rq_flags = 0;
+    size_t home_cpu = rq_lock_home(thread, &rq_flags);
+
+    thread_set_state(thread, THREAD_ZOMBIE);
+    thread->exit_code = -EFAULT;
+    thread->exit_signal = 0;
+    rq_unlock_cpu(home_cpu, rq_flags);
+
+    if (sched_state.procs.zombie_list && !thread->in_zombie_list) {
+        thread->zombie_node.data = thread;
+        list_append(sched_state.procs.zombie_list, &thread->zombie_node);
+        thread->in_zombie_list = true;
     }
 
-    return steal_idle_work(cpu_id);
+    sched_lock_restore(flags);
+    exit_event_push(thread->pid);
+
+    return true;
 }
 
-sched_thread_t *pick_next_thread(void) {
-    sched_thread_t *next = dequeue_thread();
-    if (next) {
-        return next;
-    }
+static void pull_work(size_t cpu_id) {
+    rescue_stranded(cpu_id);
 
-    if (sched_local_idle()) {
-        return sched_local_idle();
+    if (!sched_rq_depth(cpu_id)) {
+        steal_idle_work(cpu_id);
     }
+}
+
+// returns with the cpu's queue locked whether or not it found a thread, so the
+// caller commits the switch before anyone sees the queue without it; work is
+// only pulled from elsewhere once this queue turns out to be empty
+sched_thread_t *pick_next_thread(size_t cpu_id, unsigned long *flags_out) {
+    sched_cpu_t *local = &sched_state.cpus.cpu[cpu_id];
+    bool pulled = false;
+
+    for (;;) {
+        unsigned long flags = rq_lock_cpu(cpu_id);
+
+        // the outgoing thread is staged under this lock, so the last one has to go first
+        if (__atomic_load_n(&local->handoff_ready, __ATOMIC_ACQUIRE)) {
+            rq_unlock_cpu(cpu_id, flags);
+            sched_flush_handoff(cpu_id);
+            continue;
+        }
+
+        sched_thread_t *next = rq_pop_locked(cpu_id);
+
+        if (next && invalid_context(next)) {
+            rq_unlock_cpu(cpu_id, flags);
 
-    return sched_local_current();
+            if (retire_bad(next)) {
+                continue;
+            }
+
+            // nothing else is picked past it this time round, or it would
+            // come straight back off the queue on every retry
+            rq_enqueue_cpu(next, cpu_id);
+            sched_set_resched(true);
+
+            *flags_out = rq_lock_cpu(cpu_id);
+            return NULL;
+        }
+
+        if (next || pulled) {
+            *flags_out = flags;
+            return next;
+        }
+
+        rq_unlock_cpu(cpu_id, flags);
+        pull_work(cpu_id);
+        pulled = true;
+    }
 }
 
 sched_thread_t *pick_init_thread(void) {
@@ -201,10 +188,9 @@ sched_thread_t *pick_init_thread(void) {
             }
 
             rq_remove_index(rq, j);
-            spin_unlock_irqrestore(&rq->lock, flags);
-
             thread->last_cpu = cpu_id;
             thread->affinity_core = cpu_id;
+            spin_unlock_irqrestore(&rq->lock, flags);
 
             return thread;
         }
@@ -45,12 +45,13 @@ bool sched_proc_snapshot(pid_t pid, sched_proc_snapshot_t *out) {
         out->gid = thread->rgid;
         out->egid = thread->gid;
         out->sgid = thread->sgid;
-        out->umask = thread->umask & 0777;
+        out->umask = sched_group(thread)->umask & 0777;
         out->signal_pending = __atomic_load_n(&thread->signal_pending, __ATOMIC_ACQUIRE);
         out->signal_mask = __atomic_load_n(&thread->signal_mask, __ATOMIC_ACQUIRE);
         out->state = thread_get_state(thread);
         out->core_id = -1;
         out->tty_index = thread->tty_index;
+        out->nice = thread->nice;
 
         for (size_t i = 0; i < MAX_CORES; i++) {
             if (sched_state.cpus.cpu[i].current == thread) {
@@ -87,6 +88,38 @@ bool sched_proc_snapshot(pid_t pid, sched_proc_snapshot_t *out) {
     return found;
 }
 
+// referenced live user process with the lowest pid above `after`, NULL when
+// there is none or the scheduler lock is busy; callers may be running from reclaim
+sched_thread_t *sched_next_user_thread(pid_t after) {
+    unsigned long flags = 0;
+    if (!sched_state.procs.all_list || !sched_lock_try_save(&flags)) {
+        return NULL;
+    }
+
+    sched_thread_t *next = NULL;
+
+    ll_foreach(node, sched_state.procs.all_list) {
+        sched_thread_t *thread = node->data;
+
+        if (!thread || !thread->user_thread || thread->group_leader || thread->pid <= after) {
+            continue;
+        }
+
+        if (thread_get_state(thread) == THREAD_ZOMBIE || thread->lifecycle_flags) {
+            continue;
+        }
+
+        if (!next || thread->pid < next->pid) {
+            next = thread;
+        }
+    }
+
+    thread_get(next);
+    sched_lock_restore(flags);
+
+    return next;
+}
+
 void sched_cpu_usage(u64 *busy_ticks_out, u64 *total_ticks_out) {
     if (busy_ticks_out) {
         *busy_ticks_out = __atomic_load_n(&sched_state.usage.busy_ticks, __ATOMIC_RELAXED);
@@ -132,6 +165,45 @@ void sched_stats(sched_stats_t *out) {
     out->sched_runqueue_max = __atomic_load_n(&sched_state.metrics.runqueue_max, __ATOMIC_RELAXED);
     out->sched_balance_runs = __atomic_load_n(&sched_state.metrics.balance_runs, __ATOMIC_RELAXED);
     out->wait_timeout_count = __atomic_load_n(&sched_state.metrics.wait_timeout_count, __ATOMIC_RELAXED);
+    out->sched_wake_affine = __atomic_load_n(&sched_state.metrics.wake_affine, __ATOMIC_RELAXED);
+    out->sched_wake_prev = __atomic_load_n(&sched_state.metrics.wake_prev, __ATOMIC_RELAXED);
+    out->sched_hot_skips = __atomic_load_n(&sched_state.metrics.hot_skips, __ATOMIC_RELAXED);
+}
+
+bool sched_proc_latency(pid_t pid, sched_latency_t *out) {
+    if (pid <= 0 || !out || !sched_state.procs.all_list) {
+        return false;
+    }
+
+    sched_thread_t *thread = sched_find_thread(pid);
+    if (!thread) {
+        return false;
+    }
+
+    // bumped by the switch that runs it, under the queue it was picked from
+    unsigned long flags = 0;
+    size_t cpu_id = rq_lock_home(thread, &flags);
+    *out = thread->latency;
+    rq_unlock_cpu(cpu_id, flags);
+
+    thread_put(thread);
+
+    return true;
+}
+
+// bumped under the cpu's run queue lock but read without it, a sample more or
+// less is fine
+void sched_cpu_latency(size_t cpu_id, sched_latency_t *out) {
+    if (!out) {
+        return;
+    }
+
+    if (cpu_id >= MAX_CORES) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+
+    *out = sched_state.cpus.cpu[cpu_id].latency;
 }
 
 void sched_record_syscall(void) {
@@ -186,10 +258,11 @@ bool sched_proc_cwd(pid_t pid, char *out, size_t out_len) {
     sched_thread_t *thread = find_thread(pid);
 
     if (thread) {
-        size_t len = strnlen(thread->cwd, sizeof(thread->cwd));
+        const char *cwd = sched_group(thread)->cwd;
+        size_t len = strnlen(cwd, sizeof(thread->cwd));
 
         if (len + 1 <= out_len) {
-            memcpy(out, thread->cwd, len);
+            memcpy(out, cwd, len);
             out[len] = '\0';
             found = true;
         }
@@ -211,7 +284,8 @@ int sched_signal_send_pgrp(pid_t pgid, int signum) {
     ll_foreach(node, sched_state.procs.all_list) {
         sched_thread_t *thread = node->data;
 
-        if (!thread || thread->pgid != pgid) {
+        // a clone group gets one signal, through its leader
+        if (!thread || thread->group_leader || thread->pgid != pgid) {
             continue;
         }
 
@@ -244,7 +318,7 @@ int sched_signal_pgrp_as(pid_t pgid, int signum, const sched_thread_t *sender) {
     ll_foreach(node, sched_state.procs.all_list) {
         sched_thread_t *thread = node->data;
 
-        if (!thread || thread->pgid != pgid) {
+        if (!thread || thread->group_leader || thread->pgid != pgid) {
             continue;
         }
 
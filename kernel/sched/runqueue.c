@@ -1,7 +1,8 @@
 #include "internal.h"
 
-// orders the heap by virtual runtime, so the thread that has had the least cpu
-// runs next; the later keys only break ties so the order stays total and stable
+// real time threads come first by priority and then in arrival order; fair
+// ones by virtual runtime, so the thread that has had the least cpu runs next.
+// The later keys only break ties so the order stays total and stable
 static inline bool rq_less(const sched_thread_t *a, const sched_thread_t *b) {
     if (!a) {
         return false;
@@ -11,6 +12,17 @@ static inline bool rq_less(const sched_thread_t *a, const sched_thread_t *b) {
         return true;
     }
 
+    u32 a_rank = sched_rank(a);
+    u32 b_rank = sched_rank(b);
+
+    if (a_rank != b_rank) {
+        return a_rank > b_rank;
+    }
+
+    if (a_rank && a->rt_seq != b->rt_seq) {
+        return a->rt_seq < b->rt_seq;
+    }
+
     if (a->vruntime_ns != b->vruntime_ns) {
         return a->vruntime_ns < b->vruntime_ns;
     }
@@ -30,11 +42,20 @@ static bool rq_runnable(const sched_thread_t *thread) {
     return thread->context && thread->pid != 0;
 }
 
+// taken off the queue to run only once no cpu still owns it either
+static bool rq_pickable(const sched_thread_t *thread) {
+    return rq_runnable(thread) && thread_cpu(thread) < 0;
+}
+
 static bool rq_worse_than(const sched_thread_t *thread, const sched_thread_t *best) {
     if (!best) {
         return true;
     }
 
+    if (sched_rank(thread) != sched_rank(best)) {
+        return sched_rank(thread) < sched_rank(best);
+    }
+
     if (thread->vruntime_ns != best->vruntime_ns) {
         return thread->vruntime_ns > best->vruntime_ns;
     }
@@ -99,9 +120,15 @@ static bool rq_insert(sched_rq_t *rq, sched_thread_t *thread) {
 
     u32 index = (u32)rq->nr_running;
 
+    // a real time thread that blocked, yielded or used up its turn queues last
+    if (sched_rank(thread) && !thread->rt_seq) {
+        thread->rt_seq = __atomic_add_fetch(&sched_state.cpus.rt_seq, 1, __ATOMIC_RELAXED);
+    }
+
     rq->heap[index] = thread;
     thread->rq_index = index;
     rq->nr_running++;
+    rq->load_weight += thread->weight;
 
     rq_sift_up(rq, index);
 
@@ -144,6 +171,7 @@ bool rq_remove_index(sched_rq_t *rq, u32 index) {
 
     rq->heap[last] = NULL;
     rq->nr_running = last;
+    rq->load_weight -= min(rq->load_weight, (u64)removed->weight);
 
     removed->rq_index = UINT32_MAX;
     removed->on_rq = false;
@@ -174,76 +202,104 @@ bool rq_remove_index(sched_rq_t *rq, u32 index) {
     return true;
 }
 
-void rq_enqueue_cpu(sched_thread_t *thread, size_t cpu_id) {
-    if (!thread || cpu_id >= MAX_CORES) {
-        return;
-    }
+// migrations hold both queues so the thread is never on neither of them; the
+// lower cpu always goes first so two cpus moving work at each other can't deadlock
+static unsigned long rq_lock_pair(sched_rq_t *source, sched_rq_t *target) {
+    sched_rq_t *first = source < target ? source : target;
+    sched_rq_t *second = source < target ? target : source;
 
-    if (!sched_cpu_allowed(thread, cpu_id) || !cores_local[cpu_id].online) {
-        size_t allowed_cpu = pick_cpu(thread, cpu_id);
-        bool valid_cpu = allowed_cpu < MAX_CORES && cores_local[allowed_cpu].online;
+    unsigned long flags = spin_lock_irqsave(&first->lock);
 
-        if (!valid_cpu || !sched_cpu_allowed(thread, allowed_cpu)) {
-            return;
-        }
-
-        cpu_id = allowed_cpu;
+    if (second != first) {
+        spin_lock(&second->lock);
     }
 
-    if (!rq_runnable(thread)) {
-        return;
-    }
+    return flags;
+}
+
+static void rq_unlock_pair(sched_rq_t *source, sched_rq_t *target, unsigned long flags) {
+    sched_rq_t *first = source < target ? source : target;
+    sched_rq_t *second = source < target ? target : source;
 
-    if (thread->on_rq && thread->last_cpu != cpu_id) {
-        (void)rq_remove_thread(thread);
+    if (second != first) {
+        spin_unlock(&second->lock);
     }
 
-    if (thread_cpu(thread) >= 0) {
-        bool busy = thread_is_owned(thread) || thread_get_state(thread) == THREAD_RUNNING;
+    spin_unlock_irqrestore(&first->lock, flags);
+}
 
-        if (busy) {
-            return;
+// the home can only move under the lock it names, so once it reads the same
+// with that lock held it stays put until the lock is dropped
+size_t rq_lock_home(const sched_thread_t *thread, unsigned long *flags_out) {
+    for (;;) {
+        size_t cpu_id = thread_home_cpu(thread);
+        unsigned long flags = rq_lock_cpu(cpu_id);
+
+        if (thread_home_cpu(thread) == cpu_id) {
+            *flags_out = flags;
+            return cpu_id;
         }
 
-        // recover stale running_cpu metadata only for non running states
-        thread_set_cpu(thread, -1);
+        rq_unlock_cpu(cpu_id, flags);
     }
+}
 
-    sched_rq_t *rq = &sched_state.cpus.runqueues[cpu_id];
-    unsigned long flags = spin_lock_irqsave(&rq->lock);
+size_t rq_lock_home_pair(const sched_thread_t *thread, size_t target_cpu, unsigned long *flags_out) {
+    sched_rq_t *target = &sched_state.cpus.runqueues[target_cpu];
 
-    if (thread->on_rq || thread->rq_index != UINT32_MAX) {
-        bool same_cpu = thread->last_cpu == cpu_id;
-        bool valid_index = thread->rq_index < rq->nr_running;
+    for (;;) {
+        size_t cpu_id = thread_home_cpu(thread);
+        sched_rq_t *home = &sched_state.cpus.runqueues[cpu_id];
+        unsigned long flags = rq_lock_pair(home, target);
 
-        if (same_cpu && valid_index && rq->heap[thread->rq_index] == thread) {
-            spin_unlock_irqrestore(&rq->lock, flags);
-            return;
+        if (thread_home_cpu(thread) == cpu_id) {
+            *flags_out = flags;
+            return cpu_id;
         }
 
-        int found = rq_find_index(rq, thread);
+        rq_unlock_pair(home, target, flags);
+    }
+}
 
-        if (found >= 0) {
-            thread->rq_index = (u32)found;
-            thread->on_rq = true;
-            thread->in_run_queue = true;
-            thread->last_cpu = cpu_id;
-            spin_unlock_irqrestore(&rq->lock, flags);
-            return;
-        }
+void rq_unlock_home_pair(size_t home_cpu, size_t target_cpu, unsigned long flags) {
+    rq_unlock_pair(&sched_state.cpus.runqueues[home_cpu], &sched_state.cpus.runqueues[target_cpu], flags);
+}
 
-        thread->on_rq = false;
-        thread->in_run_queue = false;
-        thread->rq_index = UINT32_MAX;
+static bool rq_move_locked(sched_rq_t *source, sched_rq_t *target, u32 index, size_t target_cpu) {
+    sched_thread_t *thread = source->heap[index];
+
+    if (!thread || !target->heap || target->nr_running >= target->capacity) {
+        return false;
     }
 
+    rq_remove_index(source, index);
+
+    if (thread->vruntime_ns < target->min_vruntime) {
+        thread->vruntime_ns = target->min_vruntime;
+    }
+
+    rq_insert(target, thread);
+
+    thread->on_rq = true;
+    thread->in_run_queue = true;
+    thread->last_cpu = target_cpu;
+    thread->affinity_core = target_cpu;
+
+    target->min_vruntime = target->heap[0]->vruntime_ns;
+
+    return true;
+}
+
+// caller holds the queue lock and has checked the thread may be queued
+bool rq_enqueue_locked(sched_thread_t *thread, size_t cpu_id) {
+    sched_rq_t *rq = &sched_state.cpus.runqueues[cpu_id];
+
     if (thread->vruntime_ns < rq->min_vruntime) {
         thread->vruntime_ns = rq->min_vruntime;
     }
 
     if (!rq_insert(rq, thread)) {
-        spin_unlock_irqrestore(&rq->lock, flags);
-        return;
+        return false;
     }
 
     thread->on_rq = true;
@@ -251,14 +307,67 @@ void rq_enqueue_cpu(sched_thread_t *thread, size_t cpu_id) {
     thread->last_cpu = cpu_id;
     thread->affinity_core = cpu_id;
 
-    if (rq->nr_running > 0 && rq->heap[0]) {
-        rq->min_vruntime = rq->heap[0]->vruntime_ns;
+    // moving between runqueues keeps the first stamp, the wait is the same one
+    if (!thread->rq_enqueue_ns) {
+        thread->rq_enqueue_ns = arch_timer_ns();
     }
 
-    size_t depth = rq->nr_running;
-    spin_unlock_irqrestore(&rq->lock, flags);
+    rq->min_vruntime = rq->heap[0]->vruntime_ns;
+    rq_note_depth(rq->nr_running);
 
-    rq_note_depth(depth);
+    return true;
+}
+
+static int rq_index_of(const sched_rq_t *rq, const sched_thread_t *thread) {
+    u32 index = thread->rq_index;
+
+    if ((size_t)index < rq->nr_running && rq->heap[index] == thread) {
+        return (int)index;
+    }
+
+    return rq_find_index(rq, thread);
+}
+
+// a queued thread is moved across rather than dropped and reinserted, and one
+// that is owned by a cpu or no longer ready is left to whoever changed it
+void rq_enqueue_cpu(sched_thread_t *thread, size_t cpu_id) {
+    if (!thread || cpu_id >= MAX_CORES) {
+        return;
+    }
+
+    if (!sched_cpu_allowed(thread, cpu_id) || !cores_local[cpu_id].online) {
+        size_t allowed_cpu = pick_cpu(thread, cpu_id);
+        bool valid_cpu = allowed_cpu < MAX_CORES && cores_local[allowed_cpu].online;
+
+        if (!valid_cpu || !sched_cpu_allowed(thread, allowed_cpu)) {
+            return;
+        }
+
+        cpu_id = allowed_cpu;
+    }
+
+    unsigned long flags = 0;
+    size_t home_cpu = rq_lock_home_pair(thread, cpu_id, &flags);
+
+    sched_rq_t *home = &sched_state.cpus.runqueues[home_cpu];
+    sched_rq_t *target = &sched_state.cpus.runqueues[cpu_id];
+
+    if (!rq_pickable(thread)) {
+        rq_unlock_home_pair(home_cpu, cpu_id, flags);
+        return;
+    }
+
+    if (!thread->on_rq) {
+        rq_enqueue_locked(thread, cpu_id);
+    } else if (home != target) {
+        int found = rq_index_of(home, thread);
+
+        if (found >= 0 && rq_move_locked(home, target, (u32)found, cpu_id)) {
+            rq_note_depth(target->nr_running);
+        }
+    }
+
+    rq_unlock_home_pair(home_cpu, cpu_id, flags);
 }
 
 static bool rq_remove_cpu(sched_rq_t *rq, sched_thread_t *thread) {
@@ -294,36 +403,43 @@ static bool rq_remove_cpu(sched_rq_t *rq, sched_thread_t *thread) {
     return rq_remove_index(rq, thread->rq_index);
 }
 
-bool rq_remove_thread(sched_thread_t *thread) {
-    if (!thread || !thread->on_rq) {
+// caller holds the thread's home queue lock
+bool rq_remove_locked(sched_thread_t *thread) {
+    if (!thread->on_rq) {
         return false;
     }
 
-    sched_rq_t *rq = &sched_state.cpus.runqueues[thread->last_cpu];
+    bool removed = rq_remove_cpu(&sched_state.cpus.runqueues[thread_home_cpu(thread)], thread);
 
-    unsigned long flags = spin_lock_irqsave(&rq->lock);
-    bool removed = rq_remove_cpu(rq, thread);
-    spin_unlock_irqrestore(&rq->lock, flags);
+    // taken off without running, so the wait it was in never finished
+    if (removed) {
+        thread->rq_enqueue_ns = 0;
+    }
 
     return removed;
 }
 
-sched_thread_t *rq_pop_best_allowed(size_t cpu_id) {
-    if (cpu_id >= MAX_CORES) {
-        return NULL;
+bool rq_remove_thread(sched_thread_t *thread) {
+    if (!thread || !thread->on_rq) {
+        return false;
     }
 
-    sched_rq_t *rq = &sched_state.cpus.runqueues[cpu_id];
-    unsigned long flags = spin_lock_irqsave(&rq->lock);
+    unsigned long flags = 0;
+    size_t cpu_id = rq_lock_home(thread, &flags);
+    bool removed = rq_remove_locked(thread);
+    rq_unlock_cpu(cpu_id, flags);
+
+    return removed;
+}
 
+// past its real time budget a cpu passes over real time threads while there
+// is fair work to run instead
+static u32 rq_best_index(const sched_rq_t *rq, size_t cpu_id, bool skip_rt) {
     if (rq->nr_running) {
         sched_thread_t *root = rq->heap[0];
 
-        if (root && sched_cpu_allowed(root, cpu_id)) {
-            rq_remove_index(rq, 0);
-            spin_unlock_irqrestore(&rq->lock, flags);
-
-            return root;
+        if (rq_pickable(root) && sched_cpu_allowed(root, cpu_id) && !(skip_rt && sched_rank(root))) {
+            return 0;
         }
     }
 
@@ -333,7 +449,7 @@ sched_thread_t *rq_pop_best_allowed(size_t cpu_id) {
     for (u32 i = 0; (size_t)i < rq->nr_running; i++) {
         sched_thread_t *thread = rq->heap[i];
 
-        if (!thread || !sched_cpu_allowed(thread, cpu_id)) {
+        if (!rq_pickable(thread) || !sched_cpu_allowed(thread, cpu_id) || (skip_rt && sched_rank(thread))) {
             continue;
         }
 
@@ -343,121 +459,236 @@ sched_thread_t *rq_pop_best_allowed(size_t cpu_id) {
         }
     }
 
-    if (best && best_index != UINT32_MAX) {
-        rq_remove_index(rq, best_index);
-        spin_unlock_irqrestore(&rq->lock, flags);
-
-        return best;
+    if (best_index == UINT32_MAX && skip_rt) {
+        return rq_best_index(rq, cpu_id, false);
     }
 
-    spin_unlock_irqrestore(&rq->lock, flags);
-    return NULL;
+    return best_index;
 }
 
-sched_thread_t *rq_peek_best(size_t cpu_id) {
-    if (cpu_id >= MAX_CORES) {
-        return NULL;
+// a cpu that still names the thread but holds neither it nor its handoff lost
+// a switch that never landed. That cpu's lock guards the thread and comes
+// after this one, so it is only tried; the home moves straight to this queue
+static void rq_release_stale(sched_thread_t *thread, size_t cpu_id) {
+    size_t owner_cpu = thread_home_cpu(thread);
+    sched_rq_t *owner = &sched_state.cpus.runqueues[owner_cpu];
+
+    if (owner_cpu != cpu_id && !spin_try_lock(&owner->lock)) {
+        return;
     }
 
-    sched_rq_t *rq = &sched_state.cpus.runqueues[cpu_id];
-    unsigned long flags = spin_lock_irqsave(&rq->lock);
-    sched_thread_t *thread = NULL;
+    if (thread_cpu(thread) >= 0 && !thread_is_owned(thread)) {
+        thread->last_cpu = cpu_id;
+        thread_unclaim(thread);
+    }
 
-    if (rq->nr_running) {
-        sched_thread_t *root = rq->heap[0];
+    if (owner_cpu != cpu_id) {
+        spin_unlock(&owner->lock);
+    }
+}
+
+// the root is settled before the best thread is chosen. A thread that lost its
+// switch goes back to ready, one that blocked or exited while queued is dropped
+// since whatever readies it queues it again, and one still owned elsewhere or
+// without a context stays put and is passed over until it can run
+static void rq_settle_root(sched_rq_t *rq, size_t cpu_id) {
+    while (rq->nr_running) {
+        sched_thread_t *thread = rq->heap[0];
 
-        if (root && sched_cpu_allowed(root, cpu_id)) {
-            spin_unlock_irqrestore(&rq->lock, flags);
-            return root;
+        if (!thread || rq_pickable(thread)) {
+            return;
         }
-    }
 
-    for (u32 i = 0; (size_t)i < rq->nr_running; i++) {
-        sched_thread_t *item = rq->heap[i];
+        if (thread_cpu(thread) >= 0) {
+            rq_release_stale(thread, cpu_id);
 
-        if (!item || !sched_cpu_allowed(item, cpu_id)) {
+            if (thread_cpu(thread) >= 0) {
+                return;
+            }
+        }
+
+        thread_state_t state = thread_get_state(thread);
+        bool detached = !thread->in_wait_queue && !thread->sleep_queued;
+
+        if (state == THREAD_RUNNING || (state == THREAD_SLEEPING && detached)) {
+            thread_set_state(thread, THREAD_READY);
+        } else if (state != THREAD_READY) {
+            rq_remove_index(rq, 0);
             continue;
         }
 
-        if (!thread || rq_less(item, thread)) {
-            thread = item;
+        if (!rq_pickable(thread)) {
+            return;
         }
     }
+}
 
-    spin_unlock_irqrestore(&rq->lock, flags);
+// caller holds the queue lock
+sched_thread_t *rq_pop_locked(size_t cpu_id) {
+    sched_rq_t *rq = &sched_state.cpus.runqueues[cpu_id];
+
+    rq_settle_root(rq, cpu_id);
+
+    u32 index = rq_best_index(rq, cpu_id, sched_rt_throttled(cpu_id));
+    if (index == UINT32_MAX) {
+        return NULL;
+    }
+
+    sched_thread_t *thread = rq->heap[index];
+    rq_remove_index(rq, index);
 
     return thread;
 }
 
-sched_thread_t *rq_take_worst(size_t source_cpu, size_t target_cpu) {
-    if (source_cpu >= MAX_CORES || target_cpu >= MAX_CORES) {
+sched_thread_t *rq_peek_best(size_t cpu_id) {
+    if (cpu_id >= MAX_CORES) {
         return NULL;
     }
 
-    sched_rq_t *rq = &sched_state.cpus.runqueues[source_cpu];
+    bool throttled = sched_rt_throttled(cpu_id);
+    sched_rq_t *rq = &sched_state.cpus.runqueues[cpu_id];
     unsigned long flags = spin_lock_irqsave(&rq->lock);
 
+    u32 index = rq_best_index(rq, cpu_id, throttled);
+    sched_thread_t *thread = index != UINT32_MAX ? rq->heap[index] : NULL;
+
+    spin_unlock_irqrestore(&rq->lock, flags);
+
+    return thread;
+}
+
+// the worst thread the target may run; one that ran moments ago still has its
+// cache warm here and only goes when `allow_hot` says a cold cache beats waiting
+static u32 rq_worst_movable(sched_rq_t *rq, size_t target_cpu, bool allow_hot) {
+    u64 now_ns = arch_timer_ns();
     sched_thread_t *worst = NULL;
     u32 worst_i = UINT32_MAX;
+    bool skipped = false;
 
     for (u32 i = 0; (size_t)i < rq->nr_running; i++) {
         sched_thread_t *thread = rq->heap[i];
 
-        bool can_run = rq_runnable(thread) && sched_cpu_allowed(thread, target_cpu);
+        bool can_run = rq_pickable(thread) && sched_cpu_allowed(thread, target_cpu);
 
         if (!can_run) {
             continue;
         }
 
+        if (!allow_hot && sched_thread_hot(thread, now_ns)) {
+            skipped = true;
+            continue;
+        }
+
         if (rq_worse_than(thread, worst)) {
             worst = thread;
             worst_i = i;
         }
     }
 
-    if (worst && worst_i != UINT32_MAX) {
-        rq_remove_index(rq, worst_i);
-    } else {
-        worst = NULL;
+    if (skipped) {
+        __atomic_fetch_add(&sched_state.metrics.hot_skips, 1, __ATOMIC_RELAXED);
     }
 
-    spin_unlock_irqrestore(&rq->lock, flags);
-
-    return worst;
+    return worst_i;
 }
 
-sched_thread_t *rq_take_unfit(size_t source_cpu, size_t disallowed_cpu) {
-    if (source_cpu >= MAX_CORES || disallowed_cpu >= MAX_CORES) {
-        return NULL;
-    }
-
-    sched_rq_t *rq = &sched_state.cpus.runqueues[source_cpu];
-    unsigned long flags = spin_lock_irqsave(&rq->lock);
+static bool rq_unfit(const sched_thread_t *thread, size_t cpu_id) {
+    return rq_pickable(thread) && !sched_cpu_allowed(thread, cpu_id);
+}
 
+static u32 rq_worst_unfit(const sched_rq_t *rq, size_t cpu_id) {
     sched_thread_t *worst = NULL;
     u32 worst_i = UINT32_MAX;
 
     for (u32 i = 0; (size_t)i < rq->nr_running; i++) {
         sched_thread_t *thread = rq->heap[i];
 
-        bool runnable = rq_runnable(thread);
-        bool allowed = !runnable || sched_cpu_allowed(thread, disallowed_cpu);
-        if (allowed) {
-            continue;
-        }
-
-        if (rq_worse_than(thread, worst)) {
+        if (rq_unfit(thread, cpu_id) && rq_worse_than(thread, worst)) {
             worst = thread;
             worst_i = i;
         }
     }
 
-    if (worst && worst_i != UINT32_MAX) {
-        rq_remove_index(rq, worst_i);
-    } else {
-        worst = NULL;
+    return worst_i;
+}
+
+// a thread the source cpu may no longer run goes to wherever pick_cpu() sends
+// it. The target is chosen under the source lock alone and the move is made
+// with both held, so a thread with nowhere to go is simply left where it is
+sched_thread_t *rq_move_unfit(size_t source_cpu, size_t *target_out) {
+    if (source_cpu >= MAX_CORES) {
+        return NULL;
+    }
+
+    sched_rq_t *source = &sched_state.cpus.runqueues[source_cpu];
+    unsigned long flags = spin_lock_irqsave(&source->lock);
+
+    u32 index = rq_worst_unfit(source, source_cpu);
+    sched_thread_t *thread = index != UINT32_MAX ? source->heap[index] : NULL;
+    size_t target_cpu = thread ? pick_cpu(thread, source_cpu) : MAX_CORES;
+
+    if (target_cpu >= MAX_CORES || target_cpu == source_cpu) {
+        spin_unlock_irqrestore(&source->lock, flags);
+        return NULL;
+    }
+
+    bool can_move = cores_local[target_cpu].online && sched_cpu_allowed(thread, target_cpu);
+    spin_unlock_irqrestore(&source->lock, flags);
+
+    if (!can_move) {
+        return NULL;
+    }
+
+    // only the pointer is compared until the thread is found again, it may
+    // have been dequeued and freed while no lock was held
+    sched_rq_t *target = &sched_state.cpus.runqueues[target_cpu];
+    flags = rq_lock_pair(source, target);
+
+    int found = rq_find_index(source, thread);
+    bool moved = found >= 0 && rq_unfit(thread, source_cpu) && sched_cpu_allowed(thread, target_cpu);
+
+    moved = moved && rq_move_locked(source, target, (u32)found, target_cpu);
+
+    size_t depth = target->nr_running;
+    rq_unlock_pair(source, target, flags);
+
+    if (!moved) {
+        return NULL;
+    }
+
+    rq_note_depth(depth);
+    *target_out = target_cpu;
+
+    return thread;
+}
+
+// the worst thread goes straight from one queue to the other under both locks
+sched_thread_t *rq_move_worst(size_t source_cpu, size_t target_cpu, bool allow_hot) {
+    if (source_cpu >= MAX_CORES || target_cpu >= MAX_CORES || source_cpu == target_cpu) {
+        return NULL;
+    }
+
+    sched_rq_t *source = &sched_state.cpus.runqueues[source_cpu];
+    sched_rq_t *target = &sched_state.cpus.runqueues[target_cpu];
+    unsigned long flags = rq_lock_pair(source, target);
+
+    sched_thread_t *worst = NULL;
+    u32 worst_i = rq_worst_movable(source, target_cpu, allow_hot);
+
+    if (worst_i != UINT32_MAX) {
+        worst = source->heap[worst_i];
+
+        if (!rq_move_locked(source, target, worst_i, target_cpu)) {
+            worst = NULL;
+        }
+    }
+
+    size_t depth = target->nr_running;
+    rq_unlock_pair(source, target, flags);
+
+    if (worst) {
+        rq_note_depth(depth);
     }
 
-    spin_unlock_irqrestore(&rq->lock, flags);
     return worst;
 }
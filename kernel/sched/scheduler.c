@@ -29,8 +29,9 @@ void scheduler_init(void) {
     sched_state.procs.pid_index = hashmap_create();
 
     sched_waitq_init(&sched_state.wait.poll_wait_queue);
-    sched_waitq_init(&sched_state.wait.exit_event_wait);
     sched_waitq_init(&sched_state.wait.sleep_wait_queue);
+    sched_futex_init();
+    sched_reap_init();
 
     spinlock_init(&sched_state.wait.exit_events.lock);
     sched_state.wait.exit_events.ring = ring_queue_create(sizeof(pid_t), SCHED_EXIT_EVENT_CAP);
@@ -40,6 +41,7 @@ void scheduler_init(void) {
 
     sched_state.procs.next_user_pid = 1;
     sched_state.procs.next_kernel_pid = -1;
+    sched_topology_init();
     scheduler_init_core();
     sched_running_set(false);
     sched_set_aps_released(false);
@@ -63,7 +65,11 @@ void scheduler_init_core(void) {
     local->need_resched = false;
     local->force_resched = false;
     local->resched_irq = false;
-    local->local_ticks = 0;
+    local->charged_tick = arch_timer_ticks();
+    local->charged_ns = arch_timer_ns();
+    local->rebalance_tick = 0;
+    local->timer_deadline = 0;
+    sched_wheel_init(sched_cpu_id(), local->charged_ns);
 
     sched_thread_t *idle = create_thread("idle", idle_entry, NULL, false, false, SCHED_PID_IDLE);
 
@@ -133,24 +139,26 @@ void scheduler_start(void) {
     __atomic_store_n(&sched_local()->force_resched, false, __ATOMIC_RELEASE);
     __atomic_store_n(&sched_local()->resched_irq, false, __ATOMIC_RELEASE);
 
-    unsigned long flags = sched_lock_save();
-
+    size_t cpu_id = sched_cpu_id();
     sched_thread_t *current = sched_local_current();
     sched_thread_t *next = pick_init_thread();
+    unsigned long flags = 0;
 
-    if (!next) {
-        next = pick_next_thread();
+    if (next) {
+        flags = rq_lock_cpu(cpu_id);
+    } else {
+        next = pick_next_thread(cpu_id, &flags);
     }
 
     if (!current || !next || next == current) {
-        sched_lock_restore(flags);
+        rq_unlock_cpu(cpu_id, flags);
         sched_set_aps_released(true);
         arch_irq_restore(irq_flags);
         return;
     }
 
     if (invalid_thread_context(next)) {
-        sched_lock_restore(flags);
+        rq_unlock_cpu(cpu_id, flags);
         panic("scheduler selected invalid thread context on BSP");
     }
 
@@ -158,13 +166,14 @@ void scheduler_start(void) {
     next->exec_start_ns = next->sum_exec_ns;
     sched_set_slice_ns(0);
     sched_local_set_current(next);
-    thread_claim(next, sched_cpu_id());
+    thread_claim(next, cpu_id);
 
     if (current->fpu_initialized) {
         arch_fpu_save(current->fpu_state);
     }
 
-    sched_lock_restore(flags);
+    rq_unlock_cpu(cpu_id, flags);
+    sched_timer_program();
 
     arch_set_kernel_stack((uintptr_t)next->stack + next->stack_size);
 
@@ -207,19 +216,19 @@ void scheduler_start_cpu(void) {
     __atomic_store_n(&sched_local()->resched_irq, false, __ATOMIC_RELEASE);
     widen_affinity();
 
-    unsigned long flags = sched_lock_save();
-
+    size_t cpu_id = sched_cpu_id();
     sched_thread_t *current = sched_local_current();
-    sched_thread_t *next = pick_next_thread();
+    unsigned long flags = 0;
+    sched_thread_t *next = pick_next_thread(cpu_id, &flags);
 
     if (!current || !next || next == current) {
-        sched_lock_restore(flags);
+        rq_unlock_cpu(cpu_id, flags);
         arch_irq_restore(irq_flags);
         return;
     }
 
     if (invalid_thread_context(next)) {
-        sched_lock_restore(flags);
+        rq_unlock_cpu(cpu_id, flags);
         panic("scheduler selected invalid thread context on AP");
     }
 
@@ -227,13 +236,14 @@ void scheduler_start_cpu(void) {
     next->exec_start_ns = next->sum_exec_ns;
     sched_set_slice_ns(0);
     sched_local_set_current(next);
-    thread_claim(next, sched_cpu_id());
+    thread_claim(next, cpu_id);
 
     if (current->fpu_initialized) {
         arch_fpu_save(current->fpu_state);
     }
 
-    sched_lock_restore(flags);
+    rq_unlock_cpu(cpu_id, flags);
+    sched_timer_program();
 
     arch_set_kernel_stack((uintptr_t)next->stack + next->stack_size);
 
@@ -5,19 +5,24 @@
 #include <base/attributes.h>
 #include <base/types.h>
 #include <data/list.h>
+#include <data/rbtree.h>
 #include <data/ring.h>
 #include <limits.h>
 #include <signal.h>
 #include <sys/config.h>
 #include <sys/lock.h>
 #include <sys/proc.h>
+#include <sys/slab.h>
 #include <sys/types.h>
 
 typedef void (*thread_entry_t)(void *arg);
 
 typedef struct vfs_node vfs_node_t;
+typedef struct work work_t;
 
 #define SCHED_REGION_COW      (1ULL << 62)
+// the region's frames live in swap, paddr holds its first slot times the page size
+#define SCHED_REGION_SWAP     (1ULL << 61)
 #define SCHED_FD_FLAG_CLOEXEC (1u << 0)
 #define SCHED_THREAD_MAGIC    0x54485244u
 
@@ -84,7 +89,12 @@ typedef struct sched_user_region {
     uintptr_t paddr;
     size_t pages;
     u64 flags;
-    struct sched_user_region *next;
+
+    // keyed by vaddr, the subtree fields let gap searches skip whole subtrees
+    rb_node_t node;
+    uintptr_t subtree_start;
+    uintptr_t subtree_end;
+    uintptr_t subtree_gap;
 } sched_user_region_t;
 
 typedef struct sched_wait_queue {
@@ -107,6 +117,17 @@ typedef u32 sched_wait_flags_t;
 #define SCHED_WAIT_INTERRUPTIBLE (1U << 0)
 #define SCHED_WAIT_POLL_LINK     (1U << 1)
 
+// log2 buckets of microseconds: 0 is under 1us, i holds [2^(i-1), 2^i) us and
+// the last one everything longer
+#define SCHED_LAT_BUCKETS 24
+
+// wait is every stretch from entering a runqueue to getting a cpu, wake the
+// subset of those that started with a wakeup rather than a preemption
+typedef struct {
+    u32 wake[SCHED_LAT_BUCKETS];
+    u32 wait[SCHED_LAT_BUCKETS];
+} sched_latency_t;
+
 typedef struct sched_thread {
     char name[PROC_NAME_MAX];
     u32 magic;
@@ -115,15 +136,25 @@ typedef struct sched_thread {
     size_t last_cpu;
     u64 allowed_cpu_mask ALIGNED(8);
     bool affinity_user_set;
+    i8 nice;
+    u32 weight;
+    u8 policy;
+    u8 rt_priority;
+    u64 rt_seq ALIGNED(8);
 
     u64 vruntime_ns ALIGNED(8);
     u64 exec_start_ns ALIGNED(8);
     u64 sum_exec_ns ALIGNED(8);
+    u64 last_ran_ns ALIGNED(8);
 
     list_node_t run_node;
     bool in_run_queue;
     bool on_rq;
     u32 rq_index;
+    // when it last entered a runqueue, 0 once it has run since
+    u64 rq_enqueue_ns ALIGNED(8);
+    bool rq_woken;
+    sched_latency_t latency;
 
     list_node_t wait_node;
     bool in_wait_queue;
@@ -159,12 +190,26 @@ typedef struct sched_thread {
 
     arch_vm_space_t *vm_space;
     spinlock_t vm_lock;
+    u32 vm_busy; // region syscalls in flight, swap leaves the thread alone
+    struct sched_thread *vm_holder; // the thread those syscalls run on
+    sched_wait_queue_t vm_wait; // faults and other holders sleep here until the release
 
     uintptr_t user_stack_base;
     size_t user_stack_size;
     u64 user_mem_kib ALIGNED(8);
 
-    struct sched_user_region *regions;
+    rb_tree_t regions;
+
+    // a vfork child runs on its parent's address space until it execs or exits
+    struct sched_thread *vfork_parent;
+    bool vfork_waiting;
+
+    // threads made by clone run on their leader's address space, regions, fd
+    // table, cwd, umask and signal handlers, only the leader's copies are live
+    struct sched_thread *group_leader;
+    u32 group_threads; // on the leader, counts itself
+    bool group_exiting;
+    uintptr_t clear_tid; // zeroed and futex woken when a clone thread exits
 
     sched_wait_queue_t wait_queue;
 
@@ -176,15 +221,17 @@ typedef struct sched_thread {
     list_node_t reap_node;
     bool in_reap_list;
 
+    spinlock_t fd_lock;
     sched_fd_t fds[SCHED_FD_MAX];
     bool fd_used[SCHED_FD_MAX];
 
     char cwd[PATH_MAX];
 
-    u64 wake_tick ALIGNED(8);
+    u64 wake_ns ALIGNED(8);
     bool sleep_queued;
-    size_t sleep_index;
-    u64 wait_deadline_tick ALIGNED(8);
+    u32 sleep_cpu;
+    list_node_t sleep_node;
+    u64 wait_deadline_ns ALIGNED(8);
     u32 wait_flags;
     u8 wait_result;
     u8 wait_cookie;
@@ -212,6 +259,19 @@ typedef struct sched_thread {
     bool fpu_initialized;
 } sched_thread_t;
 
+// where a clone thread starts: its user stack and the word zeroed when it exits
+typedef struct {
+    uintptr_t stack_base;
+    size_t stack_size;
+    uintptr_t sp;
+    uintptr_t clear_tid;
+} sched_clone_t;
+
+// the thread owning what a clone group shares, the thread itself outside one
+static inline sched_thread_t *sched_group(const sched_thread_t *thread) {
+    return thread->group_leader ? thread->group_leader : (sched_thread_t *)thread;
+}
+
 typedef struct {
     u64 sched_switch_count;
     u64 syscall_count;
@@ -221,6 +281,9 @@ typedef struct {
     u64 sched_runqueue_max;
     u64 sched_balance_runs;
     u64 wait_timeout_count;
+    u64 sched_wake_affine;
+    u64 sched_wake_prev;
+    u64 sched_hot_skips;
 } sched_stats_t;
 
 enum {
@@ -245,6 +308,7 @@ typedef struct {
     thread_state_t state;
     int core_id;
     int tty_index;
+    int nice;
     u64 cpu_time_ms;
     u64 user_time_ms;
     u64 sys_time_ms;
@@ -271,6 +335,10 @@ void thread_get(sched_thread_t *thread);
 void thread_put(sched_thread_t *thread);
 int sched_set_affinity(pid_t pid, u64 mask);
 int sched_get_affinity(pid_t pid, u64 *mask_out);
+int sched_set_nice(int which, id_t who, int nice);
+int sched_get_nice(int which, id_t who, int *nice_out);
+int sched_set_policy(pid_t pid, int policy, int priority);
+int sched_get_policy(pid_t pid, int *priority_out);
 pid_t sched_getpid(void);
 int sched_setuid(uid_t uid);
 int sched_seteuid(uid_t uid);
@@ -290,8 +358,14 @@ int sched_setpgid(pid_t pid, pid_t pgid);
 pid_t sched_setsid(void);
 bool sched_pgrp_in_session(pid_t pgid, pid_t sid);
 sched_thread_t *sched_spawn_kernel(const char *name, thread_entry_t entry, void *arg);
+sched_thread_t *sched_spawn_kernel_on(const char *name, thread_entry_t entry, void *arg, size_t cpu_id);
 sched_thread_t *sched_create_user_thread(const char *name);
 pid_t sched_fork(arch_int_state_t *state);
+pid_t sched_vfork(arch_int_state_t *state);
+pid_t sched_clone(arch_int_state_t *state, const sched_clone_t *args);
+void sched_vfork_release(sched_thread_t *child, rb_tree_t *regions, u64 mem_kib);
+sched_thread_t *sched_spawn_user(sched_thread_t *parent);
+void sched_spawn_start(sched_thread_t *child, bool suspended);
 pid_t sched_wait(pid_t pid, int *status);
 pid_t sched_waitpid(pid_t pid, int *status, int options);
 void thread_prepare_user(sched_thread_t *thread, uintptr_t entry, uintptr_t user_stack_top);
@@ -302,32 +376,56 @@ void sched_stop_thread(sched_thread_t *thread, int signum);
 void sched_continue_thread(sched_thread_t *thread);
 void thread_set_name(sched_thread_t *thread, const char *name);
 
+uintptr_t sched_alloc_user_frames(uintptr_t vaddr, size_t pages);
+uintptr_t sched_alloc_user_zeroed(uintptr_t vaddr, size_t pages);
 bool sched_add_user_region(sched_thread_t *thread, uintptr_t vaddr, uintptr_t paddr, size_t pages, u64 flags);
 void sched_clear_user_regions(sched_thread_t *thread);
+void sched_vm_hold(sched_thread_t *thread);
+void sched_vm_release(sched_thread_t *thread);
+void sched_region_insert(sched_thread_t *thread, sched_user_region_t *region);
+void sched_region_remove(sched_thread_t *thread, sched_user_region_t *region);
+void sched_region_update(sched_user_region_t *region);
+void sched_region_tree_free(rb_tree_t *tree);
+sched_user_region_t *sched_region_first(const sched_thread_t *thread);
+sched_user_region_t *sched_region_last(const sched_thread_t *thread);
+sched_user_region_t *sched_region_next(const sched_user_region_t *region);
+sched_user_region_t *sched_region_prev(const sched_user_region_t *region);
+sched_user_region_t *sched_region_find(const sched_thread_t *thread, uintptr_t addr);
+sched_user_region_t *sched_region_first_overlap(const sched_thread_t *thread, uintptr_t start, uintptr_t end);
+bool sched_region_find_gap(
+    const sched_thread_t *thread,
+    uintptr_t low,
+    uintptr_t high,
+    size_t size,
+    size_t align,
+    uintptr_t *out
+);
 void sched_user_mem_add(sched_thread_t *thread, size_t pages);
 void sched_user_mem_sub(sched_thread_t *thread, size_t pages);
 void sched_set_user_mem(sched_thread_t *thread, u64 kib);
 u64 sched_user_mem_kib(const sched_thread_t *thread);
 
+extern kmem_cache_t sched_waitq_cache;
+
 void sched_waitq_init(sched_wait_queue_t *queue);
 void sched_waitq_destroy(sched_wait_queue_t *queue);
 void sched_waitq_set_poll(sched_wait_queue_t *queue, bool enabled);
 
 u32 sched_wait_seq(sched_wait_queue_t *queue);
 sched_wait_result_t
-sched_wait_on(sched_wait_queue_t *queue, u32 observed_seq, u64 deadline_tick, sched_wait_flags_t flags);
+sched_wait_on(sched_wait_queue_t *queue, u32 observed_seq, u64 deadline_ns, sched_wait_flags_t flags);
 bool sched_wait_for_change(sched_wait_queue_t *queue, u32 observed_seq);
 void sched_block(sched_wait_queue_t *queue);
 void sched_wake_one(sched_wait_queue_t *queue);
 void sched_wake_all(sched_wait_queue_t *queue);
 u32 sched_poll_wait_seq(void);
 bool sched_poll_wait_change(u32 observed_seq);
-bool sched_poll_wait_until(u32 observed_seq, u64 deadline_tick);
+bool sched_poll_wait_until(u32 observed_seq, u64 deadline_ns);
 void sched_poll_wait(void);
-sched_wait_result_t sched_wait_deadline(u64 deadline_tick, sched_wait_flags_t flags);
-u32 sched_exit_event_seq(void);
-bool sched_exit_wait_change(u32 observed_seq);
+sched_wait_result_t sched_wait_deadline(u64 deadline_ns, sched_wait_flags_t flags);
 bool sched_exit_event_pop(pid_t *pid_out);
+// queues `work` after each exit event and once now for any already waiting
+void sched_exit_event_notify(work_t *work);
 
 void sched_preempt_disable(void);
 void sched_preempt_enable(void);
@@ -335,7 +433,7 @@ bool sched_preempt_disabled(void);
 
 void sched_tick(arch_int_state_t *state);
 void sched_yield(void);
-void sched_sleep(u64 ticks);
+void sched_sleep_ns(u64 ns);
 void sched_capture_context(arch_int_state_t *state);
 void sched_ipi_resched(void);
 void sched_resched_softirq(arch_int_state_t *state);
@@ -343,15 +441,29 @@ void force_resched(void);
 void sched_resched_local(void);
 bool wait_running(sched_thread_t *self);
 void sched_exit(void) NORETURN;
+void sched_exit_group(int code, int signum) NORETURN;
+int sched_thread_exit(int code);
 bool sched_proc_snapshot(pid_t pid, sched_proc_snapshot_t *out);
+sched_thread_t *sched_next_user_thread(pid_t after);
 void sched_cpu_usage(u64 *busy_ticks_out, u64 *total_ticks_out);
 void sched_cpu_usage_core(size_t core_id, u64 *busy_ticks_out, u64 *total_ticks_out);
 void sched_stats(sched_stats_t *out);
+bool sched_proc_latency(pid_t pid, sched_latency_t *out);
+void sched_cpu_latency(size_t cpu_id, sched_latency_t *out);
 void sched_record_syscall(void);
 int sched_signal_send_pgrp(pid_t pgid, int signum);
 int sched_signal_pgrp_as(pid_t pgid, int signum, const sched_thread_t *sender);
 
+void sched_futex_init(void);
+int sched_futex_wait(sched_thread_t *thread, u32 *uaddr, u32 val, u64 deadline_ns);
+int sched_futex_wake(sched_thread_t *thread, u32 *uaddr, u32 count);
+
 bool sched_handle_cow_fault(sched_thread_t *thread, uintptr_t addr, bool write);
+bool sched_handle_swap_fault(sched_thread_t *thread, uintptr_t addr);
+void sched_swap_init(void);
+void sched_swap_map(void *root, const sched_user_region_t *region);
+void sched_swap_get(uintptr_t base, size_t pages);
+void sched_swap_put(uintptr_t base, size_t pages);
 bool sched_proc_cwd(pid_t pid, char *out, size_t out_len);
 
 int sched_fd_open(sched_thread_t *thread, const sched_fd_spec_t *spec, int min_fd);
@@ -359,6 +471,9 @@ int sched_fd_alloc(sched_thread_t *thread, const sched_fd_t *fd, int min_fd);
 int sched_fd_install(sched_thread_t *thread, int target_fd, const sched_fd_t *fd);
 int sched_fd_close(sched_thread_t *thread, int fd);
 int sched_fd_dup(sched_thread_t *thread, int oldfd, int newfd);
+bool sched_fd_get(sched_thread_t *thread, int fd, sched_fd_t *out);
+void sched_fd_put(sched_fd_t *fd);
+int sched_fd_set_flags(sched_thread_t *thread, int fd, u32 fd_flags);
 bool sched_fd_clone_table(sched_thread_t *dst, const sched_thread_t *src);
 void sched_fd_close_all(sched_thread_t *thread);
 void sched_fd_close_cloexec(sched_thread_t *thread);
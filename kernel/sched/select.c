@@ -37,17 +37,6 @@ bool cpu_needs_ipi(size_t cpu_id) {
     return !current || current == idle;
 }
 
-size_t sched_cpu_distance(size_t from_cpu, size_t to_cpu, size_t cpu_count) {
-    if (!cpu_count || from_cpu >= cpu_count || to_cpu >= cpu_count) {
-        return (size_t)-1;
-    }
-
-    size_t direct = from_cpu > to_cpu ? (from_cpu - to_cpu) : (to_cpu - from_cpu);
-    size_t wrap = cpu_count - direct;
-
-    return direct < wrap ? direct : wrap;
-}
-
 size_t pick_cpu(const sched_thread_t *thread, size_t fallback_cpu) {
     size_t ncpu = core_count;
     if (ncpu > MAX_CORES) {
@@ -84,10 +73,11 @@ size_t pick_cpu(const sched_thread_t *thread, size_t fallback_cpu) {
             continue;
         }
 
+        // between equally loaded cpus the one nearest the fallback keeps caches warm
         size_t load = sched_cpu_load(cpu);
         bool better = best_cpu >= MAX_CORES || load < best_load;
         if (!better && load == best_load) {
-            better = cpu == fallback_cpu;
+            better = sched_cpu_distance(fallback_cpu, cpu) < sched_cpu_distance(fallback_cpu, best_cpu);
         }
 
         if (better) {
@@ -139,17 +129,17 @@ void sched_nudge_thread(sched_thread_t *thread) {
     }
 }
 
-void sched_publish_handoff(sched_thread_t *thread, size_t owner_cpu) {
+// caller holds the owner's queue lock; returns true when the thread may not
+// run there and has to be enqueued elsewhere once that lock is dropped
+bool sched_publish_handoff(sched_thread_t *thread, size_t owner_cpu) {
     if (!thread || owner_cpu >= MAX_CORES) {
-        return;
+        return false;
     }
 
     if (owner_cpu != sched_cpu_id()) {
         panic("remote scheduler handoff publish");
     }
 
-    thread_unclaim(thread);
-
     if (thread_get_state(thread) == THREAD_RUNNING) {
         thread_set_state(thread, THREAD_READY);
     } else {
@@ -161,39 +151,38 @@ void sched_publish_handoff(sched_thread_t *thread, size_t owner_cpu) {
         }
     }
 
+    // released onto this cpu, so the home it falls back to is the one held;
+    // one still sitting in another queue can be picked there the moment it is
+    // unclaimed, so that queue stays its home and the claim goes last
+    if (!thread->on_rq) {
+        thread->last_cpu = owner_cpu;
+    }
+
+    thread_unclaim(thread);
+
     thread_state_t state = thread_get_state(thread);
     if (state == THREAD_ZOMBIE || state == THREAD_STOPPED) {
-        return;
+        return false;
     }
 
     if (!thread->context || thread->on_rq) {
-        return;
+        return false;
     }
 
     if (state == THREAD_SLEEPING && (thread->in_wait_queue || thread->sleep_queued)) {
-        return;
+        return false;
     }
 
     if (state != THREAD_READY) {
         thread_set_state(thread, THREAD_READY);
     }
 
-    if (thread_get_state(thread) != THREAD_READY) {
-        return;
+    if (!sched_cpu_allowed(thread, owner_cpu) || !cores_local[owner_cpu].online) {
+        return true;
     }
 
-    size_t target_cpu = owner_cpu;
-    if (!sched_cpu_allowed(thread, owner_cpu)) {
-        target_cpu = pick_cpu(thread, owner_cpu);
-    }
-
-    rq_enqueue_cpu(thread, target_cpu);
-
-    if (target_cpu != owner_cpu) {
-        if (wake_cpu(target_cpu)) {
-            __atomic_fetch_add(&sched_state.metrics.wake_ipi, 1, __ATOMIC_RELAXED);
-        }
-    }
+    rq_enqueue_locked(thread, owner_cpu);
+    return false;
 }
 
 void sched_flush_handoff(size_t cpu_id) {
@@ -203,13 +192,32 @@ void sched_flush_handoff(size_t cpu_id) {
 
     sched_cpu_t *local = &sched_state.cpus.cpu[cpu_id];
 
+    if (!__atomic_load_n(&local->handoff_ready, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    unsigned long flags = rq_lock_cpu(cpu_id);
+
     sched_thread_t *pending = __atomic_load_n(&local->handoff_ready, __ATOMIC_ACQUIRE);
-    if (!pending) {
+    bool move = false;
+
+    if (pending) {
+        __atomic_store_n(&local->handoff_ready, NULL, __ATOMIC_RELEASE);
+        move = sched_publish_handoff(pending, cpu_id);
+    }
+
+    rq_unlock_cpu(cpu_id, flags);
+
+    if (!move) {
         return;
     }
 
-    __atomic_store_n(&local->handoff_ready, NULL, __ATOMIC_RELEASE);
-    sched_publish_handoff(pending, cpu_id);
+    size_t target_cpu = pick_cpu(pending, cpu_id);
+    rq_enqueue_cpu(pending, target_cpu);
+
+    if (wake_cpu(target_cpu)) {
+        __atomic_fetch_add(&sched_state.metrics.wake_ipi, 1, __ATOMIC_RELAXED);
+    }
 }
 
 void rq_note_depth(size_t depth) {
@@ -30,7 +30,7 @@ static sighandler_t signal_get_handler(sched_thread_t *thread, int signum) {
         return SIG_DFL;
     }
 
-    sighandler_t handler = thread->signal_handlers[signum];
+    sighandler_t handler = sched_group(thread)->signal_handlers[signum];
 
     if (handler == SIG_DFL) {
         sighandler_t def = default_actions[signum];
@@ -126,14 +126,15 @@ sighandler_t sched_signal_set(sched_thread_t *thread, int signum, sighandler_t h
         return SIG_ERR;
     }
 
-    sighandler_t prev = thread->signal_handlers[signum];
-    thread->signal_handlers[signum] = handler;
+    sched_thread_t *group = sched_group(thread);
+    sighandler_t prev = group->signal_handlers[signum];
+    group->signal_handlers[signum] = handler;
 
     if (!trampoline) {
         return prev;
     }
 
-    thread->signal_trampoline = trampoline;
+    group->signal_trampoline = trampoline;
 
     return prev;
 }
@@ -223,11 +224,9 @@ void sched_signal_deliver(arch_int_state_t *state) {
         return;
     }
 
-    if (handler == SIG_DFL || !thread->signal_trampoline) {
+    if (handler == SIG_DFL || !sched_group(thread)->signal_trampoline) {
         clear_pending(thread, signum);
-        thread->exit_code = 0;
-        thread->exit_signal = signum;
-        sched_exit();
+        sched_exit_group(0, signum);
     }
 
     thread->signal_saved_state = *state;
@@ -239,10 +238,7 @@ void sched_signal_deliver(arch_int_state_t *state) {
         __atomic_store_n(&thread->current_signal, 0, __ATOMIC_RELEASE);
 
         clear_pending(thread, signum);
-
-        thread->exit_code = 0;
-        thread->exit_signal = signum;
-        sched_exit();
+        sched_exit_group(0, signum);
     }
 
     clear_pending(thread, signum);
@@ -1,5 +1,7 @@
 #include "internal.h"
 
+kmem_cache_t sched_thread_cache = KMEM_CACHE_INIT("sched_thread", sizeof(sched_thread_t), 16);
+
 sched_state_t sched_state = {
     .core = {
         .lock = SPINLOCK_INIT,
@@ -19,7 +21,7 @@ bool sched_reconcile_lock(void) {
         return false;
     }
 
-    if (__atomic_load_n(&sched_state.core.lock.state, __ATOMIC_RELAXED)) {
+    if (spin_is_locked(&sched_state.core.lock)) {
         return true;
     }
 
@@ -110,224 +112,41 @@ void sched_lock_restore(unsigned long flags) {
     arch_irq_restore(flags);
 }
 
-static bool sleep_heap_less(size_t left, size_t right) {
-    sched_thread_t *a = sched_state.wait.sleep.heap[left];
-    sched_thread_t *b = sched_state.wait.sleep.heap[right];
-
-    if (!a) {
-        return false;
-    }
-
-    if (!b) {
-        return true;
-    }
-
-    if (a->wake_tick != b->wake_tick) {
-        return a->wake_tick < b->wake_tick;
-    }
-
-    return a->pid < b->pid;
-}
-
-static bool sleep_heap_contains(sched_thread_t *thread) {
-    if (!thread || !thread->sleep_queued) {
-        return false;
-    }
-
-    if (thread->sleep_index >= sched_state.wait.sleep.count) {
-        return false;
-    }
-
-    return sched_state.wait.sleep.heap[thread->sleep_index] == thread;
-}
-
-static void sleep_heap_swap(size_t left, size_t right) {
-    sched_thread_t *saved = sched_state.wait.sleep.heap[left];
-
-    sched_state.wait.sleep.heap[left] = sched_state.wait.sleep.heap[right];
-    sched_state.wait.sleep.heap[right] = saved;
-
-    if (sched_state.wait.sleep.heap[left]) {
-        sched_state.wait.sleep.heap[left]->sleep_index = left;
-    }
-
-    if (sched_state.wait.sleep.heap[right]) {
-        sched_state.wait.sleep.heap[right]->sleep_index = right;
-    }
-}
-
-static void sleep_heap_sift_up(size_t index) {
-    while (index > 0) {
-        size_t parent = (index - 1) / 2;
-
-        if (!sleep_heap_less(index, parent)) {
-            break;
-        }
-
-        sleep_heap_swap(index, parent);
-        index = parent;
-    }
-}
-
-static void sleep_heap_sift_down(size_t index) {
-    for (;;) {
-        size_t left = index * 2 + 1;
-        size_t right = left + 1;
-        size_t best = index;
-
-        if (left < sched_state.wait.sleep.count && sleep_heap_less(left, best)) {
-            best = left;
-        }
-
-        if (right < sched_state.wait.sleep.count && sleep_heap_less(right, best)) {
-            best = right;
-        }
-
-        if (best == index) {
-            return;
-        }
-
-        sleep_heap_swap(index, best);
-        index = best;
-    }
-}
-
-static ssize_t sleep_heap_find(const sched_thread_t *thread) {
-    if (!thread) {
-        return -1;
-    }
+// user pids count up and kernel pids count down without the scheduler lock;
+// 0 means the class ran out
+static pid_t pid_advance(volatile pid_t *next, pid_t step, pid_t limit) {
+    pid_t pid = __atomic_load_n(next, __ATOMIC_RELAXED);
 
-    for (size_t i = 0; i < sched_state.wait.sleep.count; i++) {
-        if (sched_state.wait.sleep.heap[i] == thread) {
-            return (ssize_t)i;
+    do {
+        if (!pid || pid == limit || (pid > 0) != (step > 0)) {
+            return 0;
         }
-    }
+    } while (!__atomic_compare_exchange_n(next, &pid, pid + step, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
 
-    return -1;
-}
-
-bool sleep_heap_insert(sched_thread_t *thread) {
-    if (!thread) {
-        return true;
-    }
-
-    if (thread->sleep_queued) {
-        if (sleep_heap_contains(thread)) {
-            sleep_heap_remove_at(thread->sleep_index);
-        } else {
-            ssize_t found = sleep_heap_find(thread);
-
-            if (found >= 0) {
-                sleep_heap_remove_at((size_t)found);
-            }
-        }
-
-        thread->sleep_queued = false;
-        thread->sleep_index = 0;
-    }
-
-    ssize_t found = sleep_heap_find(thread);
-    if (found >= 0) {
-        sleep_heap_remove_at((size_t)found);
-    }
-
-    if (sched_state.wait.sleep.count >= SCHED_SLEEP_CAPACITY) {
-        return false;
-    }
-
-    size_t index = sched_state.wait.sleep.count++;
-
-    sched_state.wait.sleep.heap[index] = thread;
-    thread->sleep_queued = true;
-    thread->sleep_index = index;
-    sleep_heap_sift_up(index);
-
-    return true;
-}
-
-void sleep_heap_remove_at(size_t index) {
-    if (index >= sched_state.wait.sleep.count) {
-        return;
-    }
-
-    sched_thread_t *removed = sched_state.wait.sleep.heap[index];
-    sched_state.wait.sleep.count--;
-
-    if (index != sched_state.wait.sleep.count) {
-        size_t last = sched_state.wait.sleep.count;
-        sched_state.wait.sleep.heap[index] = sched_state.wait.sleep.heap[last];
-
-        if (sched_state.wait.sleep.heap[index]) {
-            sched_state.wait.sleep.heap[index]->sleep_index = index;
-        }
-
-        sleep_heap_sift_down(index);
-        sleep_heap_sift_up(index);
-    }
-
-    sched_state.wait.sleep.heap[sched_state.wait.sleep.count] = NULL;
-
-    if (removed) {
-        removed->sleep_queued = false;
-        removed->sleep_index = 0;
-    }
-}
-
-void sleep_heap_remove(sched_thread_t *thread) {
-    if (!thread) {
-        return;
-    }
-
-    if (sleep_heap_contains(thread)) {
-        sleep_heap_remove_at(thread->sleep_index);
-        return;
-    }
-
-    ssize_t found = sleep_heap_find(thread);
-    if (found >= 0) {
-        thread->sleep_queued = true;
-        thread->sleep_index = (size_t)found;
-        sleep_heap_remove_at((size_t)found);
-        return;
-    }
-
-    thread->sleep_queued = false;
-    thread->sleep_index = 0;
-}
-
-sched_thread_t *sleep_heap_top(void) {
-    if (!sched_state.wait.sleep.count) {
-        return NULL;
-    }
-
-    return sched_state.wait.sleep.heap[0];
+    return pid;
 }
 
 pid_t sched_next_pid(sched_pid_class_t pid_class) {
-    unsigned long flags = sched_lock_save();
     pid_t pid = 0;
 
     switch (pid_class) {
     case SCHED_PID_IDLE:
         break;
     case SCHED_PID_USER:
-        if (sched_state.procs.next_user_pid <= 0 || sched_state.procs.next_user_pid == INT_MAX) {
+        pid = pid_advance(&sched_state.procs.next_user_pid, 1, INT_MAX);
+        if (!pid) {
             panic("user PID space exhausted");
         }
-        pid = sched_state.procs.next_user_pid++;
         break;
     case SCHED_PID_KERNEL:
-        bool exhausted = (sched_state.procs.next_kernel_pid >= 0 || sched_state.procs.next_kernel_pid == INT_MIN);
-
-        if (exhausted) {
+        pid = pid_advance(&sched_state.procs.next_kernel_pid, -1, INT_MIN);
+        if (!pid) {
             panic("kernel PID space exhausted");
         }
-        pid = sched_state.procs.next_kernel_pid--;
         break;
     default:
         panic("invalid scheduler PID class");
     }
 
-    sched_lock_restore(flags);
     return pid;
 }
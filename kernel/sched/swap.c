@@ -0,0 +1,279 @@
+#include "internal.h"
+
+#include <sys/reclaim.h>
+#include <sys/zram.h>
+
+// regions are swapped whole so their slots stay as linear as their frames,
+// larger ones cost too much to bring back on a single fault
+#define SWAP_REGION_MAX_PAGES 512
+
+typedef struct {
+    pid_t cursor;
+    reclaim_shrinker_t shrinker;
+} swap_state_t;
+
+static swap_state_t swap = { 0 };
+
+static size_t _slot_of(uintptr_t base) {
+    return base / PAGE_4KIB;
+}
+
+static uintptr_t _region_end(const sched_user_region_t *region) {
+    return region->vaddr + region->pages * PAGE_4KIB;
+}
+
+static u64 _map_flags(u64 flags) {
+    if (flags & SCHED_REGION_COW) {
+        flags &= ~PT_WRITE;
+    }
+
+    return flags & ~SCHED_REGION_SWAP;
+}
+
+void sched_swap_get(uintptr_t base, size_t pages) {
+    zram_slot_get(_slot_of(base), pages);
+}
+
+void sched_swap_put(uintptr_t base, size_t pages) {
+    zram_slot_put(_slot_of(base), pages);
+}
+
+void sched_swap_map(void *root, const sched_user_region_t *region) {
+    size_t first = _slot_of(region->paddr);
+
+    for (size_t i = 0; i < region->pages; i++) {
+        arch_set_swap_page(root, region->vaddr + i * PAGE_4KIB, first + i, region->flags);
+    }
+}
+
+// every page must sit in its own 4KiB leaf on the region's frame, owned by
+// nobody else, and untouched since the previous scan; the check ages them too
+static bool _region_cold(page_t *root, const sched_user_region_t *region) {
+    if ((region->flags & SCHED_REGION_SWAP) || !(region->flags & PT_USER)) {
+        return false;
+    }
+
+    if (!region->pages || region->pages > SWAP_REGION_MAX_PAGES) {
+        return false;
+    }
+
+    bool cold = true;
+
+    for (size_t i = 0; i < region->pages; i++) {
+        uintptr_t paddr = region->paddr + i * PAGE_4KIB;
+        page_t *entry = NULL;
+
+        size_t size = arch_get_page(root, region->vaddr + i * PAGE_4KIB, &entry);
+        if (!entry || size != PAGE_4KIB || !(*entry & PT_PRESENT)) {
+            return false;
+        }
+
+        if (arch_page_get_paddr(entry) != paddr || pmm_refcount((void *)paddr) != 1) {
+            return false;
+        }
+
+        if (arch_page_young(entry)) {
+            cold = false;
+        }
+    }
+
+    return cold;
+}
+
+// caller holds the thread's vm lock
+static bool _swap_out(sched_thread_t *thread, page_t *root, sched_user_region_t *region) {
+    size_t first = 0;
+    if (!zram_slot_alloc(region->pages, &first)) {
+        return false;
+    }
+
+    uintptr_t start = region->vaddr;
+    uintptr_t end = _region_end(region);
+
+    // unmap before reading the frames so no late store is lost
+    for (size_t i = 0; i < region->pages; i++) {
+        arch_set_swap_page(root, start + i * PAGE_4KIB, first + i, region->flags);
+    }
+
+    arch_tlb_flush_range(thread->vm_space, start, end);
+
+    for (size_t i = 0; i < region->pages; i++) {
+        if (zram_store(first + i, region->paddr + i * PAGE_4KIB)) {
+            continue;
+        }
+
+        arch_unmap_region(root, region->pages, start);
+        arch_map_region(root, region->pages, start, region->paddr, _map_flags(region->flags));
+        zram_slot_put(first, region->pages);
+        return false;
+    }
+
+    arch_free_frames((void *)region->paddr, region->pages);
+
+    // a frame only we referenced needs no copy on write once it comes back
+    region->paddr = first * PAGE_4KIB;
+    region->flags = (region->flags & ~SCHED_REGION_COW) | SCHED_REGION_SWAP;
+
+    return true;
+}
+
+static size_t _swap_thread(sched_thread_t *thread, size_t pages) {
+    unsigned long flags = arch_irq_save();
+    if (!spin_try_lock(&thread->vm_lock)) {
+        arch_irq_restore(flags);
+        return 0;
+    }
+
+    size_t freed = 0;
+    bool busy = __atomic_load_n(&thread->vm_busy, __ATOMIC_ACQUIRE);
+    bool borrowed = thread->vfork_parent || __atomic_load_n(&thread->vfork_waiting, __ATOMIC_ACQUIRE);
+    page_t *root = thread->vm_space ? arch_vm_root(thread->vm_space) : NULL;
+
+    if (!busy && !borrowed && root && thread_get_state(thread) != THREAD_ZOMBIE) {
+        sched_user_region_t *region = sched_region_first(thread);
+
+        for (; region && freed < pages; region = sched_region_next(region)) {
+            if (_region_cold(root, region) && _swap_out(thread, root, region)) {
+                freed += region->pages;
+            }
+        }
+    }
+
+    spin_unlock(&thread->vm_lock);
+    arch_irq_restore(flags);
+
+    return freed;
+}
+
+static size_t _swap_count(void *ctx) {
+    (void)ctx;
+
+    if (!pmm_ref_ready()) {
+        return 0;
+    }
+
+    return zram_free_slots();
+}
+
+// walks processes round robin from where the last scan stopped
+static size_t _swap_scan(void *ctx, size_t pages) {
+    (void)ctx;
+
+    size_t freed = 0;
+    bool wrapped = false;
+
+    while (freed < pages) {
+        sched_thread_t *thread = sched_next_user_thread(swap.cursor);
+
+        if (!thread) {
+            if (wrapped || !swap.cursor) {
+                break;
+            }
+
+            swap.cursor = 0;
+            wrapped = true;
+            continue;
+        }
+
+        swap.cursor = thread->pid;
+        freed += _swap_thread(thread, pages - freed);
+        thread_put(thread);
+    }
+
+    return freed;
+}
+
+static bool _swap_in_page(sched_thread_t *thread, page_t *root, sched_user_region_t *region, uintptr_t page_addr) {
+    size_t index = (page_addr - region->vaddr) / PAGE_4KIB;
+    size_t slot = _slot_of(region->paddr) + index;
+    u64 flags = region->flags & ~SCHED_REGION_SWAP;
+
+    uintptr_t paddr = (uintptr_t)arch_alloc_frames_user(1);
+    if (!paddr) {
+        return false;
+    }
+
+    if (!zram_load(slot, paddr) || !sched_region_split_page(thread, region, index, paddr, flags)) {
+        arch_free_frames((void *)paddr, 1);
+        return false;
+    }
+
+    arch_unmap_region(root, 1, page_addr);
+    arch_map_region(root, 1, page_addr, paddr, flags);
+    zram_slot_put(slot, 1);
+
+    arch_tlb_flush_range(thread->vm_space, page_addr, page_addr + PAGE_4KIB);
+    return true;
+}
+
+// caller holds the thread's vm lock
+static bool _swap_in(sched_thread_t *thread, page_t *root, sched_user_region_t *region, uintptr_t page_addr) {
+    size_t first = _slot_of(region->paddr);
+    u64 flags = region->flags & ~SCHED_REGION_SWAP;
+
+    uintptr_t paddr = (uintptr_t)arch_alloc_frames_user(region->pages);
+
+    // without a contiguous run, bring back just the faulting page
+    if (!paddr) {
+        return _swap_in_page(thread, root, region, page_addr);
+    }
+
+    for (size_t i = 0; i < region->pages; i++) {
+        if (!zram_load(first + i, paddr + i * PAGE_4KIB)) {
+            arch_free_frames((void *)paddr, region->pages);
+            return false;
+        }
+    }
+
+    arch_unmap_region(root, region->pages, region->vaddr);
+    arch_map_region(root, region->pages, region->vaddr, paddr, flags);
+    zram_slot_put(first, region->pages);
+
+    region->paddr = paddr;
+    region->flags = flags;
+
+    arch_tlb_flush_range(thread->vm_space, region->vaddr, _region_end(region));
+    return true;
+}
+
+bool sched_handle_swap_fault(sched_thread_t *thread, uintptr_t addr) {
+    if (!thread || !thread->user_thread) {
+        return false;
+    }
+
+    sched_thread_t *group = sched_group(thread);
+    unsigned long vm_flags = spin_lock_irqsave(&group->vm_lock);
+
+    // sleep out the other thread's region syscall, the fault is retried after
+    if (sched_vm_held_elsewhere(group)) {
+        sched_vm_wait_unlock(group, vm_flags);
+        return true;
+    }
+
+    uintptr_t page_addr = ALIGN_DOWN(addr, PAGE_4KIB);
+    sched_user_region_t *region = sched_region_find(thread, page_addr);
+    page_t *root = thread->vm_space ? arch_vm_root(thread->vm_space) : NULL;
+
+    if (!region || !root) {
+        spin_unlock_irqrestore(&group->vm_lock, vm_flags);
+        return false;
+    }
+
+    // anything else is a real fault, or a protection one the caller deals with
+    bool handled = (region->flags & SCHED_REGION_SWAP) && _swap_in(thread, root, region, page_addr);
+
+    spin_unlock_irqrestore(&group->vm_lock, vm_flags);
+    return handled;
+}
+
+void sched_swap_init(void) {
+    swap.shrinker = (reclaim_shrinker_t){
+        .name = "swap",
+        .count = _swap_count,
+        .scan = _swap_scan,
+    };
+
+    if (!reclaim_register(&swap.shrinker)) {
+        log_warn("swap disabled");
+    }
+}
@@ -1,5 +1,7 @@
 #include "internal.h"
 
+#include <sys/workqueue.h>
+
 u64 _pid_index_key(pid_t pid) {
     return (u64)(u32)pid;
 }
@@ -222,6 +224,7 @@ void thread_put(sched_thread_t *thread) {
     }
 
     sched_lock_restore(flags);
+    sched_reap_async();
 }
 
 void thread_destroy(sched_thread_t *thread) {
@@ -237,19 +240,24 @@ void thread_destroy(sched_thread_t *thread) {
         procfs_unregister_pid(thread->pid);
     }
 
-    sched_fd_close_all(thread);
-
-    sched_clear_user_regions(thread);
+    // a clone thread only borrowed its leader's fds and address space
+    if (thread->group_leader) {
+        thread_put(thread->group_leader);
+    } else {
+        sched_fd_close_all(thread);
+        sched_clear_user_regions(thread);
 
-    if (thread->vm_space && thread->vm_space != sched_state.core.kernel_vm) {
-        arch_vm_destroy(thread->vm_space);
+        if (thread->vm_space && thread->vm_space != sched_state.core.kernel_vm) {
+            arch_vm_destroy(thread->vm_space);
+        }
     }
 
     sched_waitq_destroy(&thread->wait_queue);
+    sched_waitq_destroy(&thread->vm_wait);
 
     arch_kernel_stack_free(thread);
 
-    free(thread);
+    kmem_cache_free(&sched_thread_cache, thread);
 }
 
 static bool reapable_locked(sched_thread_t *thread) {
@@ -324,7 +332,8 @@ void sched_reap(void) {
         sched_thread_t *thread = node->data;
 
         if (thread && thread != sched_local_current() && thread != sched_local_idle()) {
-            if (thread->user_thread) {
+            // processes wait for their parent, clone threads are freed here
+            if (thread->user_thread && !thread->group_leader) {
                 node = next;
                 continue;
             }
@@ -345,3 +354,28 @@ void sched_reap(void) {
 
     sched_lock_restore(flags);
 }
+
+static void _reap_work(UNUSED work_t *work) {
+    sched_reap();
+}
+
+// one per cpu, so a dead thread is freed where it was last touched and its
+// objects go back to that cpu's slab magazines
+static work_t reap_work[MAX_CORES];
+
+void sched_reap_init(void) {
+    for (size_t cpu = 0; cpu < MAX_CORES; cpu++) {
+        work_init(&reap_work[cpu], _reap_work);
+    }
+}
+
+// frees on a worker rather than in whatever path dropped the last reference
+void sched_reap_async(void) {
+    bool queued = sched_state.procs.reap_list && sched_state.procs.reap_list->length;
+    queued |= sched_state.procs.zombie_list && sched_state.procs.zombie_list->length;
+
+    if (queued) {
+        size_t cpu_id = sched_cpu_id();
+        work_queue_on(&reap_work[cpu_id], cpu_id);
+    }
+}
@@ -1,5 +1,34 @@
 #include "internal.h"
 
+// a running real time thread only gives way to a higher rank, to its equals
+// once it yields or its round robin turn is over, and to fair work when the
+// cpu has used up its real time budget
+static bool rt_keeps_cpu(sched_thread_t *thread, size_t cpu_id, bool yielded) {
+    u32 rank = sched_rank(thread);
+
+    if (!rank || thread_get_state(thread) != THREAD_RUNNING || !sched_cpu_allowed(thread, cpu_id)) {
+        return false;
+    }
+
+    sched_thread_t *best = rq_peek_best(cpu_id);
+    if (!best) {
+        return false;
+    }
+
+    u32 best_rank = sched_rank(best);
+
+    if (best_rank != rank) {
+        return best_rank ? best_rank < rank : !sched_rt_throttled(cpu_id);
+    }
+
+    if (yielded) {
+        return false;
+    }
+
+    bool turn_over = sched_local_slice_ns() >= sched_target_slice_ns(cpu_id, thread);
+    return thread->policy != SCHED_RR || !turn_over;
+}
+
 // the idle thread yields the moment anything is runnable; a real thread keeps
 // the cpu until its slice is spent or a thread with less runtime shows up
 static bool should_preempt(sched_thread_t *thread, size_t cpu_id) {
@@ -21,7 +50,11 @@ static bool should_preempt(sched_thread_t *thread, size_t cpu_id) {
         return true;
     }
 
-    u64 target_ns = sched_target_slice_ns(cpu_id);
+    if (sched_rank(thread)) {
+        return rq_depth && !rt_keeps_cpu(thread, cpu_id, false);
+    }
+
+    u64 target_ns = sched_target_slice_ns(cpu_id, thread);
     bool has_runnable = rq_peek_best(cpu_id) != NULL;
     bool slice_done = sched_local_slice_ns() >= target_ns;
 
@@ -40,28 +73,148 @@ static bool tick_charges(sched_thread_t *thread) {
     return thread_get_state(thread) == THREAD_RUNNING;
 }
 
-static void charge_thread_tick(sched_thread_t *thread, const arch_int_state_t *state) {
+static void charge_thread_ticks(sched_thread_t *thread, const arch_int_state_t *state, u64 ticks) {
     if (!thread || !state) {
         return;
     }
 
-    __atomic_fetch_add(&thread->cpu_time_ticks, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&thread->cpu_time_ticks, ticks, __ATOMIC_RELAXED);
 
     if (arch_signal_is_user(state)) {
-        __atomic_fetch_add(&thread->user_ticks, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&thread->user_ticks, ticks, __ATOMIC_RELAXED);
     } else {
-        __atomic_fetch_add(&thread->sys_ticks, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&thread->sys_ticks, ticks, __ATOMIC_RELAXED);
     }
 }
 
-// a thread picked from the queue may still be mid-teardown on another cpu;
-// switching to a half built context would jump to garbage
-static bool invalid_switch_target(sched_thread_t *next, sched_thread_t *current) {
-    if (!next || next == current || !thread_ctx_ok(next)) {
-        return false;
+// interrupts no longer arrive every tick, so everything since this cpu last
+// accounted is billed to the thread holding it now, even one about to block.
+// Usage counters stay in ticks, runtime and slices get the exact nanoseconds
+static void charge_elapsed(sched_thread_t *thread, const arch_int_state_t *state, size_t cpu_id, u64 now_ns) {
+    sched_cpu_t *local = sched_local();
+    u64 now = arch_timer_ticks();
+    u64 ticks = now > local->charged_tick ? now - local->charged_tick : 0;
+    u64 ns = now_ns > local->charged_ns ? now_ns - local->charged_ns : 0;
+
+    local->charged_tick = now > local->charged_tick ? now : local->charged_tick;
+    local->charged_ns = now_ns > local->charged_ns ? now_ns : local->charged_ns;
+
+    if (now_ns - local->rt_period_start >= SCHED_RT_PERIOD_NS) {
+        local->rt_period_start = now_ns;
+        local->rt_used_ns = 0;
+    }
+
+    if (ticks) {
+        __atomic_fetch_add(&sched_state.usage.total_ticks, ticks, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&sched_state.usage.core_total_ticks[cpu_id], ticks, __ATOMIC_RELAXED);
+    }
+
+    if (!thread || thread == sched_local_idle()) {
+        return;
+    }
+
+    if (ticks) {
+        __atomic_fetch_add(&sched_state.usage.busy_ticks, ticks, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&sched_state.usage.core_busy_ticks[cpu_id], ticks, __ATOMIC_RELAXED);
+        charge_thread_ticks(thread, state, ticks);
+    }
+
+    if (!ns) {
+        return;
+    }
+
+    if (sched_rank(thread)) {
+        local->rt_used_ns += ns;
+    }
+
+    // a heavier thread's virtual clock runs slower, so it gets picked more often
+    thread->sum_exec_ns += ns;
+    thread->last_ran_ns = now_ns;
+    thread->vruntime_ns += ns * SCHED_NICE_0_WEIGHT / (thread->weight ? thread->weight : SCHED_NICE_0_WEIGHT);
+    thread->exec_start_ns = thread->sum_exec_ns;
+    sched_add_slice_ns(ns);
+}
+
+static u64 earliest_deadline(u64 left, u64 right) {
+    if (!left) {
+        return right;
     }
 
-    return !next->context || !ctx_valid(next);
+    if (!right) {
+        return left;
+    }
+
+    return left < right ? left : right;
+}
+
+// a running thread is woken when its slice runs out or this cpu's earliest
+// sleeper is due, and an idle cpu with nothing due stops its timer entirely
+void sched_timer_program(void) {
+    if (!sched_running_get()) {
+        return;
+    }
+
+    size_t cpu_id = sched_cpu_id();
+    sched_cpu_t *local = sched_local();
+    sched_thread_t *thread = sched_local_current();
+    u64 now = arch_timer_ns();
+    u64 deadline = 0;
+
+    if (thread && thread != sched_local_idle()) {
+        u64 target_ns = sched_target_slice_ns(cpu_id, thread);
+        u64 used_ns = sched_local_slice_ns();
+        u64 left_ns = used_ns < target_ns ? target_ns - used_ns : 0;
+
+        // with nothing else to run, or nothing allowed to displace a real time
+        // thread, it just starts another slice
+        if (!left_ns && (!sched_rq_depth(cpu_id) || sched_rank(thread))) {
+            sched_set_slice_ns(0);
+            left_ns = sched_target_slice_ns(cpu_id, thread);
+        }
+
+        deadline = now + (left_ns ? left_ns : 1);
+    }
+
+    u64 armed = deadline;
+
+    // pairs with sched_timer_note_wake: either a new sleeper is seen here, or
+    // its inserter sees the deadline stored below and kicks this cpu
+    for (;;) {
+        u64 wake = sched_wheel_next(cpu_id);
+
+        armed = earliest_deadline(deadline, wake);
+        __atomic_store_n(&local->timer_deadline, armed, __ATOMIC_SEQ_CST);
+
+        if (sched_wheel_next(cpu_id) == wake) {
+            break;
+        }
+    }
+
+    // a periodic timer fires next tick no matter what was asked for
+    if (!arch_timer_program(armed)) {
+        __atomic_store_n(&local->timer_deadline, now + sched_tick_ns(), __ATOMIC_SEQ_CST);
+    }
+}
+
+// caller holds the cpu's run queue lock
+void sched_timer_note_wake(size_t cpu_id, u64 wake_ns) {
+    if (!sched_running_get()) {
+        return;
+    }
+
+    sched_cpu_t *owner = &sched_state.cpus.cpu[cpu_id];
+    u64 armed = __atomic_load_n(&owner->timer_deadline, __ATOMIC_SEQ_CST);
+
+    if (armed && armed <= wake_ns) {
+        return;
+    }
+
+    if (sched_cpu_id() == cpu_id) {
+        sched_timer_program();
+        return;
+    }
+
+    arch_resched_cpu(cpu_id);
 }
 
 static bool need_irq_switch(sched_thread_t *thread, size_t cpu_id, bool force_resched, bool check_policy) {
@@ -78,63 +231,64 @@ static void keep_force(bool force_resched) {
     }
 }
 
-static void retire_bad(sched_thread_t *thread) {
-    thread_unclaim(thread);
-    thread_set_state(thread, THREAD_ZOMBIE);
-    thread->exit_code = -EFAULT;
-    thread->exit_signal = 0;
+// returns with the run queue locked when there is a thread to switch to
+static sched_thread_t *
+pick_switch_to(sched_thread_t *current, bool preempted, size_t cpu_id, unsigned long *flags_out) {
+    unsigned long flags = 0;
+    sched_thread_t *next = pick_next_thread(cpu_id, &flags);
 
-    if (sched_state.procs.zombie_list && !thread->in_zombie_list) {
-        thread->zombie_node.data = thread;
-        list_append(sched_state.procs.zombie_list, &thread->zombie_node);
-        thread->in_zombie_list = true;
+    if (!next && !preempted) {
+        next = sched_local_idle() ? sched_local_idle() : current;
+    }
+
+    if (!next || next == current) {
+        thread_claim(current, cpu_id);
+        rq_unlock_cpu(cpu_id, flags);
+        return NULL;
     }
 
-    exit_event_push(thread->pid);
+    *flags_out = flags;
+    return next;
 }
 
-static sched_thread_t *pick_switch_to(sched_thread_t *current, bool preempted, size_t cpu_id, unsigned long flags) {
-    sched_thread_t *next = NULL;
+static u32 latency_bucket(u64 ns) {
+    u64 us = ns / 1000;
+    u32 bucket = us ? 64 - (u32)__builtin_clzll(us) : 0;
 
-    if (preempted) {
-        next = dequeue_thread();
-        if (!next) {
-            thread_claim(current, cpu_id);
-            sched_lock_restore(flags);
-            return NULL;
-        }
-    } else {
-        next = pick_next_thread();
-    }
+    return bucket < SCHED_LAT_BUCKETS ? bucket : SCHED_LAT_BUCKETS - 1;
+}
 
-    while (invalid_switch_target(next, current)) {
-        retire_bad(next);
-        next = pick_next_thread();
-    }
+// charged to the cpu the thread finally runs on, which is where it waited last
+static void account_rq_wait(sched_thread_t *next, size_t cpu_id) {
+    u64 queued_ns = next->rq_enqueue_ns;
 
-    if (!next || next == current) {
-        thread_claim(current, cpu_id);
-        sched_lock_restore(flags);
-        return NULL;
+    if (!queued_ns || sched_thread_is_idle(next)) {
+        return;
     }
 
-    return next;
+    next->rq_enqueue_ns = 0;
+
+    u64 now_ns = arch_timer_ns();
+    u32 bucket = latency_bucket(now_ns > queued_ns ? now_ns - queued_ns : 0);
+    sched_latency_t *cpu_latency = &sched_state.cpus.cpu[cpu_id].latency;
+
+    next->latency.wait[bucket]++;
+    cpu_latency->wait[bucket]++;
+
+    if (next->rq_woken) {
+        next->latency.wake[bucket]++;
+        cpu_latency->wake[bucket]++;
+    }
 }
 
 // the outgoing thread stays owned by this cpu until its registers are saved,
-// so it is published for stealing only once the switch has actually happened
+// so it is published for stealing only once the switch has actually happened;
+// the pick that led here already flushed the last one under the same lock
 static void stage_switch_away(sched_thread_t *thread, size_t cpu_id) {
     if (!thread) {
         return;
     }
 
-    sched_thread_t *pending = __atomic_load_n(&sched_local()->handoff_ready, __ATOMIC_ACQUIRE);
-
-    if (pending && pending != thread) {
-        __atomic_store_n(&sched_local()->handoff_ready, NULL, __ATOMIC_RELEASE);
-        sched_publish_handoff(pending, cpu_id);
-    }
-
     thread_set_cpu(thread, (int)cpu_id);
     __atomic_store_n(&sched_local()->handoff_ready, thread, __ATOMIC_RELEASE);
 }
@@ -142,6 +296,19 @@ static void stage_switch_away(sched_thread_t *thread, size_t cpu_id) {
 static void
 switch_to_thread(sched_thread_t *old, sched_thread_t *next, size_t cpu_id, unsigned long flags, bool preempted) {
     (void)preempted;
+
+    trace_event(TRACE_SCHED_SWITCH, (u64)old->pid, (u64)next->pid);
+
+    // a real time thread only keeps its place in line when a higher rank took the cpu
+    if (sched_rank(next) <= sched_rank(old) || thread_get_state(old) != THREAD_RUNNING) {
+        old->rt_seq = 0;
+    }
+
+    // a thread leaving the cpu still running comes back through a preemption,
+    // anything else will be back through a wakeup
+    old->rq_woken = thread_get_state(old) != THREAD_RUNNING;
+    account_rq_wait(next, cpu_id);
+
     stage_switch_away(old, cpu_id);
 
     sched_local_set_current(next);
@@ -152,7 +319,8 @@ switch_to_thread(sched_thread_t *old, sched_thread_t *next, size_t cpu_id, unsig
         arch_fpu_save(old->fpu_state);
     }
 
-    sched_lock_restore(flags);
+    rq_unlock_cpu(cpu_id, flags);
+    sched_timer_program();
 
     arch_set_kernel_stack((uintptr_t)next->stack + next->stack_size);
 
@@ -168,7 +336,7 @@ switch_to_thread(sched_thread_t *old, sched_thread_t *next, size_t cpu_id, unsig
     arch_context_switch(next->context);
 }
 
-static void irq_reschedule(arch_int_state_t *state, bool check_policy) {
+static void irq_switch(arch_int_state_t *state, bool check_policy) {
     sched_thread_t *thread = sched_local_current();
     if (!state || !thread) {
         return;
@@ -194,23 +362,23 @@ static void irq_reschedule(arch_int_state_t *state, bool check_policy) {
         return;
     }
 
-    unsigned long flags = 0;
-    if (!sched_lock_try_save(&flags)) {
-        sched_set_resched(true);
-        keep_force(force_resched);
-        return;
-    }
-
     sched_flush_handoff(cpu_id);
-    wake_sleepers(arch_timer_ticks());
+    wake_sleepers(arch_timer_ns());
 
     if (!need_irq_switch(thread, cpu_id, force_resched, check_policy)) {
-        sched_lock_restore(flags);
         return;
     }
 
+    charge_elapsed(thread, state, cpu_id, arch_timer_ns());
+
     sched_set_resched(false);
     __atomic_store_n(&sched_local()->resched_irq, false, __ATOMIC_RELEASE);
+
+    // a wakeup or a yield alone doesn't move a real time thread off the cpu
+    if (rt_keeps_cpu(thread, cpu_id, force_resched)) {
+        return;
+    }
+
     sched_set_slice_ns(0);
 
     if (tick_charges(thread)) {
@@ -220,7 +388,8 @@ static void irq_reschedule(arch_int_state_t *state, bool check_policy) {
     }
 
     bool preempted = tick_charges(thread);
-    sched_thread_t *next = pick_switch_to(thread, preempted, cpu_id, flags);
+    unsigned long flags = 0;
+    sched_thread_t *next = pick_switch_to(thread, preempted, cpu_id, &flags);
 
     if (!next) {
         return;
@@ -229,6 +398,12 @@ static void irq_reschedule(arch_int_state_t *state, bool check_policy) {
     switch_to_thread(thread, next, cpu_id, flags, preempted);
 }
 
+// a switch programs the timer for the incoming thread and never comes back
+static void irq_reschedule(arch_int_state_t *state, bool check_policy) {
+    irq_switch(state, check_policy);
+    sched_timer_program();
+}
+
 void sched_capture_context(arch_int_state_t *state) {
     if (!sched_running_get() || !state) {
         return;
@@ -260,72 +435,33 @@ void sched_capture_context(arch_int_state_t *state) {
 void sched_tick(arch_int_state_t *state) {
     sched_thread_t *thread = sched_local_current();
 
+    // until the scheduler takes over the timer it just keeps ticking
     if (!sched_running_get() || !state || !thread) {
+        arch_timer_program(arch_timer_ns() + sched_tick_ns());
         return;
     }
 
     size_t cpu_id = sched_cpu_id();
+    sched_flush_handoff(cpu_id);
 
-    if (__atomic_load_n(&sched_local()->handoff_ready, __ATOMIC_ACQUIRE)) {
-        unsigned long flush_flags = 0;
-
-        if (sched_lock_try_save(&flush_flags)) {
-            sched_flush_handoff(cpu_id);
-            sched_lock_restore(flush_flags);
-        } else {
-            sched_set_resched(true);
-        }
-    }
-
-    __atomic_fetch_add(&sched_state.usage.total_ticks, 1, __ATOMIC_RELAXED);
-    __atomic_fetch_add(&sched_state.usage.core_total_ticks[cpu_id], 1, __ATOMIC_RELAXED);
-
-    u64 now_ticks = arch_timer_ticks();
-    u64 seen_wake_tick = __atomic_load_n(&sched_state.wait.sleep.wake_tick, __ATOMIC_ACQUIRE);
-
-    if (now_ticks > seen_wake_tick) {
-        unsigned long wake_flags = 0;
-
-        if (sched_lock_try_save(&wake_flags)) {
-            u64 locked_seen = __atomic_load_n(&sched_state.wait.sleep.wake_tick, __ATOMIC_ACQUIRE);
-
-            if (now_ticks > locked_seen) {
-                __atomic_store_n(&sched_state.wait.sleep.wake_tick, now_ticks, __ATOMIC_RELEASE);
-                wake_sleepers(now_ticks);
-            }
+    u64 now_ns = arch_timer_ns();
+    u64 next_wake = sched_wheel_next(cpu_id);
 
-            sched_lock_restore(wake_flags);
-        }
+    if (next_wake && now_ns >= next_wake) {
+        wake_sleepers(now_ns);
     }
 
-    u64 tick_ns = sched_tick_ns();
-
-    if (tick_charges(thread)) {
-        __atomic_fetch_add(&sched_state.usage.busy_ticks, 1, __ATOMIC_RELAXED);
-        __atomic_fetch_add(&sched_state.usage.core_busy_ticks[cpu_id], 1, __ATOMIC_RELAXED);
-        charge_thread_tick(thread, state);
-
-        if (tick_ns) {
-            thread->sum_exec_ns += tick_ns;
-            thread->vruntime_ns += tick_ns;
-            thread->exec_start_ns = thread->sum_exec_ns;
-            sched_add_slice_ns(tick_ns);
-        }
-    }
+    charge_elapsed(thread, state, cpu_id, now_ns);
 
     sched_capture_context(state);
     sched_signal_deliver(state);
 
-    sched_count_local_tick();
-    u64 local_ticks = sched_local_ticks();
-
-    if (local_ticks % SCHED_REBALANCE_TICKS == (cpu_id % SCHED_REBALANCE_TICKS)) {
-        unsigned long flags = 0;
+    sched_cpu_t *local = sched_local();
+    u64 now_ticks = arch_timer_ticks();
 
-        if (sched_lock_try_save(&flags)) {
-            sched_rebalance_once(cpu_id);
-            sched_lock_restore(flags);
-        }
+    if (now_ticks >= local->rebalance_tick) {
+        local->rebalance_tick = now_ticks + SCHED_REBALANCE_TICKS;
+        sched_rebalance_once(cpu_id);
     }
 
     irq_reschedule(state, true);
@@ -389,10 +525,10 @@ void sched_yield(void) {
     }
 
     if (sched_cpu_id() == 0) {
-        sched_reap();
+        sched_reap_async();
     }
 
-    sched_set_slice_ns(sched_target_slice_ns(sched_cpu_id()));
+    sched_set_slice_ns(sched_target_slice_ns(sched_cpu_id(), sched_local_current()));
     force_resched();
 }
 
@@ -412,21 +548,21 @@ void sched_resched_softirq(arch_int_state_t *state) {
     irq_reschedule(state, true);
 }
 
-void sched_sleep(u64 ticks) {
+void sched_sleep_ns(u64 ns) {
     sched_thread_t *self = sched_local_current();
-    if (!self || !ticks) {
+    if (!self || !ns) {
         return;
     }
 
     if (!sched_running_get()) {
-        u64 start = arch_timer_ticks();
-        while ((arch_timer_ticks() - start) < ticks) {
+        u64 start = arch_timer_ns();
+        while ((arch_timer_ns() - start) < ns) {
             sched_spin_wait();
         }
         return;
     }
 
-    sched_wait_deadline(arch_timer_ticks() + ticks, 0);
+    sched_wait_deadline(arch_timer_ns() + ns, 0);
 }
 
 static void reparent_children(sched_thread_t *parent) {
@@ -484,21 +620,39 @@ void sched_exit(void) {
         panic("idle thread attempted to exit");
     }
 
-    if (self) {
+    if (self && self->vfork_parent) {
+        // hand the borrowed space back first so teardown never touches it
+        arch_vm_switch(arch_vm_kernel());
+        self->vm_space = arch_vm_kernel();
+        sched_vfork_release(self, &self->regions, sched_user_mem_kib(self));
+        sched_set_user_mem(self, 0);
+    }
+
+    // a clone thread leaves the shared fd table to its leader
+    if (self && self->group_leader) {
+        sched_group_leave(self);
+    } else if (self) {
         sched_fd_close_all(self);
     }
 
     arch_irq_save();
 
-    unsigned long flags = sched_lock_save();
+    size_t cpu_id = sched_cpu_id();
 
     if (self) {
         exited_pid = self->pid;
-        wq_dequeue(self);
-        sleep_heap_remove(self);
-        reparent_children(self);
+        wq_remove(self);
+
+        unsigned long flags = sched_lock_save();
+
+        if (!self->group_leader) {
+            reparent_children(self);
+        }
+
+        unsigned long rq_flags = rq_lock_cpu(cpu_id);
+        sched_wheel_cancel(self);
         thread_set_state(self, THREAD_ZOMBIE);
-        stage_switch_away(self, sched_cpu_id());
+        rq_unlock_cpu(cpu_id, rq_flags);
 
         if (self != sched_local_idle() && !self->in_zombie_list) {
             self->zombie_node.data = self;
@@ -506,17 +660,28 @@ void sched_exit(void) {
             self->in_zombie_list = true;
         }
 
-        if (self->user_thread) {
+        // clone threads have no parent to tell, the reaper frees them
+        if (self->user_thread && !self->group_leader) {
             sched_thread_t *parent = find_thread(self->ppid);
 
             if (parent) {
-                sched_wake_one(&parent->wait_queue);
+                sched_wake_all(&parent->wait_queue);
                 sched_signal_send(parent, SIGCHLD);
             }
         }
+
+        sched_lock_restore(flags);
     }
 
-    sched_thread_t *next = pick_next_thread();
+    unsigned long flags = 0;
+    sched_thread_t *next = pick_next_thread(cpu_id, &flags);
+
+    if (!next) {
+        next = sched_local_idle();
+    }
+
+    stage_switch_away(self, cpu_id);
+
     if (next) {
         sched_set_resched(false);
         __atomic_store_n(&sched_local()->force_resched, false, __ATOMIC_RELEASE);
@@ -525,24 +690,25 @@ void sched_exit(void) {
         next->exec_start_ns = next->sum_exec_ns;
 
         if (thread_ctx_ok(next) && (!next->context || !ctx_valid(next))) {
-            sched_lock_restore(flags);
+            rq_unlock_cpu(cpu_id, flags);
             panic("scheduler exit switched to invalid context thread");
         }
 
         sched_local_set_current(next);
-        thread_claim(next, sched_cpu_id());
+        thread_claim(next, cpu_id);
     }
 
+    rq_unlock_cpu(cpu_id, flags);
+
     if (exited_pid > 0) {
         exit_event_push(exited_pid);
     }
 
-    sched_lock_restore(flags);
-
     if (!next) {
         cpu_halt();
     }
 
+    sched_timer_program();
     arch_set_kernel_stack((uintptr_t)next->stack + next->stack_size);
 
     if (!self || self->vm_space != next->vm_space) {
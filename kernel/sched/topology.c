@@ -0,0 +1,104 @@
+#include "internal.h"
+
+// the arch ids are only compared, and a level is never wider than the one
+// above it, so a half filled in topology still nests
+static bool shares_level(const cpu_core_t *a, const cpu_core_t *b, sched_domain_t level) {
+    switch (level) {
+    case SCHED_DOMAIN_SMT:
+        return a->package_id == b->package_id && a->core_id == b->core_id;
+    case SCHED_DOMAIN_CACHE:
+        return a->package_id == b->package_id && a->llc_id == b->llc_id;
+    case SCHED_DOMAIN_PACKAGE:
+        return a->package_id == b->package_id;
+    default:
+        return true;
+    }
+}
+
+static size_t count_groups(sched_domain_t level, size_t ncpu) {
+    size_t groups = 0;
+
+    for (size_t cpu = 0; cpu < ncpu; cpu++) {
+        u64 span = sched_state.cpus.domain_span[cpu][level];
+
+        if (span && (size_t)__builtin_ctzll(span) == cpu) {
+            groups++;
+        }
+    }
+
+    return groups;
+}
+
+void sched_topology_init(void) {
+    size_t ncpu = min(core_count, (size_t)MAX_CORES);
+    size_t valid = 0;
+
+    for (size_t cpu = 0; cpu < ncpu; cpu++) {
+        if (!cores_local[cpu].valid) {
+            continue;
+        }
+
+        valid++;
+
+        for (size_t level = 0; level < SCHED_DOMAIN_COUNT; level++) {
+            u64 span = level ? sched_state.cpus.domain_span[cpu][level - 1] : 0;
+
+            for (size_t peer = 0; peer < ncpu; peer++) {
+                if (cores_local[peer].valid && shares_level(&cores_local[cpu], &cores_local[peer], level)) {
+                    span |= 1ULL << peer;
+                }
+            }
+
+            sched_state.cpus.domain_span[cpu][level] = span | (1ULL << cpu);
+        }
+    }
+
+    log_info(
+        "sched topology: %zu cpus, %zu cores, %zu caches, %zu packages",
+        valid,
+        count_groups(SCHED_DOMAIN_SMT, ncpu),
+        count_groups(SCHED_DOMAIN_CACHE, ncpu),
+        count_groups(SCHED_DOMAIN_PACKAGE, ncpu)
+    );
+}
+
+u64 sched_domain_span(size_t cpu_id, sched_domain_t level) {
+    if (cpu_id >= MAX_CORES || level >= SCHED_DOMAIN_COUNT) {
+        return 0;
+    }
+
+    u64 span = sched_state.cpus.domain_span[cpu_id][level];
+    return span ? span : 1ULL << cpu_id;
+}
+
+// 0 for the cpu itself, otherwise one past the innermost domain both share
+size_t sched_cpu_distance(size_t from_cpu, size_t to_cpu) {
+    if (from_cpu >= MAX_CORES || to_cpu >= MAX_CORES) {
+        return (size_t)-1;
+    }
+
+    if (from_cpu == to_cpu) {
+        return 0;
+    }
+
+    for (size_t level = 0; level < SCHED_DOMAIN_COUNT; level++) {
+        if (sched_domain_span(from_cpu, level) & (1ULL << to_cpu)) {
+            return level + 1;
+        }
+    }
+
+    return SCHED_DOMAIN_COUNT + 1;
+}
+
+// true when no smt sibling of the cpu, nor the cpu itself, has work
+bool sched_core_idle(size_t cpu_id) {
+    u64 siblings = sched_domain_span(cpu_id, SCHED_DOMAIN_SMT) & sched_online_cpu_mask();
+
+    for (; siblings; siblings &= siblings - 1) {
+        if (sched_cpu_load((size_t)__builtin_ctzll(siblings))) {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -1,72 +1,85 @@
 #include "internal.h"
 
-void wake_sleepers(u64 now) {
-    for (;;) {
-        sched_thread_t *thread = sleep_heap_top();
-        if (!thread) {
-            break;
-        }
+// caller holds the thread's home queue lock and has taken it off any wait
+// queue; returns true when the thread is left ready but unqueued, so the
+// caller has to enqueue it once the lock is dropped
+bool sched_wake_locked(sched_thread_t *thread, sched_wait_result_t result) {
+    sched_wheel_cancel(thread);
+    thread->wake_ns = 0;
+    thread->wait_deadline_ns = 0;
+    thread->wait_result = (u8)result;
 
-        if (!thread->sleep_queued || !thread->wake_tick) {
-            sleep_heap_remove_at(0);
-            continue;
-        }
+    thread_state_t state = thread_get_state(thread);
 
-        if (thread->wake_tick > now) {
-            break;
+    if (thread_in_handoff(thread)) {
+        if (state == THREAD_ZOMBIE || state == THREAD_STOPPED) {
+            return false;
         }
 
-        sleep_heap_remove(thread);
-        thread->wake_tick = 0;
-        thread->wait_deadline_tick = 0;
+        thread_set_state(thread, THREAD_READY);
+        sched_nudge_thread(thread);
+        return false;
+    }
 
-        thread_state_t state = thread_get_state(thread);
-        if (state == THREAD_SLEEPING) {
-            if (thread->in_wait_queue) {
-                wq_dequeue(thread);
-            }
+    if (thread_on_local_cpu(thread)) {
+        sched_nudge_thread(thread);
+        return false;
+    }
 
-            thread->wait_result = (u8)SCHED_WAIT_TIMEOUT;
-            __atomic_fetch_add(&sched_state.metrics.wait_timeout_count, 1, __ATOMIC_RELAXED);
+    if (state != THREAD_SLEEPING) {
+        return sched_repair_thread(thread);
+    }
 
-            if (thread_in_handoff(thread)) {
-                thread_set_state(thread, THREAD_READY);
-                sched_nudge_thread(thread);
-                continue;
-            }
+    thread_set_state(thread, THREAD_READY);
+    return true;
+}
 
-            if (thread_on_local_cpu(thread)) {
-                sched_nudge_thread(thread);
-                continue;
-            }
+// only this cpu's wheel, every cpu runs its own off its timer
+void wake_sleepers(u64 now_ns) {
+    size_t cpu_id = sched_cpu_id();
 
-            // owned by another core, so release it before handing it back to
-            // the run queue or that core could pick it up mid-migration
-            thread_unclaim(thread);
-            thread_set_state(thread, THREAD_READY);
+    for (;;) {
+        unsigned long flags = rq_lock_cpu(cpu_id);
 
-            enqueue_ipi(thread, true);
+        sched_thread_t *thread = sched_wheel_expire(cpu_id, now_ns);
+        if (!thread) {
+            rq_unlock_cpu(cpu_id, flags);
+            return;
+        }
+
+        // queue locks come before run queue locks, so this one is only tried;
+        // on a miss the sleeper goes back on the wheel, still due, for the retry
+        sched_wait_queue_t *queue = thread->in_wait_queue ? thread->blocked_on : NULL;
 
+        if (queue && !spin_try_lock(&queue->lock)) {
+            sched_wheel_insert(thread, cpu_id);
+            rq_unlock_cpu(cpu_id, flags);
+            arch_cpu_relax();
             continue;
         }
 
-        if (state == THREAD_RUNNING) {
-            sched_repair_thread(thread, true);
-            continue;
+        bool enqueue = false;
+
+        if (thread_get_state(thread) == THREAD_SLEEPING) {
+            wq_dequeue(thread);
+            __atomic_fetch_add(&sched_state.metrics.wait_timeout_count, 1, __ATOMIC_RELAXED);
+            enqueue = sched_wake_locked(thread, SCHED_WAIT_TIMEOUT);
+        } else {
+            thread->wake_ns = 0;
+            thread->wait_deadline_ns = 0;
+            enqueue = sched_repair_thread(thread);
         }
-    }
-}
 
-void sched_wake_sleepers(u64 now) {
-    // runs from the timer interrupt, so it gives up rather than spin on the
-    // lock; the next tick retries and sleepers only wake slightly later
-    unsigned long flags = 0;
-    if (!sched_lock_try_save(&flags)) {
-        return;
-    }
+        if (queue) {
+            spin_unlock(&queue->lock);
+        }
 
-    wake_sleepers(now);
-    sched_lock_restore(flags);
+        rq_unlock_cpu(cpu_id, flags);
+
+        if (enqueue) {
+            enqueue_ipi(thread, true);
+        }
+    }
 }
 
 static bool wq_unlink(sched_wait_queue_t *queue, sched_thread_t *thread) {
@@ -142,6 +155,7 @@ static bool wq_unlink(sched_wait_queue_t *queue, sched_thread_t *thread) {
     return false;
 }
 
+// caller holds both the queue lock and the thread's home queue lock
 void wq_dequeue(sched_thread_t *thread) {
     if (!thread || !thread->in_wait_queue || !thread->blocked_on) {
         return;
@@ -163,14 +177,42 @@ void wq_dequeue(sched_thread_t *thread) {
     thread->blocked_on = NULL;
 }
 
+// locks the thread's home queue and the wait queue it is on, if any; the wait
+// queue lock is taken first everywhere else, so here it is only tried
+static size_t lock_sleeper(sched_thread_t *thread, sched_wait_queue_t **queue_out, unsigned long *flags_out) {
+    for (;;) {
+        size_t cpu_id = rq_lock_home(thread, flags_out);
+        sched_wait_queue_t *queue = thread->in_wait_queue ? thread->blocked_on : NULL;
+
+        if (!queue || spin_try_lock(&queue->lock)) {
+            *queue_out = queue;
+            return cpu_id;
+        }
+
+        rq_unlock_cpu(cpu_id, *flags_out);
+        arch_cpu_relax();
+    }
+}
+
+static void unlock_sleeper(size_t cpu_id, sched_wait_queue_t *queue, unsigned long flags) {
+    if (queue) {
+        spin_unlock(&queue->lock);
+    }
+
+    rq_unlock_cpu(cpu_id, flags);
+}
+
 void wq_remove(sched_thread_t *thread) {
     if (!thread || !thread->in_wait_queue || !thread->blocked_on) {
         return;
     }
 
-    unsigned long flags = sched_lock_save();
+    sched_wait_queue_t *queue = NULL;
+    unsigned long flags = 0;
+    size_t cpu_id = lock_sleeper(thread, &queue, &flags);
+
     wq_dequeue(thread);
-    sched_lock_restore(flags);
+    unlock_sleeper(cpu_id, queue, flags);
 }
 
 bool wait_running(sched_thread_t *self) {
@@ -214,8 +256,11 @@ void sched_discard_thread(sched_thread_t *thread) {
 
     rq_remove(thread);
     wq_remove(thread);
-    sleep_heap_remove(thread);
-    thread_unclaim(thread);
+
+    unsigned long rq_flags = 0;
+    size_t cpu_id = rq_lock_home(thread, &rq_flags);
+    sched_wheel_cancel(thread);
+    rq_unlock_cpu(cpu_id, rq_flags);
 
     if (thread->in_zombie_list && sched_state.procs.zombie_list) {
         unsigned long flags = sched_lock_save();
@@ -232,43 +277,27 @@ void sched_discard_thread(sched_thread_t *thread) {
     thread_put(thread);
 }
 
+// a new thread starts out ready but unqueued, so it is enqueued here even
+// though no wakeup moved it to ready
 void sched_make_runnable(sched_thread_t *thread) {
     if (!thread || sched_thread_is_idle(thread)) {
         return;
     }
 
-    unsigned long flags = sched_lock_save();
+    sched_wait_queue_t *queue = NULL;
+    unsigned long flags = 0;
+    size_t cpu_id = lock_sleeper(thread, &queue, &flags);
 
     wq_dequeue(thread);
-    sleep_heap_remove(thread);
-    thread->wake_tick = 0;
-    thread->wait_deadline_tick = 0;
-    thread->wait_result = (u8)SCHED_WAIT_WOKEN;
 
-    if (thread_in_handoff(thread)) {
-        thread_set_state(thread, THREAD_READY);
-        sched_nudge_thread(thread);
-        sched_lock_restore(flags);
-        return;
-    }
+    bool enqueue = sched_wake_locked(thread, SCHED_WAIT_WOKEN);
+    enqueue = enqueue || (thread_get_state(thread) == THREAD_READY && !thread_is_owned(thread));
 
-    if (thread_on_local_cpu(thread)) {
-        sched_nudge_thread(thread);
-        sched_lock_restore(flags);
-        return;
-    }
+    unlock_sleeper(cpu_id, queue, flags);
 
-    if (thread_get_state(thread) == THREAD_RUNNING) {
-        sched_repair_thread(thread, true);
-        sched_lock_restore(flags);
-        return;
+    if (enqueue) {
+        enqueue_thread(thread);
     }
-
-    thread_unclaim(thread);
-    thread_set_state(thread, THREAD_READY);
-    enqueue_thread(thread);
-
-    sched_lock_restore(flags);
 }
 
 void sched_unblock_thread(sched_thread_t *thread) {
@@ -276,53 +305,36 @@ void sched_unblock_thread(sched_thread_t *thread) {
         return;
     }
 
-    unsigned long flags = sched_lock_save();
+    sched_wait_queue_t *queue = NULL;
+    unsigned long flags = 0;
+    size_t cpu_id = lock_sleeper(thread, &queue, &flags);
 
     thread_state_t state = thread_get_state(thread);
     bool signal_wait = sched_signal_pending(thread);
     bool interruptible = (thread->wait_flags & SCHED_WAIT_INTERRUPTIBLE) != 0;
 
     if (state == THREAD_SLEEPING && signal_wait && !interruptible) {
-        sched_lock_restore(flags);
+        unlock_sleeper(cpu_id, queue, flags);
         return;
     }
 
     wq_dequeue(thread);
-    sleep_heap_remove(thread);
+    sched_wheel_cancel(thread);
 
-    if (state == THREAD_SLEEPING || state == THREAD_READY) {
-        thread->wake_tick = 0;
-        thread->wait_deadline_tick = 0;
+    bool enqueue = false;
 
+    if (state == THREAD_SLEEPING || state == THREAD_READY) {
         bool interrupted = interruptible && signal_wait;
+        enqueue = sched_wake_locked(thread, interrupted ? SCHED_WAIT_INTR : SCHED_WAIT_WOKEN);
+    } else if (state == THREAD_RUNNING) {
+        enqueue = sched_repair_thread(thread);
+    }
 
-        if (interrupted) {
-            thread->wait_result = SCHED_WAIT_INTR;
-        } else {
-            thread->wait_result = SCHED_WAIT_WOKEN;
-        }
-
-        if (thread_in_handoff(thread)) {
-            thread_set_state(thread, THREAD_READY);
-            sched_nudge_thread(thread);
-            sched_lock_restore(flags);
-            return;
-        }
-
-        if (thread_on_local_cpu(thread)) {
-            sched_nudge_thread(thread);
-            sched_lock_restore(flags);
-            return;
-        }
+    unlock_sleeper(cpu_id, queue, flags);
 
-        thread_unclaim(thread);
-        thread_set_state(thread, THREAD_READY);
+    if (enqueue) {
         enqueue_thread(thread);
-    } else if (state == THREAD_RUNNING) {
-        sched_repair_thread(thread, true);
     }
-
-    sched_lock_restore(flags);
 }
 
 void sched_stop_thread(sched_thread_t *thread, int signum) {
@@ -330,11 +342,13 @@ void sched_stop_thread(sched_thread_t *thread, int signum) {
         return;
     }
 
-    unsigned long flags = sched_lock_save();
+    sched_wait_queue_t *queue = NULL;
+    unsigned long flags = 0;
+    size_t cpu_id = lock_sleeper(thread, &queue, &flags);
     thread_state_t state = thread_get_state(thread);
 
     if (state == THREAD_ZOMBIE || state == THREAD_STOPPED) {
-        sched_lock_restore(flags);
+        unlock_sleeper(cpu_id, queue, flags);
         return;
     }
 
@@ -344,7 +358,7 @@ void sched_stop_thread(sched_thread_t *thread, int signum) {
     bool remote = false;
 
     if (!self && state == THREAD_RUNNING && cpu >= 0) {
-        remote = thread_is_owned(thread);
+        remote = owned;
     }
 
     if (remote) {
@@ -356,35 +370,35 @@ void sched_stop_thread(sched_thread_t *thread, int signum) {
         thread->stop_signal = signum;
         thread->stop_reported = false;
 
-        sched_lock_restore(flags);
+        unlock_sleeper(cpu_id, queue, flags);
 
         sched_kick_cpu((size_t)cpu);
         return;
     }
 
-    rq_remove(thread);
+    rq_remove_locked(thread);
     wq_dequeue(thread);
-    sleep_heap_remove(thread);
+    sched_wheel_cancel(thread);
 
-    thread->wake_tick = 0;
+    thread->wake_ns = 0;
     thread_set_state(thread, THREAD_STOPPED);
     thread->stop_signal = signum;
     thread->stop_reported = false;
 
-    if (!self && !owned) {
-        thread_unclaim(thread);
-    }
+    unlock_sleeper(cpu_id, queue, flags);
 
+    // the parent is looked up in the process tree, which the process lock guards
     if (thread->user_thread) {
+        unsigned long tree_flags = sched_lock_save();
         sched_thread_t *parent = find_thread(thread->ppid);
 
         if (parent) {
             sched_wake_one(&parent->wait_queue);
             sched_signal_send(parent, SIGCHLD);
         }
-    }
 
-    sched_lock_restore(flags);
+        sched_lock_restore(tree_flags);
+    }
 
     if (owned) {
         sched_nudge_thread(thread);
@@ -400,9 +414,11 @@ void sched_continue_thread(sched_thread_t *thread) {
         return;
     }
 
-    unsigned long flags = sched_lock_save();
+    unsigned long flags = 0;
+    size_t cpu_id = rq_lock_home(thread, &flags);
+
     if (thread_get_state(thread) != THREAD_STOPPED) {
-        sched_lock_restore(flags);
+        rq_unlock_cpu(cpu_id, flags);
         return;
     }
 
@@ -412,12 +428,10 @@ void sched_continue_thread(sched_thread_t *thread) {
 
     if (thread_is_owned(thread)) {
         sched_nudge_thread(thread);
-        sched_lock_restore(flags);
+        rq_unlock_cpu(cpu_id, flags);
         return;
     }
 
-    thread_unclaim(thread);
+    rq_unlock_cpu(cpu_id, flags);
     enqueue_thread(thread);
-
-    sched_lock_restore(flags);
 }
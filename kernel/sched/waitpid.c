@@ -201,12 +201,15 @@ static void wait_for_zombie_owner(sched_thread_t *thread) {
 }
 
 pid_t sched_waitpid(pid_t pid, int *status, int options) {
-    sched_thread_t *self = sched_local_current();
+    sched_thread_t *current = sched_local_current();
 
-    if (!self || !self->user_thread) {
+    if (!current || !current->user_thread) {
         return -ECHILD;
     }
 
+    // children belong to the process, any of its threads may wait for them
+    sched_thread_t *self = sched_group(current);
+
     if (options & ~(WNOHANG | WUNTRACED)) {
         return -EINVAL;
     }
@@ -1,5 +1,13 @@
 #include "internal.h"
 
+#include <sys/workqueue.h>
+
+kmem_cache_t sched_waitq_cache = KMEM_CACHE_INIT("sched_wait_queue", sizeof(sched_wait_queue_t), 16);
+
+// waiter lists are created and torn down with every wait queue, so they get
+// a cache of their own instead of going through list_create()
+static kmem_cache_t waitq_list_cache = KMEM_CACHE_INIT("waitq_list", sizeof(linked_list_t), 16);
+
 static void waitq_free_list(linked_list_t *list) {
     if (!list) {
         return;
@@ -8,51 +16,29 @@ static void waitq_free_list(linked_list_t *list) {
     list->head = NULL;
     list->tail = NULL;
     list->length = 0;
-    free(list);
+    kmem_cache_free(&waitq_list_cache, list);
 }
 
+// caller holds the queue lock the thread was just popped from
 static void wake_waiter(sched_thread_t *thread) {
     if (!thread) {
         return;
     }
 
-    sleep_heap_remove(thread);
-    thread->wake_tick = 0;
-    thread->wait_deadline_tick = 0;
-    thread->wait_result = (u8)SCHED_WAIT_WOKEN;
-
-    if (thread_in_handoff(thread)) {
-        thread_state_t state = thread_get_state(thread);
-
-        if (state == THREAD_ZOMBIE || state == THREAD_STOPPED) {
-            return;
-        }
+    trace_event(TRACE_SCHED_WAKE, (u64)thread->pid, 0);
 
-        thread_set_state(thread, THREAD_READY);
-        sched_nudge_thread(thread);
-        return;
-    }
+    unsigned long flags = 0;
+    size_t cpu_id = rq_lock_home(thread, &flags);
 
-    if (thread_on_local_cpu(thread)) {
-        sched_nudge_thread(thread);
-        return;
-    }
+    thread->in_wait_queue = false;
+    thread->blocked_on = NULL;
 
-    thread_state_t state = thread_get_state(thread);
+    bool enqueue = sched_wake_locked(thread, SCHED_WAIT_WOKEN);
+    rq_unlock_cpu(cpu_id, flags);
 
-    if (state == THREAD_RUNNING) {
-        sched_repair_thread(thread, true);
-        return;
+    if (enqueue) {
+        enqueue_wakeup(thread);
     }
-
-    if (state != THREAD_SLEEPING && state != THREAD_READY) {
-        return;
-    }
-
-    thread_set_cpu(thread, -1);
-    thread_set_state(thread, THREAD_READY);
-
-    enqueue_thread(thread);
 }
 
 static sched_thread_t *wait_queue_pop(sched_wait_queue_t *queue) {
@@ -99,9 +85,6 @@ static sched_thread_t *wait_queue_pop(sched_wait_queue_t *queue) {
             continue;
         }
 
-        thread->in_wait_queue = false;
-        thread->blocked_on = NULL;
-
         return thread;
     }
 }
@@ -126,12 +109,25 @@ static void wake_queue_all(sched_wait_queue_t *queue) {
     }
 }
 
+// one queue lock at a time, the poll queue is woken after the queue it watches
+static void wake_queue(sched_wait_queue_t *queue, bool all) {
+    unsigned long flags = spin_lock_irqsave(&queue->lock);
+
+    if (queue->list && all) {
+        wake_queue_all(queue);
+    } else if (queue->list) {
+        wake_queue_one(queue);
+    }
+
+    spin_unlock_irqrestore(&queue->lock, flags);
+}
+
 static bool waitq_has_waiters(const sched_wait_queue_t *queue) {
     if (!queue || !queue->list) {
         return false;
     }
 
-    return __atomic_load_n(&queue->waiter_count, __ATOMIC_ACQUIRE) != 0;
+    return __atomic_load_n(&queue->waiter_count, __ATOMIC_SEQ_CST) != 0;
 }
 
 static bool poll_wait_linked(const sched_wait_queue_t *queue) {
@@ -165,8 +161,8 @@ static void wait_node_clear(sched_thread_t *thread) {
 static void wait_restore_running(sched_thread_t *thread) {
     wait_node_clear(thread);
     thread->wait_flags = 0;
-    thread->wait_deadline_tick = 0;
-    thread->wake_tick = 0;
+    thread->wait_deadline_ns = 0;
+    thread->wake_ns = 0;
     thread_set_state(thread, THREAD_RUNNING);
 }
 
@@ -193,27 +189,18 @@ static bool wait_append_locked(sched_wait_queue_t *queue, sched_thread_t *thread
     return true;
 }
 
-static bool wait_arm_deadline_locked(sched_wait_queue_t *queue, sched_thread_t *thread, u64 deadline_tick) {
-    if (!deadline_tick) {
-        return true;
-    }
-
-    thread->wake_tick = deadline_tick;
-
-    if (sleep_heap_insert(thread)) {
-        return true;
-    }
-
-    if (list_remove(queue->list, &thread->wait_node) && queue->waiter_count) {
-        queue->waiter_count--;
+static void wait_arm_deadline_locked(sched_thread_t *thread, u64 deadline_ns) {
+    if (!deadline_ns) {
+        return;
     }
 
-    wait_restore_running(thread);
-    return false;
+    thread->wake_ns = deadline_ns;
+    sched_wheel_insert(thread, sched_cpu_id());
 }
 
+// caller holds the queue lock and this cpu's run queue lock
 static bool
-wait_attach_locked(sched_wait_queue_t *queue, sched_thread_t *thread, u64 deadline_tick, sched_wait_flags_t flags) {
+wait_attach_locked(sched_wait_queue_t *queue, sched_thread_t *thread, u64 deadline_ns, sched_wait_flags_t flags) {
     u8 cookie = (u8)(thread->wait_cookie + 1U);
     if (!cookie) {
         cookie = 1U;
@@ -221,7 +208,7 @@ wait_attach_locked(sched_wait_queue_t *queue, sched_thread_t *thread, u64 deadli
 
     thread->wait_cookie = cookie;
     thread->wait_flags = flags;
-    thread->wait_deadline_tick = deadline_tick;
+    thread->wait_deadline_ns = deadline_ns;
     thread->wait_result = (u8)SCHED_WAIT_ABORTED;
     thread->wait_node.data = thread;
 
@@ -231,12 +218,13 @@ wait_attach_locked(sched_wait_queue_t *queue, sched_thread_t *thread, u64 deadli
         return false;
     }
 
-    return wait_arm_deadline_locked(queue, thread, deadline_tick);
+    wait_arm_deadline_locked(thread, deadline_ns);
+    return true;
 }
 
 // a waker always publishes a result; if none arrived the wakeup raced with a
 // signal or the deadline, so work out which of the two it was
-static sched_wait_result_t wait_result(sched_thread_t *thread, u64 deadline_tick, sched_wait_flags_t flags) {
+static sched_wait_result_t wait_result(sched_thread_t *thread, u64 deadline_ns, sched_wait_flags_t flags) {
     sched_wait_result_t result = (sched_wait_result_t)__atomic_load_n(&thread->wait_result, __ATOMIC_ACQUIRE);
 
     if (result != SCHED_WAIT_ABORTED) {
@@ -247,7 +235,7 @@ static sched_wait_result_t wait_result(sched_thread_t *thread, u64 deadline_tick
         return SCHED_WAIT_INTR;
     }
 
-    if (deadline_tick && arch_timer_ticks() >= deadline_tick) {
+    if (deadline_ns && arch_timer_ns() >= deadline_ns) {
         return SCHED_WAIT_TIMEOUT;
     }
 
@@ -265,7 +253,7 @@ void sched_waitq_init(sched_wait_queue_t *queue) {
     queue->poll_link = false;
 
     if (!queue->list) {
-        queue->list = list_create();
+        queue->list = kmem_cache_zalloc(&waitq_list_cache);
     }
 }
 
@@ -282,7 +270,7 @@ void sched_waitq_destroy(sched_wait_queue_t *queue) {
         return;
     }
 
-    unsigned long flags = sched_lock_save();
+    unsigned long flags = spin_lock_irqsave(&queue->lock);
 
     if (queue->list) {
         __atomic_add_fetch(&queue->wake_seq, 1, __ATOMIC_RELEASE);
@@ -295,7 +283,7 @@ void sched_waitq_destroy(sched_wait_queue_t *queue) {
     queue->wake_seq = 0;
     queue->poll_link = false;
 
-    sched_lock_restore(flags);
+    spin_unlock_irqrestore(&queue->lock, flags);
 }
 
 u32 sched_wait_seq(sched_wait_queue_t *queue) {
@@ -307,7 +295,7 @@ u32 sched_wait_seq(sched_wait_queue_t *queue) {
 }
 
 sched_wait_result_t
-sched_wait_on(sched_wait_queue_t *queue, u32 observed_seq, u64 deadline_tick, sched_wait_flags_t flags) {
+sched_wait_on(sched_wait_queue_t *queue, u32 observed_seq, u64 deadline_ns, sched_wait_flags_t flags) {
     sched_thread_t *self = sched_local_current();
     sched_reconcile_lock();
 
@@ -323,44 +311,54 @@ sched_wait_on(sched_wait_queue_t *queue, u32 observed_seq, u64 deadline_tick, sc
         return SCHED_WAIT_ABORTED;
     }
 
-    unsigned long lock_flags = sched_lock_save();
+    // only this thread ever puts itself on a queue, so whatever it was still
+    // linked on goes first and the queue lock is never held with another
+    wq_remove(self);
+
+    unsigned long lock_flags = spin_lock_irqsave(&queue->lock);
     if (!queue->list) {
-        sched_lock_restore(lock_flags);
+        spin_unlock_irqrestore(&queue->lock, lock_flags);
         return SCHED_WAIT_ABORTED;
     }
 
     if ((flags & SCHED_WAIT_INTERRUPTIBLE) && sched_signal_pending(self)) {
-        sched_lock_restore(lock_flags);
+        spin_unlock_irqrestore(&queue->lock, lock_flags);
         return SCHED_WAIT_INTR;
     }
 
+    size_t cpu_id = sched_cpu_id();
+    sched_rq_t *rq = &sched_state.cpus.runqueues[cpu_id];
+    spin_lock(&rq->lock);
+
     thread_state_t state = thread_get_state(self);
     bool running = state == THREAD_RUNNING;
     bool current = self == sched_local_current();
 
     if (!running || !current) {
-        sched_lock_restore(lock_flags);
+        spin_unlock(&rq->lock);
+        spin_unlock_irqrestore(&queue->lock, lock_flags);
         return SCHED_WAIT_ABORTED;
     }
 
-    if (self->in_wait_queue && self->blocked_on == queue) {
-        wq_dequeue(self);
-    } else if (self->in_wait_queue || self->blocked_on) {
-        wq_dequeue(self);
-    }
+    rq_remove_locked(self);
+    sched_wheel_cancel(self);
+    self->wake_ns = 0;
 
-    rq_remove(self);
-    sleep_heap_remove(self);
-    self->wake_tick = 0;
+    bool unchanged = wait_attach_locked(queue, self, deadline_ns, flags);
 
-    u32 wake_seq = __atomic_load_n(&queue->wake_seq, __ATOMIC_ACQUIRE);
-    bool unchanged = thread_get_state(self) != THREAD_ZOMBIE && wake_seq == observed_seq;
+    // wakers bump the sequence before they look for waiters without the lock,
+    // so it is only checked once this thread is counted; one side sees the other
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
 
-    if (unchanged) {
-        unchanged = wait_attach_locked(queue, self, deadline_tick, flags);
+    if (unchanged && __atomic_load_n(&queue->wake_seq, __ATOMIC_ACQUIRE) != observed_seq) {
+        wq_dequeue(self);
+        sched_wheel_cancel(self);
+        wait_restore_running(self);
+        unchanged = false;
     }
 
-    sched_lock_restore(lock_flags);
+    spin_unlock(&rq->lock);
+    spin_unlock_irqrestore(&queue->lock, lock_flags);
 
     if (!unchanged) {
         return SCHED_WAIT_ABORTED;
@@ -371,9 +369,9 @@ sched_wait_on(sched_wait_queue_t *queue, u32 observed_seq, u64 deadline_tick, sc
         return SCHED_WAIT_ABORTED;
     }
 
-    sched_wait_result_t result = wait_result(self, deadline_tick, flags);
+    sched_wait_result_t result = wait_result(self, deadline_ns, flags);
 
-    self->wait_deadline_tick = 0;
+    self->wait_deadline_ns = 0;
     self->wait_flags = 0;
     self->wait_result = (u8)SCHED_WAIT_ABORTED;
 
@@ -405,10 +403,12 @@ void exit_event_push(pid_t pid) {
         ring_queue_push(r, &pid);
     }
 
+    work_t *work = sched_state.wait.exit_events.work;
     spin_unlock_irqrestore(&sched_state.wait.exit_events.lock, flags);
 
-    if (sched_running_get() && sched_state.wait.exit_event_wait.list) {
-        sched_wake_all(&sched_state.wait.exit_event_wait);
+    // queueing may wake a worker, so no run queue lock can be held here
+    if (work) {
+        work_queue(work);
     }
 }
 
@@ -427,15 +427,14 @@ bool sched_exit_event_pop(pid_t *pid_out) {
     return popped;
 }
 
-u32 sched_exit_event_seq(void) {
-    return sched_wait_seq(&sched_state.wait.exit_event_wait);
-}
-
-bool sched_exit_wait_change(u32 observed_seq) {
-    sched_wait_queue_t *queue = &sched_state.wait.exit_event_wait;
-    sched_wait_result_t result = sched_wait_on(queue, observed_seq, 0, SCHED_WAIT_INTERRUPTIBLE);
+void sched_exit_event_notify(work_t *work) {
+    unsigned long flags = spin_lock_irqsave(&sched_state.wait.exit_events.lock);
+    sched_state.wait.exit_events.work = work;
+    spin_unlock_irqrestore(&sched_state.wait.exit_events.lock, flags);
 
-    return result == SCHED_WAIT_WOKEN;
+    if (work) {
+        work_queue(work);
+    }
 }
 
 u32 sched_poll_wait_seq(void) {
@@ -453,11 +452,11 @@ bool sched_poll_wait_change(u32 observed_seq) {
     return result == SCHED_WAIT_WOKEN;
 }
 
-bool sched_poll_wait_until(u32 observed_seq, u64 deadline_tick) {
+bool sched_poll_wait_until(u32 observed_seq, u64 deadline_ns) {
     sched_wait_result_t result = sched_wait_on(
         &sched_state.wait.poll_wait_queue,
         observed_seq,
-        deadline_tick,
+        deadline_ns,
         SCHED_WAIT_INTERRUPTIBLE | SCHED_WAIT_POLL_LINK
     );
 
@@ -473,36 +472,29 @@ void sched_poll_wait(void) {
     sched_poll_wait_change(seq);
 }
 
-sched_wait_result_t sched_wait_deadline(u64 deadline_tick, sched_wait_flags_t flags) {
+sched_wait_result_t sched_wait_deadline(u64 deadline_ns, sched_wait_flags_t flags) {
     u32 observed_seq = sched_wait_seq(&sched_state.wait.sleep_wait_queue);
-    return sched_wait_on(&sched_state.wait.sleep_wait_queue, observed_seq, deadline_tick, flags);
+    return sched_wait_on(&sched_state.wait.sleep_wait_queue, observed_seq, deadline_ns, flags);
 }
 
-void sched_wake_one_locked(sched_wait_queue_t *queue) {
-    if (!queue || !queue->list) {
-        return;
-    }
-
-    __atomic_add_fetch(&queue->wake_seq, 1, __ATOMIC_RELEASE);
+// the sequence is bumped before waiters are looked for, see sched_wait_on
+static void waitq_wake(sched_wait_queue_t *queue, bool all) {
+    __atomic_add_fetch(&queue->wake_seq, 1, __ATOMIC_SEQ_CST);
 
-    bool wake_queue = waitq_has_waiters(queue);
+    bool has_waiters = waitq_has_waiters(queue);
     bool wake_pollers = false;
 
     if (poll_wait_linked(queue)) {
-        __atomic_add_fetch(&sched_state.wait.poll_wait_queue.wake_seq, 1, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&sched_state.wait.poll_wait_queue.wake_seq, 1, __ATOMIC_SEQ_CST);
         wake_pollers = waitq_has_waiters(&sched_state.wait.poll_wait_queue);
     }
 
-    if (!wake_queue && !wake_pollers) {
-        return;
-    }
-
-    if (wake_queue) {
-        wake_queue_one(queue);
+    if (has_waiters) {
+        wake_queue(queue, all);
     }
 
     if (wake_pollers) {
-        wake_queue_all(&sched_state.wait.poll_wait_queue);
+        wake_queue(&sched_state.wait.poll_wait_queue, true);
     }
 }
 
@@ -511,39 +503,22 @@ void sched_wake_one(sched_wait_queue_t *queue) {
         return;
     }
 
-    unsigned long flags = sched_lock_save();
-    sched_wake_one_locked(queue);
-    sched_lock_restore(flags);
-}
+    // nobody to wake is the common case, so only the sequence is bumped then
+    if (!waitq_has_waiters(queue) && !poll_wait_linked(queue)) {
+        __atomic_add_fetch(&queue->wake_seq, 1, __ATOMIC_SEQ_CST);
 
-void sched_wake_all(sched_wait_queue_t *queue) {
-    if (!queue || !queue->list) {
-        return;
+        if (!waitq_has_waiters(queue)) {
+            return;
+        }
     }
 
-    __atomic_add_fetch(&queue->wake_seq, 1, __ATOMIC_RELEASE);
-
-    bool wake_queue = waitq_has_waiters(queue);
-    bool wake_pollers = false;
-
-    if (poll_wait_linked(queue)) {
-        __atomic_add_fetch(&sched_state.wait.poll_wait_queue.wake_seq, 1, __ATOMIC_RELEASE);
-        wake_pollers = waitq_has_waiters(&sched_state.wait.poll_wait_queue);
-    }
+    waitq_wake(queue, false);
+}
 
-    if (!wake_queue && !wake_pollers) {
+void sched_wake_all(sched_wait_queue_t *queue) {
+    if (!queue || !queue->list) {
         return;
     }
 
-    unsigned long flags = sched_lock_save();
-
-    if (wake_queue) {
-        wake_queue_all(queue);
-    }
-
-    if (wake_pollers) {
-        wake_queue_all(&sched_state.wait.poll_wait_queue);
-    }
-
-    sched_lock_restore(flags);
+    waitq_wake(queue, true);
 }
@@ -0,0 +1,300 @@
+#include "internal.h"
+
+// every cpu keeps its own wheel for the sleepers it put to sleep and runs it
+// off its own timer; each wheel is guarded by its cpu's run queue lock, which
+// is the home lock of every thread on it
+
+#define WHEEL_NEVER UINT64_MAX
+#define WHEEL_SPAN  (1ULL << (SCHED_WHEEL_LEVELS * SCHED_WHEEL_BITS))
+
+static inline sched_wheel_t *wheel_of(size_t cpu_id) {
+    return &sched_state.cpus.wheels[cpu_id];
+}
+
+static inline u64 level_shift(size_t level) {
+    return (u64)level * SCHED_WHEEL_BITS;
+}
+
+static inline size_t level_index(u64 clock, size_t level) {
+    return (size_t)((clock >> level_shift(level)) & SCHED_WHEEL_MASK);
+}
+
+static inline void wheel_publish(sched_wheel_t *wheel, u64 next_ns) {
+    __atomic_store_n(&wheel->next_ns, next_ns, __ATOMIC_SEQ_CST);
+}
+
+// clock at which an occupied slot of `level` is next reached; the slot the
+// clock is in already moved down when it was entered, so above level 0 it
+// only holds timers a full lap out
+static u64 wheel_slot_clock(const sched_wheel_t *wheel, size_t level, bool skip_current) {
+    u64 bits = wheel->occupied[level];
+    if (!bits) {
+        return WHEEL_NEVER;
+    }
+
+    size_t index = level_index(wheel->clock, level);
+    u64 rotated = index ? (bits >> index) | (bits << (SCHED_WHEEL_SLOTS - index)) : bits;
+    u64 offset = 0;
+
+    if (level || skip_current) {
+        u64 ahead = rotated & ~1ULL;
+        offset = ahead ? (u64)__builtin_ctzll(ahead) : SCHED_WHEEL_SLOTS;
+    } else {
+        offset = (u64)__builtin_ctzll(rotated);
+    }
+
+    u64 shift = level_shift(level);
+    return ((wheel->clock >> shift) + offset) << shift;
+}
+
+// returns when the timer has to be looked at next: its own deadline at level
+// 0, or the moment its slot moves down a level
+static u64 wheel_place(sched_wheel_t *wheel, sched_thread_t *thread) {
+    u64 expires = thread->wake_ns >> SCHED_WHEEL_SHIFT;
+
+    if (expires < wheel->clock) {
+        expires = wheel->clock;
+    }
+
+    // beyond the top level it parks in the farthest slot and drops back in
+    if (expires - wheel->clock >= WHEEL_SPAN) {
+        expires = wheel->clock + WHEEL_SPAN - 1;
+    }
+
+    u64 delta = expires - wheel->clock;
+    size_t level = 0;
+
+    while (level + 1 < SCHED_WHEEL_LEVELS && delta >= (1ULL << level_shift(level + 1))) {
+        level++;
+    }
+
+    size_t index = level_index(expires, level);
+
+    list_append(&wheel->slots[level][index], &thread->sleep_node);
+    wheel->occupied[level] |= 1ULL << index;
+
+    if (!level) {
+        return thread->wake_ns;
+    }
+
+    u64 shift = level_shift(level);
+    return ((expires >> shift) << shift) << SCHED_WHEEL_SHIFT;
+}
+
+static void wheel_unlink(sched_wheel_t *wheel, list_node_t *node) {
+    linked_list_t *list = node->owner;
+    if (!list || !list_remove(list, node)) {
+        return;
+    }
+
+    if (list == &wheel->expired || list->length) {
+        return;
+    }
+
+    size_t slot = (size_t)(list - &wheel->slots[0][0]);
+    wheel->occupied[slot / SCHED_WHEEL_SLOTS] &= ~(1ULL << (slot % SCHED_WHEEL_SLOTS));
+}
+
+static u64 wheel_next_ns(const sched_wheel_t *wheel) {
+    u64 best = WHEEL_NEVER;
+
+    if (wheel->occupied[0]) {
+        u64 clock = wheel_slot_clock(wheel, 0, false);
+        const linked_list_t *slot = &wheel->slots[0][level_index(clock, 0)];
+
+        ll_foreach(node, slot) {
+            sched_thread_t *thread = node->data;
+            best = min(best, thread->wake_ns);
+        }
+    }
+
+    for (size_t level = 1; level < SCHED_WHEEL_LEVELS; level++) {
+        u64 clock = wheel_slot_clock(wheel, level, true);
+
+        if (clock != WHEEL_NEVER) {
+            best = min(best, clock << SCHED_WHEEL_SHIFT);
+        }
+    }
+
+    if (best == WHEEL_NEVER) {
+        return 0;
+    }
+
+    return best ? best : 1;
+}
+
+static void wheel_add(size_t cpu_id, sched_thread_t *thread) {
+    sched_wheel_t *wheel = wheel_of(cpu_id);
+
+    // an empty wheel may have idled far behind, nothing is lost catching up
+    if (!wheel->count) {
+        wheel->clock = max(wheel->clock, arch_timer_ns() >> SCHED_WHEEL_SHIFT);
+    }
+
+    u64 due = wheel_place(wheel, thread);
+    due = due ? due : 1;
+
+    wheel->count++;
+    thread->sleep_queued = true;
+    thread->sleep_cpu = (u32)cpu_id;
+
+    u64 next = wheel->next_ns;
+
+    if (!next || due < next) {
+        wheel_publish(wheel, due);
+        sched_timer_note_wake(cpu_id, due);
+    }
+}
+
+// everything in the slots of the levels the clock just entered moves down
+static void wheel_cascade(sched_wheel_t *wheel) {
+    for (size_t level = 1; level < SCHED_WHEEL_LEVELS; level++) {
+        u64 shift = level_shift(level);
+
+        if (wheel->clock & ((1ULL << shift) - 1)) {
+            return;
+        }
+
+        size_t index = level_index(wheel->clock, level);
+        linked_list_t *slot = &wheel->slots[level][index];
+
+        wheel->occupied[level] &= ~(1ULL << index);
+
+        for (list_node_t *node = list_pop_front(slot); node; node = list_pop_front(slot)) {
+            wheel_place(wheel, node->data);
+        }
+    }
+}
+
+// slots are coarser than the deadlines, so the current one is filtered
+static void wheel_collect(sched_wheel_t *wheel, u64 now_ns) {
+    size_t index = level_index(wheel->clock, 0);
+    linked_list_t *slot = &wheel->slots[0][index];
+    list_node_t *node = slot->head;
+
+    while (node) {
+        list_node_t *next = node->next;
+        sched_thread_t *thread = node->data;
+
+        if (thread->wake_ns <= now_ns && list_remove(slot, node)) {
+            list_append(&wheel->expired, node);
+        }
+
+        node = next;
+    }
+
+    if (!slot->length) {
+        wheel->occupied[0] &= ~(1ULL << index);
+    }
+}
+
+// jumps straight between occupied slots, so a long idle costs one step per
+// timer rather than one per slot
+static void wheel_run(sched_wheel_t *wheel, u64 now_ns) {
+    u64 target = now_ns >> SCHED_WHEEL_SHIFT;
+
+    for (;;) {
+        wheel_collect(wheel, now_ns);
+
+        if (wheel->clock >= target) {
+            return;
+        }
+
+        u64 next = wheel_slot_clock(wheel, 0, true);
+
+        for (size_t level = 1; level < SCHED_WHEEL_LEVELS; level++) {
+            next = min(next, wheel_slot_clock(wheel, level, true));
+        }
+
+        wheel->clock = min(next, target);
+        wheel_cascade(wheel);
+    }
+}
+
+void sched_wheel_init(size_t cpu_id, u64 now_ns) {
+    sched_wheel_t *wheel = wheel_of(cpu_id);
+
+    wheel->clock = now_ns >> SCHED_WHEEL_SHIFT;
+    wheel_publish(wheel, 0);
+}
+
+// caller holds `cpu_id`'s run queue lock, the thread's home
+void sched_wheel_insert(sched_thread_t *thread, size_t cpu_id) {
+    if (!thread || cpu_id >= MAX_CORES) {
+        return;
+    }
+
+    sched_wheel_cancel(thread);
+    wheel_add(cpu_id, thread);
+}
+
+// a next_ns left early by this only costs one interrupt, which recomputes it
+void sched_wheel_cancel(sched_thread_t *thread) {
+    if (!thread || !thread->sleep_queued) {
+        return;
+    }
+
+    sched_wheel_t *wheel = wheel_of(thread->sleep_cpu);
+
+    wheel_unlink(wheel, &thread->sleep_node);
+    thread->sleep_queued = false;
+
+    if (wheel->count && !--wheel->count) {
+        wheel_publish(wheel, 0);
+    }
+}
+
+// the sleeper's home moves along with its timer, so both queues are held; one
+// still owned by a cpu is left, it is only parked there until its switch lands
+void sched_wheel_migrate(sched_thread_t *thread, size_t cpu_id) {
+    if (!thread || cpu_id >= MAX_CORES) {
+        return;
+    }
+
+    unsigned long flags = 0;
+    size_t home_cpu = rq_lock_home_pair(thread, cpu_id, &flags);
+
+    // a thread still sitting in a queue keeps that queue as its home
+    bool unplaced = thread_cpu(thread) < 0 && !thread->on_rq;
+    bool movable = thread->sleep_queued && thread->sleep_cpu != cpu_id && unplaced;
+
+    if (movable) {
+        sched_wheel_cancel(thread);
+        thread->last_cpu = cpu_id;
+        wheel_add(cpu_id, thread);
+    }
+
+    rq_unlock_home_pair(home_cpu, cpu_id, flags);
+}
+
+// hands out one due thread per call, already off the wheel
+sched_thread_t *sched_wheel_expire(size_t cpu_id, u64 now_ns) {
+    sched_wheel_t *wheel = wheel_of(cpu_id);
+
+    if (!wheel->expired.length) {
+        if (!wheel->count) {
+            wheel->clock = max(wheel->clock, now_ns >> SCHED_WHEEL_SHIFT);
+            wheel_publish(wheel, 0);
+            return NULL;
+        }
+
+        wheel_run(wheel, now_ns);
+
+        if (!wheel->expired.length) {
+            wheel_publish(wheel, wheel_next_ns(wheel));
+            return NULL;
+        }
+    }
+
+    list_node_t *node = list_pop_front(&wheel->expired);
+    sched_thread_t *thread = node->data;
+
+    thread->sleep_queued = false;
+    wheel->count--;
+
+    return thread;
+}
+
+u64 sched_wheel_next(size_t cpu_id) {
+    return __atomic_load_n(&wheel_of(cpu_id)->next_ns, __ATOMIC_SEQ_CST);
+}
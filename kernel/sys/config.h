@@ -2,8 +2,10 @@
 
 #include <limits.h>
 
+// resolution of the tick clock; timer interrupts are only taken when
+// something is due, except on the periodic PIT fallback
 #ifndef TIMER_FREQ
-#define TIMER_FREQ 100
+#define TIMER_FREQ 1000
 #endif
 
 #ifndef MAX_CORES
@@ -18,6 +20,10 @@
 #define SCHED_GROUP_MAX 16
 #endif
 
+#ifndef SCHED_FUTEX_BUCKETS
+#define SCHED_FUTEX_BUCKETS 64
+#endif
+
 #ifndef SCHED_PIPE_CAPACITY
 #define SCHED_PIPE_CAPACITY 4096
 #endif
@@ -62,16 +68,41 @@
 #define SCHED_MIN_GRANULARITY_NS 1000000ULL
 #endif
 
+// a round robin thread's turn before it goes behind its equals
+#ifndef SCHED_RR_SLICE_NS
+#define SCHED_RR_SLICE_NS 100000000ULL
+#endif
+
+// real time threads get at most this much of every period on each cpu
+#ifndef SCHED_RT_PERIOD_NS
+#define SCHED_RT_PERIOD_NS 1000000000ULL
+#endif
+
+#ifndef SCHED_RT_RUNTIME_NS
+#define SCHED_RT_RUNTIME_NS 950000000ULL
+#endif
+
+// load weight of a nice 0 thread, vruntime runs at wall speed at this weight
+#ifndef SCHED_NICE_0_WEIGHT
+#define SCHED_NICE_0_WEIGHT 1024U
+#endif
+
 #ifndef SCHED_REBALANCE_TICKS
-#define SCHED_REBALANCE_TICKS 32ULL
+#define SCHED_REBALANCE_TICKS 320ULL
 #endif
 
 #ifndef SCHED_RQ_CAPACITY
 #define SCHED_RQ_CAPACITY 4096
 #endif
 
-#ifndef SCHED_SLEEP_CAPACITY
-#define SCHED_SLEEP_CAPACITY SCHED_RQ_CAPACITY
+// level 0 of the timer wheels ticks every 2^20 ns, five levels of 64 slots
+// reach about 13 days before a timer has to be parked at the top
+#ifndef SCHED_WHEEL_SHIFT
+#define SCHED_WHEEL_SHIFT 20
+#endif
+
+#ifndef SCHED_WHEEL_LEVELS
+#define SCHED_WHEEL_LEVELS 5
 #endif
 
 #ifndef SCHED_IDLE_STEAL_BATCH
@@ -90,8 +121,9 @@
 #define SCHED_WAKE_LOAD_SLOP 2
 #endif
 
-#ifndef KERNEL_HEAP_BLOCK_SIZE
-#define KERNEL_HEAP_BLOCK_SIZE 8
+// a thread that ran this recently is taken to still have its cache warm
+#ifndef SCHED_MIGRATION_COST_NS
+#define SCHED_MIGRATION_COST_NS 500000ULL
 #endif
 
 #ifndef KERNEL_HEAP_PAGES
@@ -102,6 +134,19 @@
 #define KERNEL_HEAP_MAX_ARENAS 16
 #endif
 
+#ifndef KMEM_MAGAZINE_SIZE
+#define KMEM_MAGAZINE_SIZE 32
+#endif
+
+#ifndef KMEM_EMPTY_SLABS
+#define KMEM_EMPTY_SLABS 1
+#endif
+
+// the compressed ram disk holds up to 1/ZRAM_DISK_DIV of memory before compression
+#ifndef ZRAM_DISK_DIV
+#define ZRAM_DISK_DIV 2
+#endif
+
 #ifndef TTY_COUNT
 #define TTY_COUNT 4
 #endif
@@ -182,15 +227,19 @@
 #error "EXEC_ARG_MAX must fit at least one exec argument"
 #endif
 
-#if SCHED_RQ_CAPACITY < 1 || SCHED_SLEEP_CAPACITY < 1
+#if SCHED_RQ_CAPACITY < 1
 #error "scheduler queue capacities must be at least 1"
 #endif
 
+#if SCHED_WHEEL_LEVELS < 1 || SCHED_WHEEL_SHIFT + SCHED_WHEEL_LEVELS * 6 > 63
+#error "timer wheel geometry must fit a 64-bit nanosecond clock"
+#endif
+
 #if SCHED_REBALANCE_TICKS < 1
 #error "SCHED_REBALANCE_TICKS must be at least 1"
 #endif
 
-#if KERNEL_HEAP_BLOCK_SIZE < 1 || KERNEL_HEAP_PAGES < 1
+#if KERNEL_HEAP_PAGES < 1
 #error "kernel heap sizing must be non-zero"
 #endif
 
@@ -198,6 +247,14 @@
 #error "KERNEL_HEAP_MAX_ARENAS must be at least 1"
 #endif
 
+#if KMEM_MAGAZINE_SIZE < 2
+#error "KMEM_MAGAZINE_SIZE must be at least 2"
+#endif
+
+#if ZRAM_DISK_DIV < 1
+#error "ZRAM_DISK_DIV must be at least 1"
+#endif
+
 #if TTY_COUNT < 1 || PTY_COUNT < 1
 #error "terminal counts must be non-zero"
 #endif
@@ -76,6 +76,9 @@ void cpu_init_core(size_t id) {
     core->valid = true;
     core->online = false;
     core->id = id;
+
+    // until the arch knows better every cpu is its own core behind one cache
+    core->core_id = (u32)id;
 }
 
 void cpu_init_boot(void) {
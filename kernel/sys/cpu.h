@@ -10,6 +10,10 @@ typedef struct {
     size_t id;
     size_t nest_depth;
     u32 lapic_id;
+    // cpus sharing an id share that level, the arch fills them in when it can
+    u32 package_id;
+    u32 core_id;
+    u32 llc_id;
 } cpu_core_t;
 
 extern cpu_core_t cores_local[MAX_CORES];
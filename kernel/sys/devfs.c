@@ -379,7 +379,10 @@ static ssize_t _dev_sched_read(vfs_node_t *node, void *buf, size_t offset, size_
         "wake_ipis=%" PRIu64 "\n"
         "runq_peak=%" PRIu64 "\n"
         "balances=%" PRIu64 "\n"
-        "timeouts=%" PRIu64 "\n",
+        "timeouts=%" PRIu64 "\n"
+        "wake_affine=%" PRIu64 "\n"
+        "wake_prev=%" PRIu64 "\n"
+        "hot_skips=%" PRIu64 "\n",
         sched_snapshot.sched_switch_count,
         sched_snapshot.syscall_count,
         sched_snapshot.sched_migrations,
@@ -387,7 +390,10 @@ static ssize_t _dev_sched_read(vfs_node_t *node, void *buf, size_t offset, size_
         sched_snapshot.sched_wake_ipi,
         sched_snapshot.sched_runqueue_max,
         sched_snapshot.sched_balance_runs,
-        sched_snapshot.wait_timeout_count
+        sched_snapshot.wait_timeout_count,
+        sched_snapshot.sched_wake_affine,
+        sched_snapshot.sched_wake_prev,
+        sched_snapshot.sched_hot_skips
     );
 
     return _dev_text_read(text, buf, offset, len);
@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/lock.h>
+#include <sys/trace.h>
 
 #include "devfs.h"
 #include "mbr.h"
@@ -270,7 +271,7 @@ static bool ext2_uuid(disk_partition_t *part, u8 out_uuid[16]) {
     }
 
     ext2_superblock_t sb = { 0 };
-    ssize_t read = part->disk->interface->read(part->disk, &sb, part->offset + 1024, sizeof(sb));
+    ssize_t read = disk_read(part->disk, &sb, part->offset + 1024, sizeof(sb));
 
     if (read < (ssize_t)sizeof(sb)) {
         return false;
@@ -345,7 +346,7 @@ static bool _parse_mbr(disk_dev_t *dev) {
     }
 
     u8 mbr[512] = { 0 };
-    ssize_t read = dev->interface->read(dev, mbr, 0, sizeof(mbr));
+    ssize_t read = disk_read(dev, mbr, 0, sizeof(mbr));
 
     if (read < (ssize_t)sizeof(mbr)) {
         log_warn("failed to read MBR");
@@ -452,7 +453,7 @@ static bool _parse_gpt(disk_dev_t *dev) {
     }
 
     u8 header_buf[512] = { 0 };
-    ssize_t read = dev->interface->read(dev, header_buf, dev->sector_size, sizeof(header_buf));
+    ssize_t read = disk_read(dev, header_buf, dev->sector_size, sizeof(header_buf));
 
     if (read < (ssize_t)sizeof(header_buf)) {
         return false;
@@ -488,7 +489,7 @@ static bool _parse_gpt(disk_dev_t *dev) {
         return false;
     }
 
-    read = dev->interface->read(dev, entries, entries_offset, entries_bytes);
+    read = disk_read(dev, entries, entries_offset, entries_bytes);
     if (read < (ssize_t)entries_bytes) {
         free(entries);
         return false;
@@ -617,6 +618,22 @@ static bool _probe_disk(disk_dev_t *dev) {
     return true;
 }
 
+ssize_t disk_read(disk_dev_t *dev, void *dest, size_t offset, size_t bytes) {
+    trace_event(TRACE_DISK_SUBMIT, dev->id, bytes);
+    ssize_t result = dev->interface->read(dev, dest, offset, bytes);
+    trace_event(TRACE_DISK_COMPLETE, dev->id, (u64)result);
+
+    return result;
+}
+
+ssize_t disk_write(disk_dev_t *dev, void *src, size_t offset, size_t bytes) {
+    trace_event(TRACE_DISK_SUBMIT, dev->id, -(u64)bytes);
+    ssize_t result = dev->interface->write(dev, src, offset, bytes);
+    trace_event(TRACE_DISK_COMPLETE, dev->id, (u64)result);
+
+    return result;
+}
+
 static ssize_t _vfs_read(vfs_node_t *node, void *buf, size_t offset, size_t len, u32 flags) {
     (void)flags;
 
@@ -645,7 +662,7 @@ static ssize_t _vfs_read(vfs_node_t *node, void *buf, size_t offset, size_t len,
         return -EOVERFLOW;
     }
 
-    return part->disk->interface->read(part->disk, buf, part->offset + offset, len);
+    return disk_read(part->disk, buf, part->offset + offset, len);
 }
 
 static ssize_t _vfs_write(vfs_node_t *node, void *buf, size_t offset, size_t len, u32 flags) {
@@ -676,7 +693,7 @@ static ssize_t _vfs_write(vfs_node_t *node, void *buf, size_t offset, size_t len
         return -EOVERFLOW;
     }
 
-    return part->disk->interface->write(part->disk, buf, part->offset + offset, len);
+    return disk_write(part->disk, buf, part->offset + offset, len);
 }
 
 static void publish_partitions(disk_dev_t *dev) {
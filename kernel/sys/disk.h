@@ -131,6 +131,10 @@ MUST_USE bool disk_unregister(disk_dev_t *dev);
 bool disk_is_busy(const disk_dev_t *dev);
 disk_dev_t *disk_lookup(size_t dev_id);
 
+// every transfer goes through these so it shows up in the trace
+ssize_t disk_read(disk_dev_t *dev, void *dest, size_t offset, size_t bytes);
+ssize_t disk_write(disk_dev_t *dev, void *src, size_t offset, size_t bytes);
+
 bool file_system_register(fs_t *fs);
 fs_t *file_system_lookup(const char *name);
 
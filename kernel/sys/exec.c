@@ -173,24 +173,6 @@ static bool _segment_range(u64 vaddr, u64 mem_size, u64 max_addr, u64 *base_out,
     return true;
 }
 
-static bool _user_region_end(const sched_user_region_t *region, uintptr_t *out) {
-    if (!region || !region->pages || !out) {
-        return false;
-    }
-
-    if (region->pages > SIZE_MAX / PAGE_4KIB) {
-        return false;
-    }
-
-    uintptr_t size = region->pages * PAGE_4KIB;
-    if (size > (uintptr_t)-1 - region->vaddr) {
-        return false;
-    }
-
-    *out = region->vaddr + size;
-    return true;
-}
-
 static bool _map_user_region(sched_thread_t *thread, uintptr_t vaddr, uintptr_t paddr, size_t pages, u64 flags) {
     if (!thread || !thread->vm_space || !pages || !paddr) {
         return false;
@@ -208,11 +190,8 @@ static bool _map_user_region(sched_thread_t *thread, uintptr_t vaddr, uintptr_t
         return true;
     }
 
-    for (size_t i = 0; i < pages; i++) {
-        uintptr_t page = vaddr + i * PAGE_4KIB;
-        unmap_page((page_t *)root, page);
-        arch_tlb_flush(page);
-    }
+    arch_unmap_region(root, pages, vaddr);
+    arch_tlb_flush_range(thread->vm_space, vaddr, vaddr + pages * PAGE_4KIB);
 
     arch_free_frames((void *)paddr, pages);
     return false;
@@ -223,17 +202,7 @@ static sched_user_region_t *find_user_page(sched_thread_t *thread, uintptr_t vad
         return NULL;
     }
 
-    sched_user_region_t *region = thread->regions;
-    while (region) {
-        uintptr_t region_end = 0;
-        if (_user_region_end(region, &region_end) && vaddr >= region->vaddr && vaddr < region_end) {
-            return region;
-        }
-
-        region = region->next;
-    }
-
-    return NULL;
+    return sched_region_find(thread, vaddr);
 }
 
 static exec_loaded_page_t *_find_loaded_page(exec_loaded_page_t *pages, uintptr_t vaddr) {
@@ -282,7 +251,7 @@ _ensure_loaded_page(sched_thread_t *thread, exec_loaded_page_t **pages, uintptr_
 
             page->flags = merged;
             arch_map_region(root, 1, vaddr, page->paddr, merged);
-            arch_tlb_flush(vaddr);
+            arch_tlb_flush_range(thread->vm_space, vaddr, vaddr + PAGE_4KIB);
 
             sched_user_region_t *region = find_user_page(thread, vaddr);
             if (region && region->pages == 1 && region->vaddr == vaddr) {
@@ -293,7 +262,7 @@ _ensure_loaded_page(sched_thread_t *thread, exec_loaded_page_t **pages, uintptr_
         return page;
     }
 
-    uintptr_t paddr = (uintptr_t)arch_alloc_frames_user(1);
+    uintptr_t paddr = sched_alloc_user_zeroed(vaddr, 1);
     if (!paddr) {
         return NULL;
     }
@@ -302,14 +271,6 @@ _ensure_loaded_page(sched_thread_t *thread, exec_loaded_page_t **pages, uintptr_
         return NULL;
     }
 
-    void *dst = arch_phys_map(paddr, PAGE_4KIB, 0);
-    if (!dst) {
-        return NULL;
-    }
-
-    memset(dst, 0, PAGE_4KIB);
-    arch_phys_unmap(dst, PAGE_4KIB);
-
     page = calloc(1, sizeof(*page));
     if (!page) {
         return NULL;
@@ -960,7 +921,7 @@ static bool _map_user_stack(sched_thread_t *thread, uintptr_t *stack_top_out) {
         return false;
     }
 
-    uintptr_t paddr = (uintptr_t)arch_alloc_frames_user(pages);
+    uintptr_t paddr = sched_alloc_user_zeroed(base, pages);
     if (!paddr) {
         return false;
     }
@@ -1027,7 +988,7 @@ static int _open_file(sched_thread_t *thread, const char *path, exec_file_t *out
         return -ENAMETOOLONG;
     }
 
-    bool resolved = path_resolve(thread->cwd, path, out->resolved, sizeof(out->resolved));
+    bool resolved = path_resolve(sched_group(thread)->cwd, path, out->resolved, sizeof(out->resolved));
 
     if (!resolved) {
         return -ENOENT;
@@ -1179,19 +1140,6 @@ _shebang_args(const exec_args_t *orig, const exec_shebang_t *shebang, const char
     return 0;
 }
 
-static void _free_regions_list(sched_user_region_t *region) {
-    while (region) {
-        sched_user_region_t *next = region->next;
-
-        if (region->paddr && region->pages) {
-            arch_free_frames((void *)region->paddr, region->pages);
-        }
-
-        free(region);
-        region = next;
-    }
-}
-
 static const char *_basename(const char *path) {
     if (!path) {
         return "";
@@ -1324,7 +1272,7 @@ out:
 
 typedef struct {
     arch_vm_space_t *vm;
-    sched_user_region_t *regions;
+    rb_tree_t regions;
     uintptr_t stack_base;
     size_t stack_size;
     u64 mem_kib;
@@ -1340,7 +1288,7 @@ static exec_image_t exec_take_image(sched_thread_t *thread, arch_vm_space_t *fre
     };
 
     thread->vm_space = fresh;
-    thread->regions = NULL;
+    thread->regions = (rb_tree_t){0};
     thread->user_stack_base = old.stack_base;
     thread->user_stack_size = old.stack_size;
     sched_set_user_mem(thread, 0);
@@ -1360,10 +1308,8 @@ static void exec_restore_image(sched_thread_t *thread, arch_vm_space_t *fresh, c
     arch_vm_destroy(fresh);
 }
 
-static void exec_drop_old_image(const exec_image_t *old) {
-    if (old->regions) {
-        _free_regions_list(old->regions);
-    }
+static void exec_drop_old_image(exec_image_t *old) {
+    sched_region_tree_free(&old->regions);
 
     if (old->vm && old->vm != arch_vm_kernel()) {
         arch_vm_destroy(old->vm);
@@ -1455,6 +1401,9 @@ int user_exec(
         return -EINVAL;
     }
 
+    // the image is swapped out from under the thread below without its vm lock
+    sched_vm_hold(thread);
+
     exec_plan_t plan = { 0 };
     int err = exec_plan_load(thread, path, argv, envp, &plan);
     if (err) {
@@ -1504,7 +1453,17 @@ int user_exec(
     sched_signal_exec(thread);
     sched_fd_close_cloexec(thread);
 
-    exec_drop_old_image(&old);
+    if (thread->vfork_parent) {
+        sched_vfork_release(thread, &old.regions, old.mem_kib);
+    } else {
+        exec_drop_old_image(&old);
+    }
+
+    // spawn builds another thread's image, leave this CPU on the caller's space
+    sched_thread_t *self = sched_current();
+    if (self && self != thread) {
+        arch_vm_switch(self->vm_space);
+    }
 
     if (state) {
         memset(state, 0, sizeof(*state));
@@ -1529,6 +1488,7 @@ int user_exec(
 
 out:
     exec_plan_clear(&plan);
+    sched_vm_release(thread);
 
     return err;
 }
@@ -0,0 +1,17 @@
+#include "extable.h"
+
+#include <stddef.h>
+
+extern const extable_entry_t __ex_table_start[];
+extern const extable_entry_t __ex_table_end[];
+
+uintptr_t extable_fixup(uintptr_t ip) {
+    // only the user copy routines add entries, a linear scan is plenty
+    for (const extable_entry_t *entry = __ex_table_start; entry < __ex_table_end; entry++) {
+        if (entry->insn == ip) {
+            return entry->fixup;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <base/types.h>
+#include <stdint.h>
+
+// an instruction allowed to fault on user memory and where to resume when it does
+typedef struct {
+    uintptr_t insn;
+    uintptr_t fixup;
+} extable_entry_t;
+
+#if UINTPTR_MAX == 0xffffffffffffffffULL
+#define EXTABLE_PTR   ".quad"
+#define EXTABLE_ALIGN "8"
+#else
+#define EXTABLE_PTR   ".long"
+#define EXTABLE_ALIGN "4"
+#endif
+
+// emitted from inline asm next to the faulting instruction, labels are local asm labels
+#define EXTABLE_ENTRY(insn, fixup)            \
+    ".pushsection __ex_table, \"a\"\n\t"       \
+    ".balign " EXTABLE_ALIGN "\n\t"           \
+    EXTABLE_PTR " " insn ", " fixup "\n\t"    \
+    ".popsection\n\t"
+
+// resume address for a kernel fault at `ip`, 0 when the fault is a real bug
+uintptr_t extable_fixup(uintptr_t ip);
@@ -9,6 +9,7 @@
 #include <string.h>
 #include <sys/cpu.h>
 #include <sys/panic.h>
+#include <sys/slab.h>
 
 volatile uint32_t lock_spin_held_depth[MAX_CORES] = { 0 };
 
@@ -52,6 +53,153 @@ void lock_debug_trap(const char *site, const void *lock_ptr, const void *caller,
 }
 #endif
 
+#if LOCK_STAT
+typedef struct {
+    lock_stat_t sites[LOCK_STAT_SITES];
+    uint64_t dropped;
+} lock_stat_state_t;
+
+// updated lock free, since the hooks run inside spin_lock itself
+static lock_stat_state_t lock_stats = { 0 };
+
+static void _stat_max(uint64_t *slot, uint64_t value) {
+    uint64_t seen = __atomic_load_n(slot, __ATOMIC_RELAXED);
+
+    while (value > seen) {
+        if (__atomic_compare_exchange_n(slot, &seen, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+}
+
+// open addressing on the site; a claimed slot is kept for good, a reset only
+// clears its counters
+static lock_stat_t *_stat_site(const void *site, uint32_t kind) {
+    uintptr_t hash = ((uintptr_t)site >> 2) ^ ((uintptr_t)site >> 11);
+
+    for (size_t probe = 0; probe < LOCK_STAT_SITES; probe++) {
+        lock_stat_t *entry = &lock_stats.sites[(hash + probe) & (LOCK_STAT_SITES - 1)];
+        const void *seen = __atomic_load_n(&entry->site, __ATOMIC_ACQUIRE);
+
+        if (!seen) {
+            bool claimed = __atomic_compare_exchange_n(
+                &entry->site,
+                &seen,
+                site,
+                false,
+                __ATOMIC_ACQ_REL,
+                __ATOMIC_ACQUIRE
+            );
+
+            if (claimed) {
+                __atomic_store_n(&entry->kind, kind, __ATOMIC_RELAXED);
+                return entry;
+            }
+        }
+
+        if (seen == site) {
+            return entry;
+        }
+    }
+
+    __atomic_fetch_add(&lock_stats.dropped, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static void *_stat_acquired(
+    const void *site,
+    uint32_t kind,
+    uint64_t wait_since,
+    bool contended,
+    uint64_t *held_since
+) {
+    uint64_t now = arch_cycles();
+    lock_stat_t *entry = _stat_site(site, kind);
+
+    *held_since = now;
+
+    if (!entry) {
+        return NULL;
+    }
+
+    __atomic_fetch_add(&entry->acquired, 1, __ATOMIC_RELAXED);
+
+    if (contended) {
+        uint64_t wait = now - wait_since;
+
+        __atomic_fetch_add(&entry->contended, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&entry->wait_total, wait, __ATOMIC_RELAXED);
+        _stat_max(&entry->wait_max, wait);
+    }
+
+    return entry;
+}
+
+// spin_lock is inlined into its caller, so the return address is the site
+void *lock_stat_spin_acquired(uint64_t wait_since, bool contended, uint64_t *held_since) {
+    return _stat_acquired(__builtin_return_address(0), LOCK_STAT_SPIN, wait_since, contended, held_since);
+}
+
+void lock_stat_released(void *entry, uint64_t held_since) {
+    lock_stat_t *stat = entry;
+
+    if (!stat) {
+        return;
+    }
+
+    uint64_t hold = arch_cycles() - held_since;
+
+    __atomic_fetch_add(&stat->hold_total, hold, __ATOMIC_RELAXED);
+    _stat_max(&stat->hold_max, hold);
+}
+
+size_t lock_stat_snapshot(lock_stat_t *out, size_t max) {
+    size_t count = 0;
+
+    for (size_t i = 0; i < LOCK_STAT_SITES && count < max; i++) {
+        lock_stat_t *entry = &lock_stats.sites[i];
+        const void *site = __atomic_load_n(&entry->site, __ATOMIC_ACQUIRE);
+
+        if (!site) {
+            continue;
+        }
+
+        out[count++] = (lock_stat_t){
+            .site = site,
+            .kind = __atomic_load_n(&entry->kind, __ATOMIC_RELAXED),
+            .acquired = __atomic_load_n(&entry->acquired, __ATOMIC_RELAXED),
+            .contended = __atomic_load_n(&entry->contended, __ATOMIC_RELAXED),
+            .wait_total = __atomic_load_n(&entry->wait_total, __ATOMIC_RELAXED),
+            .wait_max = __atomic_load_n(&entry->wait_max, __ATOMIC_RELAXED),
+            .hold_total = __atomic_load_n(&entry->hold_total, __ATOMIC_RELAXED),
+            .hold_max = __atomic_load_n(&entry->hold_max, __ATOMIC_RELAXED),
+        };
+    }
+
+    return count;
+}
+
+uint64_t lock_stat_dropped(void) {
+    return __atomic_load_n(&lock_stats.dropped, __ATOMIC_RELAXED);
+}
+
+// counts racing with the reset may land on either side of it
+void lock_stat_reset(void) {
+    for (size_t i = 0; i < LOCK_STAT_SITES; i++) {
+        lock_stat_t *entry = &lock_stats.sites[i];
+
+        __atomic_store_n(&entry->acquired, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry->contended, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry->wait_total, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry->wait_max, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry->hold_total, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry->hold_max, 0, __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&lock_stats.dropped, 0, __ATOMIC_RELAXED);
+}
+#endif
+
 static sched_wait_queue_t *mutex_wait_queue_get(mutex_t *mutex, bool create) {
     if (!mutex) {
         return NULL;
@@ -62,7 +210,7 @@ static sched_wait_queue_t *mutex_wait_queue_get(mutex_t *mutex, bool create) {
         return queue;
     }
 
-    queue = calloc(1, sizeof(*queue));
+    queue = kmem_cache_zalloc(&sched_waitq_cache);
     if (!queue) {
         return NULL;
     }
@@ -84,7 +232,7 @@ static sched_wait_queue_t *mutex_wait_queue_get(mutex_t *mutex, bool create) {
     }
 
     sched_waitq_destroy(queue);
-    free(queue);
+    kmem_cache_free(&sched_waitq_cache, queue);
     return expected;
 }
 
@@ -116,6 +264,9 @@ void mutex_init(mutex_t *mutex) {
 #if LOCK_DEBUG
     mutex->owner_thread = NULL;
 #endif
+#if LOCK_STAT
+    mutex->stat_entry = NULL;
+#endif
 }
 
 void mutex_destroy(mutex_t *mutex) {
@@ -130,7 +281,7 @@ void mutex_destroy(mutex_t *mutex) {
 
     if (queue) {
         sched_waitq_destroy(queue);
-        free(queue);
+        kmem_cache_free(&sched_waitq_cache, queue);
     }
 }
 
@@ -147,6 +298,15 @@ bool mutex_try_lock(mutex_t *mutex) {
 #if LOCK_DEBUG
         mutex->owner_thread = sched_is_running() ? sched_current() : NULL;
 #endif
+#if LOCK_STAT
+        mutex->stat_entry = _stat_acquired(
+            __builtin_return_address(0),
+            LOCK_STAT_MUTEX,
+            0,
+            false,
+            &mutex->stat_held_since
+        );
+#endif
 
         locked = true;
     }
@@ -159,6 +319,11 @@ void mutex_lock(mutex_t *mutex) {
         return;
     }
 
+#if LOCK_STAT
+    uint64_t stat_wait_since = arch_cycles();
+    bool stat_contended = false;
+#endif
+
     sched_wait_queue_t *queue = mutex_wait_queue_get(mutex, true);
     for (;;) {
         unsigned long flags = spin_lock_irqsave(&mutex->lock);
@@ -168,6 +333,15 @@ void mutex_lock(mutex_t *mutex) {
 #if LOCK_DEBUG
             mutex->owner_thread = sched_is_running() ? sched_current() : NULL;
 #endif
+#if LOCK_STAT
+            mutex->stat_entry = _stat_acquired(
+                __builtin_return_address(0),
+                LOCK_STAT_MUTEX,
+                stat_wait_since,
+                stat_contended,
+                &mutex->stat_held_since
+            );
+#endif
 
             spin_unlock_irqrestore(&mutex->lock, flags);
             return;
@@ -178,6 +352,10 @@ void mutex_lock(mutex_t *mutex) {
         }
         spin_unlock_irqrestore(&mutex->lock, flags);
 
+#if LOCK_STAT
+        stat_contended = true;
+#endif
+
         if (!sched_is_running() || !sched_current() || !arch_irq_enabled()) {
             arch_cpu_relax();
             continue;
@@ -229,6 +407,10 @@ void mutex_unlock(mutex_t *mutex) {
             lock_debug_trap("mutex_unlock:foreign-owner", mutex, __builtin_return_address(0), (size_t)-1, mutex->held);
         }
     }
+#endif
+#if LOCK_STAT
+    lock_stat_released(mutex->stat_entry, mutex->stat_held_since);
+    mutex->stat_entry = NULL;
 #endif
     mutex->held = 0;
     sched_wait_queue_t *queue = mutex->wait_queue;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <arch/arch.h>
+#include <base/attributes.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -10,13 +11,29 @@
 struct sched_wait_queue;
 extern volatile uint32_t lock_spin_held_depth[MAX_CORES];
 
+// a ticket lock: lockers take the next ticket and wait until it is served, so
+// the lock goes round in arrival order and waiters only read the shared line.
+// Both halves share one word, low half first on every supported target
 typedef struct {
-    volatile int state;
+    union {
+        volatile uint32_t state;
+        struct {
+            volatile uint16_t owner;
+            volatile uint16_t next;
+        } ticket;
+    };
 #if LOCK_DEBUG
     size_t owner_cpu;
 #endif
+#if LOCK_STAT
+    // the site holding the lock, NULL when it was taken without statistics
+    void *stat_entry;
+    uint64_t stat_held_since;
+#endif
 } spinlock_t;
 
+#define SPINLOCK_TICKET_ONE (1U << 16)
+
 #if LOCK_DEBUG
 struct sched_thread;
 void lock_debug_trap(const char *site, const void *lock_ptr, const void *caller, size_t owner_cpu, int lock_state);
@@ -29,8 +46,49 @@ typedef struct {
 #if LOCK_DEBUG
     struct sched_thread *owner_thread;
 #endif
+#if LOCK_STAT
+    void *stat_entry;
+    uint64_t stat_held_since;
+#endif
 } mutex_t;
 
+#if LOCK_STAT
+// sites that can be told apart before new ones are only counted as dropped,
+// a power of two
+#define LOCK_STAT_SITES 512
+
+typedef enum {
+    LOCK_STAT_SPIN = 1,
+    LOCK_STAT_MUTEX,
+} lock_stat_kind_t;
+
+// times are in arch_cycles(), waits only count the contended acquisitions
+typedef struct {
+    const void *site;
+    uint32_t kind;
+    uint64_t acquired;
+    uint64_t contended;
+    uint64_t wait_total;
+    uint64_t wait_max;
+    uint64_t hold_total;
+    uint64_t hold_max;
+} lock_stat_t;
+
+// statistics are keyed by the code taking the lock, which for a spinlock is
+// the return address of the hook, so spin_lock has to be inlined into it
+#define LOCK_INLINE inline ALWAYS_INLINE
+
+void *lock_stat_spin_acquired(uint64_t wait_since, bool contended, uint64_t *held_since);
+void lock_stat_released(void *entry, uint64_t held_since);
+
+// copies out at most `max` sites in no particular order and returns how many
+size_t lock_stat_snapshot(lock_stat_t *out, size_t max);
+uint64_t lock_stat_dropped(void);
+void lock_stat_reset(void);
+#else
+#define LOCK_INLINE inline
+#endif
+
 void lock_preempt_disable(void);
 void lock_preempt_enable(void);
 
@@ -63,14 +121,30 @@ static inline void spinlock_init(spinlock_t *lock) {
 #endif
 }
 
-static inline bool spin_try_lock(spinlock_t *lock) {
+static inline bool spin_is_locked(const spinlock_t *lock) {
+    uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+    return (uint16_t)state != (uint16_t)(state >> 16);
+}
+
+static LOCK_INLINE bool spin_try_lock(spinlock_t *lock) {
     if (!lock) {
         return false;
     }
 
     lock_preempt_disable();
 
-    if (__sync_lock_test_and_set(&lock->state, 1)) {
+    // only taken when nobody is queued, so a try never jumps the line
+    uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+    bool free = (uint16_t)state == (uint16_t)(state >> 16);
+
+    if (!free || !__atomic_compare_exchange_n(
+                     &lock->state,
+                     &state,
+                     state + SPINLOCK_TICKET_ONE,
+                     false,
+                     __ATOMIC_ACQUIRE,
+                     __ATOMIC_RELAXED
+                 )) {
         lock_preempt_enable();
         return false;
     }
@@ -81,12 +155,17 @@ static inline bool spin_try_lock(spinlock_t *lock) {
     lock->owner_cpu = cpu_id;
 #endif
 
+#if LOCK_STAT
+    // a try that gets the lock never waited for it
+    lock->stat_entry = lock_stat_spin_acquired(0, false, &lock->stat_held_since);
+#endif
+
     __atomic_fetch_add(&lock_spin_held_depth[cpu_id], 1U, __ATOMIC_RELAXED);
 
     return true;
 }
 
-static inline void spin_lock(spinlock_t *lock) {
+static LOCK_INLINE void spin_lock(spinlock_t *lock) {
     if (!lock) {
         return;
     }
@@ -96,19 +175,41 @@ static inline void spin_lock(spinlock_t *lock) {
     size_t cpu_id = lock_cpu_id();
 
 #if LOCK_DEBUG
-    if (!panic_in_progress() && lock->state && lock->owner_cpu == cpu_id) {
-        lock_debug_trap("spin_lock:recursive", lock, __builtin_return_address(0), lock->owner_cpu, lock->state);
+    if (!panic_in_progress() && spin_is_locked(lock) && lock->owner_cpu == cpu_id) {
+        lock_debug_trap("spin_lock:recursive", lock, __builtin_return_address(0), lock->owner_cpu, (int)lock->state);
     }
 #endif
 
-    while (__sync_lock_test_and_set(&lock->state, 1)) {
-        while (__atomic_load_n(&lock->state, __ATOMIC_RELAXED)) {
+#if LOCK_STAT
+    uint64_t stat_wait_since = arch_cycles();
+    bool stat_contended = false;
+#endif
+
+    uint16_t ticket = (uint16_t)(__atomic_fetch_add(&lock->state, SPINLOCK_TICKET_ONE, __ATOMIC_RELAXED) >> 16);
+
+    // backs off in proportion to the place in line, so the line being polled
+    // sees about one read per release instead of one per spin
+    for (;;) {
+        uint16_t owner = __atomic_load_n(&lock->ticket.owner, __ATOMIC_ACQUIRE);
+
+        if (owner == ticket) {
+            break;
+        }
+
+#if LOCK_STAT
+        stat_contended = true;
+#endif
+
+        for (uint16_t ahead = (uint16_t)(ticket - owner); ahead; ahead--) {
             arch_cpu_relax();
         }
     }
 
 #if LOCK_DEBUG
     lock->owner_cpu = cpu_id;
+#endif
+#if LOCK_STAT
+    lock->stat_entry = lock_stat_spin_acquired(stat_wait_since, stat_contended, &lock->stat_held_since);
 #endif
     __atomic_fetch_add(&lock_spin_held_depth[cpu_id], 1U, __ATOMIC_RELAXED);
 }
@@ -122,7 +223,7 @@ static inline void spin_unlock(spinlock_t *lock) {
 
 #if LOCK_DEBUG
     if (!panic_in_progress() && lock->owner_cpu != cpu_id) {
-        lock_debug_trap("spin_unlock:foreign", lock, __builtin_return_address(0), lock->owner_cpu, lock->state);
+        lock_debug_trap("spin_unlock:foreign", lock, __builtin_return_address(0), lock->owner_cpu, (int)lock->state);
     }
 
     lock->owner_cpu = (size_t)-1;
@@ -140,13 +241,21 @@ static inline void spin_unlock(spinlock_t *lock) {
                 lock,
                 __builtin_return_address(0),
                 lock->owner_cpu,
-                lock->state
+                (int)lock->state
             );
         }
 #endif
     }
 
-    __sync_lock_release(&lock->state);
+#if LOCK_STAT
+    void *stat_entry = lock->stat_entry;
+    lock->stat_entry = NULL;
+    lock_stat_released(stat_entry, lock->stat_held_since);
+#endif
+
+    // only the holder writes the owner half, so a plain increment serves the next ticket
+    uint16_t owner = __atomic_load_n(&lock->ticket.owner, __ATOMIC_RELAXED);
+    __atomic_store_n(&lock->ticket.owner, (uint16_t)(owner + 1), __ATOMIC_RELEASE);
     lock_preempt_enable();
 }
 
@@ -155,7 +264,7 @@ static inline bool lock_spin_held(void) {
     return __atomic_load_n(&lock_spin_held_depth[cpu_id], __ATOMIC_RELAXED) != 0;
 }
 
-static inline unsigned long spin_lock_irqsave(spinlock_t *lock) {
+static LOCK_INLINE unsigned long spin_lock_irqsave(spinlock_t *lock) {
     unsigned long flags = arch_irq_save();
     spin_lock(lock);
     return flags;
@@ -8,13 +8,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/cpu.h>
 #include <sys/lock.h>
+#include <sys/symbols.h>
+#include <sys/trace.h>
 
 #include "vfs.h"
 
 #define PROCFS_TEXT_MAX  512
 #define PROCFS_WRITE_MAX 256
 
+// one scope of schedstat: six values and two histograms
+#define PROCFS_LATENCY_MAX 1024
+
+// one lockstat site, with its symbol cut short to fit
+#define PROCFS_LOCKSTAT_LINE 320
+
 typedef enum {
     PROC_FIELD_STAT = 1,
     PROC_FIELD_CWD,
@@ -30,6 +39,12 @@ typedef enum {
     PROC_FIELD_GROUPS,
     PROC_FIELD_SIGMASK,
     PROC_FIELD_AFFINITY,
+    PROC_FIELD_TRACE,
+    PROC_FIELD_SCHEDSTAT,
+    PROC_FIELD_SYS_SCHEDSTAT,
+#if LOCK_STAT
+    PROC_FIELD_LOCKSTAT,
+#endif
 } proc_field_t;
 
 typedef struct {
@@ -507,6 +522,7 @@ static ssize_t _proc_stat_read(vfs_node_t *node, void *buf, size_t offset, size_
         "state=%c\n"
         "core=%d\n"
         "tty=%d\n"
+        "nice=%d\n"
         "cpu_ms=%llu\n"
         "user_ms=%llu\n"
         "sys_ms=%llu\n"
@@ -531,6 +547,7 @@ static ssize_t _proc_stat_read(vfs_node_t *node, void *buf, size_t offset, size_
         _state_char(snapshot.state),
         snapshot.core_id,
         snapshot.tty_index,
+        snapshot.nice,
         (unsigned long long)snapshot.cpu_time_ms,
         (unsigned long long)snapshot.user_time_ms,
         (unsigned long long)snapshot.sys_time_ms,
@@ -750,6 +767,304 @@ static ssize_t _affinity_write(vfs_node_t *node, void *buf, size_t offset, size_
     return (ssize_t)len;
 }
 
+// the upper edge of the bucket the percentile lands in, 0 without samples
+static u64 _latency_percentile_us(const u32 *hist, u32 permille) {
+    u64 total = 0;
+
+    for (size_t i = 0; i < SCHED_LAT_BUCKETS; i++) {
+        total += hist[i];
+    }
+
+    if (!total) {
+        return 0;
+    }
+
+    u64 rank = (total * permille + 999) / 1000;
+    u64 seen = 0;
+
+    for (size_t i = 0; i < SCHED_LAT_BUCKETS - 1; i++) {
+        seen += hist[i];
+
+        if (seen >= rank) {
+            return 1ULL << i;
+        }
+    }
+
+    return 1ULL << (SCHED_LAT_BUCKETS - 1);
+}
+
+static bool _append(char *text, size_t text_len, size_t *used, int written) {
+    if (written < 0 || (size_t)written >= text_len - *used) {
+        return false;
+    }
+
+    *used += (size_t)written;
+    return true;
+}
+
+static bool _latency_text(
+    char *text,
+    size_t text_len,
+    size_t *used,
+    const char *prefix,
+    const sched_latency_t *latency
+) {
+    const char *names[] = { "wake", "wait" };
+    const u32 *hists[] = { latency->wake, latency->wait };
+
+    for (size_t kind = 0; kind < 2; kind++) {
+        const u32 *hist = hists[kind];
+        u64 count = 0;
+
+        for (size_t i = 0; i < SCHED_LAT_BUCKETS; i++) {
+            count += hist[i];
+        }
+
+        int written = snprintf(
+            text + *used,
+            text_len - *used,
+            "%s%s_count=%llu\n"
+            "%s%s_p50_us=%llu\n"
+            "%s%s_p99_us=%llu\n"
+            "%s%s_hist=",
+            prefix,
+            names[kind],
+            (unsigned long long)count,
+            prefix,
+            names[kind],
+            (unsigned long long)_latency_percentile_us(hist, 500),
+            prefix,
+            names[kind],
+            (unsigned long long)_latency_percentile_us(hist, 990),
+            prefix,
+            names[kind]
+        );
+
+        if (!_append(text, text_len, used, written)) {
+            return false;
+        }
+
+        for (size_t i = 0; i < SCHED_LAT_BUCKETS; i++) {
+            const char *sep = i + 1 < SCHED_LAT_BUCKETS ? " " : "\n";
+            written = snprintf(text + *used, text_len - *used, "%u%s", hist[i], sep);
+
+            if (!_append(text, text_len, used, written)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static ssize_t _proc_schedstat_read(vfs_node_t *node, void *buf, size_t offset, size_t len, u32 flags) {
+    (void)flags;
+
+    if (!node || !buf) {
+        return -EINVAL;
+    }
+
+    pid_t pid = 0;
+    if (!_resolve_pid(_proc_key_pid((uintptr_t)node->private), &pid)) {
+        return -ENOENT;
+    }
+
+    sched_latency_t latency;
+    if (!sched_proc_latency(pid, &latency)) {
+        return -ENOENT;
+    }
+
+    char text[PROCFS_LATENCY_MAX];
+    size_t used = 0;
+
+    if (!_latency_text(text, sizeof(text), &used, "", &latency)) {
+        return -EIO;
+    }
+
+    return _text_read(text, buf, offset, len);
+}
+
+// the whole system first, so a reader after the summary can stop early
+static ssize_t _proc_sys_schedstat_read(vfs_node_t *node, void *buf, size_t offset, size_t len, u32 flags) {
+    (void)flags;
+
+    if (!node || !buf) {
+        return -EINVAL;
+    }
+
+    size_t ncpu = core_count < MAX_CORES ? core_count : MAX_CORES;
+    size_t text_len = (ncpu + 1) * PROCFS_LATENCY_MAX;
+    char *text = malloc(text_len);
+    sched_latency_t *per_cpu = calloc(ncpu ? ncpu : 1, sizeof(*per_cpu));
+
+    if (!text || !per_cpu) {
+        free(text);
+        free(per_cpu);
+        return -ENOMEM;
+    }
+
+    sched_latency_t total = { 0 };
+
+    for (size_t cpu = 0; cpu < ncpu; cpu++) {
+        sched_cpu_latency(cpu, &per_cpu[cpu]);
+
+        for (size_t i = 0; i < SCHED_LAT_BUCKETS; i++) {
+            total.wake[i] += per_cpu[cpu].wake[i];
+            total.wait[i] += per_cpu[cpu].wait[i];
+        }
+    }
+
+    size_t used = 0;
+    bool built = _append(text, text_len, &used, snprintf(text, text_len, "cpus=%zu\n", ncpu));
+    built = built && _latency_text(text, text_len, &used, "", &total);
+
+    for (size_t cpu = 0; built && cpu < ncpu; cpu++) {
+        char prefix[16];
+        snprintf(prefix, sizeof(prefix), "cpu%zu_", cpu);
+        built = _latency_text(text, text_len, &used, prefix, &per_cpu[cpu]);
+    }
+
+    ssize_t result = built ? _text_read(text, buf, offset, len) : -EIO;
+
+    free(text);
+    free(per_cpu);
+
+    return result;
+}
+
+static ssize_t _proc_trace_read(vfs_node_t *node, void *buf, size_t offset, size_t len, u32 flags) {
+    (void)flags;
+
+    if (!node || !buf) {
+        return -EINVAL;
+    }
+
+    return trace_dump(buf, offset, len);
+}
+
+static ssize_t _proc_trace_write(vfs_node_t *node, void *buf, size_t offset, size_t len, u32 flags) {
+    (void)flags;
+
+    if (!node || !buf || !len || offset != 0) {
+        return -EINVAL;
+    }
+
+    u64 value = 0;
+    if (!_parse_u64(buf, len, &value) || value > 1) {
+        return -EINVAL;
+    }
+
+    if (!value) {
+        trace_stop();
+    } else if (!trace_start()) {
+        return -ENOMEM;
+    }
+
+    return (ssize_t)len;
+}
+
+#if LOCK_STAT
+// the sites that waited longest come first
+static void _lockstat_sort(lock_stat_t *stats, size_t count) {
+    for (size_t i = 1; i < count; i++) {
+        lock_stat_t stat = stats[i];
+        size_t j = i;
+
+        while (j && stats[j - 1].wait_total < stat.wait_total) {
+            stats[j] = stats[j - 1];
+            j--;
+        }
+
+        stats[j] = stat;
+    }
+}
+
+static ssize_t _proc_lockstat_read(vfs_node_t *node, void *buf, size_t offset, size_t len, u32 flags) {
+    (void)flags;
+
+    if (!node || !buf) {
+        return -EINVAL;
+    }
+
+    lock_stat_t *stats = calloc(LOCK_STAT_SITES, sizeof(*stats));
+    size_t text_len = (LOCK_STAT_SITES + 1) * PROCFS_LOCKSTAT_LINE;
+    char *text = malloc(text_len);
+
+    if (!stats || !text) {
+        free(stats);
+        free(text);
+        return -ENOMEM;
+    }
+
+    size_t count = lock_stat_snapshot(stats, LOCK_STAT_SITES);
+    _lockstat_sort(stats, count);
+
+    size_t used = 0;
+    int written = snprintf(
+        text,
+        text_len,
+        "cycles_khz=%llu\nsites=%zu\ndropped=%llu\n",
+        (unsigned long long)arch_cycles_khz(),
+        count,
+        (unsigned long long)lock_stat_dropped()
+    );
+    bool built = _append(text, text_len, &used, written);
+
+    for (size_t i = 0; built && i < count; i++) {
+        const lock_stat_t *stat = &stats[i];
+        symbol_entry_t *sym = resolve_symbol((u64)(uintptr_t)stat->site);
+
+        char site[128];
+        if (sym) {
+            u64 off = (u64)(uintptr_t)stat->site - sym->addr;
+            snprintf(site, sizeof(site), "%.96s+%#llx", sym->name, (unsigned long long)off);
+        } else {
+            snprintf(site, sizeof(site), "%#llx", (unsigned long long)(uintptr_t)stat->site);
+        }
+
+        written = snprintf(
+            text + used,
+            text_len - used,
+            "site=%s kind=%s acquired=%llu contended=%llu wait_total=%llu wait_max=%llu"
+            " hold_total=%llu hold_max=%llu\n",
+            site,
+            stat->kind == LOCK_STAT_MUTEX ? "mutex" : "spin",
+            (unsigned long long)stat->acquired,
+            (unsigned long long)stat->contended,
+            (unsigned long long)stat->wait_total,
+            (unsigned long long)stat->wait_max,
+            (unsigned long long)stat->hold_total,
+            (unsigned long long)stat->hold_max
+        );
+        built = _append(text, text_len, &used, written);
+    }
+
+    ssize_t result = built ? _text_read(text, buf, offset, len) : -EIO;
+
+    free(stats);
+    free(text);
+
+    return result;
+}
+
+// writing 0 clears the counters and keeps the sites
+static ssize_t _proc_lockstat_write(vfs_node_t *node, void *buf, size_t offset, size_t len, u32 flags) {
+    (void)flags;
+
+    if (!node || !buf || !len || offset != 0) {
+        return -EINVAL;
+    }
+
+    u64 value = 0;
+    if (!_parse_u64(buf, len, &value) || value) {
+        return -EINVAL;
+    }
+
+    lock_stat_reset();
+    return (ssize_t)len;
+}
+#endif
+
 static ssize_t _proc_value_write(vfs_node_t *node, void *buf, size_t offset, size_t len, u32 flags) {
     (void)flags;
 
@@ -910,6 +1225,16 @@ static bool _upsert_file(vfs_node_t *parent, const char *name, mode_t mode, proc
             vfs_adopt_interface(node, vfs_create_interface(_proc_groups_read, _proc_groups_write, NULL));
         } else if (field == PROC_FIELD_AFFINITY) {
             vfs_adopt_interface(node, vfs_create_interface(_proc_affinity_read, _affinity_write, NULL));
+        } else if (field == PROC_FIELD_TRACE) {
+            vfs_adopt_interface(node, vfs_create_interface(_proc_trace_read, _proc_trace_write, NULL));
+        } else if (field == PROC_FIELD_SCHEDSTAT) {
+            vfs_adopt_interface(node, vfs_create_interface(_proc_schedstat_read, NULL, NULL));
+        } else if (field == PROC_FIELD_SYS_SCHEDSTAT) {
+            vfs_adopt_interface(node, vfs_create_interface(_proc_sys_schedstat_read, NULL, NULL));
+#if LOCK_STAT
+        } else if (field == PROC_FIELD_LOCKSTAT) {
+            vfs_adopt_interface(node, vfs_create_interface(_proc_lockstat_read, _proc_lockstat_write, NULL));
+#endif
         } else {
             vfs_adopt_interface(node, vfs_create_interface(_proc_value_read, _proc_value_write, NULL));
         }
@@ -948,6 +1273,7 @@ static bool _ensure_proc_entry(vfs_node_t *dir, pid_t pid, bool self) {
     built &= _upsert_file(dir, "groups", own_mode, PROC_FIELD_GROUPS, pid);
     built &= _upsert_file(dir, "sigmask", own_mode, PROC_FIELD_SIGMASK, pid);
     built &= _upsert_file(dir, "affinity", 0644, PROC_FIELD_AFFINITY, pid);
+    built &= _upsert_file(dir, "schedstat", 0444, PROC_FIELD_SCHEDSTAT, pid);
 
     return built;
 }
@@ -997,6 +1323,27 @@ bool procfs_init(void) {
         return false;
     }
 
+    if (!_upsert_file(procfs.root, "schedstat", 0444, PROC_FIELD_SYS_SCHEDSTAT, 0)) {
+        mutex_unlock(&procfs.lock);
+        log_warn("failed to create /proc/schedstat");
+        return false;
+    }
+
+    // every process's syscalls end up in the trace, so only root reads it
+    if (!_upsert_file(procfs.root, "trace", 0600, PROC_FIELD_TRACE, 0)) {
+        mutex_unlock(&procfs.lock);
+        log_warn("failed to create /proc/trace");
+        return false;
+    }
+
+#if LOCK_STAT
+    if (!_upsert_file(procfs.root, "lockstat", 0644, PROC_FIELD_LOCKSTAT, 0)) {
+        mutex_unlock(&procfs.lock);
+        log_warn("failed to create /proc/lockstat");
+        return false;
+    }
+#endif
+
     mutex_unlock(&procfs.lock);
     return true;
 }
@@ -346,22 +346,9 @@ static void _queue_clear(pty_queue_t *queue) {
     spin_unlock_irqrestore(&queue->lock, irq_flags);
 }
 
-static u64 _vtime_to_ticks(cc_t vtime) {
-    if (!vtime) {
-        return 0;
-    }
-
-    u32 hz = arch_timer_hz();
-    if (!hz) {
-        return 1;
-    }
-
-    u64 ticks = ((u64)vtime * (u64)hz + 9ULL) / 10ULL;
-    if (!ticks) {
-        ticks = 1;
-    }
-
-    return ticks;
+// VTIME counts tenths of a second
+static u64 _vtime_to_ns(cc_t vtime) {
+    return (u64)vtime * 100000000ULL;
 }
 
 static sched_wait_result_t _pty_wait(sched_wait_queue_t *queue, u32 seq, u64 deadline) {
@@ -446,20 +433,20 @@ static bool _termios_read_enough(size_t total, size_t len, size_t vmin, size_t t
     return total >= target;
 }
 
-static bool _termios_timeout_expired(u64 timeout_ticks, u64 *deadline) {
-    if (!timeout_ticks) {
+static bool _termios_timeout_expired(u64 timeout_ns, u64 *deadline) {
+    if (!timeout_ns) {
         return false;
     }
 
     if (!*deadline) {
-        *deadline = arch_timer_ticks() + timeout_ticks;
+        *deadline = arch_timer_ns() + timeout_ns;
     }
 
-    return arch_timer_ticks() >= *deadline;
+    return arch_timer_ns() >= *deadline;
 }
 
-static bool _termios_wait_has_timeout(size_t vmin, u64 timeout_ticks, bool seen_first_byte) {
-    if (!timeout_ticks) {
+static bool _termios_wait_has_timeout(size_t vmin, u64 timeout_ns, bool seen_first_byte) {
+    if (!timeout_ns) {
         return false;
     }
 
@@ -467,9 +454,9 @@ static bool _termios_wait_has_timeout(size_t vmin, u64 timeout_ticks, bool seen_
 }
 
 static bool
-_termios_idle_done(size_t total, bool closed, size_t vmin, u64 timeout_ticks, u64 *deadline, ssize_t *result) {
+_termios_idle_done(size_t total, bool closed, size_t vmin, u64 timeout_ns, u64 *deadline, ssize_t *result) {
     if (total) {
-        if (!vmin || closed || _termios_timeout_expired(timeout_ticks, deadline)) {
+        if (!vmin || closed || _termios_timeout_expired(timeout_ns, deadline)) {
             *result = (ssize_t)total;
             return true;
         }
@@ -482,12 +469,12 @@ _termios_idle_done(size_t total, bool closed, size_t vmin, u64 timeout_ticks, u6
         return true;
     }
 
-    if (!vmin && !timeout_ticks) {
+    if (!vmin && !timeout_ns) {
         *result = 0;
         return true;
     }
 
-    if (!vmin && _termios_timeout_expired(timeout_ticks, deadline)) {
+    if (!vmin && _termios_timeout_expired(timeout_ns, deadline)) {
         *result = 0;
         return true;
     }
@@ -526,7 +513,7 @@ static bool _termios_note_bytes(
     size_t limit,
     size_t vmin,
     size_t target,
-    u64 timeout_ticks
+    u64 timeout_ns
 ) {
     *total += got;
     *seen_byte = true;
@@ -535,8 +522,8 @@ static bool _termios_note_bytes(
         return true;
     }
 
-    if (timeout_ticks) {
-        *deadline = arch_timer_ticks() + timeout_ticks;
+    if (timeout_ns) {
+        *deadline = arch_timer_ns() + timeout_ns;
     }
 
     return false;
@@ -557,7 +544,7 @@ static ssize_t _queue_read_termios(pty_queue_t *queue, void *buf, size_t len, bo
 
     size_t vmin = (size_t)tos->c_cc[VMIN];
     size_t target = vmin ? (vmin < len ? vmin : len) : 1;
-    u64 timeout_ticks = _vtime_to_ticks(tos->c_cc[VTIME]);
+    u64 timeout_ns = _vtime_to_ns(tos->c_cc[VTIME]);
 
     size_t total = 0;
     bool first_byte_seen = false;
@@ -571,7 +558,7 @@ static ssize_t _queue_read_termios(pty_queue_t *queue, void *buf, size_t len, bo
         if (read_now) {
             sched_wake_one(&queue->write_wait);
 
-            if (_termios_note_bytes(&total, &first_byte_seen, &deadline, read_now, len, vmin, target, timeout_ticks)) {
+            if (_termios_note_bytes(&total, &first_byte_seen, &deadline, read_now, len, vmin, target, timeout_ns)) {
                 return (ssize_t)total;
             }
 
@@ -579,7 +566,7 @@ static ssize_t _queue_read_termios(pty_queue_t *queue, void *buf, size_t len, bo
         }
 
         ssize_t idle_result = 0;
-        if (_termios_idle_done(total, closed, vmin, timeout_ticks, &deadline, &idle_result)) {
+        if (_termios_idle_done(total, closed, vmin, timeout_ns, &deadline, &idle_result)) {
             return idle_result;
         }
 
@@ -597,7 +584,7 @@ static ssize_t _queue_read_termios(pty_queue_t *queue, void *buf, size_t len, bo
             return _queue_result(total, EINTR);
         }
 
-        bool timed = _termios_wait_has_timeout(vmin, timeout_ticks, first_byte_seen);
+        bool timed = _termios_wait_has_timeout(vmin, timeout_ns, first_byte_seen);
         sched_wait_result_t wait_result = _termios_wait(queue, wait_seq, timed, deadline);
 
         if (wait_result == SCHED_WAIT_TIMEOUT) {
@@ -0,0 +1,295 @@
+#include "reclaim.h"
+
+#include <arch/arch.h>
+#include <arch/mm.h>
+#include <arch/paging.h>
+#include <base/macros.h>
+#include <log/log.h>
+#include <sched/scheduler.h>
+#include <stdlib.h>
+#include <sys/lock.h>
+#include <sys/slab.h>
+#include <sys/time.h>
+#include <sys/workqueue.h>
+
+// the low watermark is 1/RECLAIM_LOW_DIV of memory and high is twice that
+#define RECLAIM_LOW_DIV 64
+
+// no cpu is scanning
+#define RECLAIM_NO_CPU ((size_t)-1)
+
+typedef struct {
+    // guards the shrinker list and is held for a whole pass, with interrupts
+    // left on; the cpu running the pass is noted so a shrinker or interrupt on
+    // that cpu that comes back into reclaim gives up instead of waiting on itself
+    spinlock_t lock;
+    size_t scan_cpu;
+    u64 scan_seq;
+    size_t scan_freed;
+
+    reclaim_shrinker_t *shrinkers[RECLAIM_SHRINKERS_MAX];
+    size_t shrinker_count;
+
+    size_t low_pages;
+    size_t high_pages;
+
+    work_t kswapd;
+    bool kswapd_kicked;
+} reclaim_state_t;
+
+static reclaim_state_t reclaim = {
+    .lock = SPINLOCK_INIT,
+    .scan_cpu = RECLAIM_NO_CPU,
+};
+
+static void _lru_demote(reclaim_lru_t *lru) {
+    list_node_t *node = list_pop_front(&lru->active);
+
+    if (node) {
+        list_append(&lru->inactive, node);
+    }
+}
+
+void reclaim_lru_add(reclaim_lru_t *lru, list_node_t *node) {
+    if (!lru || !node || node->owner) {
+        return;
+    }
+
+    list_append(&lru->inactive, node);
+}
+
+void reclaim_lru_touch(reclaim_lru_t *lru, list_node_t *node) {
+    if (!lru || !node || !node->owner) {
+        return;
+    }
+
+    // already the most recent entry, nothing to move
+    if (node->owner == &lru->active && lru->active.tail == node) {
+        return;
+    }
+
+    list_remove(node->owner, node);
+    list_append(&lru->active, node);
+}
+
+void reclaim_lru_remove(reclaim_lru_t *lru, list_node_t *node) {
+    if (!lru || !node || !node->owner) {
+        return;
+    }
+
+    list_remove(node->owner, node);
+}
+
+list_node_t *reclaim_lru_evict(reclaim_lru_t *lru) {
+    if (!lru) {
+        return NULL;
+    }
+
+    // keep the inactive list at least as long as the active one, so a hot
+    // entry that ages out still gets a second chance before it reaches the head
+    while (lru->active.length > lru->inactive.length) {
+        _lru_demote(lru);
+    }
+
+    list_node_t *node = list_pop_front(&lru->inactive);
+    if (!node) {
+        node = list_pop_front(&lru->active);
+    }
+
+    return node;
+}
+
+size_t reclaim_lru_count(const reclaim_lru_t *lru) {
+    return lru ? lru->active.length + lru->inactive.length : 0;
+}
+
+bool reclaim_register(reclaim_shrinker_t *shrinker) {
+    if (!shrinker || !shrinker->count || !shrinker->scan) {
+        return false;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&reclaim.lock);
+
+    if (reclaim.shrinker_count >= RECLAIM_SHRINKERS_MAX) {
+        spin_unlock_irqrestore(&reclaim.lock, flags);
+        log_warn("no room for shrinker %s", shrinker->name ? shrinker->name : "?");
+        return false;
+    }
+
+    reclaim.shrinkers[reclaim.shrinker_count++] = shrinker;
+    spin_unlock_irqrestore(&reclaim.lock, flags);
+
+    return true;
+}
+
+// waits out a running scan, so the owner may free its cache afterwards
+void reclaim_unregister(reclaim_shrinker_t *shrinker) {
+    if (!shrinker) {
+        return;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&reclaim.lock);
+
+    for (size_t i = 0; i < reclaim.shrinker_count; i++) {
+        if (reclaim.shrinkers[i] != shrinker) {
+            continue;
+        }
+
+        reclaim.shrinker_count--;
+        for (size_t j = i; j < reclaim.shrinker_count; j++) {
+            reclaim.shrinkers[j] = reclaim.shrinkers[j + 1];
+        }
+
+        break;
+    }
+
+    spin_unlock_irqrestore(&reclaim.lock, flags);
+}
+
+static size_t _free_pages(void) {
+    return pmm_free_mem() / PAGE_4KIB;
+}
+
+// caller holds reclaim.lock
+static size_t _shrink(size_t target) {
+    size_t freed = 0;
+
+    for (size_t i = 0; i < reclaim.shrinker_count && freed < target; i++) {
+        reclaim_shrinker_t *shrinker = reclaim.shrinkers[i];
+
+        size_t count = shrinker->count(shrinker->ctx);
+        if (!count) {
+            continue;
+        }
+
+        freed += shrinker->scan(shrinker->ctx, min(count, target - freed));
+    }
+
+    // freed cache objects only turn into free frames once the heap lets go of
+    // their slabs and arenas
+    freed += kmem_shrink();
+
+    return freed;
+}
+
+// interrupts are only off while the owner is noted, so one that arrives on
+// the scanning cpu always finds it there
+static bool _scan_try_begin(void) {
+    unsigned long flags = arch_irq_save();
+    bool locked = spin_try_lock(&reclaim.lock);
+
+    if (locked) {
+        __atomic_store_n(&reclaim.scan_cpu, lock_cpu_id(), __ATOMIC_RELAXED);
+    }
+
+    arch_irq_restore(flags);
+    return locked;
+}
+
+static void _scan_begin(void) {
+    while (!_scan_try_begin()) {
+        arch_cpu_relax();
+    }
+}
+
+static void _scan_end(size_t freed) {
+    unsigned long flags = arch_irq_save();
+
+    __atomic_store_n(&reclaim.scan_freed, freed, __ATOMIC_RELAXED);
+    __atomic_store_n(&reclaim.scan_cpu, RECLAIM_NO_CPU, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&reclaim.scan_seq, 1, __ATOMIC_RELEASE);
+
+    spin_unlock(&reclaim.lock);
+    arch_irq_restore(flags);
+}
+
+size_t reclaim_direct(size_t pages) {
+    size_t target = max(pages, (size_t)RECLAIM_BATCH);
+
+    for (;;) {
+        u64 seq = __atomic_load_n(&reclaim.scan_seq, __ATOMIC_ACQUIRE);
+
+        if (_scan_try_begin()) {
+            size_t freed = _shrink(target);
+            _scan_end(freed);
+
+            return freed;
+        }
+
+        // a shrinker that allocated, or an interrupt on top of the pass
+        if (__atomic_load_n(&reclaim.scan_cpu, __ATOMIC_RELAXED) == lock_cpu_id()) {
+            return 0;
+        }
+
+        // a pass on another cpu frees memory for us too; when it freed any the
+        // caller retries its allocation first, otherwise we scan ourselves
+        while (__atomic_load_n(&reclaim.scan_seq, __ATOMIC_ACQUIRE) == seq && spin_is_locked(&reclaim.lock)) {
+            arch_cpu_relax();
+        }
+
+        if (__atomic_load_n(&reclaim.scan_seq, __ATOMIC_ACQUIRE) != seq) {
+            size_t freed = __atomic_load_n(&reclaim.scan_freed, __ATOMIC_RELAXED);
+
+            if (freed) {
+                return freed;
+            }
+        }
+    }
+}
+
+void reclaim_note_free(size_t free_pages) {
+    size_t low = __atomic_load_n(&reclaim.low_pages, __ATOMIC_RELAXED);
+
+    if (free_pages >= low || !reclaim.kswapd.fn) {
+        return;
+    }
+
+    if (__atomic_exchange_n(&reclaim.kswapd_kicked, true, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+
+    // pulls the periodic pass forward; a pass already running has not requeued
+    // itself yet, so queueing now makes its own delayed requeue a no-op
+    work_cancel(&reclaim.kswapd);
+    work_queue(&reclaim.kswapd);
+}
+
+bool reclaim_can_grow(void) {
+    return _free_pages() > __atomic_load_n(&reclaim.high_pages, __ATOMIC_RELAXED);
+}
+
+// runs from a work item, so it waits its turn with interrupts on
+static void _kswapd_balance(void) {
+    while (_free_pages() < reclaim.high_pages) {
+        _scan_begin();
+        size_t freed = _shrink(RECLAIM_BATCH);
+        _scan_end(freed);
+
+        if (!freed) {
+            break;
+        }
+    }
+}
+
+static void _kswapd_work(work_t *work) {
+    bool kicked = __atomic_exchange_n(&reclaim.kswapd_kicked, false, __ATOMIC_ACQ_REL);
+
+    if (kicked || _free_pages() < reclaim.low_pages) {
+        _kswapd_balance();
+    }
+
+    work_queue_delayed(work, WORK_CPU_UNBOUND, ms_to_ns(RECLAIM_KSWAPD_PERIOD_MS));
+}
+
+void reclaim_init(void) {
+    size_t total = pmm_total_mem() / PAGE_4KIB;
+    size_t low = max(total / RECLAIM_LOW_DIV, (size_t)RECLAIM_BATCH);
+
+    __atomic_store_n(&reclaim.high_pages, low * 2, __ATOMIC_RELAXED);
+    __atomic_store_n(&reclaim.low_pages, low, __ATOMIC_RELAXED);
+
+    work_init(&reclaim.kswapd, _kswapd_work);
+    work_queue_delayed(&reclaim.kswapd, WORK_CPU_UNBOUND, ms_to_ns(RECLAIM_KSWAPD_PERIOD_MS));
+
+    log_debug("reclaim watermarks low=%zu high=%zu pages", low, low * 2);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <base/types.h>
+#include <data/list.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define RECLAIM_SHRINKERS_MAX 8
+
+// pages a reclaim pass tries to free at least, so one failure does not rescan every cache
+#define RECLAIM_BATCH 32
+
+// the kswapd work item rechecks the watermarks this often even when nobody kicked it
+#define RECLAIM_KSWAPD_PERIOD_MS 250
+
+// a cache that can give memory back under pressure. count is a cheap guess at
+// the pages scan could free, scan frees up to `pages` and reports how many it
+// did. scan can run from any allocation failure, so it may only trylock
+typedef struct reclaim_shrinker {
+    const char *name;
+    size_t (*count)(void *ctx);
+    size_t (*scan)(void *ctx, size_t pages);
+    void *ctx;
+} reclaim_shrinker_t;
+
+// two list LRU: new entries start inactive, a second hit promotes them to the
+// active list, and eviction takes the coldest inactive entry after ageing the
+// active tail into the inactive list. The owner serializes access
+typedef struct {
+    linked_list_t active;
+    linked_list_t inactive;
+} reclaim_lru_t;
+
+void reclaim_lru_add(reclaim_lru_t *lru, list_node_t *node);
+void reclaim_lru_touch(reclaim_lru_t *lru, list_node_t *node);
+void reclaim_lru_remove(reclaim_lru_t *lru, list_node_t *node);
+list_node_t *reclaim_lru_evict(reclaim_lru_t *lru);
+size_t reclaim_lru_count(const reclaim_lru_t *lru);
+
+bool reclaim_register(reclaim_shrinker_t *shrinker);
+void reclaim_unregister(reclaim_shrinker_t *shrinker);
+
+// sets the watermarks and queues the kswapd work item
+void reclaim_init(void);
+
+// frees at least `pages` from the shrinkers when it can, returns what it freed;
+// a pass already running elsewhere is waited out, and only a call from inside
+// a pass on this cpu gets 0 without one
+size_t reclaim_direct(size_t pages);
+
+// allocators report the free page count so kswapd starts below the low watermark
+void reclaim_note_free(size_t free_pages);
+
+// true while free memory is above the high watermark and caches may grow
+bool reclaim_can_grow(void);
@@ -0,0 +1,821 @@
+#include "slab.h"
+
+#include <alloc/bitmap.h>
+#include <arch/arch.h>
+#include <arch/mm.h>
+#include <arch/paging.h>
+#include <base/macros.h>
+#include <base/types.h>
+#include <inttypes.h>
+#include <log/log.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/lock.h>
+#include <sys/panic.h>
+#include <sys/reclaim.h>
+
+#define HEAP_MIN (KERNEL_HEAP_PAGES / 2)
+#define HEAP_MAX (KERNEL_HEAP_PAGES * 16)
+
+#define KMEM_SLAB_MAGIC     0x51ab51abU
+#define KMEM_MIN_ALIGN      16
+#define KMEM_SLAB_MAX_PAGES 8
+#define KMEM_MAGAZINE_BATCH (KMEM_MAGAZINE_SIZE / 2)
+
+// owner table entries with the low bit set describe a large page span and
+// carry its length; everything else is a pointer to the owning slab
+#define KMEM_OWNER_LARGE 1U
+
+// the heap hands out whole pages: size classes and object caches carve them
+// into slabs, and anything above the largest class gets a bare page span.
+// A per-page owner table replaces per-allocation headers
+
+struct kmem_slab {
+    u32 magic;
+    u32 in_use;
+    kmem_cache_t *cache;
+    void *free;
+    kmem_slab_t **list;
+    kmem_slab_t *prev;
+    kmem_slab_t *next;
+};
+
+typedef struct {
+    bitmap_allocator_t alloc;
+    uintptr_t start;
+    size_t pages;
+    uintptr_t *owners;
+} kmem_arena_t;
+
+typedef struct {
+    kmem_arena_t arenas[KERNEL_HEAP_MAX_ARENAS];
+    size_t arena_count;
+    spinlock_t lock;
+} kmem_heap_t;
+
+static kmem_heap_t heap = {
+    .lock = SPINLOCK_INIT,
+};
+
+static const size_t kmem_class_sizes[] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096,
+};
+
+#define KMEM_CLASS_COUNT ARRAY_LEN(kmem_class_sizes)
+
+static kmem_cache_t kmem_classes[KMEM_CLASS_COUNT] = {
+    KMEM_CACHE_INIT("kmalloc-16", 16, 16),
+    KMEM_CACHE_INIT("kmalloc-32", 32, 16),
+    KMEM_CACHE_INIT("kmalloc-48", 48, 16),
+    KMEM_CACHE_INIT("kmalloc-64", 64, 16),
+    KMEM_CACHE_INIT("kmalloc-96", 96, 16),
+    KMEM_CACHE_INIT("kmalloc-128", 128, 16),
+    KMEM_CACHE_INIT("kmalloc-192", 192, 16),
+    KMEM_CACHE_INIT("kmalloc-256", 256, 16),
+    KMEM_CACHE_INIT("kmalloc-384", 384, 16),
+    KMEM_CACHE_INIT("kmalloc-512", 512, 16),
+    KMEM_CACHE_INIT("kmalloc-768", 768, 16),
+    KMEM_CACHE_INIT("kmalloc-1024", 1024, 16),
+    KMEM_CACHE_INIT("kmalloc-1536", 1536, 16),
+    KMEM_CACHE_INIT("kmalloc-2048", 2048, 16),
+    KMEM_CACHE_INIT("kmalloc-3072", 3072, 16),
+    KMEM_CACHE_INIT("kmalloc-4096", 4096, 16),
+};
+
+_Static_assert(ARRAY_LEN(kmem_classes) == KMEM_CLASS_COUNT, "kmalloc class table mismatch");
+
+// magazines come from their own cache, which never uses magazines itself
+static kmem_cache_t kmem_magazine_cache = {
+    .name = "kmem-magazine",
+    .size = sizeof(kmem_magazine_t),
+    .align = 16,
+    .flags = KMEM_CACHE_NO_MAGAZINE,
+    .lock = SPINLOCK_INIT,
+};
+
+static size_t _arena_meta_pages(size_t pages) {
+    size_t bitmap_bytes = DIV_ROUND_UP(pages, BITMAP_WORD_SIZE) * sizeof(bitmap_word_t);
+    size_t owner_bytes = pages * sizeof(uintptr_t);
+
+    return DIV_ROUND_UP(bitmap_bytes, PAGE_4KIB) + DIV_ROUND_UP(owner_bytes, PAGE_4KIB);
+}
+
+static size_t _arena_usable_pages(size_t pages) {
+    size_t meta = _arena_meta_pages(pages);
+
+    return pages > meta ? pages - meta : 0;
+}
+
+static size_t _arena_pages_for(size_t usable) {
+    if (!usable || usable > SIZE_MAX / PAGE_4KIB) {
+        return 0;
+    }
+
+    size_t pages = usable + _arena_meta_pages(usable);
+
+    while (_arena_usable_pages(pages) < usable) {
+        if (pages == SIZE_MAX) {
+            return 0;
+        }
+
+        pages++;
+    }
+
+    return pages;
+}
+
+static size_t _arena_count(void) {
+    return __atomic_load_n(&heap.arena_count, __ATOMIC_ACQUIRE);
+}
+
+// freed spans go back to the arena bitmap; only a fully free newest arena is
+// ever handed back to the frame allocator, by kmem_shrink
+static bool _add_arena(size_t pages) {
+    if (heap.arena_count >= KERNEL_HEAP_MAX_ARENAS) {
+        return false;
+    }
+
+    if (!_arena_usable_pages(pages) || pages > SIZE_MAX / PAGE_4KIB) {
+        return false;
+    }
+
+    size_t free_pages = pmm_free_mem() / PAGE_4KIB;
+    if (pages > free_pages) {
+        return false;
+    }
+
+    void *start = arch_heap_map(pages);
+    if (!start) {
+        return false;
+    }
+
+    kmem_arena_t *arena = &heap.arenas[heap.arena_count];
+
+    if (!bitmap_alloc_init(&arena->alloc, start, pages * PAGE_4KIB, PAGE_4KIB)) {
+        panic("kmem arena metadata does not fit (%zu pages)", pages);
+    }
+
+    size_t owner_pages = DIV_ROUND_UP(pages * sizeof(uintptr_t), PAGE_4KIB);
+    uintptr_t *owners = bitmap_alloc_reserve(&arena->alloc, owner_pages);
+
+    if (!owners) {
+        panic("kmem arena owner table does not fit (%zu pages)", pages);
+    }
+
+    memset(owners, 0, owner_pages * PAGE_4KIB);
+
+    arena->start = (uintptr_t)start;
+    arena->owners = owners;
+    __atomic_store_n(&arena->pages, pages, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&heap.arena_count, heap.arena_count + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool _grow(size_t min_pages) {
+    size_t need = _arena_pages_for(min_pages);
+    if (!need) {
+        return false;
+    }
+
+    size_t grow_pages = KERNEL_HEAP_PAGES;
+
+    if (heap.arena_count) {
+        grow_pages = heap.arenas[heap.arena_count - 1].pages;
+    }
+
+    if (grow_pages < need) {
+        grow_pages = need;
+    }
+
+    size_t free_pages = pmm_free_mem() / PAGE_4KIB;
+
+    if (grow_pages > free_pages) {
+        grow_pages = free_pages;
+    }
+
+    if (grow_pages < need) {
+        return false;
+    }
+
+    return _add_arena(grow_pages);
+}
+
+static kmem_arena_t *_find_arena(const void *ptr) {
+    uintptr_t addr = (uintptr_t)ptr;
+    size_t count = _arena_count();
+
+    for (size_t i = 0; i < count; i++) {
+        kmem_arena_t *arena = &heap.arenas[i];
+
+        if (addr >= arena->start && addr - arena->start < arena->pages * PAGE_4KIB) {
+            return arena;
+        }
+    }
+
+    return NULL;
+}
+
+static uintptr_t *_owner_slot(const void *ptr) {
+    kmem_arena_t *arena = _find_arena(ptr);
+    if (!arena) {
+        return NULL;
+    }
+
+    size_t index = ((uintptr_t)ptr - arena->start) / PAGE_4KIB;
+    return &arena->owners[index];
+}
+
+static void _set_owner(void *start, size_t pages, uintptr_t owner) {
+    kmem_arena_t *arena = _find_arena(start);
+    if (!arena) {
+        panic("kmem span is outside every heap arena");
+    }
+
+    size_t index = ((uintptr_t)start - arena->start) / PAGE_4KIB;
+
+    for (size_t i = 0; i < pages; i++) {
+        arena->owners[index + i] = owner;
+    }
+}
+
+// caller holds heap.lock
+static void *_pages_alloc(size_t pages) {
+    size_t count = heap.arena_count;
+    size_t large = arch_large_page_size();
+
+    // big spans (window buffers) start on a large page so they need fewer TLB entries
+    if (large && pages >= large / PAGE_4KIB) {
+        for (size_t i = 0; i < count; i++) {
+            void *span = bitmap_alloc_aligned(&heap.arenas[i].alloc, pages, large);
+            if (span) {
+                return span;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        void *span = bitmap_alloc_reserve(&heap.arenas[i].alloc, pages);
+        if (span) {
+            return span;
+        }
+    }
+
+    if (!_grow(pages)) {
+        return NULL;
+    }
+
+    kmem_arena_t *arena = &heap.arenas[heap.arena_count - 1];
+    return bitmap_alloc_reserve(&arena->alloc, pages);
+}
+
+// caller holds heap.lock
+static void _pages_free(void *span, size_t pages) {
+    kmem_arena_t *arena = _find_arena(span);
+    if (!arena) {
+        panic("kmem page span does not belong to any heap arena");
+    }
+
+    _set_owner(span, pages, 0);
+
+    if (!bitmap_alloc_free(&arena->alloc, span, pages)) {
+        panic("kmem bitmap metadata rejected page span");
+    }
+}
+
+static void _cache_setup(kmem_cache_t *cache) {
+    if (cache->slab_objs) {
+        return;
+    }
+
+    size_t align = cache->align < KMEM_MIN_ALIGN ? KMEM_MIN_ALIGN : cache->align;
+
+    if (align & (align - 1)) {
+        panic("kmem cache %s has a non power of two alignment", cache->name);
+    }
+
+    size_t size = cache->size < sizeof(void *) ? sizeof(void *) : cache->size;
+    size = ALIGN(size, align);
+
+    size_t offset = ALIGN(sizeof(kmem_slab_t), align);
+    size_t pages = DIV_ROUND_UP(offset + size, PAGE_4KIB);
+
+    // grow the slab until at most an eighth of it is wasted
+    while (pages < KMEM_SLAB_MAX_PAGES) {
+        size_t bytes = pages * PAGE_4KIB;
+        size_t waste = (bytes - offset) % size;
+
+        if (waste * 8 <= bytes) {
+            break;
+        }
+
+        pages++;
+    }
+
+    cache->align = align;
+    cache->size = size;
+    cache->obj_offset = offset;
+    cache->slab_pages = pages;
+    cache->slab_objs = (pages * PAGE_4KIB - offset) / size;
+}
+
+static void _slab_unlink(kmem_slab_t *slab) {
+    if (!slab->list) {
+        return;
+    }
+
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *slab->list = slab->next;
+    }
+
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+
+    slab->prev = NULL;
+    slab->next = NULL;
+    slab->list = NULL;
+}
+
+static void _slab_link(kmem_slab_t **list, kmem_slab_t *slab) {
+    slab->list = list;
+    slab->prev = NULL;
+    slab->next = *list;
+
+    if (*list) {
+        (*list)->prev = slab;
+    }
+
+    *list = slab;
+}
+
+// caller holds cache->lock
+static kmem_slab_t *_slab_create(kmem_cache_t *cache) {
+    _cache_setup(cache);
+
+    unsigned long flags = spin_lock_irqsave(&heap.lock);
+    kmem_slab_t *slab = _pages_alloc(cache->slab_pages);
+
+    if (slab) {
+        _set_owner(slab, cache->slab_pages, (uintptr_t)slab);
+    }
+
+    spin_unlock_irqrestore(&heap.lock, flags);
+
+    if (!slab) {
+        return NULL;
+    }
+
+    slab->magic = KMEM_SLAB_MAGIC;
+    slab->in_use = 0;
+    slab->cache = cache;
+    slab->free = NULL;
+    slab->list = NULL;
+    slab->prev = NULL;
+    slab->next = NULL;
+
+    u8 *base = (u8 *)slab + cache->obj_offset;
+
+    for (size_t i = cache->slab_objs; i > 0; i--) {
+        void **obj = (void **)(base + (i - 1) * cache->size);
+        *obj = slab->free;
+        slab->free = obj;
+    }
+
+    cache->slab_count++;
+    cache->empty_count++;
+    _slab_link(&cache->empty, slab);
+
+    return slab;
+}
+
+// caller holds cache->lock
+static void _slab_destroy(kmem_cache_t *cache, kmem_slab_t *slab) {
+    _slab_unlink(slab);
+    cache->slab_count--;
+    cache->empty_count--;
+    slab->magic = 0;
+
+    unsigned long flags = spin_lock_irqsave(&heap.lock);
+    _pages_free(slab, cache->slab_pages);
+    spin_unlock_irqrestore(&heap.lock, flags);
+}
+
+// caller holds cache->lock
+static void *_slab_get(kmem_cache_t *cache) {
+    kmem_slab_t *slab = cache->partial;
+
+    if (!slab) {
+        slab = cache->empty;
+
+        if (!slab) {
+            slab = _slab_create(cache);
+        }
+
+        if (!slab) {
+            return NULL;
+        }
+
+        cache->empty_count--;
+        _slab_unlink(slab);
+        _slab_link(&cache->partial, slab);
+    }
+
+    void **obj = slab->free;
+    slab->free = *obj;
+    slab->in_use++;
+    cache->objs_in_use++;
+
+    if (!slab->free) {
+        _slab_unlink(slab);
+        _slab_link(&cache->full, slab);
+    }
+
+    return obj;
+}
+
+// caller holds cache->lock
+static void _slab_put(kmem_cache_t *cache, kmem_slab_t *slab, void *ptr) {
+    void **obj = ptr;
+    bool was_full = !slab->free;
+
+    *obj = slab->free;
+    slab->free = obj;
+    slab->in_use--;
+    cache->objs_in_use--;
+
+    if (!slab->in_use) {
+        _slab_unlink(slab);
+        _slab_link(&cache->empty, slab);
+        cache->empty_count++;
+
+        if (cache->empty_count > KMEM_EMPTY_SLABS) {
+            _slab_destroy(cache, slab);
+        }
+
+        return;
+    }
+
+    if (was_full) {
+        _slab_unlink(slab);
+        _slab_link(&cache->partial, slab);
+    }
+}
+
+static kmem_slab_t *_slab_of(kmem_cache_t *cache, void *ptr) {
+    uintptr_t *slot = _owner_slot(ptr);
+    uintptr_t owner = slot ? *slot : 0;
+
+    if (!owner || (owner & KMEM_OWNER_LARGE)) {
+        panic("kmem %s free of a pointer outside its slabs", cache ? cache->name : "?");
+    }
+
+    kmem_slab_t *slab = (kmem_slab_t *)owner;
+
+    if (slab->magic != KMEM_SLAB_MAGIC || (cache && slab->cache != cache)) {
+        panic("kmem %s free of a pointer from another cache", cache ? cache->name : "?");
+    }
+
+    return slab;
+}
+
+static void *_cache_alloc_locked(kmem_cache_t *cache) {
+    spin_lock(&cache->lock);
+    void *obj = _slab_get(cache);
+    spin_unlock(&cache->lock);
+
+    return obj;
+}
+
+static void _cache_free_locked(kmem_cache_t *cache, void *ptr) {
+    kmem_slab_t *slab = _slab_of(cache, ptr);
+
+    spin_lock(&cache->lock);
+    _slab_put(cache, slab, ptr);
+    spin_unlock(&cache->lock);
+}
+
+// runs with interrupts disabled so the magazine cannot change hands
+static kmem_magazine_t *_local_magazine(kmem_cache_t *cache) {
+    if (cache->flags & KMEM_CACHE_NO_MAGAZINE) {
+        return NULL;
+    }
+
+    size_t cpu_id = 0;
+    if (!arch_current_cpu_id(&cpu_id) || cpu_id >= MAX_CORES) {
+        return NULL;
+    }
+
+    kmem_magazine_t *mag = cache->magazines[cpu_id];
+    if (mag) {
+        return mag;
+    }
+
+    mag = _cache_alloc_locked(&kmem_magazine_cache);
+    if (!mag) {
+        return NULL;
+    }
+
+    mag->count = 0;
+    cache->magazines[cpu_id] = mag;
+
+    return mag;
+}
+
+static void _magazine_refill(kmem_cache_t *cache, kmem_magazine_t *mag) {
+    spin_lock(&cache->lock);
+
+    while (mag->count < KMEM_MAGAZINE_BATCH) {
+        void *obj = _slab_get(cache);
+        if (!obj) {
+            break;
+        }
+
+        mag->objs[mag->count++] = obj;
+    }
+
+    spin_unlock(&cache->lock);
+}
+
+static void _magazine_flush(kmem_cache_t *cache, kmem_magazine_t *mag, size_t keep) {
+    spin_lock(&cache->lock);
+
+    while (mag->count > keep) {
+        void *obj = mag->objs[--mag->count];
+        _slab_put(cache, _slab_of(cache, obj), obj);
+    }
+
+    spin_unlock(&cache->lock);
+}
+
+static void *_cache_alloc(kmem_cache_t *cache) {
+    unsigned long flags = arch_irq_save();
+    kmem_magazine_t *mag = _local_magazine(cache);
+    void *obj = NULL;
+
+    if (mag) {
+        if (!mag->count) {
+            _magazine_refill(cache, mag);
+        }
+
+        if (mag->count) {
+            obj = mag->objs[--mag->count];
+        }
+    } else {
+        obj = _cache_alloc_locked(cache);
+    }
+
+    arch_irq_restore(flags);
+
+    return obj;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    if (!cache) {
+        return NULL;
+    }
+
+    void *obj = _cache_alloc(cache);
+
+    // give cached memory back and retry as long as reclaim makes progress
+    while (!obj && reclaim_direct(max(cache->slab_pages, (size_t)1))) {
+        obj = _cache_alloc(cache);
+    }
+
+    if (!obj) {
+        panic("kmem %s out of heap memory", cache->name);
+    }
+
+    return obj;
+}
+
+void *kmem_cache_zalloc(kmem_cache_t *cache) {
+    void *obj = kmem_cache_alloc(cache);
+
+    if (obj) {
+        memset(obj, 0, cache->size);
+    }
+
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *ptr) {
+    if (!cache || !ptr) {
+        return;
+    }
+
+#ifdef KMALLOC_DEBUG
+    (void)_slab_of(cache, ptr);
+#endif
+
+    unsigned long flags = arch_irq_save();
+    kmem_magazine_t *mag = _local_magazine(cache);
+
+    if (mag) {
+        if (mag->count >= KMEM_MAGAZINE_SIZE) {
+            _magazine_flush(cache, mag, KMEM_MAGAZINE_BATCH);
+        }
+
+        mag->objs[mag->count++] = ptr;
+    } else {
+        _cache_free_locked(cache, ptr);
+    }
+
+    arch_irq_restore(flags);
+}
+
+static kmem_cache_t *_size_class(size_t size) {
+    for (size_t i = 0; i < KMEM_CLASS_COUNT; i++) {
+        if (size <= kmem_class_sizes[i]) {
+            return &kmem_classes[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void *_large_span(size_t pages) {
+    unsigned long flags = spin_lock_irqsave(&heap.lock);
+    void *span = _pages_alloc(pages);
+
+    if (span) {
+        _set_owner(span, 1, (pages << 1) | KMEM_OWNER_LARGE);
+    }
+
+    spin_unlock_irqrestore(&heap.lock, flags);
+
+    return span;
+}
+
+static void *_large_alloc(size_t size) {
+    size_t pages = DIV_ROUND_UP(size, PAGE_4KIB);
+    void *span = _large_span(pages);
+
+    while (!span && reclaim_direct(pages)) {
+        span = _large_span(pages);
+    }
+
+    if (!span) {
+        panic("kmalloc out of heap memory (requested=%zu bytes)", size);
+    }
+
+    return span;
+}
+
+void *kmalloc(size_t size) {
+    if (!size) {
+#ifdef KMALLOC_DEBUG
+        log_warn("kmalloc requested zero bytes");
+#endif
+        return NULL;
+    }
+
+    if (size > SIZE_MAX - PAGE_4KIB) {
+        panic("kmalloc size overflow (requested=%zu bytes)", size);
+    }
+
+    kmem_cache_t *cache = _size_class(size);
+    void *memory = cache ? kmem_cache_alloc(cache) : _large_alloc(size);
+
+#ifdef KMALLOC_DEBUG
+    log_debug("kmalloc alloc bytes=%zu ptr=%#" PRIx64, size, (u64)(uintptr_t)memory);
+#endif
+
+    return memory;
+}
+
+void kfree(void *ptr) {
+    if (!ptr) {
+#ifdef KMALLOC_DEBUG
+        log_warn("kmalloc free NULL pointer");
+#endif
+        return;
+    }
+
+    uintptr_t *slot = _owner_slot(ptr);
+    if (!slot) {
+        panic("kfree pointer does not belong to any heap arena");
+    }
+
+    uintptr_t owner = *slot;
+
+    if (owner & KMEM_OWNER_LARGE) {
+        if ((uintptr_t)ptr & (PAGE_4KIB - 1)) {
+            panic("kfree pointer is inside a large allocation");
+        }
+
+        size_t pages = owner >> 1;
+
+        unsigned long flags = spin_lock_irqsave(&heap.lock);
+        _pages_free(ptr, pages);
+        spin_unlock_irqrestore(&heap.lock, flags);
+
+#ifdef KMALLOC_DEBUG
+        log_debug("kmalloc free bytes=%zu ptr=%#" PRIx64, (size_t)(pages * PAGE_4KIB), (u64)(uintptr_t)ptr);
+#endif
+        return;
+    }
+
+    if (!owner) {
+        panic("kfree pointer is not allocated");
+    }
+
+    kmem_slab_t *slab = (kmem_slab_t *)owner;
+    if (slab->magic != KMEM_SLAB_MAGIC) {
+        panic("kfree invalid slab header");
+    }
+
+#ifdef KMALLOC_DEBUG
+    log_debug("kmalloc free bytes=%zu ptr=%#" PRIx64, slab->cache->size, (u64)(uintptr_t)ptr);
+#endif
+
+    kmem_cache_free(slab->cache, ptr);
+}
+
+// caller disabled interrupts; trylock because reclaim can run under any lock
+static size_t _cache_shrink(kmem_cache_t *cache) {
+    if (!spin_try_lock(&cache->lock)) {
+        return 0;
+    }
+
+    size_t freed = 0;
+
+    // the empty slabs kept around to absorb alloc/free churn are the first to go
+    while (cache->empty) {
+        freed += cache->slab_pages;
+        _slab_destroy(cache, cache->empty);
+    }
+
+    spin_unlock(&cache->lock);
+    return freed;
+}
+
+// caller holds heap.lock; only the newest arena is released so the table stays dense
+static size_t _arena_release(void) {
+    size_t freed = 0;
+
+    while (heap.arena_count > 1) {
+        kmem_arena_t *arena = &heap.arenas[heap.arena_count - 1];
+        size_t owner_pages = DIV_ROUND_UP(arena->pages * sizeof(uintptr_t), PAGE_4KIB);
+
+        if (arena->alloc.usable_blocks - arena->alloc.free_blocks != owner_pages) {
+            break;
+        }
+
+        void *start = (void *)arena->start;
+        size_t pages = arena->pages;
+
+        // lockless lookups may still walk this slot, so it must stop matching first
+        __atomic_store_n(&arena->pages, 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&heap.arena_count, heap.arena_count - 1, __ATOMIC_RELEASE);
+
+        if (!arch_heap_unmap(start, pages)) {
+            __atomic_store_n(&arena->pages, pages, __ATOMIC_RELEASE);
+            __atomic_store_n(&heap.arena_count, heap.arena_count + 1, __ATOMIC_RELEASE);
+            break;
+        }
+
+        freed += pages;
+    }
+
+    return freed;
+}
+
+size_t kmem_shrink(void) {
+    size_t freed = 0;
+    unsigned long flags = arch_irq_save();
+
+    for (size_t i = 0; i < KMEM_CLASS_COUNT; i++) {
+        freed += _cache_shrink(&kmem_classes[i]);
+    }
+
+    freed += _cache_shrink(&kmem_magazine_cache);
+
+    if (spin_try_lock(&heap.lock)) {
+        freed += _arena_release();
+        spin_unlock(&heap.lock);
+    }
+
+    arch_irq_restore(flags);
+    return freed;
+}
+
+void kmem_init(void) {
+    unsigned long flags = spin_lock_irqsave(&heap.lock);
+    size_t free_pages = pmm_free_mem() / PAGE_4KIB;
+
+    // aim to take ~33% of the memory for the kernel heap
+    size_t min_heap = min(free_pages, (size_t)HEAP_MIN);
+    size_t heap_pages = clamp(free_pages / 3, min_heap, (size_t)HEAP_MAX);
+
+    if (!_add_arena(heap_pages)) {
+        spin_unlock_irqrestore(&heap.lock, flags);
+        panic("Failed to initialize kernel heap");
+    }
+
+    spin_unlock_irqrestore(&heap.lock, flags);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <base/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/config.h>
+#include <sys/lock.h>
+
+#define KMEM_NAME_MAX 24
+
+// caches with this flag skip the per-CPU magazines and always take the cache lock
+#define KMEM_CACHE_NO_MAGAZINE (1U << 0)
+
+typedef struct kmem_slab kmem_slab_t;
+
+typedef struct {
+    u32 count;
+    void *objs[KMEM_MAGAZINE_SIZE];
+} kmem_magazine_t;
+
+typedef struct kmem_cache {
+    char name[KMEM_NAME_MAX];
+    size_t size;
+    size_t align;
+    u32 flags;
+
+    // slab geometry is computed on first grow so caches can be static
+    size_t slab_pages;
+    size_t slab_objs;
+    size_t obj_offset;
+
+    spinlock_t lock;
+    kmem_slab_t *partial;
+    kmem_slab_t *full;
+    kmem_slab_t *empty;
+    size_t slab_count;
+    size_t empty_count;
+    size_t objs_in_use;
+
+    kmem_magazine_t *magazines[MAX_CORES];
+} kmem_cache_t;
+
+#define KMEM_CACHE_INIT(cache_name, obj_size, obj_align) \
+    {                                                    \
+        .name = (cache_name),                            \
+        .size = (obj_size),                              \
+        .align = (obj_align),                            \
+        .lock = SPINLOCK_INIT,                           \
+    }
+
+void kmem_init(void);
+
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void *kmem_cache_zalloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *ptr);
+
+// drops empty slabs and fully free arenas, returns the pages released
+size_t kmem_shrink(void);
+
+void *kmalloc(size_t size);
+void kfree(void *ptr);
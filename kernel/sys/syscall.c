@@ -16,9 +16,11 @@
 #include <limits.h>
 #include <log/log.h>
 #include <poll.h>
+#include <sched.h>
 #include <sched/scheduler.h>
 #include <sched/signal.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -34,7 +36,11 @@
 #include <sys/proc.h>
 #include <sys/procfs.h>
 #include <sys/pty.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/thread.h>
+#include <sys/tlb.h>
+#include <sys/trace.h>
 #include <sys/tty.h>
 #include <sys/usercopy.h>
 #include <sys/vfs.h>
@@ -306,22 +312,14 @@ static void _maybe_clear_setid(sched_thread_t *thread, vfs_node_t *node) {
     (void)vfs_chmod(node, cleared);
 }
 
-static bool _fd_lookup(sched_thread_t *thread, int fd, sched_fd_t **entry_out) {
+// fills a pinned copy of the descriptor, so another thread closing it leaves
+// the file alive until the matching sched_fd_put
+static bool _fd_lookup(sched_thread_t *thread, int fd, sched_fd_t *entry_out) {
     if (!thread || !entry_out) {
         return false;
     }
 
-    if (fd < 0 || fd >= SCHED_FD_MAX || !thread->fd_used[fd]) {
-        return false;
-    }
-
-    sched_fd_t *entry = &thread->fds[fd];
-    if (!entry->file) {
-        return false;
-    }
-
-    *entry_out = entry;
-    return true;
+    return sched_fd_get(thread, fd, entry_out);
 }
 
 static vfs_node_t *_resolve_link_node(vfs_node_t *node) {
@@ -487,7 +485,7 @@ static int _resolve_user_path(const sched_thread_t *thread, const char *path, ch
         return copy_err;
     }
 
-    if (!path_resolve(thread->cwd, local, out, out_len)) {
+    if (!path_resolve(sched_group(thread)->cwd, local, out, out_len)) {
         return -ENOENT;
     }
 
@@ -874,116 +872,61 @@ static uintptr_t _region_end(const sched_user_region_t *region) {
     return end;
 }
 
-static bool _region_overlaps(const sched_user_region_t *region, uintptr_t start, uintptr_t end) {
-    if (start >= end) {
-        return false;
-    }
-
-    uintptr_t region_start = 0;
-    uintptr_t region_end = 0;
-    if (!_region_bounds(region, &region_start, &region_end)) {
-        return false;
-    }
-
-    return start < region_end && end > region_start;
-}
-
 static uintptr_t _pick_mmap_base(sched_thread_t *thread, size_t size) {
     if (!thread) {
         return 0;
     }
 
+    // a clone thread's own stack is an ordinary mapping, the process stack is the limit
+    sched_thread_t *group = sched_group(thread);
     uintptr_t base = 0x00400000;
-    uintptr_t stack_base = thread->user_stack_base;
+    uintptr_t stack_base = group->user_stack_base;
 
     if (!stack_base) {
         stack_base = (uintptr_t)arch_user_stack_top();
     }
 
-    uintptr_t stack_end = stack_base + thread->user_stack_size;
+    uintptr_t stack_end = stack_base + group->user_stack_size;
     if (stack_end < stack_base) {
         stack_end = (uintptr_t)-1;
     }
 
-    for (sched_user_region_t *region = thread->regions; region; region = region->next) {
+    // the highest mapping below the stack, walked from the top so only stack regions are skipped
+    sched_user_region_t *region = sched_region_last(thread);
+    while (region) {
         uintptr_t region_start = 0;
         uintptr_t region_end = 0;
-        if (!_region_bounds(region, &region_start, &region_end)) {
-            continue;
-        }
-
-        if (stack_base && region_start >= stack_base && region_end <= stack_end) {
-            continue;
-        }
-
-        if (region_end > base) {
-            base = region_end;
-        }
-    }
-
-    if (base > (uintptr_t)-1 - (PAGE_4KIB - 1)) {
-        return 0;
-    }
-
-    base = ALIGN(base, PAGE_4KIB);
-
-    uintptr_t addr = base;
-    bool advanced = true;
-
-    while (advanced) {
-        advanced = false;
 
-        for (sched_user_region_t *region = thread->regions; region; region = region->next) {
-            if (size > (uintptr_t)-1 - addr) {
-                return 0;
-            }
-
-            uintptr_t end = addr + size;
-
-            if (!_region_overlaps(region, addr, end)) {
-                continue;
-            }
-
-            uintptr_t region_end = _region_end(region);
-            if (!region_end || region_end > (uintptr_t)-1 - (PAGE_4KIB - 1)) {
-                return 0;
+        if (_region_bounds(region, &region_start, &region_end)) {
+            if (!stack_base || region_start < stack_base || region_end > stack_end) {
+                base = region_end > base ? region_end : base;
+                break;
             }
-
-            addr = ALIGN(region_end, PAGE_4KIB);
-            advanced = true;
-
-            break;
         }
-    }
 
-    if (size > (uintptr_t)-1 - addr || addr + size > stack_base) {
-        return 0;
+        region = sched_region_prev(region);
     }
 
-    return addr;
-}
+    // mappings of at least one large page get a large-page aligned base
+    size_t align = PAGE_4KIB;
+    size_t large = arch_large_page_size();
 
-static sched_user_region_t *
-_find_region_exact(sched_thread_t *thread, uintptr_t addr, size_t pages, sched_user_region_t **prev_out) {
-    if (!thread) {
-        return NULL;
+    if (large && size >= large) {
+        align = large;
     }
 
-    sched_user_region_t *prev = NULL;
-
-    for (sched_user_region_t *region = thread->regions; region; region = region->next) {
-        if (region->vaddr == addr && region->pages == pages) {
-            if (prev_out) {
-                *prev_out = prev;
-            }
+    uintptr_t addr = 0;
 
-            return region;
-        }
+    // keep growing upwards first, then fall back to the lowest hole that fits
+    if (sched_region_find_gap(thread, base, stack_base, size, align, &addr)) {
+        return addr;
+    }
 
-        prev = region;
+    if (sched_region_find_gap(thread, 0x00400000, stack_base, size, align, &addr)) {
+        return addr;
     }
 
-    return NULL;
+    return 0;
 }
 
 static sched_user_region_t *_find_region_at(sched_thread_t *thread, uintptr_t addr) {
@@ -991,20 +934,16 @@ static sched_user_region_t *_find_region_at(sched_thread_t *thread, uintptr_t ad
         return NULL;
     }
 
-    for (sched_user_region_t *region = thread->regions; region; region = region->next) {
-        uintptr_t start = 0;
-        uintptr_t end = 0;
-
-        if (!_region_bounds(region, &start, &end)) {
-            continue;
-        }
+    return sched_region_find(thread, addr);
+}
 
-        if (addr >= start && addr < end) {
-            return region;
-        }
+static sched_user_region_t *_find_region_exact(sched_thread_t *thread, uintptr_t addr, size_t pages) {
+    sched_user_region_t *region = _find_region_at(thread, addr);
+    if (!region || region->vaddr != addr || region->pages != pages) {
+        return NULL;
     }
 
-    return NULL;
+    return region;
 }
 
 static bool _user_range_mapped(sched_thread_t *thread, uintptr_t base, uintptr_t end) {
@@ -1073,14 +1012,12 @@ typedef struct {
 static size_t _mprotect_splits(sched_thread_t *thread, uintptr_t base, uintptr_t end) {
     size_t count = 0;
 
-    sched_user_region_t *region = thread->regions;
-    while (region) {
-        sched_user_region_t *next = region->next;
+    sched_user_region_t *region = sched_region_first_overlap(thread, base, end);
+    for (; region && region->vaddr < end; region = sched_region_next(region)) {
         uintptr_t start = 0;
         uintptr_t finish = 0;
 
         if (!_region_bounds(region, &start, &finish)) {
-            region = next;
             continue;
         }
 
@@ -1088,7 +1025,6 @@ static size_t _mprotect_splits(sched_thread_t *thread, uintptr_t base, uintptr_t
         uintptr_t right = end < finish ? end : finish;
 
         if (left >= right) {
-            region = next;
             continue;
         }
 
@@ -1102,8 +1038,6 @@ static size_t _mprotect_splits(sched_thread_t *thread, uintptr_t base, uintptr_t
         if (after) {
             count++;
         }
-
-        region = next;
     }
 
     return count;
@@ -1228,6 +1162,9 @@ static bool _mprotect_span(sched_user_region_t *region, const mprotect_req_t *re
         }
     }
 
+    // swapped pages pick up the new protection when they come back
+    region_flags |= region->flags & SCHED_REGION_SWAP;
+
     *span = (mprotect_span_t){
         .start = start,
         .finish = finish,
@@ -1245,11 +1182,11 @@ static bool _mprotect_span(sched_user_region_t *region, const mprotect_req_t *re
     return true;
 }
 
-static sched_user_region_t *_mprotect_after_node(
+static void _mprotect_after_node(
+    sched_thread_t *thread,
     sched_user_region_t **nodes,
     size_t *node_index,
-    const mprotect_span_t *span,
-    sched_user_region_t *next
+    const mprotect_span_t *span
 ) {
     sched_user_region_t *after = nodes[(*node_index)++];
 
@@ -1257,14 +1194,13 @@ static sched_user_region_t *_mprotect_after_node(
     after->paddr = span->paddr + span->changed_pages * PAGE_4KIB;
     after->pages = span->after_pages;
     after->flags = span->old_flags;
-    after->next = next;
 
-    return after;
+    sched_region_insert(thread, after);
 }
 
 static void _mprotect_split_region(
+    sched_thread_t *thread,
     sched_user_region_t *region,
-    sched_user_region_t *next,
     sched_user_region_t **nodes,
     size_t *node_index,
     const mprotect_span_t *span
@@ -1274,9 +1210,10 @@ static void _mprotect_split_region(
         region->paddr = span->paddr;
         region->pages = span->changed_pages;
         region->flags = span->region_flags;
+        sched_region_update(region);
 
         if (span->after_pages) {
-            region->next = _mprotect_after_node(nodes, node_index, span, next);
+            _mprotect_after_node(thread, nodes, node_index, span);
         }
 
         return;
@@ -1289,32 +1226,36 @@ static void _mprotect_split_region(
     changed->flags = span->region_flags;
 
     region->pages = span->before_pages;
-    region->next = changed;
+    sched_region_update(region);
+    sched_region_insert(thread, changed);
 
     if (span->after_pages) {
-        changed->next = _mprotect_after_node(nodes, node_index, span, next);
-    } else {
-        changed->next = next;
+        _mprotect_after_node(thread, nodes, node_index, span);
     }
 }
 
-static void _mprotect_remap(void *root, const mprotect_span_t *span) {
-    for (size_t i = 0; i < span->changed_pages; i++) {
-        uintptr_t vaddr = span->left + i * PAGE_4KIB;
-        uintptr_t paddr = span->paddr + i * PAGE_4KIB;
-
-        unmap_page((page_t *)root, vaddr);
-        arch_map_region(root, 1, vaddr, paddr, span->map_flags);
-        arch_tlb_flush(vaddr);
+static void _mprotect_remap(void *root, const mprotect_span_t *span, tlb_batch_t *batch) {
+    if (span->region_flags & SCHED_REGION_SWAP) {
+        return;
     }
+
+    // remapping the whole span lets aligned runs come back as large pages
+    arch_unmap_region(root, span->changed_pages, span->left);
+    arch_map_region(root, span->changed_pages, span->left, span->paddr, span->map_flags);
+
+    tlb_batch_add(batch, span->left, span->left + span->changed_pages * PAGE_4KIB);
 }
 
 static void _mprotect_apply(mprotect_req_t *req, sched_user_region_t **nodes) {
     size_t node_index = 0;
+    tlb_batch_t batch;
 
-    sched_user_region_t *region = req->thread->regions;
-    while (region) {
-        sched_user_region_t *next = region->next;
+    tlb_batch_init(&batch, req->thread->vm_space);
+
+    // split pieces land inside the region being split, so `next` is taken before inserting them
+    sched_user_region_t *region = sched_region_first_overlap(req->thread, req->base, req->end);
+    while (region && region->vaddr < req->end) {
+        sched_user_region_t *next = sched_region_next(region);
         mprotect_span_t span = { 0 };
 
         if (!_mprotect_span(region, req, &span)) {
@@ -1322,11 +1263,13 @@ static void _mprotect_apply(mprotect_req_t *req, sched_user_region_t **nodes) {
             continue;
         }
 
-        _mprotect_split_region(region, next, nodes, &node_index, &span);
-        _mprotect_remap(req->root, &span);
+        _mprotect_split_region(req->thread, region, nodes, &node_index, &span);
+        _mprotect_remap(req->root, &span, &batch);
 
         region = next;
     }
+
+    tlb_batch_finish(&batch);
 }
 
 static bool _mmap_flags_valid(int flags) {
@@ -1335,29 +1278,20 @@ static bool _mmap_flags_valid(int flags) {
 }
 
 static void _drop_region_exact(sched_thread_t *thread, uintptr_t addr, size_t pages) {
-    sched_user_region_t *prev = NULL;
-    sched_user_region_t *region = _find_region_exact(thread, addr, pages, &prev);
+    sched_user_region_t *region = _find_region_exact(thread, addr, pages);
 
     if (!region) {
         return;
     }
 
-    if (prev) {
-        prev->next = region->next;
-    } else {
-        thread->regions = region->next;
-    }
-
+    sched_region_remove(thread, region);
     free(region);
     sched_user_mem_sub(thread, pages);
 }
 
-static void _unmap_user_pages(void *root, uintptr_t addr, size_t pages) {
-    for (size_t i = 0; i < pages; i++) {
-        uintptr_t vaddr = addr + i * PAGE_4KIB;
-        unmap_page((page_t *)root, vaddr);
-        arch_tlb_flush(vaddr);
-    }
+static void _unmap_user_pages(sched_thread_t *thread, void *root, uintptr_t addr, size_t pages) {
+    arch_unmap_region(root, pages, addr);
+    arch_tlb_flush_range(thread->vm_space, addr, addr + pages * PAGE_4KIB);
 }
 
 static void
@@ -1367,7 +1301,7 @@ _mmap_undo_alloc(sched_thread_t *thread, void *root, uintptr_t addr, uintptr_t p
     }
 
     if (root) {
-        _unmap_user_pages(root, addr, pages);
+        _unmap_user_pages(thread, root, addr, pages);
     }
 
     if (paddr) {
@@ -1505,7 +1439,7 @@ static int _mmap_place(sched_thread_t *thread, const mmap_args_t *req, size_t si
     }
 
     uintptr_t end = addr + size;
-    uintptr_t stack_top = thread->user_stack_base;
+    uintptr_t stack_top = sched_group(thread)->user_stack_base;
 
     if (!stack_top) {
         stack_top = (uintptr_t)arch_user_stack_top();
@@ -1515,11 +1449,7 @@ static int _mmap_place(sched_thread_t *thread, const mmap_args_t *req, size_t si
         return -ENOMEM;
     }
 
-    for (sched_user_region_t *region = thread->regions; region; region = region->next) {
-        if (!_region_overlaps(region, addr, end)) {
-            continue;
-        }
-
+    if (sched_region_first_overlap(thread, addr, end)) {
         if (fixed) {
             return -ENOMEM;
         }
@@ -1530,7 +1460,6 @@ static int _mmap_place(sched_thread_t *thread, const mmap_args_t *req, size_t si
         }
 
         end = addr + size;
-        break;
     }
 
     if (!addr || end > stack_top) {
@@ -1541,6 +1470,25 @@ static int _mmap_place(sched_thread_t *thread, const mmap_args_t *req, size_t si
     return 0;
 }
 
+static int _mmap_check_file(sched_thread_t *thread, const mmap_args_t *req, int map_type, sched_file_t *file) {
+    if (file->kind != SCHED_FD_VFS || !file->node) {
+        return -EBADF;
+    }
+
+    u32 file_flags = __atomic_load_n(&file->flags, __ATOMIC_ACQUIRE);
+    if (!_open_has_read(file_flags)) {
+        return -EACCES;
+    }
+
+    int need = R_OK;
+    if (map_type == MAP_SHARED && (req->prot & PROT_WRITE)) {
+        need |= W_OK;
+    }
+
+    int access = vfs_access(file->node, thread->uid, thread->gid, need);
+    return access < 0 ? access : 0;
+}
+
 static int _mmap_file_node(sched_thread_t *thread, const mmap_args_t *req, int map_type, vfs_node_t **file_out) {
     *file_out = NULL;
 
@@ -1552,33 +1500,21 @@ static int _mmap_file_node(sched_thread_t *thread, const mmap_args_t *req, int m
         return -EBADF;
     }
 
-    sched_fd_t *entry = NULL;
+    sched_fd_t entry = { 0 };
     if (!_fd_lookup(thread, req->fd, &entry)) {
         return -EBADF;
     }
 
-    sched_file_t *file = entry->file;
-    if (file->kind != SCHED_FD_VFS || !file->node) {
-        return -EBADF;
-    }
-
-    u32 file_flags = __atomic_load_n(&file->flags, __ATOMIC_ACQUIRE);
-    if (!_open_has_read(file_flags)) {
-        return -EACCES;
-    }
-
-    int need = R_OK;
-    if (map_type == MAP_SHARED && (req->prot & PROT_WRITE)) {
-        need |= W_OK;
-    }
+    int err = _mmap_check_file(thread, req, map_type, entry.file);
 
-    int access = vfs_access(file->node, thread->uid, thread->gid, need);
-    if (access < 0) {
-        return access;
+    // the node outlives the descriptor, which may be closed while we read it
+    if (!err) {
+        vfs_node_retain(entry.file->node);
+        *file_out = entry.file->node;
     }
 
-    *file_out = file->node;
-    return 0;
+    sched_fd_put(&entry);
+    return err;
 }
 
 static size_t _fd_vfs_io_flags(const sched_fd_t *entry) {
@@ -1764,7 +1700,7 @@ static ssize_t _fd_read_vfs(const fd_io_t *io) {
         return pty_read_handle(&pty_handle, (void *)io->buf, io->len, _fd_vfs_io_flags(entry));
     }
 
-    pid_t owner = io->thread ? io->thread->pid : 0;
+    pid_t owner = io->thread ? sched_group(io->thread)->pid : 0;
     u32 io_flags = _fd_vfs_io_flags(entry);
 
     ssize_t ws_result = 0;
@@ -1835,7 +1771,7 @@ static ssize_t _fd_write_vfs(const fd_io_t *io) {
         offset = (size_t)file->node->size;
     }
 
-    pid_t owner = io->thread ? io->thread->pid : 0;
+    pid_t owner = io->thread ? sched_group(io->thread)->pid : 0;
     u32 io_flags = _fd_vfs_io_flags(entry);
 
     ssize_t ws_result = 0;
@@ -1876,6 +1812,53 @@ static ssize_t _fd_write_vfs(const fd_io_t *io) {
     return bytes;
 }
 
+static ssize_t _read_entry(
+    sched_thread_t *thread,
+    sched_fd_t *entry,
+    void *buf,
+    size_t len,
+    size_t read_offset,
+    bool positional
+) {
+    _sync_thread_tty(thread, entry);
+    sched_file_t *file = entry->file;
+
+    if (file->kind == SCHED_FD_PIPE_READ) {
+        if (positional) {
+            return -ESPIPE;
+        }
+
+        bool nonblock = (__atomic_load_n(&file->flags, __ATOMIC_ACQUIRE) & O_NONBLOCK) != 0;
+        return _pipe_read(file->pipe, buf, len, nonblock);
+    }
+
+    bool uses_offset = _file_uses_offset(file);
+    if (positional && !uses_offset) {
+        return -ESPIPE;
+    }
+
+    if (!positional && uses_offset) {
+        mutex_lock(&file->offset_lock);
+        read_offset = file->offset;
+    }
+
+    fd_io_t io = {
+        .thread = thread,
+        .entry = entry,
+        .buf = buf,
+        .len = len,
+        .offset = read_offset,
+        .advance_offset = !positional && uses_offset,
+        .wrong_kind_error = positional ? -ESPIPE : -EBADF,
+    };
+
+    ssize_t result = _fd_read_vfs(&io);
+    if (!positional && uses_offset) {
+        mutex_unlock(&file->offset_lock);
+    }
+    return result;
+}
+
 static ssize_t _read_fd(int fd, void *buf, size_t len, off_t offset, bool positional) {
     if (!len) {
         return 0;
@@ -1897,45 +1880,11 @@ static ssize_t _read_fd(int fd, void *buf, size_t len, off_t offset, bool positi
         }
     }
 
-    sched_fd_t *entry = NULL;
+    sched_fd_t entry = { 0 };
 
     if (thread && _fd_lookup(thread, fd, &entry)) {
-        _sync_thread_tty(thread, entry);
-        sched_file_t *file = entry->file;
-
-        if (file->kind == SCHED_FD_PIPE_READ) {
-            if (positional) {
-                return -ESPIPE;
-            }
-
-            bool nonblock = (__atomic_load_n(&file->flags, __ATOMIC_ACQUIRE) & O_NONBLOCK) != 0;
-            return _pipe_read(file->pipe, buf, len, nonblock);
-        }
-
-        bool uses_offset = _file_uses_offset(file);
-        if (positional && !uses_offset) {
-            return -ESPIPE;
-        }
-
-        if (!positional && uses_offset) {
-            mutex_lock(&file->offset_lock);
-            read_offset = file->offset;
-        }
-
-        fd_io_t io = {
-            .thread = thread,
-            .entry = entry,
-            .buf = buf,
-            .len = len,
-            .offset = read_offset,
-            .advance_offset = !positional && uses_offset,
-            .wrong_kind_error = positional ? -ESPIPE : -EBADF,
-        };
-
-        ssize_t result = _fd_read_vfs(&io);
-        if (!positional && uses_offset) {
-            mutex_unlock(&file->offset_lock);
-        }
+        ssize_t result = _read_entry(thread, &entry, buf, len, read_offset, positional);
+        sched_fd_put(&entry);
         return result;
     }
 
@@ -1970,23 +1919,69 @@ static ssize_t sys_getdents(int fd, dirent_t *buf, size_t len) {
         return -EFAULT;
     }
 
-    sched_fd_t *entry = NULL;
+    sched_fd_t entry = { 0 };
     if (!_fd_lookup(thread, fd, &entry)) {
         return -EBADF;
     }
 
+    sched_file_t *file = entry.file;
+    ssize_t result = -EBADF;
+
+    if (file->kind == SCHED_FD_VFS && file->node && _open_has_read(__atomic_load_n(&file->flags, __ATOMIC_ACQUIRE))) {
+        mutex_lock(&file->offset_lock);
+        result = _fd_getdents(&entry, buf, len, file->offset, true);
+        mutex_unlock(&file->offset_lock);
+    }
+
+    sched_fd_put(&entry);
+    return result;
+}
+
+static ssize_t _write_entry(
+    sched_thread_t *thread,
+    sched_fd_t *entry,
+    const void *buf,
+    size_t len,
+    size_t write_offset,
+    bool positional
+) {
+    _sync_thread_tty(thread, entry);
     sched_file_t *file = entry->file;
-    if (file->kind != SCHED_FD_VFS || !file->node) {
-        return -EBADF;
+
+    if (file->kind == SCHED_FD_PIPE_WRITE) {
+        if (positional) {
+            return -ESPIPE;
+        }
+
+        bool nonblock = (__atomic_load_n(&file->flags, __ATOMIC_ACQUIRE) & O_NONBLOCK) != 0;
+        return _pipe_write(file->pipe, buf, len, nonblock);
     }
 
-    if (!_open_has_read(__atomic_load_n(&file->flags, __ATOMIC_ACQUIRE))) {
-        return -EBADF;
+    bool uses_offset = _file_uses_offset(file);
+    if (positional && !uses_offset) {
+        return -ESPIPE;
     }
 
-    mutex_lock(&file->offset_lock);
-    ssize_t result = _fd_getdents(entry, buf, len, file->offset, true);
-    mutex_unlock(&file->offset_lock);
+    if (!positional && uses_offset) {
+        mutex_lock(&file->offset_lock);
+        write_offset = file->offset;
+    }
+
+    fd_io_t io = {
+        .thread = thread,
+        .entry = entry,
+        .buf = buf,
+        .len = len,
+        .offset = write_offset,
+        .append_mode = !positional && uses_offset,
+        .advance_offset = !positional && uses_offset,
+        .wrong_kind_error = positional ? -ESPIPE : -EBADF,
+    };
+
+    ssize_t result = _fd_write_vfs(&io);
+    if (!positional && uses_offset) {
+        mutex_unlock(&file->offset_lock);
+    }
     return result;
 }
 
@@ -2012,46 +2007,11 @@ static ssize_t _write_fd(int fd, const void *buf, size_t len, off_t offset, bool
         }
     }
 
-    sched_fd_t *entry = NULL;
+    sched_fd_t entry = { 0 };
 
     if (thread && _fd_lookup(thread, fd, &entry)) {
-        _sync_thread_tty(thread, entry);
-        sched_file_t *file = entry->file;
-
-        if (file->kind == SCHED_FD_PIPE_WRITE) {
-            if (positional) {
-                return -ESPIPE;
-            }
-
-            bool nonblock = (__atomic_load_n(&file->flags, __ATOMIC_ACQUIRE) & O_NONBLOCK) != 0;
-            return _pipe_write(file->pipe, buf, len, nonblock);
-        }
-
-        bool uses_offset = _file_uses_offset(file);
-        if (positional && !uses_offset) {
-            return -ESPIPE;
-        }
-
-        if (!positional && uses_offset) {
-            mutex_lock(&file->offset_lock);
-            write_offset = file->offset;
-        }
-
-        fd_io_t io = {
-            .thread = thread,
-            .entry = entry,
-            .buf = buf,
-            .len = len,
-            .offset = write_offset,
-            .append_mode = !positional && uses_offset,
-            .advance_offset = !positional && uses_offset,
-            .wrong_kind_error = positional ? -ESPIPE : -EBADF,
-        };
-
-        ssize_t result = _fd_write_vfs(&io);
-        if (!positional && uses_offset) {
-            mutex_unlock(&file->offset_lock);
-        }
+        ssize_t result = _write_entry(thread, &entry, buf, len, write_offset, positional);
+        sched_fd_put(&entry);
         return result;
     }
 
@@ -2077,29 +2037,35 @@ static ssize_t sys_pwrite(int fd, const void *buf, size_t len, off_t offset) {
     return _write_fd(fd, buf, len, offset, true);
 }
 
-static ssize_t sys_ioctl(int fd, u64 request, void *args) {
-    sched_thread_t *thread = sched_current();
-    sched_fd_t *entry = NULL;
+static ssize_t _ioctl_entry(sched_thread_t *thread, sched_fd_t *entry, u64 request, void *args) {
+    sched_file_t *file = entry->file;
+    if (file->kind != SCHED_FD_VFS || !file->node) {
+        return -ENOTTY;
+    }
 
-    if (thread && _fd_lookup(thread, fd, &entry)) {
-        sched_file_t *file = entry->file;
-        if (file->kind == SCHED_FD_VFS && file->node) {
-            _sync_thread_tty(thread, entry);
+    _sync_thread_tty(thread, entry);
 
-            pty_handle_t pty_handle;
-            if (_fd_pty_handle(entry, &pty_handle)) {
-                return pty_ioctl_handle(&pty_handle, request, args);
-            }
+    pty_handle_t pty_handle;
+    if (_fd_pty_handle(entry, &pty_handle)) {
+        return pty_ioctl_handle(&pty_handle, request, args);
+    }
 
-            ssize_t ws_result = 0;
-            if (ws_node_ioctl(file->node, thread->pid, request, args, &ws_result)) {
-                return ws_result;
-            }
+    ssize_t ws_result = 0;
+    if (ws_node_ioctl(file->node, sched_group(thread)->pid, request, args, &ws_result)) {
+        return ws_result;
+    }
 
-            return vfs_ioctl(file->node, request, args);
-        }
+    return vfs_ioctl(file->node, request, args);
+}
 
-        return -ENOTTY;
+static ssize_t sys_ioctl(int fd, u64 request, void *args) {
+    sched_thread_t *thread = sched_current();
+    sched_fd_t entry = { 0 };
+
+    if (thread && _fd_lookup(thread, fd, &entry)) {
+        ssize_t result = _ioctl_entry(thread, &entry, request, args);
+        sched_fd_put(&entry);
+        return result;
     }
 
     if (fd != STDIN_FILENO && fd != STDOUT_FILENO && fd != STDERR_FILENO) {
@@ -2143,7 +2109,7 @@ static int _open_create_file(sched_thread_t *thread, const char *path, int flags
         return parent_err;
     }
 
-    mode_t create_mode = _apply_umask(mode & 07777, thread->umask);
+    mode_t create_mode = _apply_umask(mode & 07777, sched_group(thread)->umask);
     vfs_node_t *node = vfs_create_hold(parent, base, VFS_FILE, create_mode);
     vfs_node_release(parent);
 
@@ -2205,32 +2171,7 @@ static int _open_truncate(sched_thread_t *thread, vfs_node_t *node, int flags) {
     return 0;
 }
 
-static int sys_open(const char *path, int flags, mode_t mode) {
-    if (!path) {
-        return -EFAULT;
-    }
-
-    sched_thread_t *thread = sched_current();
-
-    if (!thread) {
-        return -EINVAL;
-    }
-
-    if (!_open_flags_valid(flags) || !_open_access_valid(flags)) {
-        return -EINVAL;
-    }
-
-    if ((flags & O_TRUNC) && !_open_has_write(flags)) {
-        return -EINVAL;
-    }
-
-    char resolved[PATH_MAX];
-    int resolve_err = _resolve_user_path(thread, path, resolved, sizeof(resolved));
-
-    if (resolve_err < 0) {
-        return resolve_err;
-    }
-
+static int _open_resolved(sched_thread_t *thread, const char *resolved, int flags, mode_t mode) {
     open_dev_t dev = { 0 };
     int dev_err = _open_dev_prepare(resolved, &dev);
     if (dev_err < 0) {
@@ -2321,25 +2262,50 @@ static int sys_open(const char *path, int flags, mode_t mode) {
     return new_fd;
 }
 
-static int sys_close(int fd) {
-    if (fd < 0) {
-        return -EBADF;
+static bool _open_args_valid(int flags) {
+    if (!_open_flags_valid(flags) || !_open_access_valid(flags)) {
+        return false;
+    }
+
+    return !(flags & O_TRUNC) || _open_has_write(flags);
+}
+
+static int sys_open(const char *path, int flags, mode_t mode) {
+    if (!path) {
+        return -EFAULT;
     }
 
     sched_thread_t *thread = sched_current();
+
     if (!thread) {
         return -EINVAL;
     }
 
-    if (fd >= SCHED_FD_MAX) {
-        return -EBADF;
+    if (!_open_args_valid(flags)) {
+        return -EINVAL;
     }
 
-    if (!thread->fd_used[fd]) {
-        return -EBADF;
+    char resolved[PATH_MAX];
+    int resolve_err = _resolve_user_path(thread, path, resolved, sizeof(resolved));
+
+    if (resolve_err < 0) {
+        return resolve_err;
     }
 
-    return sched_fd_close(thread, fd);
+    return _open_resolved(thread, resolved, flags, mode);
+}
+
+static int sys_close(int fd) {
+    if (fd < 0) {
+        return -EBADF;
+    }
+
+    sched_thread_t *thread = sched_current();
+    if (!thread) {
+        return -EINVAL;
+    }
+
+    return sched_fd_close(thread, fd);
 }
 
 static int sys_pipe(int *fds) {
@@ -2402,50 +2368,37 @@ static int sys_pipe(int *fds) {
     return 0;
 }
 
-static int sys_dup(int oldfd, int newfd) {
-    sched_thread_t *thread = sched_current();
-    if (!thread) {
-        return -EINVAL;
-    }
-
-    if (oldfd < 0 || oldfd >= SCHED_FD_MAX || !thread->fd_used[oldfd]) {
-        return -EBADF;
-    }
-
-    if (newfd < 0) {
-        sched_fd_t source = thread->fds[oldfd];
-        source.fd_flags &= ~SCHED_FD_FLAG_CLOEXEC;
-        return sched_fd_alloc(thread, &source, 0);
+static int _dup_fd(sched_thread_t *thread, int oldfd, int newfd) {
+    if (newfd >= 0) {
+        return sched_fd_dup(thread, oldfd, newfd);
     }
 
-    if (newfd >= SCHED_FD_MAX) {
+    sched_fd_t source = { 0 };
+    if (!_fd_lookup(thread, oldfd, &source)) {
         return -EBADF;
     }
 
-    if (newfd == oldfd) {
-        return newfd;
-    }
+    sched_fd_t copy = source;
+    copy.fd_flags &= ~SCHED_FD_FLAG_CLOEXEC;
+    int result = sched_fd_alloc(thread, &copy, 0);
 
-    sched_fd_t source = thread->fds[oldfd];
-    source.fd_flags &= ~SCHED_FD_FLAG_CLOEXEC;
-    return sched_fd_install(thread, newfd, &source);
+    sched_fd_put(&source);
+    return result;
 }
 
-static int sys_fcntl(int fd, int cmd, uintptr_t arg) {
+static int sys_dup(int oldfd, int newfd) {
     sched_thread_t *thread = sched_current();
     if (!thread) {
         return -EINVAL;
     }
 
-    sched_fd_t *entry = NULL;
+    return _dup_fd(thread, oldfd, newfd);
+}
 
+static int _fcntl_entry(sched_thread_t *thread, int fd, sched_fd_t *entry, int cmd, uintptr_t arg) {
     switch (cmd) {
     case F_DUPFD:
     case F_DUPFD_CLOEXEC: {
-        if (!_fd_lookup(thread, fd, &entry)) {
-            return -EBADF;
-        }
-
         int min_fd = (int)arg;
         if (min_fd < 0 || min_fd >= SCHED_FD_MAX) {
             return -EINVAL;
@@ -2461,33 +2414,22 @@ static int sys_fcntl(int fd, int cmd, uintptr_t arg) {
     }
 
     case F_GETFD:
-        if (!_fd_lookup(thread, fd, &entry)) {
-            return -EBADF;
-        }
         return (entry->fd_flags & SCHED_FD_FLAG_CLOEXEC) ? FD_CLOEXEC : 0;
 
-    case F_SETFD:
-        if (!_fd_lookup(thread, fd, &entry)) {
-            return -EBADF;
-        }
+    case F_SETFD: {
+        u32 fd_flags = entry->fd_flags & ~SCHED_FD_FLAG_CLOEXEC;
         if ((int)arg & FD_CLOEXEC) {
-            entry->fd_flags |= SCHED_FD_FLAG_CLOEXEC;
-        } else {
-            entry->fd_flags &= ~SCHED_FD_FLAG_CLOEXEC;
+            fd_flags |= SCHED_FD_FLAG_CLOEXEC;
         }
-        return 0;
+
+        // the entry is a copy, the flag has to land in the table itself
+        return sched_fd_set_flags(thread, fd, fd_flags);
+    }
 
     case F_GETFL:
-        if (!_fd_lookup(thread, fd, &entry)) {
-            return -EBADF;
-        }
         return (int)__atomic_load_n(&entry->file->flags, __ATOMIC_ACQUIRE);
 
     case F_SETFL: {
-        if (!_fd_lookup(thread, fd, &entry)) {
-            return -EBADF;
-        }
-
         u32 *flags = &entry->file->flags;
         u32 old = __atomic_load_n(flags, __ATOMIC_ACQUIRE);
         u32 desired = 0;
@@ -2504,6 +2446,34 @@ static int sys_fcntl(int fd, int cmd, uintptr_t arg) {
     }
 }
 
+static int sys_fcntl(int fd, int cmd, uintptr_t arg) {
+    sched_thread_t *thread = sched_current();
+    if (!thread) {
+        return -EINVAL;
+    }
+
+    switch (cmd) {
+    case F_DUPFD:
+    case F_DUPFD_CLOEXEC:
+    case F_GETFD:
+    case F_SETFD:
+    case F_GETFL:
+    case F_SETFL:
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    sched_fd_t entry = { 0 };
+    if (!_fd_lookup(thread, fd, &entry)) {
+        return -EBADF;
+    }
+
+    int result = _fcntl_entry(thread, fd, &entry, cmd, arg);
+    sched_fd_put(&entry);
+    return result;
+}
+
 static int sys_mkdir(const char *path, mode_t mode) {
     sched_thread_t *thread = sched_current();
 
@@ -2540,7 +2510,7 @@ static int sys_mkdir(const char *path, mode_t mode) {
         return parent_err;
     }
 
-    vfs_node_t *node = vfs_create_hold(parent, base, VFS_DIR, _apply_umask(mode, thread->umask));
+    vfs_node_t *node = vfs_create_hold(parent, base, VFS_DIR, _apply_umask(mode, sched_group(thread)->umask));
     vfs_node_release(parent);
 
     if (!node) {
@@ -2652,8 +2622,9 @@ static int sys_chdir(const char *path) {
         return access;
     }
 
-    strncpy(thread->cwd, resolved, sizeof(thread->cwd) - 1);
-    thread->cwd[sizeof(thread->cwd) - 1] = '\0';
+    char *cwd = sched_group(thread)->cwd;
+    strncpy(cwd, resolved, sizeof(thread->cwd) - 1);
+    cwd[sizeof(thread->cwd) - 1] = '\0';
 
     vfs_node_release(node);
     return 0;
@@ -2673,6 +2644,48 @@ static int sys_access(const char *path, int mode) {
     return status;
 }
 
+static uintptr_t _mmap_fill(sched_thread_t *thread, const mmap_plan_t *plan, uintptr_t addr, vfs_node_t *file) {
+    void *root = arch_vm_root(thread->vm_space);
+    if (!root) {
+        return (uintptr_t)-ENOMEM;
+    }
+
+    u64 page_flags = _mmap_prot_flags(plan->req.prot);
+
+    uintptr_t paddr = sched_alloc_user_zeroed(addr, plan->pages);
+    if (!paddr) {
+        return (uintptr_t)-ENOMEM;
+    }
+
+    arch_map_region(root, plan->pages, addr, paddr, page_flags);
+
+    if (!sched_add_user_region(thread, addr, paddr, plan->pages, page_flags)) {
+        _mmap_undo_alloc(thread, root, addr, paddr, plan->pages, false);
+        return (uintptr_t)-ENOMEM;
+    }
+
+    // the frames arrive zeroed, only file contents still have to be copied in
+    if (!file) {
+        return addr;
+    }
+
+    void *dst = arch_phys_map(paddr, plan->pages * PAGE_4KIB, 0);
+    if (!dst) {
+        _mmap_undo_alloc(thread, root, addr, paddr, plan->pages, true);
+        return (uintptr_t)-ENOMEM;
+    }
+
+    ssize_t read_len = vfs_read(file, dst, plan->file_offset, plan->size, 0);
+    arch_phys_unmap(dst, plan->pages * PAGE_4KIB);
+
+    if (read_len < 0) {
+        _mmap_undo_alloc(thread, root, addr, paddr, plan->pages, true);
+        return (uintptr_t)read_len;
+    }
+
+    return addr;
+}
+
 static uintptr_t sys_mmap(const mmap_args_t *args) {
     sched_thread_t *thread = sched_current();
     if (!thread || !thread->vm_space) {
@@ -2697,45 +2710,13 @@ static uintptr_t sys_mmap(const mmap_args_t *args) {
         return (uintptr_t)err;
     }
 
-    void *root = arch_vm_root(thread->vm_space);
-    if (!root) {
-        return (uintptr_t)-ENOMEM;
-    }
-
-    u64 page_flags = _mmap_prot_flags(map.req.prot);
-
-    uintptr_t paddr = (uintptr_t)arch_alloc_frames_user(map.pages);
-    if (!paddr) {
-        return (uintptr_t)-ENOMEM;
-    }
-
-    arch_map_region(root, map.pages, addr, paddr, page_flags);
-
-    if (!sched_add_user_region(thread, addr, paddr, map.pages, page_flags)) {
-        _mmap_undo_alloc(thread, root, addr, paddr, map.pages, false);
-        return (uintptr_t)-ENOMEM;
-    }
-
-    void *dst = arch_phys_map(paddr, map.pages * PAGE_4KIB, 0);
-    if (!dst) {
-        _mmap_undo_alloc(thread, root, addr, paddr, map.pages, true);
-        return (uintptr_t)-ENOMEM;
-    }
-
-    memset(dst, 0, map.pages * PAGE_4KIB);
+    uintptr_t result = _mmap_fill(thread, &map, addr, file);
 
     if (file) {
-        ssize_t read_len = vfs_read(file, dst, map.file_offset, map.size, 0);
-        if (read_len < 0) {
-            arch_phys_unmap(dst, map.pages * PAGE_4KIB);
-            _mmap_undo_alloc(thread, root, addr, paddr, map.pages, true);
-            return (uintptr_t)read_len;
-        }
+        vfs_node_release(file);
     }
 
-    arch_phys_unmap(dst, map.pages * PAGE_4KIB);
-
-    return addr;
+    return result;
 }
 
 static int sys_mprotect(void *addr, size_t len, int prot) {
@@ -2840,30 +2821,32 @@ static sched_user_region_t *_munmap_tail(const sched_user_region_t *region, cons
     tail->paddr = region->paddr + (cut->page_index + cut->overlap_pages) * PAGE_4KIB;
     tail->pages = cut->after_pages;
     tail->flags = region->flags;
-    tail->next = region->next;
     return tail;
 }
 
-static void _munmap_pages(const munmap_req_t *req, const sched_user_region_t *region, const munmap_cut_t *cut) {
-    for (size_t i = 0; i < cut->overlap_pages; i++) {
-        uintptr_t vaddr = cut->start + i * PAGE_4KIB;
-
-        unmap_page((page_t *)req->root, vaddr);
-        arch_tlb_flush(vaddr);
-    }
+static void _munmap_pages(
+    const munmap_req_t *req,
+    const sched_user_region_t *region,
+    const munmap_cut_t *cut,
+    tlb_batch_t *batch
+) {
+    // large leaves that straddle the cut are split, fully covered ones are dropped whole
+    arch_unmap_region(req->root, cut->overlap_pages, cut->start);
+    tlb_batch_add(batch, cut->start, cut->end);
 
     uintptr_t paddr = region->paddr + cut->page_index * (uintptr_t)PAGE_4KIB;
-    arch_free_frames((void *)paddr, cut->overlap_pages);
-    sched_user_mem_sub(req->thread, cut->overlap_pages);
-}
 
-static void _munmap_drop_region(sched_thread_t *thread, sched_user_region_t *prev, sched_user_region_t *region) {
-    if (prev) {
-        prev->next = region->next;
+    if (region->flags & SCHED_REGION_SWAP) {
+        sched_swap_put(paddr, cut->overlap_pages);
     } else {
-        thread->regions = region->next;
+        tlb_batch_free(batch, paddr, cut->overlap_pages);
     }
 
+    sched_user_mem_sub(req->thread, cut->overlap_pages);
+}
+
+static void _munmap_drop_region(sched_thread_t *thread, sched_user_region_t *region) {
+    sched_region_remove(thread, region);
     free(region);
 }
 
@@ -2875,15 +2858,17 @@ static int sys_munmap(void *addr, size_t len) {
     }
 
     bool unmapped = false;
-    sched_user_region_t *prev = NULL;
-    sched_user_region_t *region = req.thread->regions;
+    tlb_batch_t batch;
 
-    while (region) {
-        sched_user_region_t *next = region->next;
+    tlb_batch_init(&batch, req.thread->vm_space);
+
+    sched_user_region_t *region = sched_region_first_overlap(req.thread, req.base, req.end);
+
+    while (region && region->vaddr < req.end) {
+        sched_user_region_t *next = sched_region_next(region);
         munmap_cut_t cut = { 0 };
 
         if (!_munmap_cut(&req, region, &cut)) {
-            prev = region;
             region = next;
             continue;
         }
@@ -2891,15 +2876,16 @@ static int sys_munmap(void *addr, size_t len) {
         sched_user_region_t *tail = _munmap_tail(region, &cut);
         if (cut.before_pages && cut.after_pages) {
             if (!tail) {
+                tlb_batch_finish(&batch);
                 return -ENOMEM;
             }
         }
 
-        _munmap_pages(&req, region, &cut);
+        _munmap_pages(&req, region, &cut, &batch);
         unmapped = true;
 
         if (!cut.before_pages && !cut.after_pages) {
-            _munmap_drop_region(req.thread, prev, region);
+            _munmap_drop_region(req.thread, region);
             region = next;
             continue;
         }
@@ -2908,24 +2894,23 @@ static int sys_munmap(void *addr, size_t len) {
             region->vaddr = cut.end;
             region->paddr += (cut.page_index + cut.overlap_pages) * PAGE_4KIB;
             region->pages = cut.after_pages;
-            prev = region;
+            sched_region_update(region);
             region = next;
             continue;
         }
 
         region->pages = cut.before_pages;
+        sched_region_update(region);
 
         if (tail) {
-            region->next = tail;
-            prev = tail;
-            region = tail->next;
-            continue;
+            sched_region_insert(req.thread, tail);
         }
 
-        prev = region;
         region = next;
     }
 
+    tlb_batch_finish(&batch);
+
     if (!unmapped) {
         return -EINVAL;
     }
@@ -2933,6 +2918,155 @@ static int sys_munmap(void *addr, size_t len) {
     return 0;
 }
 
+static bool _mremap_fits(sched_thread_t *thread, uintptr_t addr, uintptr_t end) {
+    uintptr_t stack_top = sched_group(thread)->user_stack_base;
+
+    if (!stack_top) {
+        stack_top = (uintptr_t)arch_user_stack_top();
+    }
+
+    if (!addr || end < addr || end > stack_top) {
+        return false;
+    }
+
+    return !sched_region_first_overlap(thread, addr, end);
+}
+
+// moving works on whole regions, a mapping split by mprotect must be moved in one piece too
+static bool _mremap_whole_regions(sched_thread_t *thread, uintptr_t base, uintptr_t end) {
+    sched_user_region_t *region = sched_region_first_overlap(thread, base, end);
+
+    for (; region && region->vaddr < end; region = sched_region_next(region)) {
+        if (region->vaddr < base || _region_end(region) > end) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int _mremap_extend(sched_thread_t *thread, void *root, uintptr_t addr, size_t pages, u64 flags) {
+    uintptr_t paddr = sched_alloc_user_zeroed(addr, pages);
+    if (!paddr) {
+        return -ENOMEM;
+    }
+
+    arch_map_region(root, pages, addr, paddr, flags);
+
+    if (!sched_add_user_region(thread, addr, paddr, pages, flags)) {
+        _mmap_undo_alloc(thread, root, addr, paddr, pages, false);
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+static void _mremap_move(sched_thread_t *thread, void *root, uintptr_t base, uintptr_t end, uintptr_t target) {
+    tlb_batch_t batch;
+    tlb_batch_init(&batch, thread->vm_space);
+
+    // the frames stay put, only their page table entries and region keys change
+    sched_user_region_t *region = sched_region_first_overlap(thread, base, end);
+
+    while (region && region->vaddr < end) {
+        sched_user_region_t *next = sched_region_next(region);
+        uintptr_t vaddr = target + (region->vaddr - base);
+        u64 map_flags = region->flags;
+
+        if (map_flags & SCHED_REGION_COW) {
+            map_flags &= ~PT_WRITE;
+        }
+
+        arch_unmap_region(root, region->pages, region->vaddr);
+        tlb_batch_add(&batch, region->vaddr, _region_end(region));
+
+        sched_region_remove(thread, region);
+        region->vaddr = vaddr;
+        sched_region_insert(thread, region);
+
+        if (region->flags & SCHED_REGION_SWAP) {
+            sched_swap_map(root, region);
+        } else {
+            arch_map_region(root, region->pages, vaddr, region->paddr, map_flags);
+        }
+
+        region = next;
+    }
+
+    tlb_batch_finish(&batch);
+}
+
+static uintptr_t sys_mremap(void *old_addr, size_t old_len, size_t new_len, int flags) {
+    sched_thread_t *thread = sched_current();
+    if (!thread || !thread->vm_space) {
+        return (uintptr_t)-EINVAL;
+    }
+
+    uintptr_t base = (uintptr_t)old_addr;
+    if (!base || (base % PAGE_4KIB) || (flags & ~MREMAP_MAYMOVE)) {
+        return (uintptr_t)-EINVAL;
+    }
+
+    size_t limit = SIZE_MAX - (PAGE_4KIB - 1);
+    if (!old_len || !new_len || old_len > limit || new_len > limit) {
+        return (uintptr_t)-EINVAL;
+    }
+
+    size_t old_size = ALIGN(old_len, PAGE_4KIB);
+    size_t new_size = ALIGN(new_len, PAGE_4KIB);
+    uintptr_t end = base + old_size;
+
+    if (end < base || !_user_range_mapped(thread, base, end)) {
+        return (uintptr_t)-EFAULT;
+    }
+
+    if (new_size == old_size) {
+        return base;
+    }
+
+    if (new_size < old_size) {
+        int err = sys_munmap((void *)(base + new_size), old_size - new_size);
+        return err < 0 ? (uintptr_t)err : base;
+    }
+
+    void *root = arch_vm_root(thread->vm_space);
+    if (!root) {
+        return (uintptr_t)-ENOMEM;
+    }
+
+    // the new tail takes the protection of the last page it extends
+    sched_user_region_t *last = _find_region_at(thread, end - 1);
+    u64 tail_flags = last->flags & ~(SCHED_REGION_COW | SCHED_REGION_SWAP);
+    size_t tail_pages = (new_size - old_size) / PAGE_4KIB;
+
+    if (_mremap_fits(thread, end, base + new_size)) {
+        int err = _mremap_extend(thread, root, end, tail_pages, tail_flags);
+        return err < 0 ? (uintptr_t)err : base;
+    }
+
+    if (!(flags & MREMAP_MAYMOVE)) {
+        return (uintptr_t)-ENOMEM;
+    }
+
+    if (!_mremap_whole_regions(thread, base, end)) {
+        return (uintptr_t)-EINVAL;
+    }
+
+    uintptr_t target = _pick_mmap_base(thread, new_size);
+    if (!_mremap_fits(thread, target, target + new_size)) {
+        return (uintptr_t)-ENOMEM;
+    }
+
+    // the tail is allocated first so a failure leaves the old mapping untouched
+    int err = _mremap_extend(thread, root, target + old_size, tail_pages, tail_flags);
+    if (err < 0) {
+        return (uintptr_t)err;
+    }
+
+    _mremap_move(thread, root, base, end, target);
+    return target;
+}
+
 static pid_t sys_waitpid(pid_t pid, int *status, int options) {
     sched_thread_t *thread = sched_current();
     if (status && !user_write_prepare(thread, status, sizeof(*status))) {
@@ -2980,16 +3114,7 @@ static int sys_lstat(const char *path, stat_t *st) {
     return _sys_stat_path(path, st, false);
 }
 
-static int sys_fstat(int fd, stat_t *st) {
-    sched_thread_t *thread = sched_current();
-
-    sched_fd_t *entry = NULL;
-
-    if (!_fd_lookup(thread, fd, &entry)) {
-        return -EBADF;
-    }
-
-    sched_file_t *file = entry->file;
+static int _fstat_file(sched_thread_t *thread, sched_file_t *file, stat_t *st) {
     if (file->kind == SCHED_FD_PIPE_READ || file->kind == SCHED_FD_PIPE_WRITE) {
         stat_t local = { 0 };
 
@@ -3010,6 +3135,19 @@ static int sys_fstat(int fd, stat_t *st) {
     return _copyout_stat(thread, st, file->node, true);
 }
 
+static int sys_fstat(int fd, stat_t *st) {
+    sched_thread_t *thread = sched_current();
+    sched_fd_t entry = { 0 };
+
+    if (!_fd_lookup(thread, fd, &entry)) {
+        return -EBADF;
+    }
+
+    int result = _fstat_file(thread, entry.file, st);
+    sched_fd_put(&entry);
+    return result;
+}
+
 static int _truncate_node(sched_thread_t *thread, vfs_node_t *node, size_t len, bool check_access) {
     if (!node) {
         return -ENOENT;
@@ -3070,22 +3208,21 @@ static int sys_ftruncate(int fd, off_t length) {
         return -EINVAL;
     }
 
-    sched_fd_t *entry = NULL;
+    sched_fd_t entry = { 0 };
 
     if (!_fd_lookup(thread, fd, &entry)) {
         return -EBADF;
     }
 
-    sched_file_t *file = entry->file;
-    if (file->kind != SCHED_FD_VFS || !file->node) {
-        return -EINVAL;
-    }
+    sched_file_t *file = entry.file;
+    int result = -EINVAL;
 
-    if (!_open_has_write(__atomic_load_n(&file->flags, __ATOMIC_ACQUIRE))) {
-        return -EINVAL;
+    if (file->kind == SCHED_FD_VFS && file->node && _open_has_write(__atomic_load_n(&file->flags, __ATOMIC_ACQUIRE))) {
+        result = _truncate_node(thread, file->node, (size_t)length, false);
     }
 
-    return _truncate_node(thread, file->node, (size_t)length, false);
+    sched_fd_put(&entry);
+    return result;
 }
 
 static int sys_utime(const char *path, const struct utimbuf *user_times) {
@@ -3560,15 +3697,7 @@ static int sys_umount(const char *target, u64 flags) {
     return 0;
 }
 
-static off_t sys_lseek(int fd, off_t offset, int whence) {
-    sched_thread_t *thread = sched_current();
-    sched_fd_t *entry = NULL;
-
-    if (!_fd_lookup(thread, fd, &entry)) {
-        return -EBADF;
-    }
-
-    sched_file_t *file = entry->file;
+static off_t _lseek_file(sched_file_t *file, off_t offset, int whence) {
     if (!_file_seekable(file)) {
         return -ESPIPE;
     }
@@ -3624,49 +3753,65 @@ out:
     return result;
 }
 
-static int sys_sleep(const struct timespec *req, struct timespec *rem) {
+static off_t sys_lseek(int fd, off_t offset, int whence) {
     sched_thread_t *thread = sched_current();
-    struct timespec ts = { 0 };
+    sched_fd_t entry = { 0 };
 
-    if (!user_copy_from(thread, &ts, req, sizeof(ts))) {
-        return -EFAULT;
+    if (!_fd_lookup(thread, fd, &entry)) {
+        return -EBADF;
     }
 
-    if (rem && !user_write_prepare(thread, rem, sizeof(*rem))) {
-        return -EFAULT;
-    }
+    off_t result = _lseek_file(entry.file, offset, whence);
+    sched_fd_put(&entry);
+    return result;
+}
 
-    if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000L) {
-        return -EINVAL;
+static void _timespec_from_ns(u64 ns, struct timespec *tp) {
+    if (!tp) {
+        return;
     }
 
-    u64 hz = arch_timer_hz();
-    if (!hz) {
+    tp->tv_sec = (time_t)(ns / 1000000000ULL);
+    tp->tv_nsec = (long)(ns % 1000000000ULL);
+}
+
+static int _timespec_to_ns(const struct timespec *ts, u64 *ns_out) {
+    if (ts->tv_sec < 0 || ts->tv_nsec < 0 || ts->tv_nsec >= 1000000000L) {
         return -EINVAL;
     }
 
-    u64 seconds = (u64)ts.tv_sec;
-    if (seconds > UINT64_MAX / hz) {
+    u64 seconds = (u64)ts->tv_sec;
+    if (seconds > (UINT64_MAX - 999999999ULL) / 1000000000ULL) {
         return -EINVAL;
     }
 
-    u64 ticks = seconds * hz;
-    u64 subsecond_ticks = ((u64)ts.tv_nsec * hz + 999999999ULL) / 1000000000ULL;
+    *ns_out = seconds * 1000000000ULL + (u64)ts->tv_nsec;
+    return 0;
+}
 
-    if (ticks > UINT64_MAX - subsecond_ticks) {
-        return -EINVAL;
+static int sys_sleep(const struct timespec *req, struct timespec *rem) {
+    sched_thread_t *thread = sched_current();
+    struct timespec ts = { 0 };
+
+    if (!user_copy_from(thread, &ts, req, sizeof(ts))) {
+        return -EFAULT;
     }
 
-    ticks += subsecond_ticks;
-    if ((ts.tv_sec || ts.tv_nsec) && !ticks) {
-        ticks = 1;
+    if (rem && !user_write_prepare(thread, rem, sizeof(*rem))) {
+        return -EFAULT;
     }
 
-    u64 start = arch_timer_ticks();
-    u64 deadline = ticks > UINT64_MAX - start ? UINT64_MAX : start + ticks;
+    u64 ns = 0;
+    int err = _timespec_to_ns(&ts, &ns);
+    if (err < 0) {
+        return err;
+    }
+
+    u64 start = arch_timer_ns();
+    u64 deadline = ns > UINT64_MAX - start ? UINT64_MAX : start + ns;
     sched_wait_result_t wait_result = SCHED_WAIT_TIMEOUT;
 
-    while (ticks && arch_timer_ticks() < deadline) {
+    while (ns && arch_timer_ns() < deadline) {
         wait_result = sched_wait_deadline(deadline, SCHED_WAIT_INTERRUPTIBLE);
 
         if (wait_result == SCHED_WAIT_INTR || wait_result == SCHED_WAIT_TIMEOUT) {
@@ -3680,12 +3825,9 @@ static int sys_sleep(const struct timespec *req, struct timespec *rem) {
 
     if (wait_result == SCHED_WAIT_INTR) {
         if (rem) {
-            u64 now = arch_timer_ticks();
-            u64 left = now < deadline ? deadline - now : 0;
-            struct timespec remaining = {
-                .tv_sec = (time_t)(left / hz),
-                .tv_nsec = (long)(((left % hz) * 1000000000ULL) / hz),
-            };
+            u64 now = arch_timer_ns();
+            struct timespec remaining = { 0 };
+            _timespec_from_ns(now < deadline ? deadline - now : 0, &remaining);
 
             if (!user_copy_to(thread, rem, &remaining, sizeof(remaining))) {
                 return -EFAULT;
@@ -3705,15 +3847,6 @@ static int sys_sleep(const struct timespec *req, struct timespec *rem) {
     return 0;
 }
 
-static void _timespec_from_ns(u64 ns, struct timespec *tp) {
-    if (!tp) {
-        return;
-    }
-
-    tp->tv_sec = (time_t)(ns / 1000000000ULL);
-    tp->tv_nsec = (long)(ns % 1000000000ULL);
-}
-
 static int sys_time(struct timespec *realtime, struct timespec *monotonic) {
     if (!realtime && !monotonic) {
         return -EINVAL;
@@ -3737,17 +3870,8 @@ static int sys_time(struct timespec *realtime, struct timespec *monotonic) {
     }
 
     if (monotonic) {
-        u64 hz = arch_timer_hz();
-        u64 ticks = arch_timer_ticks();
-        u64 ns = 0;
-
-        if (hz) {
-            ns = ticks / hz * 1000000000ULL;
-            ns += (ticks % hz) * 1000000000ULL / hz;
-        }
-
         struct timespec local = { 0 };
-        _timespec_from_ns(ns, &local);
+        _timespec_from_ns(arch_timer_ns(), &local);
         if (!user_copy_to(thread, monotonic, &local, sizeof(local))) {
             return -EFAULT;
         }
@@ -3842,12 +3966,129 @@ static u64 sys_kill(pid_t pid, int signum) {
     return status < 0 ? (u64)-ESRCH : (u64)status;
 }
 
+// returns 20 - nice so a valid priority is never mistaken for an errno
+static u64 sys_getpriority(int which, id_t who) {
+    int nice = 0;
+    int status = sched_get_nice(which, who, &nice);
+
+    if (status < 0) {
+        return (u64)status;
+    }
+
+    return (u64)(PRIO_MAX - nice);
+}
+
+static u64 sys_setpriority(int which, id_t who, int nice) {
+    return (u64)sched_set_nice(which, who, nice);
+}
+
+static u64 sys_sched_setscheduler(pid_t pid, int policy, const struct sched_param *param) {
+    sched_thread_t *thread = sched_current();
+    struct sched_param local = { 0 };
+
+    if (!param) {
+        return (u64)-EINVAL;
+    }
+
+    if (!user_copy_from(thread, &local, param, sizeof(local))) {
+        return (u64)-EFAULT;
+    }
+
+    return (u64)sched_set_policy(pid, policy, local.sched_priority);
+}
+
+static u64 sys_sched_getscheduler(pid_t pid, struct sched_param *param) {
+    sched_thread_t *thread = sched_current();
+
+    if (param && !user_write_prepare(thread, param, sizeof(*param))) {
+        return (u64)-EFAULT;
+    }
+
+    struct sched_param local = { 0 };
+    int policy = sched_get_policy(pid, &local.sched_priority);
+
+    if (policy < 0) {
+        return (u64)policy;
+    }
+
+    if (param && !user_copy_to(thread, param, &local, sizeof(local))) {
+        return (u64)-EFAULT;
+    }
+
+    return (u64)policy;
+}
+
+static pid_t sys_clone(const clone_args_t *user_args, arch_int_state_t *state) {
+    sched_thread_t *thread = sched_current();
+    clone_args_t args = { 0 };
+
+    if (!user_copy_from(thread, &args, user_args, sizeof(args))) {
+        return -EFAULT;
+    }
+
+    uintptr_t clear_tid = (uintptr_t)args.clear_tid;
+    if (!args.sp || (clear_tid & (sizeof(u32) - 1))) {
+        return -EINVAL;
+    }
+
+    sched_clone_t req = {
+        .stack_base = (uintptr_t)args.stack,
+        .stack_size = args.stack_size,
+        .sp = (uintptr_t)args.sp,
+        .clear_tid = clear_tid,
+    };
+
+    return sched_clone(state, &req);
+}
+
+static int sys_futex(u32 *uaddr, int op, u32 val, const struct timespec *timeout) {
+    sched_thread_t *thread = sched_current();
+
+    if (!thread || ((uintptr_t)uaddr & (sizeof(u32) - 1))) {
+        return -EINVAL;
+    }
+
+    if (op == FUTEX_WAKE) {
+        return sched_futex_wake(thread, uaddr, val);
+    }
+
+    if (op != FUTEX_WAIT) {
+        return -ENOSYS;
+    }
+
+    u64 deadline = 0;
+
+    if (timeout) {
+        struct timespec ts = { 0 };
+        if (!user_copy_from(thread, &ts, timeout, sizeof(ts))) {
+            return -EFAULT;
+        }
+
+        u64 ns = 0;
+        int err = _timespec_to_ns(&ts, &ns);
+        if (err < 0) {
+            return err;
+        }
+
+        // a zero timeout still checks the word, then gives up at once
+        u64 now = arch_timer_ns();
+        deadline = ns > UINT64_MAX - now ? UINT64_MAX : now + max(ns, (u64)1);
+    }
+
+    return sched_futex_wait(thread, uaddr, val, deadline);
+}
+
 static int sys_execve(const char *path, char *const argv[], char *const envp[], arch_int_state_t *state) {
     sched_thread_t *thread = sched_current();
     if (!thread) {
         return -EINVAL;
     }
 
+    // the other threads would keep running on the image exec throws away
+    if (thread->group_leader || __atomic_load_n(&thread->group_threads, __ATOMIC_ACQUIRE) > 1) {
+        return -EBUSY;
+    }
+
     char path_buf[PATH_MAX];
     int err = user_copy_string(thread, path, path_buf, sizeof(path_buf));
     if (err < 0) {
@@ -3877,6 +4118,174 @@ static int sys_execve(const char *path, char *const argv[], char *const envp[],
     return status;
 }
 
+static int _spawn_open(sched_thread_t *parent, sched_thread_t *child, const spawn_action_t *action) {
+    if (!_open_args_valid(action->oflag)) {
+        return -EINVAL;
+    }
+
+    // the path lives in the caller's memory, the child shares its cwd and creds
+    char resolved[PATH_MAX];
+    int err = _resolve_user_path(parent, action->path, resolved, sizeof(resolved));
+    if (err < 0) {
+        return err;
+    }
+
+    int fd = _open_resolved(child, resolved, action->oflag, action->mode);
+    if (fd < 0 || fd == action->fd) {
+        return fd < 0 ? fd : 0;
+    }
+
+    int ret = _dup_fd(child, fd, action->fd);
+    sched_fd_close(child, fd);
+
+    return ret < 0 ? ret : 0;
+}
+
+static int _spawn_action(sched_thread_t *parent, sched_thread_t *child, const spawn_action_t *action) {
+    if (action->fd < 0 || action->fd >= SCHED_FD_MAX) {
+        return -EBADF;
+    }
+
+    switch (action->op) {
+    case SPAWN_ACTION_OPEN:
+        return _spawn_open(parent, child, action);
+    case SPAWN_ACTION_CLOSE:
+        if (!child->fd_used[action->fd]) {
+            return -EBADF;
+        }
+
+        return sched_fd_close(child, action->fd);
+    case SPAWN_ACTION_DUP2: {
+        int ret = _dup_fd(child, action->src_fd, action->fd);
+        return ret < 0 ? ret : 0;
+    }
+    default:
+        return -EINVAL;
+    }
+}
+
+static int _spawn_actions(sched_thread_t *parent, sched_thread_t *child, const posix_spawn_file_actions_t *user_actions) {
+    if (!user_actions) {
+        return 0;
+    }
+
+    posix_spawn_file_actions_t actions = { 0 };
+    if (!user_copy_from(parent, &actions, user_actions, sizeof(actions))) {
+        return -EFAULT;
+    }
+
+    if (actions.count > SPAWN_ACTIONS_MAX) {
+        return -EINVAL;
+    }
+
+    for (size_t i = 0; i < actions.count; i++) {
+        spawn_action_t action;
+        void *slot = NULL;
+
+        if (!_user_field(actions.actions, i, sizeof(action), 0, &slot)) {
+            return -EFAULT;
+        }
+
+        if (!user_copy_from(parent, &action, slot, sizeof(action))) {
+            return -EFAULT;
+        }
+
+        int err = _spawn_action(parent, child, &action);
+        if (err < 0) {
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+static int _spawn_attr(sched_thread_t *child, const posix_spawnattr_t *attr) {
+    if (attr->flags & POSIX_SPAWN_SETPGROUP) {
+        int err = sched_setpgid(child->pid, attr->pgroup);
+        if (err < 0) {
+            return err;
+        }
+    }
+
+    if (attr->flags & POSIX_SPAWN_SETSIGDEF) {
+        for (int signum = 1; signum < NSIG; signum++) {
+            if (attr->sigdefault & (1u << (signum - 1))) {
+                child->signal_handlers[signum] = SIG_DFL;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// fork and exec in one step, the child never gets a copy of the caller's address space
+static pid_t sys_spawn(const spawn_args_t *user_args) {
+    sched_thread_t *thread = sched_current();
+    if (!thread) {
+        return -EINVAL;
+    }
+
+    spawn_args_t args = { 0 };
+    if (!user_copy_from(thread, &args, user_args, sizeof(args))) {
+        return -EFAULT;
+    }
+
+    posix_spawnattr_t attr = { 0 };
+    if (args.attr && !user_copy_from(thread, &attr, args.attr, sizeof(attr))) {
+        return -EFAULT;
+    }
+
+    char path_buf[PATH_MAX];
+    int err = user_copy_string(thread, args.path, path_buf, sizeof(path_buf));
+    if (err < 0) {
+        return err;
+    }
+
+    size_t arg_budget = EXEC_ARG_MAX;
+
+    exec_vec_t argv_copy = { 0 };
+    err = _copy_exec_vec(thread, args.argv, EXEC_MAX_ARGS, EXEC_MAX_ARG_LEN, &arg_budget, &argv_copy);
+    if (err < 0) {
+        return err;
+    }
+
+    exec_vec_t env_copy = { 0 };
+    err = _copy_exec_vec(thread, args.envp, EXEC_MAX_ENV, EXEC_MAX_ENV_LEN, &arg_budget, &env_copy);
+    if (err < 0) {
+        _free_exec_vec(&argv_copy);
+        return err;
+    }
+
+    sched_thread_t *child = sched_spawn_user(thread);
+    if (!child) {
+        err = -ENOMEM;
+        goto out;
+    }
+
+    err = _spawn_attr(child, &attr);
+    if (!err) {
+        err = _spawn_actions(thread, child, args.file_actions);
+    }
+
+    if (!err) {
+        err = user_exec(child, path_buf, argv_copy.items, env_copy.items, NULL);
+    }
+
+    if (err < 0) {
+        sched_discard_thread(child);
+        goto out;
+    }
+
+    err = child->pid;
+    sched_spawn_start(child, (attr.flags & POSIX_SPAWN_START_SUSPENDED) != 0);
+
+out:
+    _free_exec_vec(&env_copy);
+    _free_exec_vec(&argv_copy);
+
+    return err;
+}
+
 static short _pipe_poll(sched_pipe_t *pipe, bool read_end, short events) {
     if (!pipe) {
         return POLLERR;
@@ -3917,53 +4326,59 @@ static short _pipe_poll(sched_pipe_t *pipe, bool read_end, short events) {
     return revents;
 }
 
-static short _fd_poll_revents(sched_thread_t *thread, int fd, short events) {
-    if (fd < 0) {
-        return POLLNVAL;
+static short _entry_poll_revents(sched_thread_t *thread, sched_fd_t *entry, short events) {
+    sched_file_t *file = entry->file;
+
+    if (file->kind == SCHED_FD_PIPE_READ) {
+        return _pipe_poll(file->pipe, true, events);
     }
 
-    sched_fd_t *entry = NULL;
+    if (file->kind == SCHED_FD_PIPE_WRITE) {
+        return _pipe_poll(file->pipe, false, events);
+    }
 
-    if (thread && _fd_lookup(thread, fd, &entry)) {
-        sched_file_t *file = entry->file;
+    if (file->kind == SCHED_FD_VFS && file->node) {
+        size_t vfs_flags = 0;
 
-        if (file->kind == SCHED_FD_PIPE_READ) {
-            return _pipe_poll(file->pipe, true, events);
+        if (__atomic_load_n(&file->flags, __ATOMIC_ACQUIRE) & O_NONBLOCK) {
+            vfs_flags |= VFS_NONBLOCK;
         }
 
-        if (file->kind == SCHED_FD_PIPE_WRITE) {
-            return _pipe_poll(file->pipe, false, events);
+        pty_handle_t pty_handle;
+        if (_fd_pty_handle(entry, &pty_handle)) {
+            return pty_poll_handle(&pty_handle, events, (u32)vfs_flags);
         }
 
-        if (file->kind == SCHED_FD_VFS && file->node) {
-            size_t vfs_flags = 0;
+        short ws_revents = 0;
+        pid_t owner = sched_group(thread)->pid;
 
-            if (__atomic_load_n(&file->flags, __ATOMIC_ACQUIRE) & O_NONBLOCK) {
-                vfs_flags |= VFS_NONBLOCK;
-            }
+        if (ws_node_poll(file->node, owner, events, (u32)vfs_flags, &ws_revents)) {
+            return ws_revents;
+        }
 
-            pty_handle_t pty_handle;
-            if (_fd_pty_handle(entry, &pty_handle)) {
-                return pty_poll_handle(&pty_handle, events, (u32)vfs_flags);
-            }
+        short revents = vfs_poll(file->node, events, vfs_flags);
 
-            short ws_revents = 0;
-            pid_t owner = thread ? thread->pid : 0;
+        if (revents < 0) {
+            return POLLERR;
+        }
 
-            if (ws_node_poll(file->node, owner, events, (u32)vfs_flags, &ws_revents)) {
-                return ws_revents;
-            }
+        return revents;
+    }
 
-            short revents = vfs_poll(file->node, events, vfs_flags);
+    return POLLNVAL;
+}
 
-            if (revents < 0) {
-                return POLLERR;
-            }
+static short _fd_poll_revents(sched_thread_t *thread, int fd, short events) {
+    if (fd < 0) {
+        return POLLNVAL;
+    }
 
-            return revents;
-        }
+    sched_fd_t entry = { 0 };
 
-        return POLLNVAL;
+    if (thread && _fd_lookup(thread, fd, &entry)) {
+        short revents = _entry_poll_revents(thread, &entry, events);
+        sched_fd_put(&entry);
+        return revents;
     }
 
     if (fd == STDIN_FILENO || fd == STDOUT_FILENO || fd == STDERR_FILENO) {
@@ -4013,18 +4428,7 @@ static int _poll_deadline(int timeout_ms, u64 *deadline_out) {
         return 0;
     }
 
-    u32 hz = arch_timer_hz();
-    if (!hz) {
-        return -EINVAL;
-    }
-
-    u64 ticks = ((u64)timeout_ms * (u64)hz + 999ULL) / 1000ULL;
-    if (!ticks) {
-        ticks = 1;
-    }
-
-    u64 now = arch_timer_ticks();
-    *deadline_out = ticks > UINT64_MAX - now ? UINT64_MAX : now + ticks;
+    *deadline_out = arch_timer_ns() + (u64)timeout_ms * 1000000ULL;
     return 0;
 }
 
@@ -4113,7 +4517,7 @@ static int sys_poll(struct pollfd *fds, nfds_t nfds, int timeout_ms) {
             return -EINTR;
         }
 
-        if (finite_timeout && timeout_ms > 0 && arch_timer_ticks() >= deadline) {
+        if (finite_timeout && timeout_ms > 0 && arch_timer_ns() >= deadline) {
             return _finish_poll(thread, fds, pfds, nfds, 0);
         }
 
@@ -4226,7 +4630,7 @@ static bool _dispatch_io(arch_int_state_t *state, u64 num, u64 *ret) {
     }
 }
 
-static bool _dispatch_mem(arch_int_state_t *state, u64 num, u64 *ret) {
+static bool _dispatch_mem_calls(arch_int_state_t *state, u64 num, u64 *ret) {
     switch (num) {
     case SYS_MMAP:
         *ret = (u64)sys_mmap((const mmap_args_t *)arch_syscall_arg1(state));
@@ -4241,11 +4645,33 @@ static bool _dispatch_mem(arch_int_state_t *state, u64 num, u64 *ret) {
     case SYS_MUNMAP:
         *ret = (u64)sys_munmap((void *)arch_syscall_arg1(state), (size_t)arch_syscall_arg2(state));
         return true;
+    case SYS_MREMAP:
+        *ret = (u64)sys_mremap(
+            (void *)arch_syscall_arg1(state),
+            (size_t)arch_syscall_arg2(state),
+            (size_t)arch_syscall_arg3(state),
+            (int)arch_syscall_arg4(state)
+        );
+        return true;
     default:
         return false;
     }
 }
 
+static bool _dispatch_mem(arch_int_state_t *state, u64 num, u64 *ret) {
+    if (num != SYS_MMAP && num != SYS_MPROTECT && num != SYS_MUNMAP && num != SYS_MREMAP) {
+        return false;
+    }
+
+    // these rewrite the region tree without the vm lock, keep swap away meanwhile
+    sched_thread_t *thread = sched_current();
+    sched_vm_hold(thread);
+    bool handled = _dispatch_mem_calls(state, num, ret);
+    sched_vm_release(thread);
+
+    return handled;
+}
+
 static bool _dispatch_fs(arch_int_state_t *state, u64 num, u64 *ret) {
     switch (num) {
     case SYS_CHDIR:
@@ -4332,22 +4758,28 @@ static bool _dispatch_fs(arch_int_state_t *state, u64 num, u64 *ret) {
 
 static bool _dispatch_proc(arch_int_state_t *state, u64 num, u64 *ret) {
     switch (num) {
-    case SYS_EXIT: {
-        int code = (int)arch_syscall_arg1(state);
+    case SYS_EXIT:
+        sched_exit_group((int)arch_syscall_arg1(state), 0);
+    case SYS_THREAD_EXIT:
+        *ret = (u64)sched_thread_exit((int)arch_syscall_arg1(state));
+        return true;
+    case SYS_CLONE:
+        *ret = (u64)sys_clone((const clone_args_t *)arch_syscall_arg1(state), state);
+        return true;
+    case SYS_GETTID: {
         sched_thread_t *thread = sched_current();
-
-        if (thread) {
-            thread->exit_code = code;
-            thread->exit_signal = 0;
-        }
-
-        sched_exit();
-        *ret = 0;
+        *ret = thread ? (u64)thread->pid : (u64)-EINVAL;
         return true;
     }
     case SYS_FORK:
         *ret = (u64)sched_fork(state);
         return true;
+    case SYS_VFORK:
+        *ret = (u64)sched_vfork(state);
+        return true;
+    case SYS_SPAWN:
+        *ret = (u64)sys_spawn((const spawn_args_t *)arch_syscall_arg1(state));
+        return true;
     case SYS_EXECVE:
         *ret = (u64)sys_execve(
             (const char *)arch_syscall_arg1(state),
@@ -4364,6 +4796,28 @@ static bool _dispatch_proc(arch_int_state_t *state, u64 num, u64 *ret) {
     case SYS_KILL:
         *ret = sys_kill((pid_t)arch_syscall_arg1(state), (int)arch_syscall_arg2(state));
         return true;
+    case SYS_GETPRIORITY:
+        *ret = sys_getpriority((int)arch_syscall_arg1(state), (id_t)arch_syscall_arg2(state));
+        return true;
+    case SYS_SCHED_SETSCHEDULER:
+        *ret = sys_sched_setscheduler(
+            (pid_t)arch_syscall_arg1(state),
+            (int)arch_syscall_arg2(state),
+            (const struct sched_param *)arch_syscall_arg3(state)
+        );
+        return true;
+    case SYS_SCHED_GETSCHEDULER:
+        *ret = sys_sched_getscheduler((pid_t)arch_syscall_arg1(state), (struct sched_param *)arch_syscall_arg2(state));
+        return true;
+    case SYS_SCHED_YIELD:
+        sched_yield();
+        *ret = 0;
+        return true;
+    case SYS_SETPRIORITY:
+        *ret = sys_setpriority(
+            (int)arch_syscall_arg1(state), (id_t)arch_syscall_arg2(state), (int)arch_syscall_arg3(state)
+        );
+        return true;
     default:
         return false;
     }
@@ -4376,6 +4830,14 @@ static bool _dispatch_misc(arch_int_state_t *state, u64 num, u64 *ret) {
             sys_sleep((const struct timespec *)arch_syscall_arg1(state), (struct timespec *)arch_syscall_arg2(state))
         );
         return true;
+    case SYS_FUTEX:
+        *ret = (u64)sys_futex(
+            (u32 *)arch_syscall_arg1(state),
+            (int)arch_syscall_arg2(state),
+            (u32)arch_syscall_arg3(state),
+            (const struct timespec *)arch_syscall_arg4(state)
+        );
+        return true;
     case SYS_TIME: {
         struct timespec *time_now = (struct timespec *)arch_syscall_arg1(state);
         struct timespec *time_boot = (struct timespec *)arch_syscall_arg2(state);
@@ -4429,9 +4891,12 @@ static void _syscall_handler(arch_int_state_t *state) {
     sched_record_syscall();
 
     u64 num = (u64)arch_syscall_num(state);
+    trace_event(TRACE_SYSCALL_ENTER, num, 0);
+
     u64 result = _syscall_dispatch(state);
 
     syscall_count(num, result);
+    trace_event(TRACE_SYSCALL_EXIT, num, result);
 
     if (num == SYS_SIGRETURN && !result) {
         return;
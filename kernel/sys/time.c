@@ -7,17 +7,17 @@ void delay_ms(u32 ms) {
         return;
     }
 
-    u64 start = arch_timer_ticks();
-    u64 timeout = ms_to_ticks(ms);
+    u64 start = arch_timer_ns();
+    u64 timeout = ms_to_ns(ms);
 
-    while ((arch_timer_ticks() - start) < timeout) {
+    while ((arch_timer_ns() - start) < timeout) {
         if (sched_is_running() && sched_current()) {
-            u64 elapsed = arch_timer_ticks() - start;
+            u64 elapsed = arch_timer_ns() - start;
             u64 remaining = timeout > elapsed ? (timeout - elapsed) : 0;
             if (!remaining) {
                 break;
             }
-            sched_sleep(remaining);
+            sched_sleep_ns(remaining);
             continue;
         }
 
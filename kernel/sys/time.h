@@ -14,4 +14,8 @@ static inline u64 ms_to_ticks(u32 timeout_ms) {
     return ticks ? ticks : 1;
 }
 
+static inline u64 ms_to_ns(u32 timeout_ms) {
+    return (u64)timeout_ms * 1000000ULL;
+}
+
 void delay_ms(u32 ms);
@@ -0,0 +1,77 @@
+#include "tlb.h"
+
+#include <arch/mm.h>
+#include <string.h>
+
+void tlb_batch_init(tlb_batch_t *batch, arch_vm_space_t *space) {
+    memset(batch, 0, sizeof(*batch));
+    batch->space = space;
+}
+
+void tlb_batch_add(tlb_batch_t *batch, uintptr_t start, uintptr_t end) {
+    if (!batch || start >= end) {
+        return;
+    }
+
+    if (batch->start >= batch->end) {
+        batch->start = start;
+        batch->end = end;
+        return;
+    }
+
+    if (start < batch->start) {
+        batch->start = start;
+    }
+
+    if (end > batch->end) {
+        batch->end = end;
+    }
+}
+
+static void _flush(tlb_batch_t *batch) {
+    if (batch->start < batch->end) {
+        arch_tlb_flush_range(batch->space, batch->start, batch->end);
+    }
+
+    batch->start = 0;
+    batch->end = 0;
+
+    for (size_t i = 0; i < batch->free_count; i++) {
+        arch_free_frames((void *)batch->frees[i].paddr, batch->frees[i].pages);
+    }
+
+    batch->free_count = 0;
+}
+
+void tlb_batch_free(tlb_batch_t *batch, uintptr_t paddr, size_t pages) {
+    if (!batch || !paddr || !pages) {
+        return;
+    }
+
+    if (batch->free_count) {
+        tlb_batch_free_t *last = &batch->frees[batch->free_count - 1];
+
+        if (last->paddr + last->pages * PAGE_4KIB == paddr) {
+            last->pages += pages;
+            return;
+        }
+    }
+
+    // a full list forces an early flush so no frame is reused while still cached
+    if (batch->free_count == TLB_BATCH_FREES) {
+        _flush(batch);
+    }
+
+    batch->frees[batch->free_count++] = (tlb_batch_free_t){
+        .paddr = paddr,
+        .pages = pages,
+    };
+}
+
+void tlb_batch_finish(tlb_batch_t *batch) {
+    if (!batch) {
+        return;
+    }
+
+    _flush(batch);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <arch/arch.h>
+#include <base/types.h>
+#include <stddef.h>
+
+#define TLB_BATCH_FREES 16
+
+typedef struct {
+    uintptr_t paddr;
+    size_t pages;
+} tlb_batch_free_t;
+
+// gathers the invalidations of one operation so they go out as a single
+// ranged shootdown; frames unmapped on the way are only freed after it
+typedef struct {
+    arch_vm_space_t *space;
+    uintptr_t start;
+    uintptr_t end;
+
+    size_t free_count;
+    tlb_batch_free_t frees[TLB_BATCH_FREES];
+} tlb_batch_t;
+
+void tlb_batch_init(tlb_batch_t *batch, arch_vm_space_t *space);
+void tlb_batch_add(tlb_batch_t *batch, uintptr_t start, uintptr_t end);
+void tlb_batch_free(tlb_batch_t *batch, uintptr_t paddr, size_t pages);
+void tlb_batch_finish(tlb_batch_t *batch);
@@ -0,0 +1,217 @@
+#include "trace.h"
+
+#include <arch/arch.h>
+#include <base/macros.h>
+#include <errno.h>
+#include <log/log.h>
+#include <sched/scheduler.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/cpu.h>
+#include <sys/lock.h>
+
+#include "vfs.h"
+
+// each cpu only ever writes its own ring with interrupts off, so a slot has a
+// single writer. The slot sequence is cleared while the record is rewritten
+// and set to its index + 1 after, which lets a reader on another cpu drop a
+// slot it raced with instead of locking the writer out
+typedef struct {
+    u64 seq;
+    trace_record_t record;
+} trace_slot_t;
+
+typedef struct {
+    u64 head;
+    // the head when tracing last started, older slots belong to a past run
+    u64 start;
+    trace_slot_t slots[TRACE_RING_RECORDS];
+} trace_ring_t;
+
+typedef struct {
+    mutex_t lock;
+    trace_ring_t *rings[MAX_CORES];
+} trace_state_t;
+
+static trace_state_t trace = {
+    .lock = MUTEX_INIT,
+};
+
+volatile u32 trace_enabled = 0;
+
+static size_t _cpu_count(void) {
+    return min(core_count, (size_t)MAX_CORES);
+}
+
+void trace_record(u16 event, u64 arg0, u64 arg1) {
+    unsigned long flags = arch_irq_save();
+    size_t cpu_id = lock_cpu_id();
+    trace_ring_t *ring = __atomic_load_n(&trace.rings[cpu_id], __ATOMIC_ACQUIRE);
+
+    if (!ring) {
+        arch_irq_restore(flags);
+        return;
+    }
+
+    sched_thread_t *current = sched_current();
+    u64 index = ring->head;
+    trace_slot_t *slot = &ring->slots[index & (TRACE_RING_RECORDS - 1)];
+
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->record.ts_ns = arch_timer_ns();
+    slot->record.arg0 = arg0;
+    slot->record.arg1 = arg1;
+    slot->record.pid = current ? (u32)current->pid : 0;
+    slot->record.event = event;
+    slot->record.cpu = (u16)cpu_id;
+
+    __atomic_store_n(&slot->seq, index + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->head, index + 1, __ATOMIC_RELEASE);
+
+    arch_irq_restore(flags);
+}
+
+bool trace_start(void) {
+    mutex_lock(&trace.lock);
+
+    size_t ncpu = _cpu_count();
+
+    for (size_t cpu = 0; cpu < ncpu; cpu++) {
+        if (trace.rings[cpu]) {
+            continue;
+        }
+
+        trace_ring_t *ring = calloc(1, sizeof(*ring));
+        if (!ring) {
+            mutex_unlock(&trace.lock);
+            log_warn("no memory for the cpu %zu trace ring", cpu);
+            return false;
+        }
+
+        __atomic_store_n(&trace.rings[cpu], ring, __ATOMIC_RELEASE);
+    }
+
+    // the head only moves forward, so a writer still finishing a record from
+    // the last run can never pull it back under the new start
+    for (size_t cpu = 0; cpu < ncpu; cpu++) {
+        trace_ring_t *ring = trace.rings[cpu];
+        __atomic_store_n(&ring->start, __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+    }
+
+    __atomic_store_n(&trace_enabled, 1, __ATOMIC_RELEASE);
+    mutex_unlock(&trace.lock);
+
+    log_debug("tracing started on %zu cpus", ncpu);
+    return true;
+}
+
+void trace_stop(void) {
+    __atomic_store_n(&trace_enabled, 0, __ATOMIC_RELEASE);
+}
+
+bool trace_running(void) {
+    return __atomic_load_n(&trace_enabled, __ATOMIC_ACQUIRE) != 0;
+}
+
+static u64 _ring_first(const trace_ring_t *ring, u64 head) {
+    u64 start = __atomic_load_n(&ring->start, __ATOMIC_ACQUIRE);
+    u64 first = head > TRACE_RING_RECORDS ? head - TRACE_RING_RECORDS : 0;
+
+    return max(first, start);
+}
+
+// a slot overwritten or mid write while it was copied reads back as event 0
+static void _read_slot(const trace_ring_t *ring, u64 index, trace_record_t *out) {
+    const trace_slot_t *slot = &ring->slots[index & (TRACE_RING_RECORDS - 1)];
+
+    u64 seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    *out = slot->record;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if (seq != index + 1 || __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+        memset(out, 0, sizeof(*out));
+    }
+}
+
+ssize_t trace_dump(void *buf, size_t offset, size_t len) {
+    if (!buf) {
+        return -EINVAL;
+    }
+
+    size_t ncpu = _cpu_count();
+    u64 heads[MAX_CORES] = { 0 };
+    u64 total = 0;
+
+    for (size_t cpu = 0; cpu < ncpu; cpu++) {
+        trace_ring_t *ring = __atomic_load_n(&trace.rings[cpu], __ATOMIC_ACQUIRE);
+
+        if (ring) {
+            heads[cpu] = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+            total += heads[cpu] - _ring_first(ring, heads[cpu]);
+        }
+    }
+
+    trace_header_t header = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .record_size = sizeof(trace_record_t),
+        .cpus = (u32)ncpu,
+        .records = (u32)total,
+    };
+
+    size_t size = sizeof(header) + total * sizeof(trace_record_t);
+    if (offset >= size) {
+        return VFS_EOF;
+    }
+
+    len = min(len, size - offset);
+
+    u8 *out = buf;
+    size_t done = 0;
+
+    if (offset < sizeof(header)) {
+        done = min(len, sizeof(header) - offset);
+        memcpy(out, (u8 *)&header + offset, done);
+    }
+
+    // records are numbered across the rings in cpu order
+    size_t cpu = 0;
+    u64 base = 0;
+
+    while (done < len) {
+        u64 pos = offset + done - sizeof(header);
+        u64 nth = pos / sizeof(trace_record_t);
+        size_t skip = pos % sizeof(trace_record_t);
+
+        trace_ring_t *ring = NULL;
+        u64 first = 0;
+        u64 count = 0;
+
+        for (; cpu < ncpu; cpu++) {
+            ring = trace.rings[cpu];
+            first = ring ? _ring_first(ring, heads[cpu]) : 0;
+            count = ring ? heads[cpu] - first : 0;
+
+            if (nth < base + count) {
+                break;
+            }
+
+            base += count;
+        }
+
+        if (cpu >= ncpu) {
+            break;
+        }
+
+        trace_record_t record;
+        _read_slot(ring, first + (nth - base), &record);
+
+        size_t chunk = min(sizeof(record) - skip, len - done);
+        memcpy(out + done, (u8 *)&record + skip, chunk);
+        done += chunk;
+    }
+
+    return (ssize_t)done;
+}
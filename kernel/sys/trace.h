@@ -0,0 +1,62 @@
+#pragma once
+
+#include <base/attributes.h>
+#include <base/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// records per cpu, a power of two; the rings are only allocated the first
+// time tracing is switched on
+#define TRACE_RING_RECORDS 4096
+
+#define TRACE_MAGIC   0x43525441 // "ATRC"
+#define TRACE_VERSION 1
+
+typedef enum {
+    TRACE_SCHED_SWITCH = 1, // arg0 = previous pid, arg1 = next pid
+    TRACE_SCHED_WAKE,       // arg0 = woken pid
+    TRACE_SYSCALL_ENTER,    // arg0 = syscall number
+    TRACE_SYSCALL_EXIT,     // arg0 = syscall number, arg1 = result
+    TRACE_IRQ,              // arg0 = vector or cause
+    TRACE_DISK_SUBMIT,      // arg0 = disk id, arg1 = bytes, negative for writes
+    TRACE_DISK_COMPLETE,    // arg0 = disk id, arg1 = result
+} trace_event_t;
+
+// /proc/trace is this header and then the records of each cpu oldest first
+typedef struct PACKED {
+    u32 magic;
+    u16 version;
+    u16 record_size;
+    u32 cpus;
+    u32 records;
+} trace_header_t;
+
+typedef struct PACKED {
+    u64 ts_ns;
+    u64 arg0;
+    u64 arg1;
+    u32 pid;
+    u16 event;
+    u16 cpu;
+} trace_record_t;
+
+// checked inline at every tracepoint, so a disabled one costs a load and a
+// branch that is never taken
+extern volatile u32 trace_enabled;
+
+void trace_record(u16 event, u64 arg0, u64 arg1);
+
+static inline void trace_event(trace_event_t event, u64 arg0, u64 arg1) {
+    if (__builtin_expect(__atomic_load_n(&trace_enabled, __ATOMIC_RELAXED) != 0, 0)) {
+        trace_record((u16)event, arg0, arg1);
+    }
+}
+
+// a start drops what the rings held and a dump is only consistent once stopped
+bool trace_start(void);
+void trace_stop(void);
+bool trace_running(void);
+
+// reads the header and records at `offset` as one flat file, VFS_EOF past the end
+ssize_t trace_dump(void *buf, size_t offset, size_t len);
@@ -395,15 +395,8 @@ static ssize_t _input_read_raw(size_t screen, ring_buffer_t *buffer, void *buf,
     size_t total = 0;
     bool timer_started = false;
     u64 timer_start = 0;
-    u64 timeout_ticks = 0;
-
-    if (vtime) {
-        u32 hz = arch_timer_hz();
-        timeout_ticks = ((u64)vtime * (u64)hz + 9) / 10;
-        if (!timeout_ticks) {
-            timeout_ticks = 1;
-        }
-    }
+    // VTIME counts tenths of a second
+    u64 timeout_ns = (u64)vtime * 100000000ULL;
 
     for (;;) {
 
@@ -416,9 +409,9 @@ static ssize_t _input_read_raw(size_t screen, ring_buffer_t *buffer, void *buf,
         if (popped) {
             total += popped;
 
-            if (!timer_started && timeout_ticks) {
+            if (!timer_started && timeout_ns) {
                 timer_started = true;
-                timer_start = arch_timer_ticks();
+                timer_start = arch_timer_ns();
             }
 
             if (!vmin) {
@@ -430,15 +423,15 @@ static ssize_t _input_read_raw(size_t screen, ring_buffer_t *buffer, void *buf,
             }
         }
 
-        if (timer_started && timeout_ticks) {
-            u64 now = arch_timer_ticks();
+        if (timer_started && timeout_ns) {
+            u64 now = arch_timer_ns();
 
-            if (now - timer_start >= timeout_ticks) {
+            if (now - timer_start >= timeout_ns) {
                 return (ssize_t)total;
             }
-        } else if (!vmin && timeout_ticks) {
+        } else if (!vmin && timeout_ns) {
             timer_started = true;
-            timer_start = arch_timer_ticks();
+            timer_start = arch_timer_ns();
         }
 
         if (!sched_is_running()) {
@@ -456,9 +449,9 @@ static ssize_t _input_read_raw(size_t screen, ring_buffer_t *buffer, void *buf,
             continue;
         }
 
-        if (timer_started && timeout_ticks) {
-            u64 deadline_tick = timer_start + timeout_ticks;
-            sched_wait_result_t wait_result = _wait_input_until(screen, wait_seq, deadline_tick);
+        if (timer_started && timeout_ns) {
+            u64 deadline_ns = timer_start + timeout_ns;
+            sched_wait_result_t wait_result = _wait_input_until(screen, wait_seq, deadline_ns);
 
             if (wait_result == SCHED_WAIT_TIMEOUT) {
                 return (ssize_t)total;
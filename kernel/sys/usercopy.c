@@ -9,28 +9,30 @@
 #include <stdint.h>
 #include <string.h>
 
-static bool user_page_ok(const sched_thread_t *thread, uintptr_t addr, bool write) {
-    if (!thread || !thread->vm_space) {
-        return false;
-    }
+// the region tree says what may be touched, the copies themselves find out what is mapped:
+// a missing page faults into the exception table and a cow page is broken by the fault handler
+static bool _regions_allow(const sched_thread_t *thread, uintptr_t start, uintptr_t end, bool write) {
+    uintptr_t cursor = start;
+    while (cursor < end) {
+        const sched_user_region_t *match = sched_region_find(thread, cursor);
+        if (!match || match->pages > SIZE_MAX / PAGE_4KIB) {
+            return false;
+        }
 
-    void *root = arch_vm_root(thread->vm_space);
-    if (!root) {
-        return false;
-    }
+        uintptr_t match_end = match->vaddr + match->pages * PAGE_4KIB;
+        if (match_end <= match->vaddr) {
+            return false;
+        }
 
-    page_t *entry = NULL;
-    size_t size = arch_get_page(root, addr, &entry);
-    // page tables are checked after the region list so stale metadata cannot authorize access
-    bool present = entry && size && (*entry & PT_PRESENT);
-    bool user = entry && (*entry & PT_USER);
+        if (!(match->flags & PT_USER)) {
+            return false;
+        }
 
-    if (!present || !user) {
-        return false;
-    }
+        if (write && !(match->flags & PT_WRITE)) {
+            return false;
+        }
 
-    if (write && !(*entry & PT_WRITE)) {
-        return false;
+        cursor = match_end < end ? match_end : end;
     }
 
     return true;
@@ -53,83 +55,18 @@ bool user_range_ok(const sched_thread_t *thread, const void *ptr, size_t len, bo
         return false;
     }
 
-    uintptr_t cursor = start;
-    while (cursor < end) {
-        const sched_user_region_t *match = NULL;
-        uintptr_t match_end = 0;
-
-        // the region list says what should exist; the PTEs say what exists now
-        for (const sched_user_region_t *region = thread->regions; region; region = region->next) {
-            uintptr_t region_start = region->vaddr;
-            if (region->pages > SIZE_MAX / PAGE_4KIB) {
-                return false;
-            }
-
-            uintptr_t region_size = region->pages * PAGE_4KIB;
-            uintptr_t region_end = region_start + region_size;
-
-            if (region_end <= region_start) {
-                return false;
-            }
-
-            if (cursor >= region_start && cursor < region_end) {
-                match = region;
-                match_end = region_end;
-                break;
-            }
-        }
-
-        if (!match || !(match->flags & PT_USER)) {
-            return false;
-        }
-
-        if (write && !(match->flags & PT_WRITE)) {
-            return false;
-        }
-
-        uintptr_t segment_end = match_end < end ? match_end : end;
-        bool require_write = write && !(match->flags & SCHED_REGION_COW);
+    // another thread of the group may be rewriting the region tree
+    sched_thread_t *holder = (sched_thread_t *)thread;
+    sched_vm_hold(holder);
+    bool ok = _regions_allow(thread, start, end, write);
+    sched_vm_release(holder);
 
-        // cow pages are fine for reads; writes fault them private first
-        for (uintptr_t page = ALIGN_DOWN(cursor, PAGE_4KIB); page < segment_end; page += PAGE_4KIB) {
-            if (!user_page_ok(thread, page, require_write)) {
-                return false;
-            }
-        }
-
-        cursor = segment_end;
-    }
-
-    return true;
+    return ok;
 }
 
 bool user_write_prepare(const sched_thread_t *thread, void *ptr, size_t len) {
-    if (!user_range_ok(thread, ptr, len, true)) {
-        return false;
-    }
-
-    if (!len) {
-        return true;
-    }
-
-    uintptr_t start = ALIGN_DOWN((uintptr_t)ptr, PAGE_4KIB);
-    uintptr_t end = (uintptr_t)ptr + len;
-
-    for (uintptr_t page = start; page < end; page += PAGE_4KIB) {
-        if (user_page_ok(thread, page, true)) {
-            continue;
-        }
-
-        if (!sched_handle_cow_fault((sched_thread_t *)thread, page, true)) {
-            return false;
-        }
-
-        if (!user_page_ok(thread, page, true)) {
-            return false;
-        }
-    }
-
-    return true;
+    // write faults on cow pages are resolved when they happen, nothing to pre-fault
+    return user_range_ok(thread, ptr, len, true);
 }
 
 bool user_copy_from(const sched_thread_t *thread, void *dst, const void *src, size_t len) {
@@ -141,8 +78,7 @@ bool user_copy_from(const sched_thread_t *thread, void *dst, const void *src, si
         return false;
     }
 
-    memcpy(dst, src, len);
-    return true;
+    return !arch_copy_user(dst, src, len);
 }
 
 bool user_copy_to(const sched_thread_t *thread, void *dst, const void *src, size_t len) {
@@ -150,12 +86,11 @@ bool user_copy_to(const sched_thread_t *thread, void *dst, const void *src, size
         return true;
     }
 
-    if (!src || !user_write_prepare(thread, dst, len)) {
+    if (!src || !user_range_ok(thread, dst, len, true)) {
         return false;
     }
 
-    memcpy(dst, src, len);
-    return true;
+    return !arch_copy_user(dst, src, len);
 }
 
 int user_copy_string(const sched_thread_t *thread, const char *src, char *dst, size_t dst_len) {
@@ -163,16 +98,25 @@ int user_copy_string(const sched_thread_t *thread, const char *src, char *dst, s
         return -EFAULT;
     }
 
-    for (size_t i = 0; i < dst_len; i++) {
-        const char *user_ch = (const char *)((uintptr_t)src + i);
-        if (!user_range_ok(thread, user_ch, 1, false)) {
+    size_t copied = 0;
+    while (copied < dst_len) {
+        uintptr_t addr = (uintptr_t)src + copied;
+
+        // never read past the page holding the terminator, the next one may not exist
+        size_t chunk = PAGE_4KIB - (addr & (PAGE_4KIB - 1));
+        if (chunk > dst_len - copied) {
+            chunk = dst_len - copied;
+        }
+
+        if (!user_copy_from(thread, dst + copied, (const void *)addr, chunk)) {
             return -EFAULT;
         }
 
-        dst[i] = *user_ch;
-        if (!dst[i]) {
+        if (memchr(dst + copied, '\0', chunk)) {
             return 0;
         }
+
+        copied += chunk;
     }
 
     dst[dst_len - 1] = '\0';
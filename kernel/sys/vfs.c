@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/lock.h>
+#include <sys/slab.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -36,6 +37,8 @@ struct vfs {
 
 static vfs_t *vfs = NULL;
 
+static kmem_cache_t vfs_node_cache = KMEM_CACHE_INIT("vfs_node", sizeof(vfs_node_t), 16);
+
 // symlink resolution and path walking recurse into each other
 static vfs_node_t *_walk_from_locked(vfs_node_t *from, const char *path, size_t *depth);
 
@@ -376,7 +379,7 @@ static void _free_node_data(vfs_node_t *node) {
         free(node->symlink_target);
     }
 
-    free(node);
+    kmem_cache_free(&vfs_node_cache, node);
 }
 
 static bool _free_tree_node(tree_node_t *node) {
@@ -958,7 +961,7 @@ vfs_t *vfs_init(void) {
 }
 
 vfs_node_t *vfs_create_node(char *name, u32 type) {
-    vfs_node_t *node = calloc(1, sizeof(vfs_node_t));
+    vfs_node_t *node = kmem_cache_zalloc(&vfs_node_cache);
 
     if (!node) {
         return NULL;
@@ -967,7 +970,7 @@ vfs_node_t *vfs_create_node(char *name, u32 type) {
     node->type = type;
     node->tree_entry = tree_create_node(node);
     if (!node->tree_entry) {
-        free(node);
+        kmem_cache_free(&vfs_node_cache, node);
         return NULL;
     }
 
@@ -980,7 +983,7 @@ vfs_node_t *vfs_create_node(char *name, u32 type) {
         node->name = strdup(name);
         if (!node->name) {
             tree_destroy_node(node->tree_entry);
-            free(node);
+            kmem_cache_free(&vfs_node_cache, node);
             return NULL;
         }
     }
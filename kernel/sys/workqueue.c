@@ -0,0 +1,451 @@
+#include "workqueue.h"
+
+#include <arch/arch.h>
+#include <base/macros.h>
+#include <log/log.h>
+#include <sched/scheduler.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/cpu.h>
+#include <sys/lock.h>
+#include <sys/panic.h>
+#include <sys/time.h>
+
+// every pool lock is a leaf: wakes and thread creation only happen after it
+// is dropped, so queueing is safe under any other lock
+
+typedef struct work_pool work_pool_t;
+
+typedef struct {
+    sched_thread_t *thread;
+    work_pool_t *pool;
+    work_t *volatile current;
+} work_worker_t;
+
+struct work_pool {
+    spinlock_t lock;
+    linked_list_t items;
+    sched_wait_queue_t wait;
+    work_worker_t workers[WORK_UNBOUND_MAX_WORKERS];
+    size_t nr_workers;
+    size_t nr_idle;
+    size_t max_workers;
+    size_t cpu;
+};
+
+typedef struct {
+    work_pool_t bound[MAX_CORES];
+    work_pool_t unbound;
+    // delayed items wait here unordered, there are rarely more than a few
+    work_pool_t timers;
+
+    sched_wait_queue_t manager_wait;
+    sched_wait_queue_t done_wait;
+    sched_thread_t *manager;
+} workqueue_state_t;
+
+static workqueue_state_t wq = {
+    .unbound = { .lock = SPINLOCK_INIT, .cpu = WORK_CPU_UNBOUND },
+    .timers = { .lock = SPINLOCK_INIT, .cpu = WORK_CPU_UNBOUND },
+};
+
+static work_pool_t *_pool_for(size_t cpu_id) {
+    if (cpu_id < MAX_CORES && cpu_id < core_count && cores_local[cpu_id].online) {
+        return &wq.bound[cpu_id];
+    }
+
+    return &wq.unbound;
+}
+
+static void _manager_kick(void) {
+    sched_wake_one(&wq.manager_wait);
+}
+
+static void _pool_insert(work_pool_t *pool, work_t *work) {
+    unsigned long flags = spin_lock_irqsave(&pool->lock);
+
+    work->node.data = work;
+    list_append(&pool->items, &work->node);
+    __atomic_store_n(&work->pool, pool, __ATOMIC_RELEASE);
+
+    bool idle = pool->nr_idle > 0;
+    spin_unlock_irqrestore(&pool->lock, flags);
+
+    // the wake path takes the scheduler lock, so spinlock holders leave it
+    // to the manager's next pass
+    if (pool == &wq.timers || lock_spin_held()) {
+        return;
+    }
+
+    if (idle) {
+        sched_wake_one(&pool->wait);
+    } else {
+        _manager_kick();
+    }
+}
+
+void work_init(work_t *work, work_fn_t fn) {
+    if (!work) {
+        return;
+    }
+
+    memset(work, 0, sizeof(*work));
+    work->fn = fn;
+    work->cpu = WORK_CPU_UNBOUND;
+}
+
+// interrupts stay off between claiming the item and queueing it, so a cancel
+// from an interrupt on this cpu never spins on a half queued item
+bool work_queue_on(work_t *work, size_t cpu_id) {
+    if (!work || !work->fn) {
+        return false;
+    }
+
+    unsigned long flags = arch_irq_save();
+
+    if (__atomic_exchange_n(&work->pending, 1, __ATOMIC_ACQ_REL)) {
+        arch_irq_restore(flags);
+        return false;
+    }
+
+    work->cpu = cpu_id;
+    _pool_insert(_pool_for(cpu_id), work);
+
+    arch_irq_restore(flags);
+    return true;
+}
+
+bool work_queue(work_t *work) {
+    return work_queue_on(work, WORK_CPU_UNBOUND);
+}
+
+bool work_queue_delayed(work_t *work, size_t cpu_id, u64 delay_ns) {
+    if (!delay_ns) {
+        return work_queue_on(work, cpu_id);
+    }
+
+    if (!work || !work->fn) {
+        return false;
+    }
+
+    unsigned long flags = arch_irq_save();
+
+    if (__atomic_exchange_n(&work->pending, 1, __ATOMIC_ACQ_REL)) {
+        arch_irq_restore(flags);
+        return false;
+    }
+
+    work->cpu = cpu_id;
+    work->due_ns = arch_timer_ns() + delay_ns;
+    _pool_insert(&wq.timers, work);
+
+    arch_irq_restore(flags);
+
+    if (!lock_spin_held()) {
+        _manager_kick();
+    }
+
+    return true;
+}
+
+bool work_pending(const work_t *work) {
+    return work && __atomic_load_n(&work->pending, __ATOMIC_ACQUIRE);
+}
+
+static bool _work_running(const work_t *work) {
+    size_t ncpu = min(core_count, (size_t)MAX_CORES);
+
+    for (size_t cpu = 0; cpu <= ncpu; cpu++) {
+        const work_pool_t *pool = cpu < ncpu ? &wq.bound[cpu] : &wq.unbound;
+        size_t workers = __atomic_load_n(&pool->nr_workers, __ATOMIC_ACQUIRE);
+
+        for (size_t i = 0; i < workers; i++) {
+            if (__atomic_load_n(&pool->workers[i].current, __ATOMIC_ACQUIRE) == work) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool work_cancel(work_t *work) {
+    if (!work) {
+        return false;
+    }
+
+    for (;;) {
+        if (!work_pending(work)) {
+            return false;
+        }
+
+        // pending without a pool only while another cpu moves it between queues
+        work_pool_t *pool = __atomic_load_n(&work->pool, __ATOMIC_ACQUIRE);
+        if (!pool) {
+            arch_cpu_relax();
+            continue;
+        }
+
+        unsigned long flags = spin_lock_irqsave(&pool->lock);
+        bool removed = work->node.owner == &pool->items && list_remove(&pool->items, &work->node);
+
+        if (removed) {
+            __atomic_store_n(&work->pool, NULL, __ATOMIC_RELEASE);
+            __atomic_store_n(&work->pending, 0, __ATOMIC_RELEASE);
+        }
+
+        spin_unlock_irqrestore(&pool->lock, flags);
+
+        if (removed) {
+            return true;
+        }
+    }
+}
+
+static void _wait_idle(work_t *work, bool pending_too) {
+    for (;;) {
+        u32 seq = sched_wait_seq(&wq.done_wait);
+
+        if (!(pending_too && work_pending(work)) && !_work_running(work)) {
+            return;
+        }
+
+        sched_wait_on(&wq.done_wait, seq, 0, 0);
+    }
+}
+
+bool work_cancel_sync(work_t *work) {
+    bool removed = work_cancel(work);
+
+    if (work) {
+        _wait_idle(work, false);
+    }
+
+    return removed;
+}
+
+void work_flush(work_t *work) {
+    if (work) {
+        _wait_idle(work, true);
+    }
+}
+
+static void _worker_entry(void *arg) {
+    work_worker_t *worker = arg;
+    work_pool_t *pool = worker->pool;
+
+    for (;;) {
+        u32 seq = sched_wait_seq(&pool->wait);
+        unsigned long flags = spin_lock_irqsave(&pool->lock);
+
+        list_node_t *node = list_pop_front(&pool->items);
+        work_t *work = node ? node->data : NULL;
+
+        if (work) {
+            // current is set first so a flush never sees it neither pending nor
+            // running, pending is cleared before the callback so it can requeue
+            __atomic_store_n(&work->pool, NULL, __ATOMIC_RELEASE);
+            __atomic_store_n(&worker->current, work, __ATOMIC_RELEASE);
+            __atomic_store_n(&work->pending, 0, __ATOMIC_RELEASE);
+        } else {
+            pool->nr_idle++;
+        }
+
+        spin_unlock_irqrestore(&pool->lock, flags);
+
+        if (!work) {
+            sched_wait_on(&pool->wait, seq, 0, 0);
+
+            flags = spin_lock_irqsave(&pool->lock);
+            pool->nr_idle--;
+            spin_unlock_irqrestore(&pool->lock, flags);
+            continue;
+        }
+
+        work->fn(work);
+
+        __atomic_store_n(&worker->current, NULL, __ATOMIC_RELEASE);
+        sched_wake_all(&wq.done_wait);
+    }
+}
+
+static void _spawn_worker(work_pool_t *pool) {
+    unsigned long flags = spin_lock_irqsave(&pool->lock);
+
+    if (pool->nr_workers >= pool->max_workers) {
+        spin_unlock_irqrestore(&pool->lock, flags);
+        return;
+    }
+
+    work_worker_t *worker = &pool->workers[pool->nr_workers];
+    worker->pool = pool;
+    worker->thread = NULL;
+    worker->current = NULL;
+
+    size_t index = pool->nr_workers++;
+    spin_unlock_irqrestore(&pool->lock, flags);
+
+    char name[32];
+    sched_thread_t *thread = NULL;
+
+    if (pool->cpu == WORK_CPU_UNBOUND) {
+        snprintf(name, sizeof(name), "kworker/u%zu", index);
+        thread = sched_spawn_kernel(name, _worker_entry, worker);
+    } else {
+        snprintf(name, sizeof(name), "kworker/%zu:%zu", pool->cpu, index);
+        thread = sched_spawn_kernel_on(name, _worker_entry, worker, pool->cpu);
+    }
+
+    flags = spin_lock_irqsave(&pool->lock);
+
+    // only the manager spawns, so the slot is still the last one
+    if (thread) {
+        worker->thread = thread;
+    } else {
+        pool->nr_workers--;
+    }
+
+    spin_unlock_irqrestore(&pool->lock, flags);
+
+    if (!thread) {
+        log_warn("failed to create worker %s", name);
+        return;
+    }
+
+    sched_make_runnable(thread);
+}
+
+// an unbound pool grows whenever work waits with no idle worker; a bound one
+// only when every worker it has is blocked inside a callback, since a running
+// worker gets to the backlog by itself and more would only contend for its cpu
+static void _manage_pool(work_pool_t *pool) {
+    unsigned long flags = spin_lock_irqsave(&pool->lock);
+
+    size_t backlog = pool->items.length;
+    size_t idle = pool->nr_idle;
+    size_t workers = pool->nr_workers;
+    bool all_blocked = true;
+
+    for (size_t i = 0; i < workers; i++) {
+        sched_thread_t *thread = pool->workers[i].thread;
+        bool blocked = thread && pool->workers[i].current && thread->state == THREAD_SLEEPING;
+
+        all_blocked &= blocked;
+    }
+
+    spin_unlock_irqrestore(&pool->lock, flags);
+
+    if (!backlog) {
+        return;
+    }
+
+    // a wake skipped under a spinlock is made up here
+    if (idle) {
+        sched_wake_one(&pool->wait);
+        return;
+    }
+
+    if (!workers || pool->cpu == WORK_CPU_UNBOUND || all_blocked) {
+        _spawn_worker(pool);
+    }
+}
+
+// moves due items to their pools and returns when the next one is due, or 0
+static u64 _run_timers(u64 now_ns) {
+    for (;;) {
+        unsigned long irq = arch_irq_save();
+        unsigned long flags = spin_lock_irqsave(&wq.timers.lock);
+
+        work_t *due = NULL;
+        u64 next_ns = 0;
+
+        ll_foreach(node, &wq.timers.items) {
+            work_t *work = node->data;
+
+            if (work->due_ns <= now_ns) {
+                due = work;
+                break;
+            }
+
+            next_ns = next_ns ? min(next_ns, work->due_ns) : work->due_ns;
+        }
+
+        if (due) {
+            list_remove(&wq.timers.items, &due->node);
+            __atomic_store_n(&due->pool, NULL, __ATOMIC_RELEASE);
+        }
+
+        spin_unlock_irqrestore(&wq.timers.lock, flags);
+
+        if (due) {
+            _pool_insert(_pool_for(due->cpu), due);
+        }
+
+        arch_irq_restore(irq);
+
+        if (!due) {
+            return next_ns;
+        }
+    }
+}
+
+static void _manager_entry(void *arg) {
+    (void)arg;
+
+    for (;;) {
+        if (!sched_is_running()) {
+            arch_cpu_wait();
+            continue;
+        }
+
+        u32 seq = sched_wait_seq(&wq.manager_wait);
+        u64 next_due = _run_timers(arch_timer_ns());
+        size_t ncpu = min(core_count, (size_t)MAX_CORES);
+
+        for (size_t cpu = 0; cpu < ncpu; cpu++) {
+            if (cores_local[cpu].online) {
+                _manage_pool(&wq.bound[cpu]);
+            }
+        }
+
+        _manage_pool(&wq.unbound);
+
+        u64 deadline = arch_timer_ns() + ms_to_ns(WORK_MANAGER_PERIOD_MS);
+        if (next_due && next_due < deadline) {
+            deadline = next_due;
+        }
+
+        sched_wait_on(&wq.manager_wait, seq, deadline, 0);
+    }
+}
+
+void workqueue_init(void) {
+    if (wq.manager) {
+        return;
+    }
+
+    for (size_t cpu = 0; cpu < MAX_CORES; cpu++) {
+        work_pool_t *pool = &wq.bound[cpu];
+
+        sched_waitq_init(&pool->wait);
+        pool->max_workers = WORK_BOUND_MAX_WORKERS;
+        pool->cpu = cpu;
+    }
+
+    sched_waitq_init(&wq.unbound.wait);
+    wq.unbound.max_workers = WORK_UNBOUND_MAX_WORKERS;
+
+    sched_waitq_init(&wq.manager_wait);
+    sched_waitq_init(&wq.done_wait);
+
+    // the first worker comes before the manager, which is the only spawner after it
+    _spawn_worker(&wq.unbound);
+
+    wq.manager = sched_spawn_kernel("kworkerd", _manager_entry, NULL);
+    if (!wq.manager) {
+        panic("failed to create the workqueue manager");
+    }
+
+    sched_make_runnable(wq.manager);
+}
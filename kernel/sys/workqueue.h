@@ -0,0 +1,58 @@
+#pragma once
+
+#include <base/types.h>
+#include <data/list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/config.h>
+
+// work queued with this cpu goes to the unbound pool, whose workers run anywhere
+#define WORK_CPU_UNBOUND MAX_CORES
+
+// a bound pool only grows past one worker while all of its workers are blocked
+#define WORK_BOUND_MAX_WORKERS 4
+
+// the unbound pool grows whenever work waits and no worker is idle
+#define WORK_UNBOUND_MAX_WORKERS 8
+
+// the manager rechecks backlogs this often, which covers work queued by
+// callers holding a spinlock since those cannot wake a worker themselves
+#define WORK_MANAGER_PERIOD_MS 50
+
+typedef struct work work_t;
+typedef void (*work_fn_t)(work_t *work);
+
+// embed one in the object the work is about and get back to it from the
+// callback. An item is queued at most once at a time; it is off its queue
+// before the callback runs, so the callback may queue it again or free it
+struct work {
+    list_node_t node;
+    work_fn_t fn;
+    void *pool;
+    size_t cpu;
+    u64 due_ns;
+    volatile u8 pending;
+};
+
+void work_init(work_t *work, work_fn_t fn);
+
+// all return false when the item was already pending, which leaves it as it was
+bool work_queue(work_t *work);
+bool work_queue_on(work_t *work, size_t cpu_id);
+bool work_queue_delayed(work_t *work, size_t cpu_id, u64 delay_ns);
+
+bool work_pending(const work_t *work);
+
+// takes a pending item off its queue and reports whether it did, a callback
+// already running is left to finish
+bool work_cancel(work_t *work);
+
+// the same, and then waits out a running callback; not from the callback itself
+bool work_cancel_sync(work_t *work);
+
+// waits until the item is neither pending nor running
+void work_flush(work_t *work);
+
+// starts the manager and the unbound pool, needs the scheduler. Work queued
+// earlier waits until then, bound workers start as their cpus come online
+void workqueue_init(void);
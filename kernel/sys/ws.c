@@ -19,6 +19,7 @@
 #include <sys/lock.h>
 #include <sys/time.h>
 #include <sys/usercopy.h>
+#include <sys/workqueue.h>
 
 #define WS_DEV_UID 0U
 #define WS_DEV_GID 46U
@@ -84,7 +85,7 @@ typedef struct {
     vfs_interface_t *wsmgr_if;
     vfs_interface_t *ws_fb_if;
     vfs_interface_t *ws_ev_if;
-    sched_thread_t *reaper_thread;
+    work_t reaper_work;
     mutex_t lock;
 } ws_state_t;
 
@@ -1459,51 +1460,30 @@ static bool _ws_state_init(void) {
     return true;
 }
 
-static void _ws_reaper_entry(void *arg) {
-    (void)arg;
+// queued by every exit event, an event pushed while this runs queues it again
+static void _ws_reap_work(UNUSED work_t *work) {
+    bool handled = false;
+    pid_t exited_pid = 0;
 
-    for (;;) {
-        bool handled = false;
-        pid_t exited_pid = 0;
-
-        while (sched_exit_event_pop(&exited_pid)) {
-            mutex_lock(&ws_state.lock);
-            reap_pid_locked(exited_pid);
-            mutex_unlock(&ws_state.lock);
-            handled = true;
-        }
-
-        if (handled) {
-            flush_wakes();
-            continue;
-        }
-
-        if (!sched_is_running()) {
-            arch_cpu_wait();
-            continue;
-        }
-
-        u32 wait_seq = sched_exit_event_seq();
-        if (sched_exit_event_pop(&exited_pid)) {
-            continue;
-        }
+    while (sched_exit_event_pop(&exited_pid)) {
+        mutex_lock(&ws_state.lock);
+        reap_pid_locked(exited_pid);
+        mutex_unlock(&ws_state.lock);
+        handled = true;
+    }
 
-        sched_exit_wait_change(wait_seq);
+    if (handled) {
+        flush_wakes();
     }
 }
 
 static void _ws_start_reaper(void) {
-    if (ws_state.reaper_thread) {
-        return;
-    }
-
-    ws_state.reaper_thread = sched_spawn_kernel("ws-reaper", _ws_reaper_entry, NULL);
-    if (!ws_state.reaper_thread) {
-        log_warn("failed to create reaper thread");
+    if (ws_state.reaper_work.fn) {
         return;
     }
 
-    sched_make_runnable(ws_state.reaper_thread);
+    work_init(&ws_state.reaper_work, _ws_reap_work);
+    sched_exit_event_notify(&ws_state.reaper_work);
 }
 
 static sched_wait_queue_t *wsmgr_wait(vfs_node_t *node, short events, u32 flags) {
@@ -0,0 +1,262 @@
+#include "zpool.h"
+
+#include <arch/arch.h>
+#include <arch/mm.h>
+#include <sys/config.h>
+#include <sys/lock.h>
+#include <sys/reclaim.h>
+
+#define ZPOOL_PAGES 32
+#define ZPOOL_RUNS  2
+
+// refilling stops while less than 1/ZPOOL_MIN_FREE_DIV of memory is free
+#define ZPOOL_MIN_FREE_DIV 8
+
+typedef struct {
+    spinlock_t lock;
+    size_t page_count;
+    size_t run_count;
+    uintptr_t pages[ZPOOL_PAGES];
+    uintptr_t runs[ZPOOL_RUNS];
+} zpool_cpu_t;
+
+typedef struct {
+    bool ready;
+    zpool_cpu_t cpus[MAX_CORES];
+} zpool_state_t;
+
+static zpool_state_t zpool = { 0 };
+
+static size_t _cpu_id(void) {
+    size_t cpu_id = 0;
+    if (!arch_current_cpu_id(&cpu_id) || cpu_id >= MAX_CORES) {
+        return 0;
+    }
+
+    return cpu_id;
+}
+
+static size_t _shrink_count(void *ctx) {
+    (void)ctx;
+    size_t pages = 0;
+
+    for (size_t i = 0; i < MAX_CORES; i++) {
+        zpool_cpu_t *pool = &zpool.cpus[i];
+
+        pages += __atomic_load_n(&pool->page_count, __ATOMIC_RELAXED);
+        pages += __atomic_load_n(&pool->run_count, __ATOMIC_RELAXED) * ZPOOL_RUN_PAGES;
+    }
+
+    return pages;
+}
+
+// zeroing is cheap to redo, so the pool is the first thing reclaim empties
+static size_t _shrink_scan(void *ctx, size_t pages) {
+    (void)ctx;
+    size_t freed = 0;
+
+    for (size_t i = 0; i < MAX_CORES && freed < pages; i++) {
+        zpool_cpu_t *pool = &zpool.cpus[i];
+
+        while (freed < pages) {
+            uintptr_t paddr = 0;
+            size_t count = 0;
+
+            unsigned long flags = arch_irq_save();
+            if (!spin_try_lock(&pool->lock)) {
+                arch_irq_restore(flags);
+                break;
+            }
+
+            if (pool->run_count) {
+                paddr = pool->runs[--pool->run_count];
+                count = ZPOOL_RUN_PAGES;
+            } else if (pool->page_count) {
+                paddr = pool->pages[--pool->page_count];
+                count = 1;
+            }
+
+            spin_unlock_irqrestore(&pool->lock, flags);
+
+            if (!count) {
+                break;
+            }
+
+            arch_free_frames((void *)paddr, count);
+            freed += count;
+        }
+    }
+
+    return freed;
+}
+
+static reclaim_shrinker_t zpool_shrinker = {
+    .name = "zpool",
+    .count = _shrink_count,
+    .scan = _shrink_scan,
+};
+
+void zpool_init(void) {
+    for (size_t i = 0; i < MAX_CORES; i++) {
+        zpool.cpus[i].lock = (spinlock_t)SPINLOCK_INIT;
+    }
+
+    __atomic_store_n(&zpool.ready, true, __ATOMIC_RELEASE);
+    reclaim_register(&zpool_shrinker);
+}
+
+static uintptr_t _take(zpool_cpu_t *pool, size_t pages) {
+    bool has_page = __atomic_load_n(&pool->page_count, __ATOMIC_RELAXED) != 0;
+    bool has_run = __atomic_load_n(&pool->run_count, __ATOMIC_RELAXED) != 0;
+
+    if (!(pages == 1 && has_page) && !has_run) {
+        return 0;
+    }
+
+    uintptr_t paddr = 0;
+    uintptr_t spare = 0;
+    size_t spare_pages = 0;
+    unsigned long flags = spin_lock_irqsave(&pool->lock);
+
+    if (pages == 1 && pool->page_count) {
+        paddr = pool->pages[--pool->page_count];
+    } else if (pool->run_count) {
+        paddr = pool->runs[--pool->run_count];
+
+        // the rest of the run is still zeroed, park what fits as single pages
+        size_t next = pages;
+        while (next < ZPOOL_RUN_PAGES && pool->page_count < ZPOOL_PAGES) {
+            pool->pages[pool->page_count++] = paddr + next * PAGE_4KIB;
+            next++;
+        }
+
+        spare = paddr + next * PAGE_4KIB;
+        spare_pages = ZPOOL_RUN_PAGES - next;
+    }
+
+    spin_unlock_irqrestore(&pool->lock, flags);
+
+    if (spare_pages) {
+        arch_free_frames((void *)spare, spare_pages);
+    }
+
+    return paddr;
+}
+
+uintptr_t zpool_alloc(size_t pages) {
+    if (!pages || pages > ZPOOL_RUN_PAGES || !__atomic_load_n(&zpool.ready, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    size_t self = _cpu_id();
+
+    // the local pool first, then whatever other idle CPUs prepared
+    for (size_t i = 0; i < MAX_CORES; i++) {
+        uintptr_t paddr = _take(&zpool.cpus[(self + i) % MAX_CORES], pages);
+
+        if (paddr) {
+            return paddr;
+        }
+    }
+
+    return 0;
+}
+
+static bool _zero_frames(uintptr_t paddr, size_t pages) {
+    size_t size = pages * PAGE_4KIB;
+
+    void *dst = arch_phys_map(paddr, size, 0);
+    if (!dst) {
+        return false;
+    }
+
+    arch_clear_pages(dst, pages);
+    arch_phys_unmap(dst, size);
+
+    return true;
+}
+
+static bool _memory_tight(void) {
+    return pmm_free_mem() < pmm_total_mem() / ZPOOL_MIN_FREE_DIV;
+}
+
+bool zpool_refill(void) {
+    if (!__atomic_load_n(&zpool.ready, __ATOMIC_ACQUIRE) || _memory_tight()) {
+        return false;
+    }
+
+    zpool_cpu_t *pool = &zpool.cpus[_cpu_id()];
+    size_t page_count = __atomic_load_n(&pool->page_count, __ATOMIC_RELAXED);
+    size_t run_count = __atomic_load_n(&pool->run_count, __ATOMIC_RELAXED);
+
+    // single pages are the common case, keep at least half of them ready before runs
+    bool want_run = run_count < ZPOOL_RUNS && page_count >= ZPOOL_PAGES / 2;
+    bool want_page = page_count < ZPOOL_PAGES;
+
+    if (!want_run && !want_page) {
+        return false;
+    }
+
+    size_t pages = want_run ? ZPOOL_RUN_PAGES : 1;
+
+    uintptr_t paddr = (uintptr_t)arch_alloc_frames_user(pages);
+    if (!paddr) {
+        return false;
+    }
+
+    if (!_zero_frames(paddr, pages)) {
+        arch_free_frames((void *)paddr, pages);
+        return false;
+    }
+
+    bool stored = false;
+    unsigned long flags = spin_lock_irqsave(&pool->lock);
+
+    if (want_run && pool->run_count < ZPOOL_RUNS) {
+        pool->runs[pool->run_count++] = paddr;
+        stored = true;
+    } else if (!want_run && pool->page_count < ZPOOL_PAGES) {
+        pool->pages[pool->page_count++] = paddr;
+        stored = true;
+    }
+
+    spin_unlock_irqrestore(&pool->lock, flags);
+
+    if (!stored) {
+        arch_free_frames((void *)paddr, pages);
+    }
+
+    return stored;
+}
+
+void zpool_drain(void) {
+    if (!__atomic_load_n(&zpool.ready, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    for (size_t i = 0; i < MAX_CORES; i++) {
+        zpool_cpu_t *pool = &zpool.cpus[i];
+
+        for (;;) {
+            uintptr_t paddr = 0;
+            size_t pages = 0;
+            unsigned long flags = spin_lock_irqsave(&pool->lock);
+
+            if (pool->run_count) {
+                paddr = pool->runs[--pool->run_count];
+                pages = ZPOOL_RUN_PAGES;
+            } else if (pool->page_count) {
+                paddr = pool->pages[--pool->page_count];
+                pages = 1;
+            }
+
+            spin_unlock_irqrestore(&pool->lock, flags);
+
+            if (!pages) {
+                break;
+            }
+
+            arch_free_frames((void *)paddr, pages);
+        }
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <base/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// pages kept in one pre-zeroed run, enough for a default user stack
+#define ZPOOL_RUN_PAGES 64
+
+void zpool_init(void);
+
+// zeroed user frames for up to ZPOOL_RUN_PAGES pages, 0 when the pool is dry
+uintptr_t zpool_alloc(size_t pages);
+
+// zero one more page or run for the local CPU, false once there's nothing to do
+bool zpool_refill(void);
+
+// give every pooled frame back to the frame allocator
+void zpool_drain(void);
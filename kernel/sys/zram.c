@@ -0,0 +1,763 @@
+#include "zram.h"
+
+#include <arch/arch.h>
+#include <arch/mm.h>
+#include <arch/paging.h>
+#include <base/attributes.h>
+#include <base/macros.h>
+#include <libc_ext/string.h>
+#include <log/log.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/config.h>
+#include <sys/disk.h>
+#include <sys/lock.h>
+
+#define ZRAM_SECTOR_SIZE 512
+
+// compressed pages are packed into frames split into equal chunks, one class
+// per chunk count. A page that does not fit a half frame keeps a frame of its own
+#define ZRAM_CHUNKS_MIN   2
+#define ZRAM_CHUNKS_MAX   16
+#define ZRAM_CLASSES      (ZRAM_CHUNKS_MAX - ZRAM_CHUNKS_MIN + 1)
+#define ZRAM_ZPAGE_HEADER 32
+
+#define LZ4_HASH_BITS     12
+#define LZ4_MIN_MATCH     4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MATCH_LIMIT   12
+
+enum {
+    ZRAM_EMPTY = 0, // reads back as zeros
+    ZRAM_SAME,      // every word equals `data`
+    ZRAM_CHUNK,     // lz4 block in the chunk at `data`
+    ZRAM_RAW,       // stored as is in the frame at `data`
+};
+
+enum {
+    ZRAM_FREE = 0,
+    ZRAM_OWNER_DISK,
+    ZRAM_OWNER_SWAP,
+};
+
+typedef struct {
+    u64 data;
+    u16 size;
+    u16 refs;
+    u8 kind;
+    u8 owner;
+} zram_slot_t;
+
+// lives at the start of every chunked frame, frames with free chunks are
+// linked per class by physical address
+typedef struct {
+    u64 prev;
+    u64 next;
+    u16 cls;
+    u16 used;
+    u16 free_mask;
+} zram_zpage_t;
+
+typedef struct {
+    spinlock_t lock;
+    zram_slot_t *slots;
+    size_t slot_count;
+    size_t free_slots;
+    size_t cursor;
+    u64 partial[ZRAM_CLASSES];
+
+    // scratch for the page being stored or loaded, guarded by the lock
+    u8 page[PAGE_4KIB] ALIGNED(8);
+    u8 buf[PAGE_4KIB] ALIGNED(8);
+    u16 hash[1 << LZ4_HASH_BITS];
+
+    disk_dev_t disk;
+} zram_state_t;
+
+static zram_state_t zram = {
+    .lock = SPINLOCK_INIT,
+};
+
+static u32 _read32(const u8 *ptr) {
+    u32 value = 0;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+static size_t _hash32(u32 value) {
+    return (value * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+static u8 *_put_length(u8 *out, size_t len) {
+    while (len >= 255) {
+        *out++ = 255;
+        len -= 255;
+    }
+
+    *out++ = (u8)len;
+    return out;
+}
+
+// bytes a sequence may take at most, checked before it is written
+static size_t _sequence_bound(size_t literals, size_t match) {
+    return 1 + literals / 255 + 1 + literals + 2 + match / 255 + 1;
+}
+
+static u8 *_put_sequence(u8 *out, const u8 *literals, size_t literal_len, size_t offset, size_t match_len) {
+    u8 *token = out++;
+
+    *token = (u8)(min(literal_len, (size_t)15) << 4);
+    if (literal_len >= 15) {
+        out = _put_length(out, literal_len - 15);
+    }
+
+    memcpy(out, literals, literal_len);
+    out += literal_len;
+
+    // the closing sequence carries literals only
+    if (!offset) {
+        return out;
+    }
+
+    *out++ = (u8)offset;
+    *out++ = (u8)(offset >> 8);
+
+    *token |= (u8)min(match_len, (size_t)15);
+    if (match_len >= 15) {
+        out = _put_length(out, match_len - 15);
+    }
+
+    return out;
+}
+
+// lz4 block format, returns the compressed size or 0 when it would exceed `cap`
+static size_t _lz4_compress(const u8 *src, size_t len, u8 *dst, size_t cap) {
+    const u8 *ip = src;
+    const u8 *anchor = src;
+    const u8 *end = src + len;
+    u8 *op = dst;
+    u8 *op_end = dst + cap;
+
+    memset(zram.hash, 0, sizeof(zram.hash));
+
+    if (len >= LZ4_MATCH_LIMIT) {
+        const u8 *match_limit = end - LZ4_MATCH_LIMIT;
+        const u8 *copy_limit = end - LZ4_LAST_LITERALS;
+
+        ip++;
+
+        while (ip < match_limit) {
+            size_t h = _hash32(_read32(ip));
+            const u8 *ref = src + zram.hash[h];
+            zram.hash[h] = (u16)(ip - src);
+
+            if (ref >= ip || _read32(ref) != _read32(ip)) {
+                ip++;
+                continue;
+            }
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+
+            const u8 *match_end = ip + LZ4_MIN_MATCH;
+            const u8 *ref_end = ref + LZ4_MIN_MATCH;
+            while (match_end < copy_limit && *match_end == *ref_end) {
+                match_end++;
+                ref_end++;
+            }
+
+            size_t literal_len = (size_t)(ip - anchor);
+            size_t match_len = (size_t)(match_end - ip) - LZ4_MIN_MATCH;
+
+            if (_sequence_bound(literal_len, match_len) > (size_t)(op_end - op)) {
+                return 0;
+            }
+
+            op = _put_sequence(op, anchor, literal_len, (size_t)(ip - ref), match_len);
+            ip = match_end;
+            anchor = ip;
+        }
+    }
+
+    size_t literal_len = (size_t)(end - anchor);
+    if (_sequence_bound(literal_len, 0) > (size_t)(op_end - op)) {
+        return 0;
+    }
+
+    op = _put_sequence(op, anchor, literal_len, 0, 0);
+    return (size_t)(op - dst);
+}
+
+static bool _get_length(const u8 **ip, const u8 *end, size_t *len) {
+    u8 byte = 255;
+
+    while (byte == 255) {
+        if (*ip >= end) {
+            return false;
+        }
+
+        byte = *(*ip)++;
+        *len += byte;
+    }
+
+    return true;
+}
+
+// rejects anything that would read or write out of bounds, the input is trusted
+// only as far as it was written by _lz4_compress
+static bool _lz4_decompress(const u8 *src, size_t len, u8 *dst, size_t cap) {
+    const u8 *ip = src;
+    const u8 *end = src + len;
+    u8 *op = dst;
+    u8 *op_end = dst + cap;
+
+    while (ip < end) {
+        u8 token = *ip++;
+        size_t literal_len = token >> 4;
+
+        if (literal_len == 15 && !_get_length(&ip, end, &literal_len)) {
+            return false;
+        }
+
+        if (literal_len > (size_t)(end - ip) || literal_len > (size_t)(op_end - op)) {
+            return false;
+        }
+
+        memcpy(op, ip, literal_len);
+        op += literal_len;
+        ip += literal_len;
+
+        if (ip >= end) {
+            break;
+        }
+
+        if (end - ip < 2) {
+            return false;
+        }
+
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+
+        size_t match_len = token & 15;
+        if (match_len == 15 && !_get_length(&ip, end, &match_len)) {
+            return false;
+        }
+
+        match_len += LZ4_MIN_MATCH;
+
+        if (!offset || offset > (size_t)(op - dst) || match_len > (size_t)(op_end - op)) {
+            return false;
+        }
+
+        // matches may overlap their own output, so copy forwards a byte at a time
+        const u8 *ref = op - offset;
+        while (match_len--) {
+            *op++ = *ref++;
+        }
+    }
+
+    return op == op_end;
+}
+
+static bool _same_filled(const u8 *page, u64 *fill) {
+    const u64 *words = (const u64 *)page;
+    size_t count = PAGE_4KIB / sizeof(u64);
+
+    for (size_t i = 1; i < count; i++) {
+        if (words[i] != words[0]) {
+            return false;
+        }
+    }
+
+    *fill = words[0];
+    return true;
+}
+
+// the physical window maps one range at a time, so frames are only ever
+// touched through these copies
+static bool _phys_read(u64 paddr, void *dst, size_t len) {
+    void *src = arch_phys_map(paddr, len, 0);
+    if (!src) {
+        return false;
+    }
+
+    memcpy(dst, src, len);
+    arch_phys_unmap(src, len);
+    return true;
+}
+
+static bool _phys_write(u64 paddr, const void *src, size_t len) {
+    void *dst = arch_phys_map(paddr, len, 0);
+    if (!dst) {
+        return false;
+    }
+
+    memcpy(dst, src, len);
+    arch_phys_unmap(dst, len);
+    return true;
+}
+
+static size_t _class_size(size_t cls) {
+    return ((PAGE_4KIB - ZRAM_ZPAGE_HEADER) / (ZRAM_CHUNKS_MIN + cls)) & ~(size_t)7;
+}
+
+// the smallest chunk that holds `size` bytes, ZRAM_CLASSES when none does
+static size_t _class_for(size_t size) {
+    for (size_t cls = ZRAM_CLASSES; cls-- > 0;) {
+        if (_class_size(cls) >= size) {
+            return cls;
+        }
+    }
+
+    return ZRAM_CLASSES;
+}
+
+static u64 _chunk_paddr(u64 addr, size_t cls) {
+    u64 zpage = ALIGN_DOWN(addr, (u64)PAGE_4KIB);
+    return zpage + ZRAM_ZPAGE_HEADER + (addr - zpage) * _class_size(cls);
+}
+
+static void _partial_push(size_t cls, u64 paddr, zram_zpage_t *hdr) {
+    u64 head = zram.partial[cls];
+    zram_zpage_t next;
+
+    hdr->prev = 0;
+    hdr->next = head;
+
+    if (head && _phys_read(head, &next, sizeof(next))) {
+        next.prev = paddr;
+        _phys_write(head, &next, sizeof(next));
+    }
+
+    zram.partial[cls] = paddr;
+}
+
+static void _partial_unlink(size_t cls, zram_zpage_t *hdr) {
+    zram_zpage_t other;
+
+    if (!hdr->prev) {
+        zram.partial[cls] = hdr->next;
+    } else if (_phys_read(hdr->prev, &other, sizeof(other))) {
+        other.next = hdr->next;
+        _phys_write(hdr->prev, &other, sizeof(other));
+    }
+
+    if (hdr->next && _phys_read(hdr->next, &other, sizeof(other))) {
+        other.prev = hdr->prev;
+        _phys_write(hdr->next, &other, sizeof(other));
+    }
+
+    hdr->prev = 0;
+    hdr->next = 0;
+}
+
+// frames come straight from the frame allocator without reclaiming, stores
+// run from reclaim and a failure only means the page stays where it is
+static u64 _chunk_alloc(size_t cls) {
+    zram_zpage_t hdr;
+    u64 zpage = zram.partial[cls];
+
+    if (zpage) {
+        if (!_phys_read(zpage, &hdr, sizeof(hdr))) {
+            return 0;
+        }
+    } else {
+        zpage = (u64)(uintptr_t)arch_alloc_frames_try(1);
+        if (!zpage) {
+            return 0;
+        }
+
+        hdr = (zram_zpage_t){
+            .cls = (u16)cls,
+            .free_mask = (u16)((1U << (ZRAM_CHUNKS_MIN + cls)) - 1),
+        };
+
+        _partial_push(cls, zpage, &hdr);
+    }
+
+    size_t chunk = (size_t)__builtin_ctz(hdr.free_mask);
+    hdr.free_mask &= (u16)~(1U << chunk);
+    hdr.used++;
+
+    if (!hdr.free_mask) {
+        _partial_unlink(cls, &hdr);
+    }
+
+    _phys_write(zpage, &hdr, sizeof(hdr));
+    return zpage | chunk;
+}
+
+static void _chunk_free(u64 addr) {
+    u64 zpage = ALIGN_DOWN(addr, (u64)PAGE_4KIB);
+    zram_zpage_t hdr;
+
+    if (!_phys_read(zpage, &hdr, sizeof(hdr))) {
+        return;
+    }
+
+    bool was_full = !hdr.free_mask;
+    hdr.free_mask |= (u16)(1U << (addr - zpage));
+    hdr.used--;
+
+    if (!hdr.used) {
+        if (!was_full) {
+            _partial_unlink(hdr.cls, &hdr);
+        }
+
+        arch_free_frames((void *)(uintptr_t)zpage, 1);
+        return;
+    }
+
+    if (was_full) {
+        _partial_push(hdr.cls, zpage, &hdr);
+    }
+
+    _phys_write(zpage, &hdr, sizeof(hdr));
+}
+
+static void _slot_drop_data(zram_slot_t *slot) {
+    if (slot->kind == ZRAM_CHUNK) {
+        _chunk_free(slot->data);
+    } else if (slot->kind == ZRAM_RAW) {
+        arch_free_frames((void *)(uintptr_t)slot->data, 1);
+    }
+
+    slot->kind = ZRAM_EMPTY;
+    slot->data = 0;
+    slot->size = 0;
+}
+
+static void _slot_release(zram_slot_t *slot) {
+    _slot_drop_data(slot);
+
+    slot->owner = ZRAM_FREE;
+    slot->refs = 0;
+    zram.free_slots++;
+}
+
+// replaces what the slot holds with zram.page, caller holds the lock
+static bool _store(zram_slot_t *slot) {
+    _slot_drop_data(slot);
+
+    u64 fill = 0;
+    if (_same_filled(zram.page, &fill)) {
+        slot->kind = ZRAM_SAME;
+        slot->data = fill;
+        return true;
+    }
+
+    size_t size = _lz4_compress(zram.page, PAGE_4KIB, zram.buf, _class_size(0));
+    size_t cls = size ? _class_for(size) : ZRAM_CLASSES;
+
+    if (cls < ZRAM_CLASSES) {
+        u64 addr = _chunk_alloc(cls);
+        if (!addr) {
+            return false;
+        }
+
+        _phys_write(_chunk_paddr(addr, cls), zram.buf, size);
+
+        slot->kind = ZRAM_CHUNK;
+        slot->data = addr;
+        slot->size = (u16)size;
+        return true;
+    }
+
+    u64 frame = (u64)(uintptr_t)arch_alloc_frames_try(1);
+    if (!frame) {
+        return false;
+    }
+
+    _phys_write(frame, zram.page, PAGE_4KIB);
+
+    slot->kind = ZRAM_RAW;
+    slot->data = frame;
+    slot->size = PAGE_4KIB;
+    return true;
+}
+
+// fills zram.page from the slot, caller holds the lock
+static bool _load(const zram_slot_t *slot) {
+    switch (slot->kind) {
+    case ZRAM_EMPTY:
+        memset(zram.page, 0, PAGE_4KIB);
+        return true;
+    case ZRAM_SAME: {
+        u64 *words = (u64 *)zram.page;
+
+        for (size_t i = 0; i < PAGE_4KIB / sizeof(u64); i++) {
+            words[i] = slot->data;
+        }
+
+        return true;
+    }
+    case ZRAM_RAW:
+        return _phys_read(slot->data, zram.page, PAGE_4KIB);
+    case ZRAM_CHUNK: {
+        u64 paddr = _chunk_paddr(slot->data, _class_for(slot->size));
+
+        if (!_phys_read(paddr, zram.buf, slot->size)) {
+            return false;
+        }
+
+        return _lz4_decompress(zram.buf, slot->size, zram.page, PAGE_4KIB);
+    }
+    default:
+        return false;
+    }
+}
+
+static bool _swap_slot(size_t slot) {
+    return slot && slot < zram.slot_count && zram.slots[slot].owner == ZRAM_OWNER_SWAP;
+}
+
+size_t zram_free_slots(void) {
+    return __atomic_load_n(&zram.free_slots, __ATOMIC_RELAXED);
+}
+
+bool zram_slot_alloc(size_t count, size_t *first_out) {
+    if (!count || !first_out) {
+        return false;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&zram.lock);
+
+    if (count > zram.free_slots) {
+        spin_unlock_irqrestore(&zram.lock, flags);
+        return false;
+    }
+
+    // first fit from where the last run ended, wrapping around once
+    size_t run = 0;
+    size_t found = 0;
+
+    for (size_t scanned = 0; scanned < zram.slot_count && !found; scanned++) {
+        size_t index = zram.cursor + scanned;
+        if (index >= zram.slot_count) {
+            index -= zram.slot_count - 1;
+        }
+
+        // a run may not wrap past the end of the table
+        if (index == 1) {
+            run = 0;
+        }
+
+        run = zram.slots[index].owner == ZRAM_FREE ? run + 1 : 0;
+
+        if (run == count) {
+            found = index + 1 - count;
+        }
+    }
+
+    if (!found) {
+        spin_unlock_irqrestore(&zram.lock, flags);
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        zram_slot_t *slot = &zram.slots[found + i];
+
+        slot->owner = ZRAM_OWNER_SWAP;
+        slot->refs = 1;
+    }
+
+    zram.free_slots -= count;
+    zram.cursor = found + count < zram.slot_count ? found + count : 1;
+
+    spin_unlock_irqrestore(&zram.lock, flags);
+
+    *first_out = found;
+    return true;
+}
+
+void zram_slot_get(size_t first, size_t count) {
+    unsigned long flags = spin_lock_irqsave(&zram.lock);
+
+    for (size_t i = 0; i < count; i++) {
+        if (_swap_slot(first + i)) {
+            zram.slots[first + i].refs++;
+        }
+    }
+
+    spin_unlock_irqrestore(&zram.lock, flags);
+}
+
+void zram_slot_put(size_t first, size_t count) {
+    unsigned long flags = spin_lock_irqsave(&zram.lock);
+
+    for (size_t i = 0; i < count; i++) {
+        if (!_swap_slot(first + i)) {
+            continue;
+        }
+
+        zram_slot_t *slot = &zram.slots[first + i];
+        if (!--slot->refs) {
+            _slot_release(slot);
+        }
+    }
+
+    spin_unlock_irqrestore(&zram.lock, flags);
+}
+
+bool zram_store(size_t slot, uintptr_t paddr) {
+    unsigned long flags = spin_lock_irqsave(&zram.lock);
+
+    bool stored = _swap_slot(slot) && _phys_read(paddr, zram.page, PAGE_4KIB) && _store(&zram.slots[slot]);
+
+    spin_unlock_irqrestore(&zram.lock, flags);
+    return stored;
+}
+
+bool zram_load(size_t slot, uintptr_t paddr) {
+    unsigned long flags = spin_lock_irqsave(&zram.lock);
+
+    bool loaded = _swap_slot(slot) && _load(&zram.slots[slot]) && _phys_write(paddr, zram.page, PAGE_4KIB);
+
+    spin_unlock_irqrestore(&zram.lock, flags);
+    return loaded;
+}
+
+// disk offsets start at slot 1, buffers may be user memory and fault, so they
+// are only touched through a bounce page with the lock dropped
+static bool _disk_span(size_t pos, size_t left, size_t *slot, size_t *in_page, size_t *chunk) {
+    *slot = pos / PAGE_4KIB + 1;
+    *in_page = pos % PAGE_4KIB;
+    *chunk = min(PAGE_4KIB - *in_page, left);
+
+    return *slot < zram.slot_count;
+}
+
+static ssize_t _disk_read(disk_dev_t *dev, void *dest, size_t offset, size_t bytes) {
+    (void)dev;
+
+    u8 *bounce = malloc(PAGE_4KIB);
+    if (!bounce) {
+        return -1;
+    }
+
+    size_t done = 0;
+    while (done < bytes) {
+        size_t slot = 0;
+        size_t in_page = 0;
+        size_t chunk = 0;
+
+        if (!_disk_span(offset + done, bytes - done, &slot, &in_page, &chunk)) {
+            break;
+        }
+
+        unsigned long flags = spin_lock_irqsave(&zram.lock);
+
+        // pages lent to swap belong to some process and never leave through the disk
+        bool ok = zram.slots[slot].owner != ZRAM_OWNER_SWAP && _load(&zram.slots[slot]);
+        if (ok) {
+            memcpy(bounce, zram.page + in_page, chunk);
+        }
+
+        spin_unlock_irqrestore(&zram.lock, flags);
+
+        if (!ok) {
+            free(bounce);
+            return -1;
+        }
+
+        memcpy((u8 *)dest + done, bounce, chunk);
+        done += chunk;
+    }
+
+    free(bounce);
+    return (ssize_t)done;
+}
+
+static ssize_t _disk_write(disk_dev_t *dev, void *src, size_t offset, size_t bytes) {
+    (void)dev;
+
+    u8 *bounce = malloc(PAGE_4KIB);
+    if (!bounce) {
+        return -1;
+    }
+
+    size_t done = 0;
+    while (done < bytes) {
+        size_t slot_index = 0;
+        size_t in_page = 0;
+        size_t chunk = 0;
+
+        if (!_disk_span(offset + done, bytes - done, &slot_index, &in_page, &chunk)) {
+            break;
+        }
+
+        memcpy(bounce, (const u8 *)src + done, chunk);
+
+        unsigned long flags = spin_lock_irqsave(&zram.lock);
+        zram_slot_t *slot = &zram.slots[slot_index];
+
+        bool ok = slot->owner != ZRAM_OWNER_SWAP && _load(slot);
+        if (ok) {
+            memcpy(zram.page + in_page, bounce, chunk);
+
+            if (slot->owner == ZRAM_FREE) {
+                slot->owner = ZRAM_OWNER_DISK;
+                zram.free_slots--;
+            }
+
+            ok = _store(slot);
+
+            // a zeroed page is the same as a never written one, give it back to swap
+            if (ok && slot->kind == ZRAM_SAME && !slot->data) {
+                _slot_release(slot);
+            }
+        }
+
+        spin_unlock_irqrestore(&zram.lock, flags);
+
+        if (!ok) {
+            free(bounce);
+            return done ? (ssize_t)done : -1;
+        }
+
+        done += chunk;
+    }
+
+    free(bounce);
+    return (ssize_t)done;
+}
+
+void zram_init(void) {
+    size_t pages = pmm_total_mem() / PAGE_4KIB / ZRAM_DISK_DIV;
+    if (pages < 2) {
+        return;
+    }
+
+    zram_slot_t *slots = calloc(pages, sizeof(*slots));
+    if (!slots) {
+        log_warn("no memory for %zu zram slots", pages);
+        return;
+    }
+
+    static disk_interface_t interface = {
+        .read = _disk_read,
+        .write = _disk_write,
+    };
+
+    unsigned long flags = spin_lock_irqsave(&zram.lock);
+    zram.slots = slots;
+    zram.slot_count = pages;
+    zram.free_slots = pages - 1;
+    zram.cursor = 1;
+    spin_unlock_irqrestore(&zram.lock, flags);
+
+    disk_dev_t *disk = &zram.disk;
+    disk->name = strdup("zram0");
+    disk->type = DISK_VIRTUAL;
+    disk->sector_size = ZRAM_SECTOR_SIZE;
+    disk->sector_count = (pages - 1) * (PAGE_4KIB / ZRAM_SECTOR_SIZE);
+    disk->interface = &interface;
+
+    if (!disk->name || !disk_register(disk)) {
+        log_warn("failed to register zram disk, swap only");
+    }
+
+    log_debug("zram holds %zu pages", pages - 1);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <base/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// compressed ram disk. Its page slots are shared between the block device and
+// swap: a slot written through the disk belongs to the disk, one reserved with
+// zram_slot_alloc belongs to swap until its last reference is put. Slot 0 is
+// never handed out, so a swapped region's slot base is never 0
+
+// sizes the slot table and registers the zram0 disk, needs the heap and disk layer
+void zram_init(void);
+
+// slots swap could still reserve, 0 before init
+size_t zram_free_slots(void);
+
+// reserve `count` consecutive free slots for swap, each with one reference
+bool zram_slot_alloc(size_t count, size_t *first_out);
+void zram_slot_get(size_t first, size_t count);
+void zram_slot_put(size_t first, size_t count);
+
+// compress the frame at paddr into a reserved slot, or fill the frame back from it
+bool zram_store(size_t slot, uintptr_t paddr);
+bool zram_load(size_t slot, uintptr_t paddr);
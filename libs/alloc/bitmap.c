@@ -193,6 +193,71 @@ void *bitmap_alloc_high(bitmap_allocator_t *alloc, size_t blocks) {
     return bitmap_alloc_to_ptr(alloc, first_block);
 }
 
+// returns the first set block in [block, block + blocks), or block + blocks when the run is free;
+// a word at a time, so a 2 MiB candidate costs 16 loads rather than 512 bit tests
+static size_t _first_used(bitmap_allocator_t *alloc, size_t block, size_t blocks) {
+    size_t end = block + blocks;
+
+    while (block < end) {
+        size_t bit = block % BITMAP_WORD_SIZE;
+        size_t span = BITMAP_WORD_SIZE - bit;
+
+        if (span > end - block) {
+            span = end - block;
+        }
+
+        bitmap_word_t bits = alloc->bitmap[block / BITMAP_WORD_SIZE] >> bit;
+
+        if (span < BITMAP_WORD_SIZE) {
+            bits &= ((bitmap_word_t)1U << span) - 1U;
+        }
+
+        if (bits) {
+            return block + (size_t)__builtin_ctz(bits);
+        }
+
+        block += span;
+    }
+
+    return end;
+}
+
+void *bitmap_alloc_aligned(bitmap_allocator_t *alloc, size_t blocks, size_t align) {
+    if (!alloc || !blocks || blocks > alloc->free_blocks) {
+        return NULL;
+    }
+
+    if (align <= alloc->block_size) {
+        return bitmap_alloc_reserve(alloc, blocks);
+    }
+
+    // the alignment applies to the returned address, not to the block index
+    uintptr_t start = (uintptr_t)alloc->chunk_start;
+    uintptr_t first = ALIGN(start, align);
+
+    if (first < start) {
+        return NULL;
+    }
+
+    size_t step = align / alloc->block_size;
+    size_t block = (first - start) / alloc->block_size;
+
+    while (block < alloc->block_count && blocks <= alloc->block_count - block) {
+        size_t used = _first_used(alloc, block, blocks);
+
+        if (used == block + blocks) {
+            bitmap_set_region(alloc->bitmap, block, blocks);
+            alloc->free_blocks -= blocks;
+            return bitmap_alloc_to_ptr(alloc, block);
+        }
+
+        // every base up to the used block would take it in, so the next one past it is tried
+        block += ((used - block) / step + 1) * step;
+    }
+
+    return NULL;
+}
+
 bool bitmap_alloc_free(bitmap_allocator_t *alloc, void *ptr, size_t blocks) {
     bool invalid_args = !alloc || !ptr || !blocks;
     bool invalid_alloc = alloc && (!alloc->block_size || !alloc->block_count || !alloc->chunk_size);
@@ -38,4 +38,5 @@ bool bitmap_alloc_init(bitmap_allocator_t *alloc, void *chunk_start, size_t chun
 
 void *bitmap_alloc_reserve(bitmap_allocator_t *alloc, size_t blocks);
 void *bitmap_alloc_high(bitmap_allocator_t *alloc, size_t blocks);
+void *bitmap_alloc_aligned(bitmap_allocator_t *alloc, size_t blocks, size_t align);
 bool bitmap_alloc_free(bitmap_allocator_t *alloc, void *ptr, size_t blocks);
@@ -11,3 +11,4 @@
 #define FALLTHROUGH      __attribute__((fallthrough))
 #define NONSTRING        __attribute__((nonstring))
 #define MUST_USE         __attribute__((warn_unused_result))
+#define ALWAYS_INLINE    __attribute__((always_inline))
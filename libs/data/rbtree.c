@@ -0,0 +1,319 @@
+#include "rbtree.h"
+
+static inline void _augment(rb_node_t *node, rb_augment_fn augment) {
+    if (augment && node) {
+        augment(node);
+    }
+}
+
+static void _replace_child(rb_tree_t *tree, rb_node_t *parent, rb_node_t *old, rb_node_t *new) {
+    if (!parent) {
+        tree->root = new;
+    } else if (parent->left == old) {
+        parent->left = new;
+    } else {
+        parent->right = new;
+    }
+}
+
+static void _rotate_left(rb_tree_t *tree, rb_node_t *node, rb_augment_fn augment) {
+    rb_node_t *pivot = node->right;
+
+    node->right = pivot->left;
+    if (pivot->left) {
+        pivot->left->parent = node;
+    }
+
+    pivot->parent = node->parent;
+    _replace_child(tree, node->parent, node, pivot);
+
+    pivot->left = node;
+    node->parent = pivot;
+
+    // the subtree as a whole is unchanged, only the two rotated nodes need refreshing
+    _augment(node, augment);
+    _augment(pivot, augment);
+}
+
+static void _rotate_right(rb_tree_t *tree, rb_node_t *node, rb_augment_fn augment) {
+    rb_node_t *pivot = node->left;
+
+    node->left = pivot->right;
+    if (pivot->right) {
+        pivot->right->parent = node;
+    }
+
+    pivot->parent = node->parent;
+    _replace_child(tree, node->parent, node, pivot);
+
+    pivot->right = node;
+    node->parent = pivot;
+
+    _augment(node, augment);
+    _augment(pivot, augment);
+}
+
+static inline bool _is_red(const rb_node_t *node) {
+    return node && node->red;
+}
+
+void rb_propagate(rb_node_t *node, rb_augment_fn augment) {
+    if (!augment) {
+        return;
+    }
+
+    for (; node; node = node->parent) {
+        augment(node);
+    }
+}
+
+void rb_insert(rb_tree_t *tree, rb_node_t *node, rb_node_t *parent, rb_node_t **link, rb_augment_fn augment) {
+    node->parent = parent;
+    node->left = NULL;
+    node->right = NULL;
+    node->red = true;
+    *link = node;
+    tree->count++;
+
+    rb_propagate(node, augment);
+
+    while (_is_red(node->parent)) {
+        rb_node_t *dad = node->parent;
+        rb_node_t *grand = dad->parent;
+
+        if (dad == grand->left) {
+            rb_node_t *uncle = grand->right;
+
+            if (_is_red(uncle)) {
+                dad->red = false;
+                uncle->red = false;
+                grand->red = true;
+                node = grand;
+                continue;
+            }
+
+            if (node == dad->right) {
+                node = dad;
+                _rotate_left(tree, node, augment);
+                dad = node->parent;
+            }
+
+            dad->red = false;
+            grand->red = true;
+            _rotate_right(tree, grand, augment);
+        } else {
+            rb_node_t *uncle = grand->left;
+
+            if (_is_red(uncle)) {
+                dad->red = false;
+                uncle->red = false;
+                grand->red = true;
+                node = grand;
+                continue;
+            }
+
+            if (node == dad->left) {
+                node = dad;
+                _rotate_right(tree, node, augment);
+                dad = node->parent;
+            }
+
+            dad->red = false;
+            grand->red = true;
+            _rotate_left(tree, grand, augment);
+        }
+    }
+
+    tree->root->red = false;
+}
+
+static void _erase_fixup(rb_tree_t *tree, rb_node_t *node, rb_node_t *parent, rb_augment_fn augment) {
+    while (node != tree->root && !_is_red(node)) {
+        if (node == parent->left) {
+            rb_node_t *sibling = parent->right;
+
+            if (_is_red(sibling)) {
+                sibling->red = false;
+                parent->red = true;
+                _rotate_left(tree, parent, augment);
+                sibling = parent->right;
+            }
+
+            if (!_is_red(sibling->left) && !_is_red(sibling->right)) {
+                sibling->red = true;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (!_is_red(sibling->right)) {
+                sibling->left->red = false;
+                sibling->red = true;
+                _rotate_right(tree, sibling, augment);
+                sibling = parent->right;
+            }
+
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->right->red = false;
+            _rotate_left(tree, parent, augment);
+            node = tree->root;
+        } else {
+            rb_node_t *sibling = parent->left;
+
+            if (_is_red(sibling)) {
+                sibling->red = false;
+                parent->red = true;
+                _rotate_right(tree, parent, augment);
+                sibling = parent->left;
+            }
+
+            if (!_is_red(sibling->left) && !_is_red(sibling->right)) {
+                sibling->red = true;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (!_is_red(sibling->left)) {
+                sibling->right->red = false;
+                sibling->red = true;
+                _rotate_left(tree, sibling, augment);
+                sibling = parent->left;
+            }
+
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->left->red = false;
+            _rotate_right(tree, parent, augment);
+            node = tree->root;
+        }
+    }
+
+    if (node) {
+        node->red = false;
+    }
+}
+
+void rb_erase(rb_tree_t *tree, rb_node_t *node, rb_augment_fn augment) {
+    rb_node_t *child = NULL;
+    rb_node_t *parent = NULL;
+    bool removed_red = node->red;
+
+    if (!node->left || !node->right) {
+        child = node->left ? node->left : node->right;
+        parent = node->parent;
+
+        if (child) {
+            child->parent = parent;
+        }
+
+        _replace_child(tree, parent, node, child);
+    } else {
+        // the in-order successor takes over the node's place and colour
+        rb_node_t *next = node->right;
+        while (next->left) {
+            next = next->left;
+        }
+
+        removed_red = next->red;
+        child = next->right;
+
+        if (next->parent == node) {
+            parent = next;
+        } else {
+            parent = next->parent;
+            parent->left = child;
+
+            if (child) {
+                child->parent = parent;
+            }
+
+            next->right = node->right;
+            node->right->parent = next;
+        }
+
+        next->left = node->left;
+        node->left->parent = next;
+        next->parent = node->parent;
+        next->red = node->red;
+        _replace_child(tree, node->parent, node, next);
+    }
+
+    tree->count--;
+
+    // `parent` is the deepest node whose subtree changed, its path covers the successor too
+    rb_propagate(parent, augment);
+
+    if (!removed_red) {
+        _erase_fixup(tree, child, parent, augment);
+    }
+
+    node->parent = NULL;
+    node->left = NULL;
+    node->right = NULL;
+}
+
+rb_node_t *rb_first(const rb_tree_t *tree) {
+    rb_node_t *node = tree ? tree->root : NULL;
+
+    while (node && node->left) {
+        node = node->left;
+    }
+
+    return node;
+}
+
+rb_node_t *rb_last(const rb_tree_t *tree) {
+    rb_node_t *node = tree ? tree->root : NULL;
+
+    while (node && node->right) {
+        node = node->right;
+    }
+
+    return node;
+}
+
+rb_node_t *rb_next(const rb_node_t *node) {
+    if (!node) {
+        return NULL;
+    }
+
+    if (node->right) {
+        rb_node_t *next = node->right;
+
+        while (next->left) {
+            next = next->left;
+        }
+
+        return next;
+    }
+
+    while (node->parent && node == node->parent->right) {
+        node = node->parent;
+    }
+
+    return node->parent;
+}
+
+rb_node_t *rb_prev(const rb_node_t *node) {
+    if (!node) {
+        return NULL;
+    }
+
+    if (node->left) {
+        rb_node_t *prev = node->left;
+
+        while (prev->right) {
+            prev = prev->right;
+        }
+
+        return prev;
+    }
+
+    while (node->parent && node == node->parent->left) {
+        node = node->parent;
+    }
+
+    return node->parent;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// intrusive red-black tree, the caller owns the nodes and the ordering
+typedef struct rb_node {
+    struct rb_node *parent;
+    struct rb_node *left;
+    struct rb_node *right;
+    bool red;
+} rb_node_t;
+
+typedef struct rb_tree {
+    rb_node_t *root;
+    size_t count;
+} rb_tree_t;
+
+// recomputes per-node data that summarizes the subtree, children are already up to date
+typedef void (*rb_augment_fn)(rb_node_t *node);
+
+#define rb_entry(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+// link `node` at `*link` below `parent` (found by the caller's own descent), then rebalance
+void rb_insert(rb_tree_t *tree, rb_node_t *node, rb_node_t *parent, rb_node_t **link, rb_augment_fn augment);
+void rb_erase(rb_tree_t *tree, rb_node_t *node, rb_augment_fn augment);
+
+// refresh augmented data from `node` up to the root after an in-place key change
+void rb_propagate(rb_node_t *node, rb_augment_fn augment);
+
+rb_node_t *rb_first(const rb_tree_t *tree);
+rb_node_t *rb_last(const rb_tree_t *tree);
+rb_node_t *rb_next(const rb_node_t *node);
+rb_node_t *rb_prev(const rb_node_t *node);
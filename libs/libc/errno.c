@@ -1,3 +1,11 @@
 #include "errno.h"
 
+#ifdef _KERNEL
 int errno = 0;
+#else
+#include <threads.h>
+
+int *__errno_location(void) {
+    return &__libc_local()->err;
+}
+#endif
@@ -91,4 +91,10 @@
         _ret < 0 ? (errno = -_ret, -1) : _ret; \
     })
 
+#ifdef _KERNEL
 extern int errno;
+#else
+// every thread has its own
+int *__errno_location(void);
+#define errno (*__errno_location())
+#endif
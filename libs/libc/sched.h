@@ -0,0 +1,29 @@
+#pragma once
+
+#include <sys/types.h>
+
+// SCHED_FIFO and SCHED_RR threads run ahead of every SCHED_OTHER one, higher
+// priorities first. FIFO keeps the cpu until it blocks or yields, RR takes
+// turns with its equals. Real time work is throttled to part of each second
+// so a runaway thread cannot starve the rest. The class survives exec and is
+// shared by clone threads, but a forked or spawned process starts fair again
+#define SCHED_OTHER 0
+#define SCHED_FIFO  1
+#define SCHED_RR    2
+
+#define SCHED_RT_PRIO_MIN 1
+#define SCHED_RT_PRIO_MAX 99
+
+struct sched_param {
+    int sched_priority;
+};
+
+#ifndef _KERNEL
+int sched_setscheduler(pid_t pid, int policy, const struct sched_param *param);
+int sched_getscheduler(pid_t pid);
+int sched_setparam(pid_t pid, const struct sched_param *param);
+int sched_getparam(pid_t pid, struct sched_param *param);
+int sched_get_priority_min(int policy);
+int sched_get_priority_max(int policy);
+int sched_yield(void);
+#endif
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <signal.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define POSIX_SPAWN_SETPGROUP 0x01
+#define POSIX_SPAWN_SETSIGDEF 0x02
+
+// the child is created stopped and waits for SIGCONT, like the macOS extension
+#define POSIX_SPAWN_START_SUSPENDED 0x80
+
+#define SPAWN_ACTIONS_MAX 64
+
+enum {
+    SPAWN_ACTION_OPEN = 1,
+    SPAWN_ACTION_CLOSE,
+    SPAWN_ACTION_DUP2,
+};
+
+typedef struct spawn_action {
+    int op;
+    int fd;
+    int src_fd;
+    int oflag;
+    mode_t mode;
+    char *path;
+} spawn_action_t;
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    spawn_action_t *actions;
+} posix_spawn_file_actions_t;
+
+typedef struct {
+    short flags;
+    pid_t pgroup;
+    sigset_t sigdefault;
+} posix_spawnattr_t;
+
+// what SYS_SPAWN reads from the caller, file actions run in order in the child
+typedef struct spawn_args {
+    const char *path;
+    char *const *argv;
+    char *const *envp;
+    const posix_spawn_file_actions_t *file_actions;
+    const posix_spawnattr_t *attr;
+} spawn_args_t;
+
+#ifndef _KERNEL
+int posix_spawn(
+    pid_t *pid,
+    const char *path,
+    const posix_spawn_file_actions_t *file_actions,
+    const posix_spawnattr_t *attrp,
+    char *const argv[],
+    char *const envp[]
+);
+int posix_spawnp(
+    pid_t *pid,
+    const char *file,
+    const posix_spawn_file_actions_t *file_actions,
+    const posix_spawnattr_t *attrp,
+    char *const argv[],
+    char *const envp[]
+);
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t *file_actions);
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t *file_actions);
+int posix_spawn_file_actions_addopen(
+    posix_spawn_file_actions_t *file_actions,
+    int fd,
+    const char *path,
+    int oflag,
+    mode_t mode
+);
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t *file_actions, int fd);
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t *file_actions, int fd, int newfd);
+
+int posix_spawnattr_init(posix_spawnattr_t *attr);
+int posix_spawnattr_destroy(posix_spawnattr_t *attr);
+int posix_spawnattr_getflags(const posix_spawnattr_t *attr, short *flags);
+int posix_spawnattr_setflags(posix_spawnattr_t *attr, short flags);
+int posix_spawnattr_getpgroup(const posix_spawnattr_t *attr, pid_t *pgroup);
+int posix_spawnattr_setpgroup(posix_spawnattr_t *attr, pid_t pgroup);
+int posix_spawnattr_getsigdefault(const posix_spawnattr_t *attr, sigset_t *sigdefault);
+int posix_spawnattr_setsigdefault(posix_spawnattr_t *attr, const sigset_t *sigdefault);
+#endif
@@ -15,6 +15,8 @@
 
 #define MAP_FAILED ((void *)-1)
 
+#define MREMAP_MAYMOVE 1
+
 typedef struct mmap_args {
     void *addr;
     size_t len;
@@ -28,4 +30,5 @@ typedef struct mmap_args {
 void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
 int mprotect(void *addr, size_t len, int prot);
 int munmap(void *addr, size_t len);
+void *mremap(void *old_address, size_t old_size, size_t new_size, int flags);
 #endif
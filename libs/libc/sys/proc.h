@@ -46,6 +46,7 @@ typedef struct {
     char state;
     int core_id;
     int tty_index;
+    int nice;
     uint64_t cpu_time_ms;
     uint64_t user_time_ms;
     uint64_t sys_time_ms;
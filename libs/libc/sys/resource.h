@@ -6,11 +6,21 @@
 #define RUSAGE_SELF     0
 #define RUSAGE_CHILDREN -1
 
+#define PRIO_PROCESS 0
+#define PRIO_PGRP    1
+#define PRIO_USER    2
+
+// nice values run from PRIO_MIN up to but not including PRIO_MAX
+#define PRIO_MIN -20
+#define PRIO_MAX 20
+
+#ifndef _KERNEL
 struct rusage {
     struct timeval ru_utime;
     struct timeval ru_stime;
 };
 
-#ifndef _KERNEL
 int getrusage(int who, struct rusage *usage);
+int getpriority(int which, id_t who);
+int setpriority(int which, id_t who, int prio);
 #endif
@@ -0,0 +1,37 @@
+#pragma once
+
+#ifndef _APHELEIA_SOURCE
+#error "<sys/thread.h> is an apheleiaOS extension. Define _APHELEIA_SOURCE."
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// threads made by clone share the address space, descriptors, cwd and signal
+// handlers of the process that made them, and have their own tid and stack
+
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+
+// the new thread starts at the caller's return address with sp as its stack
+// pointer. When it exits the kernel zeroes *clear_tid and wakes the futex
+// waiters there, which is how a join learns the thread is gone
+typedef struct clone_args {
+    void *stack;
+    size_t stack_size;
+    void *sp;
+    int *clear_tid;
+} clone_args_t;
+
+#ifndef _KERNEL
+struct timespec;
+
+pid_t gettid(void);
+
+// the calling thread only; exit() ends every thread of the process
+void thread_exit(int code) __attribute__((noreturn));
+
+// sleeps while *uaddr still holds val, with an optional relative timeout
+int futex(volatile uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout);
+#endif
@@ -1,3 +1,54 @@
 #pragma once
 
-#define __STDC_NO_THREADS__ 1
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+// C11 threads, each one a clone of the process sharing its memory
+// there is no thread local storage, so thread_local is not provided and tss
+// values are looked up through the calling thread's id
+
+#define ONCE_FLAG_INIT      { 0 }
+#define TSS_DTOR_ITERATIONS 4
+
+enum {
+    thrd_success = 0,
+    thrd_busy,
+    thrd_error,
+    thrd_nomem,
+    thrd_timedout,
+};
+
+enum {
+    mtx_plain = 0,
+    mtx_recursive = 1,
+    mtx_timed = 2,
+};
+
+typedef int (*thrd_start_t)(void *arg);
+typedef void (*tss_dtor_t)(void *value);
+
+typedef struct __thrd *thrd_t;
+
+// the lock word is 0 when free, 1 when held and 2 when held with sleepers
+typedef struct {
+    volatile uint32_t lock;
+    int type;
+    pid_t owner;
+    unsigned depth;
+} mtx_t;
+
+// waiters sleep on the sequence, every signal or broadcast bumps it
+typedef struct {
+    volatile uint32_t seq;
+} cnd_t;
+
+typedef struct {
+    volatile uint32_t state;
+} once_flag;
+
+typedef unsigned tss_t;
+
+#ifndef _KERNEL
+#include <libc_usr/threads.h>
+#endif
@@ -13,6 +13,8 @@ struct timespec {
 #define CLOCK_REALTIME  0
 #define CLOCK_MONOTONIC 1
 
+#define TIME_UTC 1
+
 struct tm {
     int tm_sec;
     int tm_min;
@@ -28,6 +30,7 @@ struct tm {
 time_t time(time_t *timer);
 int nanosleep(const struct timespec *req, struct timespec *rem);
 int clock_gettime(clockid_t clock_id, struct timespec *tp);
+int timespec_get(struct timespec *ts, int base);
 
 time_t mktime(struct tm *tm);
 
@@ -4,160 +4,505 @@
 #include <stdint.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <threads.h>
+
+// size-class allocator backed by mmap
+// small requests are rounded to one of CLASS_COUNT sizes and carved out of 64 KiB
+// spans that hold a single class, so malloc and free are a list pop and push;
+// anything larger gets its own mapping, which realloc grows through mremap
+
+#define ALIGNMENT 16U
+#define PAGE_SIZE 4096U
+
+#define SPAN_SIZE (64U * 1024U)
+#define SPAN_MASK ((uintptr_t)SPAN_SIZE - 1)
+
+// 16..128 in steps of 16, then four classes per power of two up to 16 KiB
+#define CLASS_LINEAR 8U
+#define CLASS_COUNT  36U
+#define SMALL_MAX    16384U
+
+// objects parked in a bin before half of them go back to their spans
+#define CACHE_MAX 64U
+
+typedef struct free_obj {
+    struct free_obj *next;
+} free_obj_t;
+
+typedef struct span {
+    struct span *next;
+    struct span *prev;
+    free_obj_t *free;
+    char *bump; // never handed out yet, carved lazily
+    char *limit;
+    unsigned class_index;
+    unsigned used;
+    int partial; // linked on its class's partial list
+} span_t;
+
+#define SPAN_HEADER (((sizeof(span_t) + ALIGNMENT - 1) / ALIGNMENT) * ALIGNMENT)
+
+typedef struct {
+    size_t size;
+    size_t map_size;
+} large_t;
+
+#define LARGE_HEADER (((sizeof(large_t) + ALIGNMENT - 1) / ALIGNMENT) * ALIGNMENT)
+
+// one bin per class: a cache of loose objects in front of the spans that own them.
+// Every thread has its own set, so malloc and free only take the heap lock to
+// refill or flush a bin; the spans and their partial lists are shared
+typedef struct {
+    free_obj_t *cache;
+    unsigned cached;
+} bin_t;
+
+typedef struct {
+    bin_t bins[CLASS_COUNT];
+} heap_cache_t;
+
+#define HEAP_CACHE_BYTES ((sizeof(heap_cache_t) + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1))
+
+// the bins of the last thread to exit, cached objects and all, kept for the
+// next thread so short lived ones don't each map and unmap a set
+static heap_cache_t *heap_spare;
+
+// a bit per SPAN_SIZE slot of the address space marks the spans, which is how
+// free tells small objects from large ones. Lookups take no lock: the bits only
+// change under the heap lock, and the nodes are mapped once and never unmapped
+#if UINTPTR_MAX > 0xffffffffU
+#define MAP_ADDR_BITS 48U
+#else
+#define MAP_ADDR_BITS 32U
+#endif
+
+#define SPAN_SHIFT     16U
+#define MAP_LEAF_BITS  15U // a page of bits
+#define MAP_UPPER_BITS (MAP_ADDR_BITS - SPAN_SHIFT - MAP_LEAF_BITS)
+#define MAP_MID_BITS   (MAP_UPPER_BITS / 2)
+#define MAP_ROOT_BITS  (MAP_UPPER_BITS - MAP_MID_BITS)
+
+_Static_assert(SPAN_SIZE == 1U << SPAN_SHIFT, "span map assumes 64 KiB spans");
+
+typedef struct {
+    uint8_t *leaves[1U << MAP_MID_BITS];
+} span_map_mid_t;
+
+static span_map_mid_t *span_map[1U << MAP_ROOT_BITS];
+static span_t *partial[CLASS_COUNT];
+
+// taken only once the process has a second thread; the decision is returned
+// so an unlock always matches its lock even if a thread starts in between
+static volatile uint32_t heap_lock;
+
+static int _heap_lock(void) {
+    int threaded = __atomic_load_n(&__libc_threaded, __ATOMIC_ACQUIRE);
+
+    if (threaded) {
+        __libc_lock(&heap_lock);
+    }
 
-// simple first-fit free-list allocator backed by mmap
-// this should grow into a real arena allocator eventually
+    return threaded;
+}
 
-#define ARENA_SIZE     (64U * 1024U)
-#define MMAP_THRESHOLD (ARENA_SIZE / 2U)
-#define ALIGNMENT      16U
-#define PAGE_SIZE      4096U
+static void _heap_unlock(int locked) {
+    if (locked) {
+        __libc_unlock(&heap_lock);
+    }
+}
 
-typedef struct block {
-    size_t size; // excludes header
-    struct block *next;
-    int free;
-    int mmap_backed; // 1 if this block owns its own mmap region
-} block_t;
+static size_t _class_size(unsigned index) {
+    if (index < CLASS_LINEAR) {
+        return (size_t)(index + 1) * ALIGNMENT;
+    }
 
-#define HEADER_SIZE ((sizeof(block_t) + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1))
+    unsigned group = (index - CLASS_LINEAR) / 4;
+    unsigned step = (index - CLASS_LINEAR) % 4;
+    return ((size_t)1 << (group + 7)) + (size_t)(step + 1) * ((size_t)1 << (group + 5));
+}
 
-static block_t *free_list = NULL;
+static unsigned _class_index(size_t size) {
+    if (size <= CLASS_LINEAR * ALIGNMENT) {
+        return size ? (unsigned)((size - 1) / ALIGNMENT) : 0;
+    }
 
-static int _blocks_touch(const block_t *left, const block_t *right) {
-    return left && right && (const char *)left + HEADER_SIZE + left->size == (const char *)right;
+    unsigned bits = (unsigned)(sizeof(unsigned long) * CHAR_BIT - 1) - (unsigned)__builtin_clzl(size - 1);
+    unsigned step = (unsigned)((size - 1) >> (bits - 2)) - 4;
+    return CLASS_LINEAR + (bits - 7) * 4 + step;
 }
 
-static int _align_size(size_t n, size_t align, size_t *out) {
-    if (!out || !align) {
-        errno = EINVAL;
-        return -1;
+static void *_mmap_pages(size_t bytes) {
+    void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+
+    if (p == MAP_FAILED) {
+        return NULL;
     }
 
-    size_t mask = align - 1;
-    if (n > SIZE_MAX - mask) {
-        errno = ENOMEM;
+    return p;
+}
+
+// the leaf holding the bit for `base`, mapping the missing nodes when `create`
+// is set, which only happens under the heap lock
+static uint8_t *_map_leaf(uintptr_t base, int create) {
+    uintptr_t index = base >> SPAN_SHIFT;
+    size_t root = (size_t)(index >> (MAP_LEAF_BITS + MAP_MID_BITS)) & ((1U << MAP_ROOT_BITS) - 1);
+    size_t mid = (size_t)(index >> MAP_LEAF_BITS) & ((1U << MAP_MID_BITS) - 1);
+
+    span_map_mid_t *node = __atomic_load_n(&span_map[root], __ATOMIC_ACQUIRE);
+
+    if (!node) {
+        if (!create || !(node = _mmap_pages(PAGE_SIZE))) {
+            return NULL;
+        }
+
+        __atomic_store_n(&span_map[root], node, __ATOMIC_RELEASE);
+    }
+
+    uint8_t *leaf = __atomic_load_n(&node->leaves[mid], __ATOMIC_ACQUIRE);
+
+    if (!leaf) {
+        if (!create || !(leaf = _mmap_pages(PAGE_SIZE))) {
+            return NULL;
+        }
+
+        __atomic_store_n(&node->leaves[mid], leaf, __ATOMIC_RELEASE);
+    }
+
+    return leaf;
+}
+
+static size_t _map_bit(uintptr_t base) {
+    return (size_t)(base >> SPAN_SHIFT) & ((1U << MAP_LEAF_BITS) - 1);
+}
+
+static int _map_add(uintptr_t base) {
+    uint8_t *leaf = _map_leaf(base, 1);
+    if (!leaf) {
         return -1;
     }
 
-    *out = (n + mask) & ~mask;
+    size_t bit = _map_bit(base);
+    __atomic_fetch_or(&leaf[bit / 8], (uint8_t)(1U << (bit % 8)), __ATOMIC_RELEASE);
     return 0;
 }
 
-static int _alloc_total(size_t size, size_t *out) {
-    if (size > SIZE_MAX - HEADER_SIZE) {
-        errno = ENOMEM;
-        return -1;
+static int _map_has(uintptr_t base) {
+    uint8_t *leaf = _map_leaf(base, 0);
+    if (!leaf) {
+        return 0;
     }
 
-    return _align_size(HEADER_SIZE + size, PAGE_SIZE, out);
+    size_t bit = _map_bit(base);
+    return (__atomic_load_n(&leaf[bit / 8], __ATOMIC_ACQUIRE) >> (bit % 8)) & 1U;
 }
 
-static void *_mmap_pages(size_t bytes) {
-    void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+static void _map_remove(uintptr_t base) {
+    uint8_t *leaf = _map_leaf(base, 0);
+    size_t bit = _map_bit(base);
 
-    if (p == MAP_FAILED) {
+    __atomic_fetch_and(&leaf[bit / 8], (uint8_t)~(1U << (bit % 8)), __ATOMIC_RELEASE);
+}
+
+// mmap only promises page alignment, so map twice the span and trim both ends
+static span_t *_span_map(void) {
+    char *raw = _mmap_pages(SPAN_SIZE * 2);
+    if (!raw) {
         return NULL;
     }
 
-    return p;
+    uintptr_t base = ((uintptr_t)raw + SPAN_MASK) & ~SPAN_MASK;
+    size_t head = base - (uintptr_t)raw;
+
+    if (head) {
+        munmap(raw, head);
+    }
+
+    munmap((char *)base + SPAN_SIZE, SPAN_SIZE - head);
+    return (span_t *)base;
 }
 
-static void _split(block_t *block, size_t needed) {
-    size_t remaining = block->size - needed;
-    if (remaining < HEADER_SIZE + ALIGNMENT) {
-        return;
+static void _partial_push(span_t *span) {
+    span_t **head = &partial[span->class_index];
+
+    span->prev = NULL;
+    span->next = *head;
+
+    if (*head) {
+        (*head)->prev = span;
     }
 
-    block_t *rest = (block_t *)((char *)block + HEADER_SIZE + needed);
-    rest->size = remaining - HEADER_SIZE;
-    rest->free = 1;
-    rest->mmap_backed = 0;
-    rest->next = block->next;
+    *head = span;
+    span->partial = 1;
+}
+
+static void _partial_remove(span_t *span) {
+    if (span->prev) {
+        span->prev->next = span->next;
+    } else {
+        partial[span->class_index] = span->next;
+    }
+
+    if (span->next) {
+        span->next->prev = span->prev;
+    }
 
-    block->size = needed;
-    block->next = rest;
+    span->next = NULL;
+    span->prev = NULL;
+    span->partial = 0;
 }
 
-// extend the heap by allocating a new arena
-static block_t *_grow_heap(size_t needed) {
-    size_t arena = ARENA_SIZE;
-    if (needed > SIZE_MAX - HEADER_SIZE) {
-        errno = ENOMEM;
+static span_t *_span_new(unsigned class_index) {
+    span_t *span = _span_map();
+    if (!span) {
         return NULL;
     }
 
-    if (needed + HEADER_SIZE > arena && _alloc_total(needed, &arena) < 0) {
+    size_t size = _class_size(class_index);
+    size_t count = (SPAN_SIZE - SPAN_HEADER) / size;
+
+    memset(span, 0, sizeof(*span));
+    span->class_index = class_index;
+    span->bump = (char *)span + SPAN_HEADER;
+    span->limit = span->bump + count * size;
+
+    if (_map_add((uintptr_t)span) < 0) {
+        munmap(span, SPAN_SIZE);
         return NULL;
     }
 
-    void *mem = _mmap_pages(arena);
-    if (!mem) {
-        return NULL;
+    return span;
+}
+
+static void _span_release(span_t *span) {
+    // the last partial span stays mapped so a free/malloc loop does not thrash mmap
+    if (span->partial && partial[span->class_index] == span && !span->next) {
+        return;
     }
 
-    block_t *block = (block_t *)mem;
+    if (span->partial) {
+        _partial_remove(span);
+    }
+
+    _map_remove((uintptr_t)span);
+    munmap(span, SPAN_SIZE);
+}
 
-    block->size = arena - HEADER_SIZE;
-    block->free = 1;
-    block->mmap_backed = 0;
-    block->next = free_list;
-    free_list = block;
+static void *_span_take(span_t *span, size_t size) {
+    free_obj_t *obj = span->free;
 
-    return block;
+    if (obj) {
+        span->free = obj->next;
+    } else if (span->bump + size <= span->limit) {
+        obj = (free_obj_t *)span->bump;
+        span->bump += size;
+    } else {
+        return NULL;
+    }
+
+    span->used++;
+    return obj;
 }
 
-void *malloc(size_t size) {
-    if (!size) {
-        size = 1;
+static int _span_full(const span_t *span, size_t size) {
+    return !span->free && span->bump + size > span->limit;
+}
+
+static void _span_give(span_t *span, free_obj_t *obj) {
+    obj->next = span->free;
+    span->free = obj;
+    span->used--;
+
+    if (!span->partial) {
+        _partial_push(span);
     }
 
-    if (_align_size(size, ALIGNMENT, &size) < 0) {
-        return NULL;
+    if (!span->used) {
+        _span_release(span);
     }
+}
 
-    // large allocations get their own mmap region
-    if (size >= MMAP_THRESHOLD) {
-        size_t total = 0;
-        if (_alloc_total(size, &total) < 0) {
-            return NULL;
+// move up to half a cache worth of objects from partial spans into the bin
+static int _bin_refill(bin_t *bin, unsigned class_index) {
+    size_t size = _class_size(class_index);
+    unsigned want = CACHE_MAX / 2;
+
+    int locked = _heap_lock();
+
+    while (want) {
+        span_t *span = partial[class_index];
+
+        if (!span) {
+            span = _span_new(class_index);
+            if (!span) {
+                break;
+            }
+
+            _partial_push(span);
         }
 
-        void *mem = _mmap_pages(total);
+        while (want) {
+            free_obj_t *obj = _span_take(span, size);
+            if (!obj) {
+                break;
+            }
 
-        if (!mem) {
-            return NULL;
+            obj->next = bin->cache;
+            bin->cache = obj;
+            bin->cached++;
+            want--;
         }
 
-        block_t *block = (block_t *)mem;
-        block->size = total - HEADER_SIZE;
-        block->free = 0;
-        block->mmap_backed = 1;
-        block->next = NULL;
+        if (_span_full(span, size)) {
+            _partial_remove(span);
+        }
+    }
 
-        return (char *)block + HEADER_SIZE;
+    _heap_unlock(locked);
+
+    return bin->cached ? 0 : -1;
+}
+
+static void _bin_flush(bin_t *bin, unsigned keep) {
+    int locked = _heap_lock();
+
+    while (bin->cached > keep) {
+        free_obj_t *obj = bin->cache;
+        bin->cache = obj->next;
+        bin->cached--;
+
+        span_t *span = (span_t *)((uintptr_t)obj & ~SPAN_MASK);
+        _span_give(span, obj);
     }
 
-    block_t *curr = free_list;
+    _heap_unlock(locked);
+}
 
-    while (curr) {
-        if (curr->free && curr->size >= size) {
-            _split(curr, size);
-            curr->free = 0;
-            return (char *)curr + HEADER_SIZE;
-        }
-        curr = curr->next;
+// the calling thread's bins, taken over or mapped on its first small allocation
+static heap_cache_t *_heap_cache(void) {
+    __libc_local_t *local = __libc_local();
+
+    if (!local->heap) {
+        local->heap = __atomic_exchange_n(&heap_spare, NULL, __ATOMIC_ACQ_REL);
+    }
+
+    if (!local->heap) {
+        local->heap = _mmap_pages(HEAP_CACHE_BYTES);
+    }
+
+    return local->heap;
+}
+
+static void *_small_alloc(size_t size) {
+    unsigned class_index = _class_index(size);
+    heap_cache_t *heap = _heap_cache();
+
+    if (!heap) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    bin_t *bin = &heap->bins[class_index];
+
+    if (!bin->cache && _bin_refill(bin, class_index) < 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    free_obj_t *obj = bin->cache;
+    bin->cache = obj->next;
+    bin->cached--;
+
+    return obj;
+}
+
+// a thread that never allocated has no bins yet, its first free maps them
+static void _small_free(span_t *span, void *ptr) {
+    heap_cache_t *heap = _heap_cache();
+    free_obj_t *obj = ptr;
+
+    if (!heap) {
+        int locked = _heap_lock();
+        _span_give(span, obj);
+        _heap_unlock(locked);
+        return;
+    }
+
+    bin_t *bin = &heap->bins[span->class_index];
+
+    obj->next = bin->cache;
+    bin->cache = obj;
+    bin->cached++;
+
+    if (bin->cached > CACHE_MAX) {
+        _bin_flush(bin, CACHE_MAX / 2);
+    }
+}
+
+void __libc_heap_release(void *cache) {
+    heap_cache_t *heap = cache;
+
+    if (!heap) {
+        return;
+    }
+
+    heap_cache_t *empty = NULL;
+    if (__atomic_compare_exchange_n(&heap_spare, &empty, heap, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    for (unsigned i = 0; i < CLASS_COUNT; i++) {
+        _bin_flush(&heap->bins[i], 0);
     }
 
-    // no suitable block, grow the heap
-    block_t *block = _grow_heap(size);
-    if (!block) {
+    munmap(heap, HEAP_CACHE_BYTES);
+}
+
+static int _large_total(size_t size, size_t *out) {
+    if (size > SIZE_MAX - LARGE_HEADER - (PAGE_SIZE - 1)) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    *out = (LARGE_HEADER + size + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+    return 0;
+}
+
+static void *_large_alloc(size_t size) {
+    size_t total = 0;
+    if (_large_total(size, &total) < 0) {
         return NULL;
     }
 
-    _split(block, size);
-    block->free = 0;
-    return (char *)block + HEADER_SIZE;
+    large_t *large = _mmap_pages(total);
+    if (!large) {
+        return NULL;
+    }
+
+    large->size = total - LARGE_HEADER;
+    large->map_size = total;
+
+    return (char *)large + LARGE_HEADER;
+}
+
+static large_t *_large_of(void *ptr) {
+    return (large_t *)((char *)ptr - LARGE_HEADER);
+}
+
+static span_t *_span_of(void *ptr) {
+    uintptr_t base = (uintptr_t)ptr & ~SPAN_MASK;
+    return _map_has(base) ? (span_t *)base : NULL;
+}
+
+static size_t _usable_size(void *ptr, span_t *span) {
+    return span ? _class_size(span->class_index) : _large_of(ptr)->size;
+}
+
+void *malloc(size_t size) {
+    if (size > SMALL_MAX) {
+        return _large_alloc(size);
+    }
+
+    return _small_alloc(size ? size : 1);
 }
 
 void *calloc(size_t num, size_t size) {
@@ -167,11 +512,14 @@ void *calloc(size_t num, size_t size) {
 
     size_t total = num * size;
     if (size && total / size != num) {
+        errno = ENOMEM;
         return NULL;
     }
 
     void *memory = malloc(total);
-    if (memory) {
+
+    // large blocks come straight from mmap and are already zero
+    if (memory && total <= SMALL_MAX) {
         memset(memory, 0, total);
     }
 
@@ -183,22 +531,43 @@ void free(void *ptr) {
         return;
     }
 
-    block_t *block = (block_t *)((char *)ptr - HEADER_SIZE);
+    span_t *span = _span_of(ptr);
 
-    if (block->mmap_backed) {
-        size_t total = HEADER_SIZE + block->size;
-        munmap(block, total);
+    if (span) {
+        _small_free(span, ptr);
         return;
     }
 
-    block->free = 1;
+    large_t *large = _large_of(ptr);
+    munmap(large, large->map_size);
+}
+
+static void *_large_realloc(void *ptr, size_t size) {
+    large_t *large = _large_of(ptr);
+    size_t total = 0;
+
+    if (_large_total(size, &total) < 0) {
+        return NULL;
+    }
+
+    if (total == large->map_size) {
+        return ptr;
+    }
+
+    // the kernel grows the mapping in place when it can and moves the frames when it cannot
+    large_t *moved = mremap(large, large->map_size, total, MREMAP_MAYMOVE);
+    if (moved == MAP_FAILED) {
+        if (total < large->map_size) {
+            return ptr;
+        }
 
-    // The free list contains multiple mmap arenas, so list neighbours are not
-    // necessarily adjacent in memory.
-    if (block->next && block->next->free && _blocks_touch(block, block->next)) {
-        block->size += HEADER_SIZE + block->next->size;
-        block->next = block->next->next;
+        return NULL;
     }
+
+    moved->size = total - LARGE_HEADER;
+    moved->map_size = total;
+
+    return (char *)moved + LARGE_HEADER;
 }
 
 void *realloc(void *ptr, size_t size) {
@@ -211,14 +580,16 @@ void *realloc(void *ptr, size_t size) {
         return NULL;
     }
 
-    block_t *block = (block_t *)((char *)ptr - HEADER_SIZE);
-    size_t old_size = block->size;
+    span_t *span = _span_of(ptr);
 
-    if (_align_size(size, ALIGNMENT, &size) < 0) {
-        return NULL;
+    if (!span && size > SMALL_MAX) {
+        return _large_realloc(ptr, size);
     }
 
-    if (old_size >= size) {
+    size_t old_size = _usable_size(ptr, span);
+
+    // anything that still fits the block's class stays where it is
+    if (span && size <= old_size) {
         return ptr;
     }
 
@@ -227,7 +598,7 @@ void *realloc(void *ptr, size_t size) {
         return NULL;
     }
 
-    memcpy(new_ptr, ptr, old_size);
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
     free(ptr);
     return new_ptr;
 }
@@ -29,3 +29,20 @@ int mprotect(void *addr, size_t len, int prot) {
 int munmap(void *addr, size_t len) {
     return (int)__SYSCALL_ERRNO(syscall2(SYS_MUNMAP, (uintptr_t)addr, (uintptr_t)len));
 }
+
+void *mremap(void *old_address, size_t old_size, size_t new_size, int flags) {
+    long result = syscall4(
+        SYS_MREMAP,
+        (uintptr_t)old_address,
+        (uintptr_t)old_size,
+        (uintptr_t)new_size,
+        (uintptr_t)flags
+    );
+
+    if (result < 0) {
+        errno = (int)-result;
+        return MAP_FAILED;
+    }
+
+    return (void *)result;
+}
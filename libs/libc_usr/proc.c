@@ -118,6 +118,11 @@ static bool _stat_signed_field(proc_stat_t *out, const char *key, const char *va
         if (_parse_i64(value, &parsed)) {
             out->tty_index = (int)parsed;
         }
+    } else if (!strcmp(key, "nice")) {
+        long long parsed = 0;
+        if (_parse_i64(value, &parsed)) {
+            out->nice = (int)parsed;
+        }
     } else {
         return false;
     }
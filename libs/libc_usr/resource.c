@@ -1,3 +1,5 @@
+#include <apheleia/syscall.h>
+#include <arch/sys.h>
 #include <errno.h>
 #include <sys/proc.h>
 #include <sys/resource.h>
@@ -38,3 +40,26 @@ int getrusage(int who, struct rusage *usage) {
 
     return 0;
 }
+
+// -1 is also a valid nice value, callers clear errno first to tell them apart
+int getpriority(int which, id_t who) {
+    long result = syscall2(SYS_GETPRIORITY, (uintptr_t)which, (uintptr_t)who);
+
+    if (result < 0) {
+        errno = (int)-result;
+        return -1;
+    }
+
+    return PRIO_MAX - (int)result;
+}
+
+int setpriority(int which, id_t who, int prio) {
+    long result = syscall3(SYS_SETPRIORITY, (uintptr_t)which, (uintptr_t)who, (uintptr_t)prio);
+
+    if (result < 0) {
+        errno = (int)-result;
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include <apheleia/syscall.h>
+#include <arch/sys.h>
+#include <errno.h>
+#include <sched.h>
+
+int sched_setscheduler(pid_t pid, int policy, const struct sched_param *param) {
+    return (int)__SYSCALL_ERRNO(syscall3(SYS_SCHED_SETSCHEDULER, (uintptr_t)pid, (uintptr_t)policy, (uintptr_t)param));
+}
+
+int sched_getscheduler(pid_t pid) {
+    return (int)__SYSCALL_ERRNO(syscall2(SYS_SCHED_GETSCHEDULER, (uintptr_t)pid, (uintptr_t)NULL));
+}
+
+int sched_setparam(pid_t pid, const struct sched_param *param) {
+    int policy = sched_getscheduler(pid);
+
+    if (policy < 0) {
+        return -1;
+    }
+
+    return sched_setscheduler(pid, policy, param);
+}
+
+int sched_getparam(pid_t pid, struct sched_param *param) {
+    if (!param) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    long result = syscall2(SYS_SCHED_GETSCHEDULER, (uintptr_t)pid, (uintptr_t)param);
+
+    if (result < 0) {
+        errno = (int)-result;
+        return -1;
+    }
+
+    return 0;
+}
+
+int sched_get_priority_min(int policy) {
+    switch (policy) {
+    case SCHED_OTHER:
+        return 0;
+    case SCHED_FIFO:
+    case SCHED_RR:
+        return SCHED_RT_PRIO_MIN;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+int sched_get_priority_max(int policy) {
+    switch (policy) {
+    case SCHED_OTHER:
+        return 0;
+    case SCHED_FIFO:
+    case SCHED_RR:
+        return SCHED_RT_PRIO_MAX;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+int sched_yield(void) {
+    return (int)__SYSCALL_ERRNO(syscall0(SYS_SCHED_YIELD));
+}
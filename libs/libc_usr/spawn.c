@@ -0,0 +1,289 @@
+#include <apheleia/syscall.h>
+#include <arch/sys.h>
+#include <errno.h>
+#include <limits.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int _spawn(
+    pid_t *pid,
+    const char *path,
+    const posix_spawn_file_actions_t *file_actions,
+    const posix_spawnattr_t *attrp,
+    char *const argv[],
+    char *const envp[]
+) {
+    spawn_args_t args = {
+        .path = path,
+        .argv = argv,
+        .envp = envp ? envp : environ,
+        .file_actions = file_actions,
+        .attr = attrp,
+    };
+
+    long result = (long)syscall1(SYS_SPAWN, (uintptr_t)&args);
+    if (result < 0) {
+        return (int)-result;
+    }
+
+    if (pid) {
+        *pid = (pid_t)result;
+    }
+
+    return 0;
+}
+
+int posix_spawn(
+    pid_t *pid,
+    const char *path,
+    const posix_spawn_file_actions_t *file_actions,
+    const posix_spawnattr_t *attrp,
+    char *const argv[],
+    char *const envp[]
+) {
+    if (!path) {
+        return EINVAL;
+    }
+
+    return _spawn(pid, path, file_actions, attrp, argv, envp);
+}
+
+int posix_spawnp(
+    pid_t *pid,
+    const char *file,
+    const posix_spawn_file_actions_t *file_actions,
+    const posix_spawnattr_t *attrp,
+    char *const argv[],
+    char *const envp[]
+) {
+    if (!file || !*file) {
+        return ENOENT;
+    }
+
+    if (strchr(file, '/')) {
+        return _spawn(pid, file, file_actions, attrp, argv, envp);
+    }
+
+    const char *path = getenv("PATH");
+    if (!path || !*path) {
+        path = "/bin";
+    }
+
+    int last_error = ENOENT;
+    const char *segment = path;
+
+    while (1) {
+        const char *separator = strchr(segment, ':');
+        size_t segment_len = separator ? (size_t)(separator - segment) : strlen(segment);
+
+        char full_path[PATH_MAX];
+        int n = 0;
+        if (!segment_len) {
+            n = snprintf(full_path, sizeof(full_path), "./%s", file);
+        } else {
+            n = snprintf(full_path, sizeof(full_path), "%.*s/%s", (int)segment_len, segment, file);
+        }
+
+        if (n > 0 && (size_t)n < sizeof(full_path)) {
+            int err = _spawn(pid, full_path, file_actions, attrp, argv, envp);
+            if (!err) {
+                return 0;
+            }
+
+            if (err != ENOENT && err != ENOTDIR) {
+                last_error = err;
+            }
+        } else {
+            last_error = ENAMETOOLONG;
+        }
+
+        if (!separator) {
+            break;
+        }
+
+        segment = separator + 1;
+    }
+
+    return last_error;
+}
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t *file_actions) {
+    if (!file_actions) {
+        return EINVAL;
+    }
+
+    memset(file_actions, 0, sizeof(*file_actions));
+    return 0;
+}
+
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t *file_actions) {
+    if (!file_actions) {
+        return EINVAL;
+    }
+
+    for (size_t i = 0; i < file_actions->count; i++) {
+        free(file_actions->actions[i].path);
+    }
+
+    free(file_actions->actions);
+    memset(file_actions, 0, sizeof(*file_actions));
+    return 0;
+}
+
+static spawn_action_t *_action_push(posix_spawn_file_actions_t *file_actions, int op, int fd) {
+    if (file_actions->count >= SPAWN_ACTIONS_MAX) {
+        return NULL;
+    }
+
+    if (file_actions->count == file_actions->capacity) {
+        size_t capacity = file_actions->capacity ? file_actions->capacity * 2 : 4;
+        spawn_action_t *grown = realloc(file_actions->actions, capacity * sizeof(*grown));
+        if (!grown) {
+            return NULL;
+        }
+
+        file_actions->actions = grown;
+        file_actions->capacity = capacity;
+    }
+
+    spawn_action_t *action = &file_actions->actions[file_actions->count++];
+    memset(action, 0, sizeof(*action));
+    action->op = op;
+    action->fd = fd;
+
+    return action;
+}
+
+int posix_spawn_file_actions_addopen(
+    posix_spawn_file_actions_t *file_actions,
+    int fd,
+    const char *path,
+    int oflag,
+    mode_t mode
+) {
+    if (!file_actions || !path) {
+        return EINVAL;
+    }
+
+    if (fd < 0) {
+        return EBADF;
+    }
+
+    char *copy = strdup(path);
+    if (!copy) {
+        return ENOMEM;
+    }
+
+    spawn_action_t *action = _action_push(file_actions, SPAWN_ACTION_OPEN, fd);
+    if (!action) {
+        free(copy);
+        return ENOMEM;
+    }
+
+    action->path = copy;
+    action->oflag = oflag;
+    action->mode = mode;
+    return 0;
+}
+
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t *file_actions, int fd) {
+    if (!file_actions) {
+        return EINVAL;
+    }
+
+    if (fd < 0) {
+        return EBADF;
+    }
+
+    return _action_push(file_actions, SPAWN_ACTION_CLOSE, fd) ? 0 : ENOMEM;
+}
+
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t *file_actions, int fd, int newfd) {
+    if (!file_actions) {
+        return EINVAL;
+    }
+
+    if (fd < 0 || newfd < 0) {
+        return EBADF;
+    }
+
+    spawn_action_t *action = _action_push(file_actions, SPAWN_ACTION_DUP2, newfd);
+    if (!action) {
+        return ENOMEM;
+    }
+
+    action->src_fd = fd;
+    return 0;
+}
+
+int posix_spawnattr_init(posix_spawnattr_t *attr) {
+    if (!attr) {
+        return EINVAL;
+    }
+
+    memset(attr, 0, sizeof(*attr));
+    return 0;
+}
+
+int posix_spawnattr_destroy(posix_spawnattr_t *attr) {
+    return attr ? 0 : EINVAL;
+}
+
+int posix_spawnattr_getflags(const posix_spawnattr_t *attr, short *flags) {
+    if (!attr || !flags) {
+        return EINVAL;
+    }
+
+    *flags = attr->flags;
+    return 0;
+}
+
+int posix_spawnattr_setflags(posix_spawnattr_t *attr, short flags) {
+    short known = POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_START_SUSPENDED;
+
+    if (!attr || (flags & ~known)) {
+        return EINVAL;
+    }
+
+    attr->flags = flags;
+    return 0;
+}
+
+int posix_spawnattr_getpgroup(const posix_spawnattr_t *attr, pid_t *pgroup) {
+    if (!attr || !pgroup) {
+        return EINVAL;
+    }
+
+    *pgroup = attr->pgroup;
+    return 0;
+}
+
+int posix_spawnattr_setpgroup(posix_spawnattr_t *attr, pid_t pgroup) {
+    if (!attr || pgroup < 0) {
+        return EINVAL;
+    }
+
+    attr->pgroup = pgroup;
+    return 0;
+}
+
+int posix_spawnattr_getsigdefault(const posix_spawnattr_t *attr, sigset_t *sigdefault) {
+    if (!attr || !sigdefault) {
+        return EINVAL;
+    }
+
+    *sigdefault = attr->sigdefault;
+    return 0;
+}
+
+int posix_spawnattr_setsigdefault(posix_spawnattr_t *attr, const sigset_t *sigdefault) {
+    if (!attr || !sigdefault) {
+        return EINVAL;
+    }
+
+    attr->sigdefault = *sigdefault;
+    return 0;
+}
@@ -0,0 +1,719 @@
+#include <apheleia/syscall.h>
+#include <arch/sys.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/thread.h>
+#include <threads.h>
+#include <time.h>
+
+// threads are clones running on their own mmap'd stack; a join sleeps on the
+// word the kernel clears once the thread is gone. With no thread local storage
+// a thread finds its control block in the top slot of its stack, which is
+// aligned to its size so masking the stack pointer gets there
+
+#define THREAD_STACK_SIZE (128U * 1024U)
+#define THREAD_STACK_MASK ((uintptr_t)THREAD_STACK_SIZE - 1)
+#define THREAD_MAX        128U
+#define TSS_MAX           32U
+
+_Static_assert(SYS_CLONE == 47, "clone stub hardcodes the syscall number");
+
+enum {
+    THREAD_JOINABLE = 0,
+    THREAD_DETACHED,
+    THREAD_EXITED,
+};
+
+struct __thrd {
+    struct __thrd *next;
+    thrd_start_t func;
+    void *arg;
+    int result;
+    int state;
+    volatile int clear_tid; // nonzero until the kernel is done with the thread
+    void *stack;
+    void *tss[TSS_MAX];
+    __libc_local_t local;
+};
+
+typedef struct {
+    volatile uint32_t lock;
+    struct __thrd *live;
+    struct __thrd *dead; // detached and exited, their stacks still need freeing
+    struct __thrd main;
+    tss_dtor_t dtors[TSS_MAX];
+    uint32_t keys;
+    uint32_t nr_threads; // running or being created
+    uintptr_t stack_ceiling; // end of the highest thread stack ever mapped
+} thread_state_t;
+
+static thread_state_t threads = { 0 };
+
+int __libc_threaded = 0;
+
+long _clone(clone_args_t *args);
+
+static long _futex(volatile uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout) {
+    return (long)syscall4(SYS_FUTEX, (uintptr_t)uaddr, (uintptr_t)op, (uintptr_t)val, (uintptr_t)timeout);
+}
+
+int futex(volatile uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout) {
+    return (int)__SYSCALL_ERRNO(_futex(uaddr, op, val, timeout));
+}
+
+pid_t gettid(void) {
+    return (pid_t)syscall0(SYS_GETTID);
+}
+
+void thread_exit(int code) {
+    // the last thread out waits for the others, a signal can cut that short
+    for (;;) {
+        syscall1(SYS_THREAD_EXIT, (uintptr_t)code);
+    }
+}
+
+// false once the absolute deadline has passed, the rest of it otherwise
+static bool _time_left(const struct timespec *deadline, struct timespec *left) {
+    struct timespec now = { 0 };
+    if (!timespec_get(&now, TIME_UTC)) {
+        return false;
+    }
+
+    left->tv_sec = deadline->tv_sec - now.tv_sec;
+    left->tv_nsec = deadline->tv_nsec - now.tv_nsec;
+
+    if (left->tv_nsec < 0) {
+        left->tv_sec--;
+        left->tv_nsec += 1000000000L;
+    }
+
+    return left->tv_sec > 0 || (!left->tv_sec && left->tv_nsec > 0);
+}
+
+static bool _lock_try(volatile uint32_t *lock) {
+    uint32_t seen = 0;
+    return __atomic_compare_exchange_n(lock, &seen, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+// whoever finds the lock taken marks it contended, so the unlock knows to wake
+static int _lock_until(volatile uint32_t *lock, const struct timespec *deadline) {
+    if (_lock_try(lock)) {
+        return thrd_success;
+    }
+
+    while (__atomic_exchange_n(lock, 2, __ATOMIC_ACQUIRE)) {
+        struct timespec left = { 0 };
+
+        if (deadline && !_time_left(deadline, &left)) {
+            return thrd_timedout;
+        }
+
+        _futex(lock, FUTEX_WAIT, 2, deadline ? &left : NULL);
+    }
+
+    return thrd_success;
+}
+
+void __libc_lock(volatile uint32_t *lock) {
+    _lock_until(lock, NULL);
+}
+
+void __libc_unlock(volatile uint32_t *lock) {
+    if (__atomic_exchange_n(lock, 0, __ATOMIC_RELEASE) == 2) {
+        _futex(lock, FUTEX_WAKE, 1, NULL);
+    }
+}
+
+static void _wait_gone(struct __thrd *thread) {
+    int seen = 0;
+
+    while ((seen = __atomic_load_n(&thread->clear_tid, __ATOMIC_ACQUIRE))) {
+        _futex((volatile uint32_t *)&thread->clear_tid, FUTEX_WAIT, (uint32_t)seen, NULL);
+    }
+}
+
+static void *_stack_mmap(void *hint, size_t size) {
+    return mmap(hint, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+}
+
+// new mappings go above the highest one, so the aligned address past the first
+// try is normally free; failing that map twice the size and trim it
+static void *_stack_map(void) {
+    void *stack = _stack_mmap(NULL, THREAD_STACK_SIZE);
+
+    if (stack == MAP_FAILED || !((uintptr_t)stack & THREAD_STACK_MASK)) {
+        return stack;
+    }
+
+    void *want = (void *)(((uintptr_t)stack + THREAD_STACK_MASK) & ~THREAD_STACK_MASK);
+    munmap(stack, THREAD_STACK_SIZE);
+
+    stack = _stack_mmap(want, THREAD_STACK_SIZE);
+    if (stack == want) {
+        return stack;
+    }
+
+    if (stack != MAP_FAILED) {
+        munmap(stack, THREAD_STACK_SIZE);
+    }
+
+    char *wide = _stack_mmap(NULL, 2 * THREAD_STACK_SIZE);
+    if (wide == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+
+    char *aligned = (char *)(((uintptr_t)wide + THREAD_STACK_MASK) & ~THREAD_STACK_MASK);
+    size_t head = (size_t)(aligned - wide);
+
+    if (head) {
+        munmap(wide, head);
+    }
+
+    munmap(aligned + THREAD_STACK_SIZE, THREAD_STACK_SIZE - head);
+    return aligned;
+}
+
+static void _thread_free(struct __thrd *thread) {
+    munmap(thread->stack, THREAD_STACK_SIZE);
+    free(thread);
+}
+
+static void _reap_dead(void) {
+    __libc_lock(&threads.lock);
+
+    struct __thrd **link = &threads.dead;
+    struct __thrd *gone = NULL;
+
+    while (*link) {
+        struct __thrd *thread = *link;
+
+        if (__atomic_load_n(&thread->clear_tid, __ATOMIC_ACQUIRE)) {
+            link = &thread->next;
+            continue;
+        }
+
+        *link = thread->next;
+        thread->next = gone;
+        gone = thread;
+    }
+
+    __libc_unlock(&threads.lock);
+
+    while (gone) {
+        struct __thrd *next = gone->next;
+        _thread_free(gone);
+        gone = next;
+    }
+}
+
+static void _unlink_live(struct __thrd *thread) {
+    for (struct __thrd **link = &threads.live; *link; link = &(*link)->next) {
+        if (*link == thread) {
+            *link = thread->next;
+            thread->next = NULL;
+            return;
+        }
+    }
+}
+
+// mmap never places anything above the main stack's base, so a stack pointer
+// past every thread stack is main's
+static struct __thrd *_self(void) {
+    if (!__atomic_load_n(&__libc_threaded, __ATOMIC_ACQUIRE)) {
+        return &threads.main;
+    }
+
+    uintptr_t sp = (uintptr_t)__builtin_frame_address(0);
+
+    if (sp >= __atomic_load_n(&threads.stack_ceiling, __ATOMIC_ACQUIRE)) {
+        return &threads.main;
+    }
+
+    return *(struct __thrd **)((sp & ~THREAD_STACK_MASK) + THREAD_STACK_SIZE - 16);
+}
+
+__libc_local_t *__libc_local(void) {
+    return &_self()->local;
+}
+
+static void _run_dtors(struct __thrd *self) {
+    for (unsigned pass = 0; pass < TSS_DTOR_ITERATIONS; pass++) {
+        bool ran = false;
+
+        for (tss_t key = 0; key < TSS_MAX; key++) {
+            void *value = self->tss[key];
+            tss_dtor_t dtor = threads.dtors[key];
+
+            if (!value || !dtor || !(threads.keys & (1U << key))) {
+                continue;
+            }
+
+            self->tss[key] = NULL;
+            dtor(value);
+            ran = true;
+        }
+
+        if (!ran) {
+            return;
+        }
+    }
+}
+
+__attribute__((noreturn)) static void _thread_finish(struct __thrd *self, int result) {
+    _run_dtors(self);
+    self->result = result;
+
+    __libc_heap_release(self->local.heap);
+    self->local.heap = NULL;
+
+    __libc_lock(&threads.lock);
+    _unlink_live(self);
+
+    // a detached thread has nobody to join it, the next create frees it
+    int expected = THREAD_JOINABLE;
+    if (!__atomic_compare_exchange_n(&self->state, &expected, THREAD_EXITED, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        self->next = threads.dead;
+        threads.dead = self;
+    }
+
+    __libc_unlock(&threads.lock);
+
+    __atomic_fetch_sub(&threads.nr_threads, 1, __ATOMIC_RELEASE);
+    thread_exit(result);
+}
+
+__attribute__((used, noreturn, visibility("hidden"))) void _thread_start(struct __thrd *self) {
+    _thread_finish(self, self->func(self->arg));
+}
+
+// the child returns from the trap on its new stack, whose top slot holds its
+// control block, and never comes back through here
+// clang-format off
+#if defined(__x86_64__)
+__asm__(
+    ".globl _clone\n"
+    ".hidden _clone\n"
+    ".type _clone, @function\n"
+    "_clone:\n"
+    "movl $47, %eax\n"
+    "int $0x80\n"
+    "testq %rax, %rax\n"
+    "jnz 0f\n"
+    "movq (%rsp), %rdi\n"
+    "call _thread_start\n"
+    "ud2\n"
+    "0:\n"
+    "ret\n"
+);
+#elif defined(__i386__)
+__asm__(
+    ".globl _clone\n"
+    ".hidden _clone\n"
+    ".type _clone, @function\n"
+    "_clone:\n"
+    "pushl %ebx\n"
+    "movl 8(%esp), %ebx\n"
+    "movl $47, %eax\n"
+    "int $0x80\n"
+    "testl %eax, %eax\n"
+    "jnz 0f\n"
+    "call _thread_start\n"
+    "ud2\n"
+    "0:\n"
+    "popl %ebx\n"
+    "ret\n"
+);
+#elif defined(__riscv)
+#if __riscv_xlen == 64
+#define CLONE_LOAD "ld"
+#else
+#define CLONE_LOAD "lw"
+#endif
+__asm__(
+    ".globl _clone\n"
+    ".hidden _clone\n"
+    ".type _clone, @function\n"
+    "_clone:\n"
+    "li a7, 47\n"
+    "ecall\n"
+    "bnez a0, 0f\n"
+    CLONE_LOAD " a0, 0(sp)\n"
+    "call _thread_start\n"
+    "unimp\n"
+    "0:\n"
+    "ret\n"
+);
+#else
+#error "Unsupported architecture"
+#endif
+// clang-format on
+
+int thrd_create(thrd_t *thr, thrd_start_t func, void *arg) {
+    if (!thr || !func) {
+        return thrd_error;
+    }
+
+    _reap_dead();
+
+    if (__atomic_add_fetch(&threads.nr_threads, 1, __ATOMIC_ACQ_REL) > THREAD_MAX) {
+        __atomic_fetch_sub(&threads.nr_threads, 1, __ATOMIC_RELEASE);
+        return thrd_error;
+    }
+
+    struct __thrd *thread = calloc(1, sizeof(*thread));
+    if (!thread) {
+        __atomic_fetch_sub(&threads.nr_threads, 1, __ATOMIC_RELEASE);
+        return thrd_nomem;
+    }
+
+    void *stack = _stack_map();
+    if (stack == MAP_FAILED) {
+        __atomic_fetch_sub(&threads.nr_threads, 1, __ATOMIC_RELEASE);
+        free(thread);
+        return thrd_nomem;
+    }
+
+    void **slot = (void **)((char *)stack + THREAD_STACK_SIZE - 16);
+    *slot = thread;
+
+    thread->func = func;
+    thread->arg = arg;
+    thread->stack = stack;
+    thread->clear_tid = -1;
+
+    clone_args_t args = {
+        .stack = stack,
+        .stack_size = THREAD_STACK_SIZE,
+        .sp = slot,
+        .clear_tid = (int *)&thread->clear_tid,
+    };
+
+    // from here on malloc and stdio may be entered from two threads at once
+    __atomic_store_n(&__libc_threaded, 1, __ATOMIC_RELEASE);
+
+    __libc_lock(&threads.lock);
+    thread->next = threads.live;
+    threads.live = thread;
+
+    // raised before the thread runs, so its first _self already sees it
+    uintptr_t end = (uintptr_t)stack + THREAD_STACK_SIZE;
+    if (end > threads.stack_ceiling) {
+        __atomic_store_n(&threads.stack_ceiling, end, __ATOMIC_RELEASE);
+    }
+
+    __libc_unlock(&threads.lock);
+
+    long tid = _clone(&args);
+
+    if (tid < 0) {
+        __libc_lock(&threads.lock);
+        _unlink_live(thread);
+        __libc_unlock(&threads.lock);
+
+        __atomic_fetch_sub(&threads.nr_threads, 1, __ATOMIC_RELEASE);
+        _thread_free(thread);
+        return tid == -ENOMEM ? thrd_nomem : thrd_error;
+    }
+
+    *thr = thread;
+    return thrd_success;
+}
+
+thrd_t thrd_current(void) {
+    return _self();
+}
+
+int thrd_equal(thrd_t lhs, thrd_t rhs) {
+    return lhs == rhs;
+}
+
+int thrd_detach(thrd_t thr) {
+    if (!thr || thr == &threads.main) {
+        return thrd_error;
+    }
+
+    int expected = THREAD_JOINABLE;
+    if (__atomic_compare_exchange_n(&thr->state, &expected, THREAD_DETACHED, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return thrd_success;
+    }
+
+    // it already exited and is waiting for a join, do that instead
+    return thrd_join(thr, NULL);
+}
+
+int thrd_join(thrd_t thr, int *res) {
+    if (!thr || thr == &threads.main || thr == _self()) {
+        return thrd_error;
+    }
+
+    _wait_gone(thr);
+
+    if (res) {
+        *res = thr->result;
+    }
+
+    _thread_free(thr);
+    return thrd_success;
+}
+
+int thrd_sleep(const struct timespec *duration, struct timespec *remaining) {
+    if (!nanosleep(duration, remaining)) {
+        return 0;
+    }
+
+    return errno == EINTR ? -1 : -2;
+}
+
+void thrd_yield(void) {
+    sched_yield();
+}
+
+void thrd_exit(int res) {
+    struct __thrd *self = _self();
+
+    if (self != &threads.main) {
+        _thread_finish(self, res);
+    }
+
+    // the process lives on until its last thread is gone, with res as its status
+    _run_dtors(self);
+    thread_exit(res);
+}
+
+int mtx_init(mtx_t *mtx, int type) {
+    if (!mtx || (type & ~(mtx_recursive | mtx_timed))) {
+        return thrd_error;
+    }
+
+    *mtx = (mtx_t){ .type = type };
+    return thrd_success;
+}
+
+// only recursive mutexes need to know their owner, plain ones skip the tid call
+static int _mtx_acquire(mtx_t *mtx, const struct timespec *deadline, bool try) {
+    if (!mtx) {
+        return thrd_error;
+    }
+
+    pid_t self = 0;
+
+    if (mtx->type & mtx_recursive) {
+        self = gettid();
+
+        if (__atomic_load_n(&mtx->owner, __ATOMIC_RELAXED) == self) {
+            mtx->depth++;
+            return thrd_success;
+        }
+    }
+
+    int status = thrd_success;
+
+    if (try) {
+        status = _lock_try(&mtx->lock) ? thrd_success : thrd_busy;
+    } else {
+        status = _lock_until(&mtx->lock, deadline);
+    }
+
+    if (status == thrd_success) {
+        __atomic_store_n(&mtx->owner, self, __ATOMIC_RELAXED);
+        mtx->depth = 1;
+    }
+
+    return status;
+}
+
+int mtx_lock(mtx_t *mtx) {
+    return _mtx_acquire(mtx, NULL, false);
+}
+
+int mtx_timedlock(mtx_t *mtx, const struct timespec *time_point) {
+    if (!mtx || !time_point || !(mtx->type & mtx_timed)) {
+        return thrd_error;
+    }
+
+    return _mtx_acquire(mtx, time_point, false);
+}
+
+int mtx_trylock(mtx_t *mtx) {
+    return _mtx_acquire(mtx, NULL, true);
+}
+
+int mtx_unlock(mtx_t *mtx) {
+    if (!mtx || !mtx->depth) {
+        return thrd_error;
+    }
+
+    if (--mtx->depth) {
+        return thrd_success;
+    }
+
+    __atomic_store_n(&mtx->owner, 0, __ATOMIC_RELAXED);
+    __libc_unlock(&mtx->lock);
+    return thrd_success;
+}
+
+void mtx_destroy(mtx_t *mtx) {
+    (void)mtx;
+}
+
+int cnd_init(cnd_t *cond) {
+    if (!cond) {
+        return thrd_error;
+    }
+
+    cond->seq = 0;
+    return thrd_success;
+}
+
+static int _cnd_wake(cnd_t *cond, uint32_t count) {
+    if (!cond) {
+        return thrd_error;
+    }
+
+    __atomic_add_fetch(&cond->seq, 1, __ATOMIC_RELEASE);
+    _futex(&cond->seq, FUTEX_WAKE, count, NULL);
+    return thrd_success;
+}
+
+int cnd_signal(cnd_t *cond) {
+    return _cnd_wake(cond, 1);
+}
+
+int cnd_broadcast(cnd_t *cond) {
+    return _cnd_wake(cond, INT_MAX);
+}
+
+// the sequence is read before the mutex drops, so a wake in between changes it
+// and the futex returns at once instead of sleeping through the signal
+static int _cnd_wait(cnd_t *cond, mtx_t *mtx, const struct timespec *deadline) {
+    if (!cond || !mtx || !mtx->depth) {
+        return thrd_error;
+    }
+
+    uint32_t seq = __atomic_load_n(&cond->seq, __ATOMIC_ACQUIRE);
+    pid_t owner = mtx->owner;
+    unsigned depth = mtx->depth;
+
+    mtx->depth = 1;
+    mtx_unlock(mtx);
+
+    int status = thrd_success;
+    struct timespec left = { 0 };
+
+    if (deadline && !_time_left(deadline, &left)) {
+        status = thrd_timedout;
+    } else if (_futex(&cond->seq, FUTEX_WAIT, seq, deadline ? &left : NULL) == -ETIMEDOUT) {
+        status = thrd_timedout;
+    }
+
+    _lock_until(&mtx->lock, NULL);
+    __atomic_store_n(&mtx->owner, owner, __ATOMIC_RELAXED);
+    mtx->depth = depth;
+
+    return status;
+}
+
+int cnd_wait(cnd_t *cond, mtx_t *mtx) {
+    return _cnd_wait(cond, mtx, NULL);
+}
+
+int cnd_timedwait(cnd_t *cond, mtx_t *mtx, const struct timespec *time_point) {
+    if (!time_point) {
+        return thrd_error;
+    }
+
+    return _cnd_wait(cond, mtx, time_point);
+}
+
+void cnd_destroy(cnd_t *cond) {
+    (void)cond;
+}
+
+enum {
+    ONCE_NEW = 0,
+    ONCE_RUNNING,
+    ONCE_DONE,
+};
+
+void call_once(once_flag *flag, void (*func)(void)) {
+    if (__atomic_load_n(&flag->state, __ATOMIC_ACQUIRE) == ONCE_DONE) {
+        return;
+    }
+
+    uint32_t seen = ONCE_NEW;
+    if (__atomic_compare_exchange_n(&flag->state, &seen, ONCE_RUNNING, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        func();
+        __atomic_store_n(&flag->state, ONCE_DONE, __ATOMIC_RELEASE);
+        _futex(&flag->state, FUTEX_WAKE, INT_MAX, NULL);
+        return;
+    }
+
+    while ((seen = __atomic_load_n(&flag->state, __ATOMIC_ACQUIRE)) != ONCE_DONE) {
+        _futex(&flag->state, FUTEX_WAIT, seen, NULL);
+    }
+}
+
+int tss_create(tss_t *key, tss_dtor_t dtor) {
+    if (!key) {
+        return thrd_error;
+    }
+
+    __libc_lock(&threads.lock);
+
+    tss_t slot = 0;
+    while (slot < TSS_MAX && (threads.keys & (1U << slot))) {
+        slot++;
+    }
+
+    if (slot == TSS_MAX) {
+        __libc_unlock(&threads.lock);
+        return thrd_error;
+    }
+
+    // a reused key must not hand out values from its previous life
+    threads.main.tss[slot] = NULL;
+    for (struct __thrd *thread = threads.live; thread; thread = thread->next) {
+        thread->tss[slot] = NULL;
+    }
+
+    threads.keys |= 1U << slot;
+    threads.dtors[slot] = dtor;
+
+    __libc_unlock(&threads.lock);
+
+    *key = slot;
+    return thrd_success;
+}
+
+void *tss_get(tss_t key) {
+    if (key >= TSS_MAX) {
+        return NULL;
+    }
+
+    return _self()->tss[key];
+}
+
+int tss_set(tss_t key, void *value) {
+    if (key >= TSS_MAX) {
+        return thrd_error;
+    }
+
+    _self()->tss[key] = value;
+    return thrd_success;
+}
+
+void tss_delete(tss_t key) {
+    if (key >= TSS_MAX) {
+        return;
+    }
+
+    __libc_lock(&threads.lock);
+    threads.keys &= ~(1U << key);
+    threads.dtors[key] = NULL;
+    __libc_unlock(&threads.lock);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <threads.h>
+#include <time.h>
+
+int thrd_create(thrd_t *thr, thrd_start_t func, void *arg);
+thrd_t thrd_current(void);
+int thrd_equal(thrd_t lhs, thrd_t rhs);
+int thrd_detach(thrd_t thr);
+int thrd_join(thrd_t thr, int *res);
+int thrd_sleep(const struct timespec *duration, struct timespec *remaining);
+void thrd_yield(void);
+void thrd_exit(int res) __attribute__((noreturn));
+
+int mtx_init(mtx_t *mtx, int type);
+int mtx_lock(mtx_t *mtx);
+int mtx_timedlock(mtx_t *mtx, const struct timespec *time_point);
+int mtx_trylock(mtx_t *mtx);
+int mtx_unlock(mtx_t *mtx);
+void mtx_destroy(mtx_t *mtx);
+
+int cnd_init(cnd_t *cond);
+int cnd_signal(cnd_t *cond);
+int cnd_broadcast(cnd_t *cond);
+int cnd_wait(cnd_t *cond, mtx_t *mtx);
+int cnd_timedwait(cnd_t *cond, mtx_t *mtx, const struct timespec *time_point);
+void cnd_destroy(cnd_t *cond);
+
+void call_once(once_flag *flag, void (*func)(void));
+
+int tss_create(tss_t *key, tss_dtor_t dtor);
+void *tss_get(tss_t key);
+int tss_set(tss_t key, void *value);
+void tss_delete(tss_t key);
+
+// set once a second thread exists; libc takes its internal locks only then
+extern int __libc_threaded;
+
+void __libc_lock(volatile uint32_t *lock);
+void __libc_unlock(volatile uint32_t *lock);
+
+// what libc keeps per thread: errno and the malloc bins
+typedef struct {
+    int err;
+    void *heap;
+} __libc_local_t;
+
+// the calling thread's, found from its stack pointer without a syscall
+__libc_local_t *__libc_local(void);
+
+// keeps a finished thread's malloc bins for the next thread, or hands them
+// back to the shared spans when one is already kept
+void __libc_heap_release(void *heap);
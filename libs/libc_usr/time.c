@@ -47,6 +47,14 @@ int clock_gettime(clockid_t clock_id, struct timespec *tp) {
     return -1;
 }
 
+int timespec_get(struct timespec *ts, int base) {
+    if (base != TIME_UTC || clock_gettime(CLOCK_REALTIME, ts) < 0) {
+        return 0;
+    }
+
+    return base;
+}
+
 int nanosleep(const struct timespec *req, struct timespec *rem) {
     return syscall_sleep(req, rem);
 }
@@ -12,6 +12,7 @@
 #include <string.h>
 #include <sys/mount.h>
 #include <sys/proc.h>
+#include <sys/resource.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
@@ -199,6 +200,30 @@ int usleep(useconds_t usec) {
     return nanosleep(&req, NULL);
 }
 
+int nice(int inc) {
+    errno = 0;
+    int prio = getpriority(PRIO_PROCESS, 0);
+
+    if (prio == -1 && errno) {
+        return -1;
+    }
+
+    // summed wide, any int increment just lands on the end of the range
+    long long target = (long long)prio + inc;
+    target = target < PRIO_MIN ? PRIO_MIN : target;
+    target = target > PRIO_MAX - 1 ? PRIO_MAX - 1 : target;
+
+    if (setpriority(PRIO_PROCESS, 0, (int)target) < 0) {
+        if (errno == EACCES) {
+            errno = EPERM;
+        }
+
+        return -1;
+    }
+
+    return getpriority(PRIO_PROCESS, 0);
+}
+
 int chdir(const char *path) {
     return SYSCALL_RET(int, syscall1(SYS_CHDIR, (uintptr_t)path));
 }
@@ -728,6 +753,34 @@ int setgroups(size_t size, const gid_t list[]) {
     return 0;
 }
 
+// the kernel reports its online cores in /dev/cpu, assume one when it cannot be read
+static long _online_cpus(void) {
+    char text[512];
+    long cpus = 1;
+
+    int fd = open("/dev/cpu", O_RDONLY, 0);
+    if (fd < 0) {
+        return cpus;
+    }
+
+    ssize_t len = read(fd, text, sizeof(text) - 1);
+    close(fd);
+
+    if (len <= 0) {
+        return cpus;
+    }
+
+    text[len] = '\0';
+
+    const char *field = strstr(text, "cores=");
+    if (field) {
+        long parsed = strtol(field + 6, NULL, 10);
+        cpus = parsed > 0 ? parsed : 1;
+    }
+
+    return cpus;
+}
+
 long sysconf(int name) {
     switch (name) {
     case _SC_ARG_MAX:
@@ -742,7 +795,7 @@ long sysconf(int name) {
         return 4096;
     case _SC_NPROCESSORS_CONF:
     case _SC_NPROCESSORS_ONLN:
-        return 1;
+        return _online_cpus();
     default:
         errno = EINVAL;
         return -1;
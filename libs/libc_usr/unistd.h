@@ -26,6 +26,7 @@ off_t lseek(int fd, off_t offset, int whence);
 mode_t umask(mode_t mask);
 unsigned int sleep(unsigned int seconds);
 int usleep(useconds_t usec);
+int nice(int inc);
 int chdir(const char *path);
 char *getcwd(char *buf, size_t size);
 int isatty(int fd);
@@ -51,6 +52,7 @@ int mount(const char *source, const char *target, const char *filesystemtype, un
 int umount(const char *target, unsigned long flags);
 
 pid_t fork(void);
+pid_t vfork(void);
 pid_t wait(int *status);
 pid_t waitpid(pid_t pid, int *status, int options);
 int execve(const char *path, char *const argv[], char *const envp[]);
@@ -0,0 +1,65 @@
+#include <apheleia/syscall.h>
+#include <errno.h>
+#include <unistd.h>
+
+// the child runs on the parent's stack, so vfork cannot keep its return
+// address there: it is held in a register across the trap and pushed back
+_Static_assert(SYS_VFORK == 44, "vfork stub hardcodes the syscall number");
+
+__attribute__((used, visibility("hidden"))) long _vfork_error(long ret) {
+    errno = (int)-ret;
+    return -1;
+}
+
+// clang-format off
+#if defined(__x86_64__)
+__asm__(
+    ".globl vfork\n"
+    ".type vfork, @function\n"
+    "vfork:\n"
+    "popq %rcx\n"
+    "movl $44, %eax\n"
+    "int $0x80\n"
+    "pushq %rcx\n"
+    "testl %eax, %eax\n"
+    "js 0f\n"
+    "ret\n"
+    "0:\n"
+    "movslq %eax, %rdi\n"
+    "jmp _vfork_error\n"
+);
+#elif defined(__i386__)
+__asm__(
+    ".globl vfork\n"
+    ".type vfork, @function\n"
+    "vfork:\n"
+    "popl %ecx\n"
+    "movl $44, %eax\n"
+    "int $0x80\n"
+    "pushl %ecx\n"
+    "testl %eax, %eax\n"
+    "js 0f\n"
+    "ret\n"
+    "0:\n"
+    "pushl %eax\n"
+    "call _vfork_error\n"
+    "addl $4, %esp\n"
+    "ret\n"
+);
+#elif defined(__riscv)
+__asm__(
+    ".globl vfork\n"
+    ".type vfork, @function\n"
+    "vfork:\n"
+    "li a7, 44\n"
+    "li a0, 0\n"
+    "ecall\n"
+    "bltz a0, 0f\n"
+    "ret\n"
+    "0:\n"
+    "tail _vfork_error\n"
+);
+#else
+#error "Unsupported architecture"
+#endif
+// clang-format on
@@ -64,6 +64,7 @@ enum {
     FDT_DEFAULT_ADDR_CELLS = 2,
     FDT_DEFAULT_SIZE_CELLS = 1,
     FDT_MAX_IRQ_PROVIDERS = 64,
+    FDT_MAX_CPUS = 64,
 };
 
 static inline u32 fdt_be32(const void *ptr) {
@@ -1172,6 +1173,200 @@ bool fdt_find_irq_contexts(
     return found > 0;
 }
 
+typedef struct {
+    u32 phandle;
+    u64 hartid;
+} fdt_cpu_node_t;
+
+typedef struct {
+    u32 phandle;
+    u32 package;
+    u32 cluster;
+    u32 core;
+} fdt_cpu_map_entry_t;
+
+static bool fdt_name_index(const char *name, const char *prefix, u32 *out) {
+    size_t len = strlen(prefix);
+
+    if (strncmp(name, prefix, len) || !name[len]) {
+        return false;
+    }
+
+    u32 value = 0;
+    for (const char *p = name + len; *p; p++) {
+        if (*p < '0' || *p > '9') {
+            return false;
+        }
+
+        value = value * 10 + (u32)(*p - '0');
+    }
+
+    *out = value;
+    return true;
+}
+
+// walks /cpus/cpu-map: socketN/clusterN/coreN[/threadN] leaves point at cpu
+// nodes by phandle. Clusters and cores get ids unique across the whole map
+// since the spec only numbers them within their parent
+bool fdt_find_cpu_map(const void *dtb, fdt_cpu_topology_t *out, size_t max_cpus, size_t *out_count) {
+    if (out_count) {
+        *out_count = 0;
+    }
+
+    if (!out && max_cpus) {
+        return false;
+    }
+
+    fdt_view_t fdt;
+    if (!fdt_view_init(dtb, &fdt)) {
+        return false;
+    }
+
+    fdt_node_state_t stack[FDT_STACK_DEPTH];
+    fdt_cpu_node_t cpus[FDT_MAX_CPUS];
+    fdt_cpu_map_entry_t entries[FDT_MAX_CPUS];
+    size_t cpu_count = 0;
+    size_t entry_count = 0;
+    int depth = -1;
+    int cpus_depth = -1;
+    int map_depth = -1;
+    u32 cluster_seq = 0;
+    u32 core_seq = 0;
+    fdt_cpu_map_entry_t place = { 0 };
+
+    const u8 *p = fdt.dt_struct;
+    u32 token = 0;
+
+    while (fdt_read_token(&fdt, &p, &token)) {
+        if (token == FDT_BEGIN_NODE) {
+            const u8 *name_at = p;
+            const char *name = NULL;
+
+            if (!fdt_read_name(&name_at, fdt.dt_end, &name) || !fdt_begin_node(&fdt, &p, stack, &depth)) {
+                return false;
+            }
+
+            if (depth == 1 && !strcmp(name, "cpus")) {
+                cpus_depth = depth;
+            } else if (cpus_depth >= 0 && depth == cpus_depth + 1 && !strcmp(name, "cpu-map")) {
+                map_depth = depth;
+            } else if (map_depth >= 0) {
+                u32 index = 0;
+
+                if (fdt_name_index(name, "socket", &index)) {
+                    place.package = index;
+                } else if (fdt_name_index(name, "cluster", &index)) {
+                    place.cluster = ++cluster_seq;
+                } else if (fdt_name_index(name, "core", &index)) {
+                    place.core = ++core_seq;
+                }
+            }
+
+            continue;
+        }
+
+        if (token == FDT_END_NODE) {
+            if (depth < 0) {
+                return false;
+            }
+
+            fdt_node_state_t *node = &stack[depth];
+            bool reg_ok = node->reg_data && node->addr_cells && node->addr_cells <= 2 &&
+                          node->reg_len >= node->addr_cells * sizeof(u32);
+
+            if (node->cpu && node->phandle && reg_ok && cpu_count < FDT_MAX_CPUS) {
+                cpus[cpu_count++] = (fdt_cpu_node_t){
+                    .phandle = node->phandle,
+                    .hartid = read_cells(node->reg_data, node->addr_cells),
+                };
+            }
+
+            if (depth == map_depth) {
+                map_depth = -1;
+            } else if (depth == cpus_depth) {
+                cpus_depth = -1;
+            }
+
+            if (!fdt_leave_node(&depth)) {
+                return false;
+            }
+
+            continue;
+        }
+
+        if (token == FDT_PROP) {
+            fdt_prop_t prop;
+            fdt_node_state_t *node = NULL;
+
+            if (!fdt_node_prop(&fdt, &p, stack, depth, &prop, &node)) {
+                return false;
+            }
+
+            if (!node) {
+                continue;
+            }
+
+            if (!strcmp(prop.name, "phandle") || !strcmp(prop.name, "linux,phandle")) {
+                if (!prop_u32(&prop, &node->phandle)) {
+                    return false;
+                }
+
+                continue;
+            }
+
+            if (map_depth >= 0 && depth > map_depth && !strcmp(prop.name, "cpu") && entry_count < FDT_MAX_CPUS) {
+                fdt_cpu_map_entry_t entry = place;
+
+                if (!prop_u32(&prop, &entry.phandle)) {
+                    return false;
+                }
+
+                entries[entry_count++] = entry;
+            }
+
+            continue;
+        }
+
+        if (token == FDT_NOP) {
+            continue;
+        }
+
+        if (token == FDT_END) {
+            break;
+        }
+
+        return false;
+    }
+
+    size_t found = 0;
+
+    for (size_t i = 0; i < entry_count; i++) {
+        for (size_t j = 0; j < cpu_count; j++) {
+            if (cpus[j].phandle != entries[i].phandle) {
+                continue;
+            }
+
+            if (found < max_cpus) {
+                out[found] = (fdt_cpu_topology_t){
+                    .hartid = cpus[j].hartid,
+                    .package = entries[i].package,
+                    .cluster = entries[i].cluster,
+                    .core = entries[i].core,
+                };
+            }
+
+            found++;
+            break;
+        }
+    }
+
+    if (out_count) {
+        *out_count = found > max_cpus ? max_cpus : found;
+    }
+
+    return found > 0;
+}
+
 bool fdt_find_u32(const void *dtb, const char *compatible, const char *property, u32 *out) {
     if (!compatible || !property || !out) {
         return false;
@@ -17,6 +17,14 @@ typedef struct {
     u32 irq;
 } fdt_irq_context_t;
 
+// ids are only meaningful for equality, harts sharing one share that level
+typedef struct {
+    u64 hartid;
+    u32 package;
+    u32 cluster;
+    u32 core;
+} fdt_cpu_topology_t;
+
 bool fdt_valid(const void *dtb);
 size_t fdt_size(const void *dtb);
 bool fdt_boot_cpuid_phys(const void *dtb, u64 *out);
@@ -40,6 +48,8 @@ bool fdt_find_irq_contexts(
     size_t *out_count
 );
 
+bool fdt_find_cpu_map(const void *dtb, fdt_cpu_topology_t *out, size_t max_cpus, size_t *out_count);
+
 bool fdt_find_u32(const void *dtb, const char *compatible, const char *property, u32 *out);
 
 bool fdt_find_initrd(const void *dtb, fdt_reg_t *out);
@@ -0,0 +1,137 @@
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static bool parse_number(const char *text, long min, long max, long *out) {
+    if (!text || !*text || !out) {
+        return false;
+    }
+
+    errno = 0;
+    char *end = NULL;
+    long value = strtol(text, &end, 10);
+
+    if (errno == ERANGE || end == text || *end || value < min || value > max) {
+        return false;
+    }
+
+    *out = value;
+    return true;
+}
+
+static const char *policy_name(int policy) {
+    switch (policy) {
+    case SCHED_FIFO:
+        return "SCHED_FIFO";
+    case SCHED_RR:
+        return "SCHED_RR";
+    default:
+        return "SCHED_OTHER";
+    }
+}
+
+static int show(pid_t pid) {
+    struct sched_param param = { 0 };
+    int policy = sched_getscheduler(pid);
+
+    if (policy < 0 || sched_getparam(pid, &param) < 0) {
+        fprintf(stderr, "chrt: %ld: %s\n", (long)pid, strerror(errno));
+        return 1;
+    }
+
+    printf("pid %ld: %s priority %d\n", (long)pid, policy_name(policy), param.sched_priority);
+    return 0;
+}
+
+static void usage(void) {
+    static const char text[] = "usage: chrt [-f|-r|-o] PRIO COMMAND [ARG]...\n"
+                               "       chrt -p [-f|-r|-o] PRIO PID\n"
+                               "       chrt -p PID\n";
+    write(STDERR_FILENO, text, sizeof(text) - 1);
+}
+
+int main(int argc, char **argv) {
+    int policy = SCHED_RR;
+    bool on_pid = false;
+    int argi = 1;
+
+    for (; argi < argc && argv[argi][0] == '-'; argi++) {
+        const char *arg = argv[argi];
+
+        if (!strcmp(arg, "--")) {
+            argi++;
+            break;
+        }
+
+        if (!strcmp(arg, "-f")) {
+            policy = SCHED_FIFO;
+        } else if (!strcmp(arg, "-r")) {
+            policy = SCHED_RR;
+        } else if (!strcmp(arg, "-o")) {
+            policy = SCHED_OTHER;
+        } else if (!strcmp(arg, "-p")) {
+            on_pid = true;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    long value = 0;
+
+    if (on_pid && argc - argi == 1) {
+        if (!parse_number(argv[argi], 0, INT_MAX, &value)) {
+            usage();
+            return 1;
+        }
+
+        return show((pid_t)value);
+    }
+
+    if (argi + 1 >= argc || (on_pid && argi + 2 != argc)) {
+        usage();
+        return 1;
+    }
+
+    long prio = 0;
+    int min = sched_get_priority_min(policy);
+    int max = sched_get_priority_max(policy);
+
+    if (!parse_number(argv[argi], min, max, &prio)) {
+        fprintf(stderr, "chrt: priority must be %d to %d for %s\n", min, max, policy_name(policy));
+        return 1;
+    }
+
+    pid_t pid = 0;
+
+    if (on_pid) {
+        if (!parse_number(argv[argi + 1], 1, INT_MAX, &value)) {
+            usage();
+            return 1;
+        }
+
+        pid = (pid_t)value;
+    }
+
+    struct sched_param param = { .sched_priority = (int)prio };
+
+    if (sched_setscheduler(pid, policy, &param) < 0) {
+        fprintf(stderr, "chrt: %s\n", strerror(errno));
+        return 1;
+    }
+
+    if (on_pid) {
+        return 0;
+    }
+
+    // the class carries over the exec
+    execvp(argv[argi + 1], &argv[argi + 1]);
+
+    fprintf(stderr, "chrt: %s: %s\n", argv[argi + 1], strerror(errno));
+    return errno == ENOENT ? 127 : 126;
+}
@@ -155,7 +155,8 @@ static int run_script_sync(const char *path) {
         return 0;
     }
 
-    pid_t pid = fork();
+    // the child only execs, so it can borrow our address space instead of copying it
+    pid_t pid = vfork();
     if (!pid) {
         char *args[] = { "sh", (char *)path, NULL };
         execve("/bin/sh", args, NULL);
@@ -164,7 +165,7 @@ static int run_script_sync(const char *path) {
     }
 
     if (pid < 0) {
-        io_write_str("init: failed to fork startup script\n");
+        io_write_str("init: failed to vfork startup script\n");
         return -1;
     }
 
@@ -215,7 +216,7 @@ static pid_t spawn_getty(const char *tty_path) {
         return -1;
     }
 
-    pid_t pid = fork();
+    pid_t pid = vfork();
 
     if (!pid) {
         char *args[] = { "getty", (char *)tty_path, "/bin/login", NULL };
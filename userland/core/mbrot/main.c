@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <term_size.h>
+#include <threads.h>
 #include <ui.h>
 #include <unistd.h>
 
@@ -22,6 +23,7 @@
 #define MBROT_HUD_BG_RENDERING 0x00330000U
 #define MBROT_SCALE_MIN        0.000000000001
 #define MBROT_SCALE_MAX        8.0
+#define MBROT_WORKERS_MAX      8U
 
 typedef struct {
     double center_x;
@@ -64,6 +66,14 @@ typedef struct {
     double step_dx;
 } mbrot_render_ctx_t;
 
+typedef void (*mbrot_row_fn_t)(const mbrot_render_ctx_t *ctx, u32 y);
+
+typedef struct {
+    const mbrot_render_ctx_t *ctx;
+    mbrot_row_fn_t render_row;
+    u32 next_row;
+} mbrot_row_queue_t;
+
 typedef struct {
     const char *title;
     double center_x;
@@ -639,6 +649,48 @@ static void render_row_blocks(const mbrot_render_ctx_t *ctx, u32 y) {
     }
 }
 
+static void render_rows(mbrot_row_queue_t *queue) {
+    const mbrot_render_ctx_t *ctx = queue->ctx;
+
+    for (;;) {
+        u32 y = __atomic_fetch_add(&queue->next_row, ctx->step, __ATOMIC_RELAXED);
+        if (y >= ctx->fb->height) {
+            return;
+        }
+
+        queue->render_row(ctx, y);
+    }
+}
+
+static int render_worker(void *arg) {
+    render_rows(arg);
+    return 0;
+}
+
+// rows go to whichever thread asks next, so the slow band through the set
+// does not leave the other cores idle while one thread grinds through it
+static void render_rows_parallel(const mbrot_render_ctx_t *ctx, mbrot_row_fn_t render_row) {
+    mbrot_row_queue_t queue = { .ctx = ctx, .render_row = render_row, .next_row = 0 };
+    thrd_t workers[MBROT_WORKERS_MAX - 1];
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    u32 helpers = cpus > 1 ? (u32)cpus - 1 : 0;
+    if (helpers > MBROT_WORKERS_MAX - 1) {
+        helpers = MBROT_WORKERS_MAX - 1;
+    }
+
+    u32 started = 0;
+    while (started < helpers && thrd_create(&workers[started], render_worker, &queue) == thrd_success) {
+        started++;
+    }
+
+    render_rows(&queue);
+
+    for (u32 i = 0; i < started; i++) {
+        thrd_join(workers[i], NULL);
+    }
+}
+
 static bool flush_frame(window_t *window) {
     return window && window_flush(window) == 0;
 }
@@ -665,16 +717,14 @@ static bool render_fractal_pass(
     }
     target_step = clamp_render_step(target_step);
 
-    void (*render_row)(const mbrot_render_ctx_t *, u32) = (ctx.step == 1U) ? render_row_pixels : render_row_blocks;
+    mbrot_row_fn_t render_row = (ctx.step == 1U) ? render_row_pixels : render_row_blocks;
 
     draw_status_overlay(ctx.fb, view, fractal, ctx.step, target_step, true);
     if (!flush_frame(window) && errno != EAGAIN && errno != EINTR) {
         return false;
     }
 
-    for (u32 y = 0; y < ctx.fb->height; y += ctx.step) {
-        render_row(&ctx, y);
-    }
+    render_rows_parallel(&ctx, render_row);
 
     draw_status_overlay(ctx.fb, view, fractal, ctx.step, target_step, false);
     return true;
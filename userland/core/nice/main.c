@@ -0,0 +1,71 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+static bool parse_number(const char *text, long min, long max, long *out) {
+    if (!text || !*text || !out) {
+        return false;
+    }
+
+    errno = 0;
+    char *end = NULL;
+    long value = strtol(text, &end, 10);
+
+    if (errno == ERANGE || end == text || *end || value < min || value > max) {
+        return false;
+    }
+
+    *out = value;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    long inc = 10;
+    int argi = 1;
+
+    if (argi < argc && !strcmp(argv[argi], "-n")) {
+        if (argi + 1 >= argc || !parse_number(argv[argi + 1], INT_MIN, INT_MAX, &inc)) {
+            static const char error[] = "nice: invalid adjustment\n";
+            write(STDERR_FILENO, error, sizeof(error) - 1);
+            return 1;
+        }
+
+        argi += 2;
+    }
+
+    if (argi < argc && !strcmp(argv[argi], "--")) {
+        argi++;
+    }
+
+    // with no command it only reports the current niceness
+    if (argi >= argc) {
+        errno = 0;
+        int prio = getpriority(PRIO_PROCESS, 0);
+
+        if (prio == -1 && errno) {
+            static const char error[] = "nice: cannot get priority\n";
+            write(STDERR_FILENO, error, sizeof(error) - 1);
+            return 1;
+        }
+
+        printf("%d\n", prio);
+        return 0;
+    }
+
+    // running at the old priority beats not running, as with other nices
+    errno = 0;
+    if (nice((int)inc) == -1 && errno) {
+        static const char error[] = "nice: cannot set priority\n";
+        write(STDERR_FILENO, error, sizeof(error) - 1);
+    }
+
+    execvp(argv[argi], &argv[argi]);
+
+    fprintf(stderr, "nice: %s: %s\n", argv[argi], strerror(errno));
+    return errno == ENOENT ? 127 : 126;
+}
@@ -0,0 +1,128 @@
+#include <errno.h>
+#include <limits.h>
+#include <pwd.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+static bool parse_number(const char *text, long min, long max, long *out) {
+    if (!text || !*text || !out) {
+        return false;
+    }
+
+    errno = 0;
+    char *end = NULL;
+    long value = strtol(text, &end, 10);
+
+    if (errno == ERANGE || end == text || *end || value < min || value > max) {
+        return false;
+    }
+
+    *out = value;
+    return true;
+}
+
+static bool parse_who(int which, const char *text, id_t *out) {
+    long value = 0;
+
+    if (parse_number(text, 0, INT_MAX, &value)) {
+        *out = (id_t)value;
+        return true;
+    }
+
+    if (which != PRIO_USER) {
+        return false;
+    }
+
+    struct passwd *pw = getpwnam(text);
+    if (!pw) {
+        return false;
+    }
+
+    *out = (id_t)pw->pw_uid;
+    return true;
+}
+
+static void usage(void) {
+    static const char text[] = "usage: renice [-g|-p|-u] -n INCREMENT ID...\n";
+    write(STDERR_FILENO, text, sizeof(text) - 1);
+}
+
+int main(int argc, char **argv) {
+    int which = PRIO_PROCESS;
+    long inc = 0;
+    bool have_inc = false;
+    int argi = 1;
+
+    for (; argi < argc && argv[argi][0] == '-'; argi++) {
+        const char *arg = argv[argi];
+
+        if (!strcmp(arg, "--")) {
+            argi++;
+            break;
+        }
+
+        if (!strcmp(arg, "-p")) {
+            which = PRIO_PROCESS;
+        } else if (!strcmp(arg, "-g")) {
+            which = PRIO_PGRP;
+        } else if (!strcmp(arg, "-u")) {
+            which = PRIO_USER;
+        } else if (!strcmp(arg, "-n") && argi + 1 < argc) {
+            if (!parse_number(argv[++argi], INT_MIN, INT_MAX, &inc)) {
+                static const char error[] = "renice: invalid increment\n";
+                write(STDERR_FILENO, error, sizeof(error) - 1);
+                return 1;
+            }
+
+            have_inc = true;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (!have_inc || argi >= argc) {
+        usage();
+        return 1;
+    }
+
+    int status = 0;
+
+    for (; argi < argc; argi++) {
+        id_t who = 0;
+
+        if (!parse_who(which, argv[argi], &who)) {
+            fprintf(stderr, "renice: invalid id %s\n", argv[argi]);
+            status = 1;
+            continue;
+        }
+
+        errno = 0;
+        int old = getpriority(which, who);
+
+        if (old == -1 && errno) {
+            fprintf(stderr, "renice: %s: %s\n", argv[argi], strerror(errno));
+            status = 1;
+            continue;
+        }
+
+        // long is only 32 bits on x86_32, where old + INT_MAX would overflow it
+        long long prio = (long long)old + inc;
+        prio = prio < PRIO_MIN ? PRIO_MIN : prio;
+        prio = prio > PRIO_MAX - 1 ? PRIO_MAX - 1 : prio;
+
+        if (setpriority(which, who, (int)prio) < 0) {
+            fprintf(stderr, "renice: %s: %s\n", argv[argi], strerror(errno));
+            status = 1;
+            continue;
+        }
+
+        printf("%s: old priority %d, new priority %lld\n", argv[argi], old, prio);
+    }
+
+    return status;
+}
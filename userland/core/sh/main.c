@@ -7,6 +7,7 @@
 #include <poll.h>
 #include <pwd.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -1474,8 +1475,7 @@ static void env_build_exec(char env_data[SH_ENV_MAX][SH_ENV_ENTRY_MAX], char *en
     envp[count] = NULL;
 }
 
-static void exec_script(const char *script, char *const argv[], char *const envp[]) {
-    char *sh_args[SH_MAX_ARGS];
+static void script_args(const char *script, char *const argv[], char *sh_args[SH_MAX_ARGS]) {
     int argc = 0;
 
     sh_args[argc++] = "sh";
@@ -1488,6 +1488,11 @@ static void exec_script(const char *script, char *const argv[], char *const envp
     }
 
     sh_args[argc] = NULL;
+}
+
+static void exec_script(const char *script, char *const argv[], char *const envp[]) {
+    char *sh_args[SH_MAX_ARGS];
+    script_args(script, argv, sh_args);
     execve("/bin/sh", sh_args, envp);
 }
 
@@ -1593,6 +1598,76 @@ static bool exec_in_path(const char *cmd, char *const argv[], char *const envp[]
     return false;
 }
 
+typedef struct {
+    const posix_spawn_file_actions_t *actions;
+    const posix_spawnattr_t *attr;
+    pid_t pid;
+} sh_spawn_t;
+
+static int spawn_file(sh_spawn_t *spawn, const char *path, char *const argv[], char *const envp[]) {
+    int err = posix_spawn(&spawn->pid, path, spawn->actions, spawn->attr, argv, envp);
+
+    if (err == ENOEXEC && !file_has_elf_magic(path)) {
+        char *sh_args[SH_MAX_ARGS];
+        script_args(path, argv, sh_args);
+        err = posix_spawn(&spawn->pid, "/bin/sh", spawn->actions, spawn->attr, sh_args, envp);
+    }
+
+    return err;
+}
+
+// same lookup as exec_in_path, but the kernel builds the child straight from the file
+static int spawn_in_path(sh_spawn_t *spawn, const char *cmd, char *const argv[], char *const envp[]) {
+    if (!cmd || !cmd[0]) {
+        return ENOENT;
+    }
+
+    if (strlen(cmd) >= PATH_MAX) {
+        return ENAMETOOLONG;
+    }
+
+    if (strchr(cmd, '/')) {
+        return spawn_file(spawn, cmd, argv, envp);
+    }
+
+    const char *path = env_get("PATH");
+    if (!path || !path[0]) {
+        path = "/bin";
+    }
+    const char *cursor = path;
+    char full[PATH_MAX];
+    int last_error = ENOENT;
+
+    while (*cursor) {
+        const char *next = strchr(cursor, ':');
+        size_t len = next ? (size_t)(next - cursor) : strlen(cursor);
+
+        if (!build_exec_path(full, sizeof(full), cursor, len, cmd)) {
+            if (errno != ENOENT) {
+                last_error = errno;
+            }
+        } else {
+            int err = spawn_file(spawn, full, argv, envp);
+
+            if (!err) {
+                return 0;
+            }
+
+            if (err != ENOENT && err != ENOTDIR) {
+                last_error = err;
+            }
+        }
+
+        if (!next) {
+            break;
+        }
+
+        cursor = next + 1;
+    }
+
+    return last_error;
+}
+
 static void print_exec_error(const char *cmd, int err) {
     const char *name = (cmd && cmd[0]) ? cmd : "<null>";
 
@@ -2525,9 +2600,107 @@ static void pipeline_child(pipeline_run_t *run, sh_stage_t *stage, int index, in
     _exit(1);
 }
 
+static bool spawn_stage_actions(
+    const pipeline_run_t *run,
+    const sh_stage_t *stage,
+    int index,
+    int stage_count,
+    posix_spawn_file_actions_t *actions
+) {
+    bool ok = true;
+
+    if (index > 0) {
+        ok = ok && !posix_spawn_file_actions_adddup2(actions, run->pipes[index - 1][0], STDIN_FILENO);
+    }
+
+    if (index + 1 < stage_count) {
+        ok = ok && !posix_spawn_file_actions_adddup2(actions, run->pipes[index][1], STDOUT_FILENO);
+    }
+
+    for (int i = 0; i + 1 < stage_count; i++) {
+        ok = ok && !posix_spawn_file_actions_addclose(actions, run->pipes[i][0]);
+        ok = ok && !posix_spawn_file_actions_addclose(actions, run->pipes[i][1]);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (run->start_gate[i] >= 0) {
+            ok = ok && !posix_spawn_file_actions_addclose(actions, run->start_gate[i]);
+        }
+    }
+
+    if (stage->in_path && stage->in_path[0]) {
+        ok = ok && !posix_spawn_file_actions_addopen(actions, STDIN_FILENO, stage->in_path, O_RDONLY, 0);
+    }
+
+    if (stage->out_path && stage->out_path[0]) {
+        int flags = O_WRONLY | O_CREAT | (stage->out_append ? O_APPEND : O_TRUNC);
+        ok = ok && !posix_spawn_file_actions_addopen(actions, STDOUT_FILENO, stage->out_path, flags, 0644);
+    }
+
+    return ok;
+}
+
+// external stages skip fork entirely, a failure returns 0 and the caller
+// falls back to fork so the child reports the error as it always has
+static pid_t pipeline_spawn_stage(pipeline_run_t *run, sh_stage_t *stage, int index, int stage_count) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t sigdefault;
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+
+    sigemptyset(&sigdefault);
+    sigaddset(&sigdefault, SIGINT);
+    sigaddset(&sigdefault, SIGTSTP);
+    sigaddset(&sigdefault, SIGQUIT);
+    sigaddset(&sigdefault, SIGTTIN);
+    sigaddset(&sigdefault, SIGTTOU);
+    sigaddset(&sigdefault, SIGWINCH);
+
+    // a stopped child stands in for the start gate until the tty is handed over
+    short flags = POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF;
+    if (run->gate_child_start) {
+        flags |= POSIX_SPAWN_START_SUSPENDED;
+    }
+
+    posix_spawnattr_setflags(&attr, flags);
+    posix_spawnattr_setpgroup(&attr, run->pgid);
+    posix_spawnattr_setsigdefault(&attr, &sigdefault);
+
+    sh_spawn_t spawn = {
+        .actions = &actions,
+        .attr = &attr,
+        .pid = 0,
+    };
+
+    if (spawn_stage_actions(run, stage, index, stage_count, &actions)) {
+        char env_data[SH_ENV_MAX][SH_ENV_ENTRY_MAX];
+        char *envp[SH_ENV_MAX + 1];
+        env_build_exec(env_data, envp);
+
+        if (spawn_in_path(&spawn, stage->argv[0], stage->argv, envp)) {
+            spawn.pid = 0;
+        }
+    }
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+
+    return spawn.pid;
+}
+
 static int pipeline_spawn(pipeline_run_t *run, sh_stage_t *stages, int stage_count) {
     for (int i = 0; i < stage_count; i++) {
-        pid_t pid = fork();
+        pid_t pid = 0;
+
+        if (!is_builtin_name(stages[i].argv[0])) {
+            pid = pipeline_spawn_stage(run, &stages[i], i, stage_count);
+        }
+
+        if (!pid) {
+            pid = fork();
+        }
 
         if (!pid) {
             pipeline_child(run, &stages[i], i, stage_count);
@@ -2574,6 +2747,10 @@ static int pipeline_finish(pipeline_run_t *run, bool background, const char *cmd
 
     release_start_gate(run->start_gate);
 
+    if (run->gate_child_start) {
+        kill(-run->pgid, SIGCONT);
+    }
+
     sh_wait_result_t wait_result = wait_foreground_pgrp(run->pgid, run->last_pid);
     if (sh.interactive) {
         tty_set_pgrp(sh.pgid);
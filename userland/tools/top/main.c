@@ -27,6 +27,8 @@
 #define TOP_CPU_MAX_CORES    64
 #define TOP_CPU_TEXT_MAX     8192
 #define TOP_BAR_TEXT_MAX     160
+#define TOP_LAT_BUCKETS      24
+#define TOP_LAT_TEXT_MAX     2048
 
 typedef struct {
     unsigned long long now;
@@ -48,6 +50,12 @@ typedef struct {
     unsigned long long core_total_ticks[TOP_CPU_MAX_CORES];
 } top_cpu_t;
 
+// the system wide histograms from /proc/schedstat, log2 microsecond buckets
+typedef struct {
+    unsigned long long wake[TOP_LAT_BUCKETS];
+    unsigned long long wait[TOP_LAT_BUCKETS];
+} top_latency_t;
+
 typedef struct {
     pid_t pid;
     unsigned long long cpu_time_ms;
@@ -78,6 +86,7 @@ typedef struct {
     int clock_fd;
     int mem_fd;
     int cpu_fd;
+    int sched_fd;
 } top_data_fds_t;
 
 typedef struct {
@@ -96,6 +105,8 @@ typedef struct {
     const top_mem_t *memory;
     const top_cpu_t *cpu;
     const top_cpu_t *prev_cpu;
+    const top_latency_t *latency;
+    const top_latency_t *prev_latency;
     unsigned long long cpu_count;
 } top_sample_t;
 
@@ -454,6 +465,88 @@ static bool top_read_cpu(int fd, top_cpu_t *out) {
     return true;
 }
 
+static bool top_parse_hist(const char *text, const char *key, unsigned long long *out) {
+    char value[TOP_LAT_BUCKETS * 12] = { 0 };
+
+    if (!kv_read_string(text, key, value, sizeof(value))) {
+        return false;
+    }
+
+    char *cursor = value;
+
+    for (size_t i = 0; i < TOP_LAT_BUCKETS; i++) {
+        char *end = NULL;
+        out[i] = strtoull(cursor, &end, 10);
+
+        if (end == cursor) {
+            return false;
+        }
+
+        cursor = end;
+    }
+
+    return true;
+}
+
+static bool top_read_latency(int fd, top_latency_t *out) {
+    if (!out || fd < 0) {
+        return false;
+    }
+
+    // the system wide lines come first, the per cpu ones past them can be cut off
+    char text[TOP_LAT_TEXT_MAX] = { 0 };
+    if (!top_read_text_fd(fd, text, sizeof(text))) {
+        return false;
+    }
+
+    return top_parse_hist(text, "wake_hist", out->wake) && top_parse_hist(text, "wait_hist", out->wait);
+}
+
+// over the last interval when there is one, the upper edge of the bucket the
+// percentile lands in, 0 without samples
+static unsigned long long top_latency_us(
+    const unsigned long long *now,
+    const unsigned long long *prev,
+    unsigned long long permille
+) {
+    unsigned long long counts[TOP_LAT_BUCKETS];
+    unsigned long long total = 0;
+
+    for (size_t i = 0; i < TOP_LAT_BUCKETS; i++) {
+        counts[i] = prev && now[i] >= prev[i] ? now[i] - prev[i] : now[i];
+        total += counts[i];
+    }
+
+    if (!total) {
+        return 0;
+    }
+
+    unsigned long long rank = (total * permille + 999ULL) / 1000ULL;
+    unsigned long long seen = 0;
+
+    for (size_t i = 0; i + 1 < TOP_LAT_BUCKETS; i++) {
+        seen += counts[i];
+
+        if (seen >= rank) {
+            return 1ULL << i;
+        }
+    }
+
+    return 1ULL << (TOP_LAT_BUCKETS - 1);
+}
+
+static void top_format_us(unsigned long long us, char *out, size_t out_len) {
+    if (!us) {
+        snprintf(out, out_len, "-");
+    } else if (us < 1000ULL) {
+        snprintf(out, out_len, "%lluus", us);
+    } else if (us < 1000000ULL) {
+        snprintf(out, out_len, "%llums", us / 1000ULL);
+    } else {
+        snprintf(out, out_len, "%llus", us / 1000000ULL);
+    }
+}
+
 static unsigned long long top_cpu_pct_x10(
     unsigned long long now_busy,
     unsigned long long now_total,
@@ -938,6 +1031,7 @@ static top_data_fds_t top_open_data_fds(void) {
         .clock_fd = open("/dev/clock", O_RDONLY, 0),
         .mem_fd = open("/dev/meminfo", O_RDONLY, 0),
         .cpu_fd = open("/dev/cpu", O_RDONLY, 0),
+        .sched_fd = open("/proc/schedstat", O_RDONLY, 0),
     };
 
     return fds;
@@ -955,6 +1049,10 @@ static void top_close_data_fds(top_data_fds_t *fds) {
     if (fds->cpu_fd >= 0) {
         close(fds->cpu_fd);
     }
+
+    if (fds->sched_fd >= 0) {
+        close(fds->sched_fd);
+    }
 }
 
 static bool top_read_byte(int input_fd, char *out, int timeout_ms, void *ctx) {
@@ -1102,6 +1200,31 @@ static size_t top_render_summary(const top_sample_t *sample, const top_view_t *v
 
     size_t header_lines = 2;
 
+    if (sample->latency) {
+        const top_latency_t *prev = sample->prev_latency;
+        char wake_p50[16];
+        char wake_p99[16];
+        char wait_p50[16];
+        char wait_p99[16];
+
+        top_format_us(top_latency_us(sample->latency->wake, prev ? prev->wake : NULL, 500), wake_p50, sizeof(wake_p50));
+        top_format_us(top_latency_us(sample->latency->wake, prev ? prev->wake : NULL, 990), wake_p99, sizeof(wake_p99));
+        top_format_us(top_latency_us(sample->latency->wait, prev ? prev->wait : NULL, 500), wait_p50, sizeof(wait_p50));
+        top_format_us(top_latency_us(sample->latency->wait, prev ? prev->wait : NULL, 990), wait_p99, sizeof(wait_p99));
+
+        snprintf(
+            line,
+            sizeof(line),
+            "Lat: wakeup p50 %s p99 %s, runq wait p50 %s p99 %s\n",
+            wake_p50,
+            wake_p99,
+            wait_p50,
+            wait_p99
+        );
+        top_write_line(line, view->interactive, rendered_lines);
+        header_lines++;
+    }
+
     if (view->show_per_core && !view->show_bars) {
         size_t extra = top_core_summary(sample->cpu, sample->prev_cpu, view->cols, view->interactive);
         header_lines += extra;
@@ -1323,6 +1446,9 @@ typedef struct {
     top_cpu_t prev_cpu;
     bool have_prev_cpu;
 
+    top_latency_t prev_latency;
+    bool have_prev_latency;
+
     top_clock_t prev_clock;
     bool have_prev_clock;
 
@@ -1341,6 +1467,9 @@ typedef struct {
     top_cpu_t cpu;
     bool have_cpu;
 
+    top_latency_t latency;
+    bool have_latency;
+
     top_proc_t *procs;
     size_t proc_count;
     unsigned long long elapsed_ms;
@@ -1352,6 +1481,7 @@ static void top_read_frame(const top_data_fds_t *fds, const top_opts_t *opts, to
     frame->have_clock = top_read_clock(fds->clock_fd, &frame->clock);
     frame->have_mem = top_read_mem(fds->mem_fd, &frame->mem);
     frame->have_cpu = top_read_cpu(fds->cpu_fd, &frame->cpu);
+    frame->have_latency = top_read_latency(fds->sched_fd, &frame->latency);
 
     if (frame->have_cpu && frame->cpu.ncpu > 0) {
         run->cpu_count = frame->cpu.ncpu;
@@ -1409,6 +1539,8 @@ static void top_show_frame(top_frame_t *frame, top_run_t *run, const top_opts_t
         .memory = frame->have_mem ? &frame->mem : NULL,
         .cpu = frame->have_cpu ? &frame->cpu : NULL,
         .prev_cpu = run->have_prev_cpu ? &run->prev_cpu : NULL,
+        .latency = frame->have_latency ? &frame->latency : NULL,
+        .prev_latency = run->have_prev_latency ? &run->prev_latency : NULL,
         .cpu_count = run->cpu_count,
     };
 
@@ -1431,6 +1563,11 @@ static bool top_save_frame(top_frame_t *frame, top_run_t *run) {
         run->have_prev_cpu = true;
     }
 
+    if (frame->have_latency) {
+        run->prev_latency = frame->latency;
+        run->have_prev_latency = true;
+    }
+
     if (frame->have_clock) {
         run->prev_clock = frame->clock;
         run->have_prev_clock = true;
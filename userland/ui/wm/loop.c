@@ -443,7 +443,8 @@ static int _present_damage(int fb_fd, const fb_info_t *fb_info, const pixel_t *f
 }
 
 static void _spawn_term(void) {
-    pid_t pid = fork();
+    // the wm's heap and framebuffer mappings are large, vfork skips cloning them
+    pid_t pid = vfork();
     if (pid < 0) {
         return;
     }
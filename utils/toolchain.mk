@@ -118,6 +118,7 @@ CC_DEBUG := \
 
 CC_DEBUG_EXTRA := \
 	-DKMALLOC_DEBUG \
+	-DLOCK_STAT \
 	-DSCHED_DEBUG \
 	-DINT_DEBUG \
 	-DSYSCALL_DEBUG
@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+"""Convert a /proc/trace dump into Chrome trace JSON.
+
+Capture on the guest with `echo 1 > /proc/trace`, run the workload, then
+`echo 0 > /proc/trace` and copy /proc/trace out. The result opens in
+chrome://tracing or ui.perfetto.dev: one track per cpu shows what ran and the
+interrupts it took, one per process shows its syscalls and wakeups, and disk
+transfers show up as async slices.
+"""
+
+import argparse
+import json
+import re
+import struct
+import sys
+from pathlib import Path
+
+ROOT = Path(__file__).resolve().parents[1]
+SYSCALL_DEF = ROOT / "libs" / "apheleia" / "syscall.def"
+
+# kernel/sys/trace.h
+HEADER = struct.Struct("<IHHII")
+RECORD = struct.Struct("<QQQIHH")
+MAGIC = 0x43525441
+VERSION = 1
+
+SCHED_SWITCH = 1
+SCHED_WAKE = 2
+SYSCALL_ENTER = 3
+SYSCALL_EXIT = 4
+IRQ = 5
+DISK_SUBMIT = 6
+DISK_COMPLETE = 7
+
+# the cpu tracks live in a process of their own, away from any real pid
+CPU_PID = -1
+
+
+def syscall_names() -> dict[int, str]:
+    names = {}
+
+    if SYSCALL_DEF.exists():
+        for match in re.finditer(r"SYSCALL\(\w+,\s*(\w+),\s*(\d+)\)", SYSCALL_DEF.read_text()):
+            names[int(match.group(2))] = match.group(1)
+
+    return names
+
+
+def signed(value: int) -> int:
+    return value - (1 << 64) if value >= 1 << 63 else value
+
+
+def parse(data: bytes) -> list[tuple]:
+    if len(data) < HEADER.size:
+        raise ValueError("trace is shorter than its header")
+
+    magic, version, record_size, _cpus, count = HEADER.unpack_from(data)
+
+    if magic != MAGIC or version != VERSION or record_size != RECORD.size:
+        raise ValueError("not a version 1 /proc/trace dump")
+
+    records = []
+
+    for i in range(count):
+        offset = HEADER.size + i * RECORD.size
+        if offset + RECORD.size > len(data):
+            break
+
+        record = RECORD.unpack_from(data, offset)
+
+        # slots the kernel raced with while dumping come back zeroed
+        if record[4]:
+            records.append(record)
+
+    records.sort(key=lambda record: record[0])
+    return records
+
+
+def convert(records: list[tuple]) -> list[dict]:
+    names = syscall_names()
+    events = []
+    running = {}
+    disk_pending = {}
+
+    def cpu_event(cpu: int, **fields) -> None:
+        events.append({"pid": CPU_PID, "tid": cpu, **fields})
+
+    for ts_ns, arg0, arg1, pid, event, cpu in records:
+        ts = ts_ns / 1000.0
+
+        if event == SCHED_SWITCH:
+            prev = running.pop(cpu, None)
+            if prev:
+                cpu_event(cpu, ph="X", name=f"pid {prev[0]}", ts=prev[1], dur=ts - prev[1])
+
+            running[cpu] = (arg1, ts)
+        elif event == SCHED_WAKE:
+            args = {"pid": arg0}
+            events.append({"pid": pid, "tid": pid, "ph": "i", "s": "t", "name": "wake", "ts": ts, "args": args})
+        elif event in (SYSCALL_ENTER, SYSCALL_EXIT):
+            name = names.get(arg0, f"syscall {arg0}")
+            fields = {"pid": pid, "tid": pid, "name": name, "ts": ts}
+
+            if event == SYSCALL_ENTER:
+                events.append({**fields, "ph": "B"})
+            else:
+                events.append({**fields, "ph": "E", "args": {"result": signed(arg1)}})
+        elif event == IRQ:
+            cpu_event(cpu, ph="i", s="t", name=f"irq {arg0}", ts=ts)
+        elif event == DISK_SUBMIT:
+            size = signed(arg1)
+            name = f"disk {arg0} {'write' if size < 0 else 'read'} {abs(size)}"
+            disk_pending[(arg0, pid)] = name
+            events.append({"pid": pid, "tid": pid, "ph": "b", "cat": "disk", "id": arg0, "name": name, "ts": ts})
+        elif event == DISK_COMPLETE:
+            name = disk_pending.pop((arg0, pid), f"disk {arg0}")
+            fields = {"pid": pid, "tid": pid, "cat": "disk", "id": arg0, "name": name, "ts": ts}
+            events.append({**fields, "ph": "e", "args": {"result": signed(arg1)}})
+
+    # whatever was still on a cpu runs to the end of the trace
+    end = records[-1][0] / 1000.0 if records else 0.0
+
+    for cpu in sorted(running):
+        pid, start = running[cpu]
+        cpu_event(cpu, ph="X", name=f"pid {pid}", ts=start, dur=end - start)
+        events.append({"pid": CPU_PID, "tid": cpu, "ph": "M", "name": "thread_name", "args": {"name": f"cpu {cpu}"}})
+
+    events.append({"pid": CPU_PID, "ph": "M", "name": "process_name", "args": {"name": "cpus"}})
+    return events
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("trace", type=Path, help="a copy of /proc/trace")
+    parser.add_argument("-o", "--output", type=Path, help="where to write the JSON, stdout by default")
+    args = parser.parse_args()
+
+    try:
+        records = parse(args.trace.read_bytes())
+    except (OSError, ValueError) as error:
+        print(f"trace2json: {error}", file=sys.stderr)
+        return 1
+
+    text = json.dumps({"traceEvents": convert(records), "displayTimeUnit": "ns"})
+
+    if args.output:
+        args.output.write_text(text)
+    else:
+        print(text)
+
+    return 0
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())